@@ -3,6 +3,7 @@
  * Written by Simon Fuhrmann.
  */
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -36,8 +37,11 @@ struct AppSettings
     std::string original_name;
     std::string undistorted_name;
     std::string exif_name;
+    std::string feature_cache_name;
     std::string prebundle_file;
+    std::string matching_log_file;
     std::string log_file;
+    std::string ba_problem_file;
     int max_image_size;
     int initial_pair_1;
     int initial_pair_2;
@@ -45,7 +49,15 @@ struct AppSettings
     bool skip_sfm;
     bool always_full_ba;
     bool fixed_intrinsics;
+    bool orb_features;
+    bool guided_matching;
     int video_matching;
+    int matching_candidates;
+    sfm::Matching::NearestNeighborSearch nn_search;
+    int batch_views;
+    bool local_ba;
+    float full_ba_growth;
+    int ba_threads;
     float track_error_thres_factor;
     float new_track_error_thres;
 };
@@ -73,6 +85,7 @@ log_message (AppSettings const& conf, std::string const& message)
 
 void
 features_and_matching (mve::Scene::Ptr scene, AppSettings const& conf,
+    std::string const& matching_log_path,
     sfm::bundler::ViewportList* viewports,
     sfm::bundler::PairwiseMatching* pairwise_matching)
 {
@@ -81,7 +94,11 @@ features_and_matching (mve::Scene::Ptr scene, AppSettings const& conf,
     feature_opts.image_embedding = conf.original_name;
     feature_opts.exif_embedding = conf.exif_name;
     feature_opts.max_image_size = conf.max_image_size;
-    feature_opts.feature_options.feature_types = sfm::FeatureSet::FEATURE_ALL;
+    feature_opts.feature_options.feature_types = conf.orb_features
+        ? sfm::FeatureSet::FEATURE_ORB : sfm::FeatureSet::FEATURE_ALL;
+    feature_opts.feature_cache_embedding = conf.feature_cache_name;
+    feature_opts.feature_options.sift_matching_opts.nn_search = conf.nn_search;
+    feature_opts.feature_options.surf_matching_opts.nn_search = conf.nn_search;
 
     std::cout << "Computing image features..." << std::endl;
     {
@@ -101,7 +118,10 @@ features_and_matching (mve::Scene::Ptr scene, AppSettings const& conf,
     matching_opts.ransac_opts.threshold = 3.0f;
     matching_opts.ransac_opts.verbose_output = false;
     matching_opts.use_lowres_matching = conf.lowres_matching;
+    matching_opts.use_guided_matching = conf.guided_matching;
     matching_opts.match_num_previous_frames = conf.video_matching;
+    matching_opts.num_retrieval_candidates = conf.matching_candidates;
+    matching_opts.matching_log_file = matching_log_path;
 
     std::cout << "Performing feature matching..." << std::endl;
     {
@@ -114,7 +134,20 @@ features_and_matching (mve::Scene::Ptr scene, AppSettings const& conf,
             + util::string::get(timer.get_elapsed()) + "ms.");
     }
 
-    if (pairwise_matching->empty())
+    /* Without a pairwise matching, the matches are only in the log. */
+    std::size_t num_matched_pairs = 0;
+    if (pairwise_matching != NULL)
+        num_matched_pairs = pairwise_matching->size();
+    else
+    {
+        sfm::bundler::MatchingLogIndex index;
+        sfm::bundler::load_matching_log_index(matching_log_path, &index);
+        for (std::size_t i = 0; i < index.size(); ++i)
+            if (index[i].num_matches > 0)
+                num_matched_pairs += 1;
+    }
+
+    if (num_matched_pairs == 0)
     {
         std::cerr << "No matching image pairs. Exiting." << std::endl;
         std::exit(1);
@@ -136,6 +169,14 @@ sfm_reconstruct (AppSettings const& conf)
     std::cout << "SSE3 accelerated matching is disabled." << std::endl;
 #endif
 
+    sfm::SimdLevel const nn_simd = sfm::detect_simd();
+    std::cout << "AVX2 accelerated matching is "
+        << (nn_simd >= sfm::SIMD_AVX2 ? "enabled." : "disabled.")
+        << std::endl;
+    std::cout << "AVX-512 accelerated matching is "
+        << (nn_simd >= sfm::SIMD_AVX512 ? "enabled." : "disabled.")
+        << std::endl;
+
     /* Load scene. */
     mve::Scene::Ptr scene = mve::Scene::create(conf.scene_path);
     std::string const prebundle_path
@@ -144,14 +185,28 @@ sfm_reconstruct (AppSettings const& conf)
     /* Log time and date if a log file is specified. */
     log_message(conf, "Starting SfM reconstruction.");
 
+    /*
+     * With a matching log, the matches are not kept in memory. The
+     * pre-bundle, the tracks and the initial pair are computed from the
+     * log, which only reads the matches of a few pairs at a time.
+     */
     sfm::bundler::ViewportList viewports;
     sfm::bundler::PairwiseMatching pairwise_matching;
+    std::string matching_log_path;
     if (!util::fs::file_exists(prebundle_path.c_str()))
     {
+        if (!conf.matching_log_file.empty())
+            matching_log_path = util::fs::join_path(scene->get_path(),
+                conf.matching_log_file);
         util::system::rand_seed(RAND_SEED_MATCHING);
-        features_and_matching(scene, conf, &viewports, &pairwise_matching);
+        features_and_matching(scene, conf, matching_log_path, &viewports,
+            matching_log_path.empty() ? &pairwise_matching : NULL);
         std::cout << "Saving pre-bundle to file..." << std::endl;
-        sfm::bundler::save_prebundle_to_file(viewports, pairwise_matching, prebundle_path);
+        if (matching_log_path.empty())
+            sfm::bundler::save_prebundle_to_file(viewports, pairwise_matching, prebundle_path);
+        else
+            sfm::bundler::save_prebundle_from_matching_log(viewports,
+                matching_log_path, prebundle_path);
     }
     else if (!conf.skip_sfm)
     {
@@ -162,6 +217,8 @@ sfm_reconstruct (AppSettings const& conf)
 
     if (conf.skip_sfm)
     {
+        if (!matching_log_path.empty())
+            util::fs::unlink(matching_log_path.c_str());
         std::cout << "Prebundle finished, skipping SfM. Exiting." << std::endl;
         std::exit(0);
     }
@@ -172,7 +229,7 @@ sfm_reconstruct (AppSettings const& conf)
         viewports[i].features.clear_descriptors();
 
     /* Check if there are some matching images. */
-    if (pairwise_matching.empty())
+    if (matching_log_path.empty() && pairwise_matching.empty())
     {
         std::cerr << "No matching image pairs. Exiting." << std::endl;
         std::exit(1);
@@ -192,7 +249,10 @@ sfm_reconstruct (AppSettings const& conf)
     sfm::bundler::Tracks bundler_tracks(tracks_options);
     sfm::bundler::TrackList tracks;
     std::cout << "Computing feature tracks..." << std::endl;
-    bundler_tracks.compute(pairwise_matching, &viewports, &tracks);
+    if (matching_log_path.empty())
+        bundler_tracks.compute(pairwise_matching, &viewports, &tracks);
+    else
+        bundler_tracks.compute(matching_log_path, &viewports, &tracks);
     std::cout << "Created a total of " << tracks.size()
         << " tracks." << std::endl;
 
@@ -213,7 +273,10 @@ sfm_reconstruct (AppSettings const& conf)
         init_pair_opts.verbose_output = true;
 
         sfm::bundler::InitialPair init_pair(init_pair_opts);
-        init_pair.compute(viewports, pairwise_matching, &init_pair_result);
+        if (matching_log_path.empty())
+            init_pair.compute(viewports, pairwise_matching, &init_pair_result);
+        else
+            init_pair.compute(viewports, matching_log_path, &init_pair_result);
     }
     else
     {
@@ -236,6 +299,10 @@ sfm_reconstruct (AppSettings const& conf)
     /* Clear pairwise matching to save memeory. */
     pairwise_matching.clear();
 
+    /* The matching log is not required once the pre-bundle is saved. */
+    if (!matching_log_path.empty())
+        util::fs::unlink(matching_log_path.c_str());
+
     /* Incrementally compute full bundle. */
     sfm::bundler::Incremental::Options incremental_opts;
     incremental_opts.fundamental_opts.already_normalized = false;
@@ -249,6 +316,7 @@ sfm_reconstruct (AppSettings const& conf)
     incremental_opts.new_track_error_threshold = conf.new_track_error_thres;
     incremental_opts.min_triangulation_angle = MATH_DEG2RAD(3.0);
     incremental_opts.ba_fixed_intrinsics = conf.fixed_intrinsics;
+    incremental_opts.ba_num_threads = conf.ba_threads;
     incremental_opts.verbose_output = true;
 
     sfm::bundler::Incremental incremental(incremental_opts);
@@ -272,6 +340,7 @@ sfm_reconstruct (AppSettings const& conf)
     /* Reconstruct remaining views. */
     int num_cameras_reconstructed = 2;
     int full_ba_num_skipped = 0;
+    int full_ba_num_cameras = num_cameras_reconstructed;
     while (true)
     {
         std::vector<int> next_views;
@@ -283,40 +352,85 @@ sfm_reconstruct (AppSettings const& conf)
             break;
         }
 
-        int next_view_id = -1;
-        for (std::size_t i = 0; i < next_views.size(); ++i)
+        std::vector<int> new_views;
+        if (conf.batch_views > 1)
         {
-            std::cout << std::endl;
-            std::cout << "Adding next view ID " << next_views[i]
-                << " (" << (num_cameras_reconstructed + 1) << " of "
-                << viewports.size() << ")..." << std::endl;
-            if (incremental.reconstruct_next_view(next_views[i]))
+            /* Try batches of the best views until views are accepted. */
+            std::size_t const batch_size = conf.batch_views;
+            for (std::size_t i = 0; new_views.empty()
+                && i < next_views.size(); i += batch_size)
             {
-                next_view_id = next_views[i];
-                break;
+                std::vector<int> batch(next_views.begin() + i,
+                    next_views.begin() + std::min(i + batch_size,
+                    next_views.size()));
+                std::cout << std::endl;
+                std::cout << "Adding batch of " << batch.size()
+                    << " views (" << (num_cameras_reconstructed + 1)
+                    << " of " << viewports.size() << ")..." << std::endl;
+                incremental.reconstruct_next_views(batch, &new_views);
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i < next_views.size(); ++i)
+            {
+                std::cout << std::endl;
+                std::cout << "Adding next view ID " << next_views[i]
+                    << " (" << (num_cameras_reconstructed + 1) << " of "
+                    << viewports.size() << ")..." << std::endl;
+                if (incremental.reconstruct_next_view(next_views[i]))
+                {
+                    new_views.push_back(next_views[i]);
+                    break;
+                }
             }
         }
 
-        if (next_view_id < 0)
+        if (new_views.empty())
         {
             std::cout << "No valid next view. Exiting." << std::endl;
             break;
         }
 
-        std::cout << "Running single camera bundle adjustment..." << std::endl;
-        incremental.bundle_adjustment_single_cam(next_view_id);
-        incremental.triangulate_new_tracks();
+        std::cout << "Running bundle adjustment for " << new_views.size()
+            << " new camera(s)..." << std::endl;
+        incremental.bundle_adjustment_cams(new_views);
+        incremental.triangulate_new_tracks(new_views);
         incremental.invalidate_large_error_tracks();
-        num_cameras_reconstructed += 1;
+        num_cameras_reconstructed += new_views.size();
+
+        /*
+         * Run full bundle adjustment only after a couple of views. In local
+         * mode, full BA runs once the model has grown by the given factor
+         * and local BA runs on the new views in between.
+         */
+        if (conf.local_ba && !conf.always_full_ba)
+        {
+            if (num_cameras_reconstructed < (1.0f + conf.full_ba_growth)
+                * static_cast<float>(full_ba_num_cameras))
+            {
+                std::cout << "Running local bundle adjustment..."
+                    << std::endl;
+                incremental.bundle_adjustment_local(new_views);
+                full_ba_num_skipped += new_views.size();
+            }
+            else
+            {
+                std::cout << "Running full bundle adjustment..." << std::endl;
+                incremental.bundle_adjustment_full();
+                full_ba_num_skipped = 0;
+                full_ba_num_cameras = num_cameras_reconstructed;
+            }
+            continue;
+        }
 
-        /* Run full bundle adjustment only after a couple of views. */
         int const full_ba_skip_views = conf.always_full_ba ? 0
             : std::min(5, num_cameras_reconstructed / 15);
         if (full_ba_num_skipped < full_ba_skip_views)
         {
             std::cout << "Skipping full bundle adjustment (skipping "
                 << full_ba_skip_views << " views)." << std::endl;
-            full_ba_num_skipped += 1;
+            full_ba_num_skipped += new_views.size();
         }
         else
         {
@@ -337,6 +451,15 @@ sfm_reconstruct (AppSettings const& conf)
     log_message(conf, "SfM reconstruction took "
         + util::string::get(timer.get_elapsed()) + "ms.");
 
+    /* Save the final bundle adjustment problem for benchmarking. */
+    if (!conf.ba_problem_file.empty())
+    {
+        std::string const fname = util::fs::join_path(conf.scene_path,
+            conf.ba_problem_file);
+        std::cout << "Saving BA problem to " << fname << "..." << std::endl;
+        incremental.save_bundle_adjustment_problem(fname);
+    }
+
     std::cout << "Normalizing scene..." << std::endl;
     incremental.normalize_scene();
 
@@ -424,17 +547,31 @@ main (int argc, char** argv)
     args.set_helptext_indent(23);
     args.set_description("Reconstruction of camera parameters "
         "for MVE scenes using Structure-from-Motion. Note: the "
-        "prebundle and the log file are relative to the scene directory.");
+        "prebundle, the matching log and the log file are relative to the "
+        "scene directory. If a matching log is given, interrupted matching "
+        "is resumed from it, and the matches are read from the log instead "
+        "of being kept in memory.");
     args.add_option('o', "original", true, "Original image embedding [original]");
     args.add_option('e', "exif", true, "EXIF data embedding [exif]");
     args.add_option('m', "max-pixels", true, "Limit image size by iterative half-sizing [6000000]");
     args.add_option('u', "undistorted", true, "Undistorted image embedding [undistorted]");
+    args.add_option('\0', "feature-cache", true, "Cache features in views with embedding prefix ARG []");
     args.add_option('\0', "prebundle", true, "Load/store pre-bundle file [prebundle.sfm]");
+    args.add_option('\0', "matching-log", true, "Stream matching to resumable log, disabled if empty []");
     args.add_option('\0', "log-file", true, "Logs some timings to file []");
     args.add_option('\0', "no-prediction", false, "Disables matchability prediction");
+    args.add_option('\0', "guided-matching", false, "Match again near epipolar lines after RANSAC");
     args.add_option('\0', "skip-sfm", false, "Compute prebundle, skip SfM reconstruction");
     args.add_option('\0', "always-full-ba", false, "Run full bundle adjustment after every view");
+    args.add_option('\0', "batch-views", true, "Add up to ARG views per iteration [1]");
+    args.add_option('\0', "local-ba", false, "Local BA on new views, full BA on model growth");
+    args.add_option('\0', "full-ba-growth", true, "Model growth for full BA in local BA mode [0.1]");
+    args.add_option('\0', "ba-threads", true, "Number of BA threads, 0 for all cores [0]");
+    args.add_option('\0', "ba-problem", true, "Save final BA problem to file []");
     args.add_option('\0', "video-matching", true, "Only match to ARG previous frames [0]");
+    args.add_option('\0', "orb-features", false, "Use fast binary ORB features, e.g. for video");
+    args.add_option('\0', "matching-candidates", true, "Only match to ARG most similar views [0]");
+    args.add_option('\0', "nn-search", true, "SIFT/SURF matching search, exhaustive or kd-forest [exhaustive]");
     args.add_option('\0', "fixed-intrinsics", false, "Do not optimize camera intrinsics");
     args.add_option('\0', "track-error-thres", true, "Error threshold for new tracks [10]");
     args.add_option('\0', "track-thres-factor", true, "Error threshold factor for tracks [25]");
@@ -455,7 +592,15 @@ main (int argc, char** argv)
     conf.skip_sfm = false;
     conf.always_full_ba = false;
     conf.video_matching = 0;
+    conf.matching_candidates = 0;
+    conf.nn_search = sfm::Matching::NN_SEARCH_EXHAUSTIVE;
+    conf.batch_views = 1;
+    conf.local_ba = false;
+    conf.full_ba_growth = 0.1f;
+    conf.ba_threads = 0;
     conf.fixed_intrinsics = false;
+    conf.orb_features = false;
+    conf.guided_matching = false;
     conf.track_error_thres_factor = 25.0f;
     conf.new_track_error_thres = 10.0f;
 
@@ -469,20 +614,53 @@ main (int argc, char** argv)
             conf.exif_name = i->arg;
         else if (i->opt->lopt == "undistorted")
             conf.undistorted_name = i->arg;
+        else if (i->opt->lopt == "feature-cache")
+            conf.feature_cache_name = i->arg;
         else if (i->opt->lopt == "max-pixels")
             conf.max_image_size = i->get_arg<int>();
         else if (i->opt->lopt == "prebundle")
             conf.prebundle_file = i->arg;
+        else if (i->opt->lopt == "matching-log")
+            conf.matching_log_file = i->arg;
         else if (i->opt->lopt == "log-file")
             conf.log_file = i->arg;
         else if (i->opt->lopt == "no-prediction")
             conf.lowres_matching = false;
+        else if (i->opt->lopt == "guided-matching")
+            conf.guided_matching = true;
         else if (i->opt->lopt == "skip-sfm")
             conf.skip_sfm = true;
         else if (i->opt->lopt == "always-full-ba")
             conf.always_full_ba = true;
+        else if (i->opt->lopt == "orb-features")
+            conf.orb_features = true;
         else if (i->opt->lopt == "video-matching")
             conf.video_matching = i->get_arg<int>();
+        else if (i->opt->lopt == "matching-candidates")
+            conf.matching_candidates = i->get_arg<int>();
+        else if (i->opt->lopt == "nn-search")
+        {
+            if (i->arg == "exhaustive")
+                conf.nn_search = sfm::Matching::NN_SEARCH_EXHAUSTIVE;
+            else if (i->arg == "kd-forest")
+                conf.nn_search = sfm::Matching::NN_SEARCH_KD_FOREST;
+            else
+            {
+                std::cerr << "Error: Invalid nearest neighbor search: "
+                    << i->arg << std::endl;
+                std::exit(1);
+            }
+        }
+        else if (i->opt->lopt == "batch-views")
+            conf.batch_views = std::max(1, i->get_arg<int>());
+        else if (i->opt->lopt == "local-ba")
+            conf.local_ba = true;
+        else if (i->opt->lopt == "full-ba-growth")
+            conf.full_ba_growth = std::max(0.0f, i->get_arg<float>());
+        else if (i->opt->lopt == "ba-threads")
+            conf.ba_threads = std::max(0, i->get_arg<int>());
+        else if (i->opt->lopt == "ba-problem")
+            conf.ba_problem_file = i->arg;
         else if (i->opt->lopt == "fixed-intrinsics")
             conf.fixed_intrinsics = true;
         else if (i->opt->lopt == "track-error-thres")
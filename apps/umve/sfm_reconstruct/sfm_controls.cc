@@ -331,11 +331,11 @@ SfmControls::create_sfm_points_renderer (void)
 
     for (std::size_t i = 0; i < this->tracks.size(); ++i)
     {
-        if (!this->tracks[i].is_valid())
+        if (!this->tracks.is_valid(i))
             continue;
 
-        vertices.push_back(this->tracks[i].pos);
-        math::Vec3f color = this->tracks[i].color;
+        vertices.push_back(this->tracks.position(i));
+        math::Vec3f color = this->tracks.color(i);
         color /= 255.0f;
         colors.push_back(math::Vec4f(color[0], color[1], color[2], 1.0f));
     }
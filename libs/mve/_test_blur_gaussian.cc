@@ -0,0 +1,120 @@
+/*
+ * Benchmark of the Gaussian blur for float and byte images with the blur
+ * sigmas of a SIFT octave, compared to the previous generic implementation.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#include "util/timer.h"
+#include "math/accum.h"
+#include "math/functions.h"
+#include "mve/image.h"
+#include "mve/image_tools.h"
+
+/* The previous generic implementation of mve::image::blur_gaussian(). */
+template <typename T>
+typename mve::Image<T>::Ptr
+blur_gaussian_generic (typename mve::Image<T>::ConstPtr in, float sigma)
+{
+    int const w = in->width();
+    int const h = in->height();
+    int const c = in->channels();
+    int const ks = std::ceil(sigma * 2.884f);
+    std::vector<float> kernel(ks + 1);
+    for (int i = 0; i < ks + 1; ++i)
+        kernel[i] = math::gaussian((float)i, sigma);
+
+    typename mve::Image<T>::Ptr sep(mve::Image<T>::create(w, h, c));
+    int px = 0;
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x, ++px)
+            for (int cc = 0; cc < c; ++cc)
+            {
+                math::Accum<T> accum(T(0));
+                for (int i = -ks; i <= ks; ++i)
+                {
+                    int idx = math::clamp(x + i, 0, w - 1);
+                    accum.add(in->at(y * w + idx, cc), kernel[std::abs(i)]);
+                }
+                sep->at(px, cc) = accum.normalized();
+            }
+
+    typename mve::Image<T>::Ptr out(mve::Image<T>::create(w, h, c));
+    px = 0;
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x, ++px)
+            for (int cc = 0; cc < c; ++cc)
+            {
+                math::Accum<T> accum(T(0));
+                for (int i = -ks; i <= ks; ++i)
+                {
+                    int idx = math::clamp(y + i, 0, h - 1);
+                    accum.add(sep->at(idx * w + x, cc), kernel[std::abs(i)]);
+                }
+                out->at(px, cc) = accum.normalized();
+            }
+
+    return out;
+}
+
+template <typename T>
+void
+benchmark (char const* name, typename mve::Image<T>::ConstPtr image)
+{
+    /* Base blur and incremental blur of a SIFT octave with 3 samples. */
+    float const k = std::pow(2.0f, 1.0f / 3.0f);
+    float sigmas[6];
+    sigmas[0] = std::sqrt(1.6f * 1.6f - 0.5f * 0.5f);
+    for (int i = 1; i < 6; ++i)
+        sigmas[i] = 1.6f * std::pow(k, i - 1) * std::sqrt(k * k - 1.0f);
+
+    std::cout << name << " " << image->width() << "x" << image->height()
+        << "x" << image->channels() << ":" << std::endl;
+    for (int i = 0; i < 6; ++i)
+    {
+        util::WallTimer timer;
+        typename mve::Image<T>::Ptr expected
+            = blur_gaussian_generic<T>(image, sigmas[i]);
+        std::size_t const generic_time = timer.get_elapsed();
+
+        timer.reset();
+        typename mve::Image<T>::Ptr blurred
+            = mve::image::blur_gaussian<T>(image, sigmas[i]);
+        std::size_t const fast_time = timer.get_elapsed();
+
+        double max_error = 0.0;
+        for (int j = 0; j < image->get_value_amount(); ++j)
+            max_error = std::max(max_error, std::abs(
+                static_cast<double>(expected->at(j)) - blurred->at(j)));
+
+        std::cout << "  sigma " << sigmas[i] << ": generic "
+            << generic_time << " ms, fast " << fast_time << " ms, speedup "
+            << static_cast<double>(generic_time) / std::max<std::size_t>
+            (1, fast_time) << "x, max error " << max_error << std::endl;
+    }
+}
+
+int
+main (void)
+{
+    std::srand(0);
+    int const width = 4000;
+    int const height = 3000;
+
+    mve::FloatImage::Ptr float_image
+        = mve::FloatImage::create(width, height, 1);
+    for (int i = 0; i < float_image->get_value_amount(); ++i)
+        float_image->at(i) = static_cast<float>(std::rand() % 256) / 255.0f;
+    benchmark<float>("Float image", float_image);
+
+    mve::ByteImage::Ptr byte_image
+        = mve::ByteImage::create(width, height, 3);
+    for (int i = 0; i < byte_image->get_value_amount(); ++i)
+        byte_image->at(i) = static_cast<uint8_t>(std::rand() % 256);
+    benchmark<uint8_t>("Byte image", byte_image);
+
+    return 0;
+}
@@ -1,8 +1,23 @@
 #include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#   include <emmintrin.h> // SSE2
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   include <immintrin.h> // AVX2
+#   define BLUR_AVX2_KERNEL 1
+#else
+#   define BLUR_AVX2_KERNEL 0
+#endif
 
 #include "mve/camera.h"
 #include "mve/image_tools.h"
 
+/* Images with fewer values are blurred by a single thread. */
+#define BLUR_PARALLEL_MIN_VALUES 65536
+
 MVE_NAMESPACE_BEGIN
 MVE_IMAGE_NAMESPACE_BEGIN
 
@@ -172,5 +187,340 @@ gamma_correct (ByteImage::Ptr image, float power)
         image->at(i) = lookup[image->at(i)];
 }
 
+/*
+ * ------------------------- Image blurring --------------------------
+ */
+
+namespace
+{
+    /*
+     * The symmetric convolution kernel for one row of 'n' values:
+     *   out[j] = k[0] * center[j] + sum_i k[i] * (minus[i][j] + plus[i][j])
+     * for i in [1, ks]. For the horizontal pass, 'minus' and 'plus' point
+     * to the neighboring pixels in the padded row, for the vertical pass
+     * to the (clamped) neighboring rows. Thus, the same kernel is used for
+     * both passes and border handling is not part of the inner loop.
+     *
+     * All kernels multiply and add in the same order without FMA, so the
+     * result is identical on all CPUs, which is required by feature caches
+     * that do not store the instruction set.
+     */
+    typedef void (*BlurKernel) (float const* kernel, int ks,
+        float const* center, float const* const* minus,
+        float const* const* plus, float* out, int n);
+
+    void
+    blur_kernel_scalar (float const* kernel, int ks, float const* center,
+        float const* const* minus, float const* const* plus, float* out,
+        int begin, int end)
+    {
+        for (int j = begin; j < end; ++j)
+        {
+            float accum = kernel[0] * center[j];
+            for (int i = 1; i <= ks; ++i)
+                accum += kernel[i] * (minus[i][j] + plus[i][j]);
+            out[j] = accum;
+        }
+    }
+
+#if !defined(__SSE2__)
+    void
+    blur_kernel_scalar (float const* kernel, int ks, float const* center,
+        float const* const* minus, float const* const* plus, float* out,
+        int n)
+    {
+        blur_kernel_scalar(kernel, ks, center, minus, plus, out, 0, n);
+    }
+#endif
+
+#if defined(__SSE2__)
+    void
+    blur_kernel_sse2 (float const* kernel, int ks, float const* center,
+        float const* const* minus, float const* const* plus, float* out,
+        int n)
+    {
+        __m128 const k0 = _mm_set1_ps(kernel[0]);
+        int j = 0;
+        for (; j + 4 <= n; j += 4)
+        {
+            __m128 accum = _mm_mul_ps(k0, _mm_loadu_ps(center + j));
+            for (int i = 1; i <= ks; ++i)
+            {
+                __m128 sum = _mm_add_ps(_mm_loadu_ps(minus[i] + j),
+                    _mm_loadu_ps(plus[i] + j));
+                accum = _mm_add_ps(accum,
+                    _mm_mul_ps(_mm_set1_ps(kernel[i]), sum));
+            }
+            _mm_storeu_ps(out + j, accum);
+        }
+        blur_kernel_scalar(kernel, ks, center, minus, plus, out, j, n);
+    }
+#endif
+
+#if BLUR_AVX2_KERNEL
+    __attribute__((target("avx2")))
+    void
+    blur_kernel_avx2 (float const* kernel, int ks, float const* center,
+        float const* const* minus, float const* const* plus, float* out,
+        int n)
+    {
+        __m256 const k0 = _mm256_set1_ps(kernel[0]);
+        int j = 0;
+        for (; j + 16 <= n; j += 16)
+        {
+            __m256 accum1 = _mm256_mul_ps(k0, _mm256_loadu_ps(center + j));
+            __m256 accum2 = _mm256_mul_ps(k0,
+                _mm256_loadu_ps(center + j + 8));
+            for (int i = 1; i <= ks; ++i)
+            {
+                __m256 const ki = _mm256_set1_ps(kernel[i]);
+                __m256 const sum1 = _mm256_add_ps(
+                    _mm256_loadu_ps(minus[i] + j),
+                    _mm256_loadu_ps(plus[i] + j));
+                __m256 const sum2 = _mm256_add_ps(
+                    _mm256_loadu_ps(minus[i] + j + 8),
+                    _mm256_loadu_ps(plus[i] + j + 8));
+                accum1 = _mm256_add_ps(accum1, _mm256_mul_ps(ki, sum1));
+                accum2 = _mm256_add_ps(accum2, _mm256_mul_ps(ki, sum2));
+            }
+            _mm256_storeu_ps(out + j, accum1);
+            _mm256_storeu_ps(out + j + 8, accum2);
+        }
+        for (; j + 8 <= n; j += 8)
+        {
+            __m256 accum = _mm256_mul_ps(k0, _mm256_loadu_ps(center + j));
+            for (int i = 1; i <= ks; ++i)
+            {
+                __m256 const sum = _mm256_add_ps(
+                    _mm256_loadu_ps(minus[i] + j),
+                    _mm256_loadu_ps(plus[i] + j));
+                accum = _mm256_add_ps(accum,
+                    _mm256_mul_ps(_mm256_set1_ps(kernel[i]), sum));
+            }
+            _mm256_storeu_ps(out + j, accum);
+        }
+        blur_kernel_scalar(kernel, ks, center, minus, plus, out, j, n);
+    }
+#endif
+
+    BlurKernel
+    blur_cpu_kernel (void)
+    {
+#if BLUR_AVX2_KERNEL
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &blur_kernel_avx2;
+#endif
+#if defined(__SSE2__)
+        return &blur_kernel_sse2;
+#else
+        return &blur_kernel_scalar;
+#endif
+    }
+
+    BlurKernel
+    blur_select_kernel (void)
+    {
+        static BlurKernel const kernel = blur_cpu_kernel();
+        return kernel;
+    }
+
+    /* Conversion of image rows from and to the float working buffers. */
+    void
+    blur_load_row (float const* in, int n, float* out)
+    {
+        std::copy(in, in + n, out);
+    }
+
+    void
+    blur_load_row (uint8_t const* in, int n, float* out)
+    {
+        for (int i = 0; i < n; ++i)
+            out[i] = static_cast<float>(in[i]);
+    }
+
+    /* The intermediate image of byte images is rounded like before. */
+    void
+    blur_round_row (float const* /*type*/, float* /*row*/, int /*n*/)
+    {
+    }
+
+    void
+    blur_round_row (uint8_t const* /*type*/, float* row, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            row[i] = static_cast<float>(static_cast<int>(row[i] + 0.5f));
+    }
+
+    /* Float rows are written in place, byte rows to the buffer. */
+    float*
+    blur_output_row (float* out, std::vector<float>* /*buffer*/)
+    {
+        return out;
+    }
+
+    float*
+    blur_output_row (uint8_t* /*out*/, std::vector<float>* buffer)
+    {
+        return &buffer->at(0);
+    }
+
+    void
+    blur_store_row (float const* /*in*/, int /*n*/, float* /*out*/)
+    {
+    }
+
+    void
+    blur_store_row (float const* in, int n, uint8_t* out)
+    {
+        for (int i = 0; i < n; ++i)
+            out[i] = static_cast<uint8_t>(std::min(255.0f, in[i] + 0.5f));
+    }
+
+    /*
+     * Separable Gaussian blur. The horizontal pass copies every row to a
+     * buffer that is padded with the border values and stores the result
+     * in 'sep'. The vertical pass combines entire rows, which streams
+     * through memory instead of accessing columns. Rows are processed in
+     * parallel.
+     */
+    template <typename T>
+    void
+    blur_gaussian_separable (Image<T> const& in, float sigma,
+        float* sep, Image<T>* out)
+    {
+        int const w = in.width();
+        int const h = in.height();
+        int const c = in.channels();
+        int const ks = std::ceil(sigma * 2.884f); // Cap kernel at 1/128
+        int const row_values = w * c;
+
+        /* Normalized kernel values, equivalent to the accumulator. */
+        std::vector<float> kernel(ks + 1);
+        float kernel_sum = 0.0f;
+        for (int i = 0; i < ks + 1; ++i)
+        {
+            kernel[i] = math::gaussian((float)i, sigma);
+            kernel_sum += (i == 0 ? 1.0f : 2.0f) * kernel[i];
+        }
+        for (int i = 0; i < ks + 1; ++i)
+            kernel[i] /= kernel_sum;
+
+        BlurKernel const blur_kernel = blur_select_kernel();
+
+#pragma omp parallel if (row_values * h >= BLUR_PARALLEL_MIN_VALUES)
+        {
+            std::vector<float const*> minus(ks + 1), plus(ks + 1);
+            std::vector<float> buffer((w + 2 * ks) * c);
+
+            /* Convolve the image in x direction. */
+#pragma omp for schedule(static)
+            for (int y = 0; y < h; ++y)
+            {
+                T const* in_row = &in.at(0, y, 0);
+                float* padded = &buffer[0];
+                float* center = padded + ks * c;
+                blur_load_row(in_row, row_values, center);
+                for (int x = 0; x < ks; ++x)
+                    for (int cc = 0; cc < c; ++cc)
+                    {
+                        padded[x * c + cc] = center[cc];
+                        center[(w + x) * c + cc]
+                            = center[(w - 1) * c + cc];
+                    }
+                for (int i = 1; i <= ks; ++i)
+                {
+                    minus[i] = center - i * c;
+                    plus[i] = center + i * c;
+                }
+
+                float* sep_row = sep + static_cast<std::size_t>(y)
+                    * row_values;
+                blur_kernel(&kernel[0], ks, center, &minus[0], &plus[0],
+                    sep_row, row_values);
+                blur_round_row(in_row, sep_row, row_values);
+            }
+
+            /* Convolve the image in y direction. */
+            buffer.resize(row_values);
+#pragma omp for schedule(static)
+            for (int y = 0; y < h; ++y)
+            {
+                for (int i = 1; i <= ks; ++i)
+                {
+                    minus[i] = sep + static_cast<std::size_t>(
+                        std::max(y - i, 0)) * row_values;
+                    plus[i] = sep + static_cast<std::size_t>(
+                        std::min(y + i, h - 1)) * row_values;
+                }
+                T* out_row = &out->at(0, y, 0);
+                float* result = blur_output_row(out_row, &buffer);
+                blur_kernel(&kernel[0], ks,
+                    sep + static_cast<std::size_t>(y) * row_values,
+                    &minus[0], &plus[0], result, row_values);
+                blur_store_row(result, row_values, out_row);
+            }
+        }
+    }
+}
+
+template <>
+FloatImage::Ptr
+blur_gaussian<float> (FloatImage::ConstPtr in, float sigma)
+{
+    if (in == NULL)
+        throw std::invalid_argument("NULL image given");
+
+    /* Small sigmas result in literally no change. */
+    if (MATH_EPSILON_EQ(sigma, 0.0f, 0.1f))
+        return in->duplicate();
+
+    FloatImage::Ptr out(FloatImage::create(in->width(), in->height(),
+        in->channels()));
+    std::vector<float> sep(std::max(1, in->get_value_amount()));
+    blur_gaussian_separable<float>(*in, sigma, &sep[0], out.get());
+    return out;
+}
+
+template <>
+ByteImage::Ptr
+blur_gaussian<uint8_t> (ByteImage::ConstPtr in, float sigma)
+{
+    if (in == NULL)
+        throw std::invalid_argument("NULL image given");
+
+    /* Small sigmas result in literally no change. */
+    if (MATH_EPSILON_EQ(sigma, 0.0f, 0.1f))
+        return in->duplicate();
+
+    ByteImage::Ptr out(ByteImage::create(in->width(), in->height(),
+        in->channels()));
+    std::vector<float> sep(std::max(1, in->get_value_amount()));
+    blur_gaussian_separable<uint8_t>(*in, sigma, &sep[0], out.get());
+    return out;
+}
+
+void
+blur_gaussian (FloatImage::ConstPtr in, float sigma,
+    FloatImage::Ptr tmp, FloatImage::Ptr out)
+{
+    if (in == NULL || tmp == NULL || out == NULL)
+        throw std::invalid_argument("NULL image given");
+    if (in == out || in == tmp || tmp == out)
+        throw std::invalid_argument("Images must be distinct");
+
+    out->resize(in->width(), in->height(), in->channels());
+
+    /* Small sigmas result in literally no change. */
+    if (MATH_EPSILON_EQ(sigma, 0.0f, 0.1f))
+    {
+        std::copy(in->begin(), in->end(), out->begin());
+        return;
+    }
+
+    tmp->resize(in->width(), in->height(), in->channels());
+    blur_gaussian_separable<float>(*in, sigma, tmp->begin(), out.get());
+}
+
 MVE_IMAGE_NAMESPACE_END
 MVE_NAMESPACE_END
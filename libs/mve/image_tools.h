@@ -254,12 +254,31 @@ rescale_gaussian (typename Image<T>::ConstPtr in,
 
 /**
  * Blurs the image using a gaussian convolution kernel.
- * The implementation exploits kernel separability.
+ * The implementation exploits kernel separability. Float and byte images
+ * are blurred with SIMD kernels and rows are processed in parallel.
  */
 template <typename T>
 typename Image<T>::Ptr
 blur_gaussian (typename Image<T>::ConstPtr in, float sigma);
 
+template <>
+FloatImage::Ptr
+blur_gaussian<float> (FloatImage::ConstPtr in, float sigma);
+
+template <>
+ByteImage::Ptr
+blur_gaussian<uint8_t> (ByteImage::ConstPtr in, float sigma);
+
+/**
+ * Blurs the float image 'in' like blur_gaussian() and stores the result
+ * in 'out', which is resized to the size of 'in'. The intermediate result
+ * is stored in 'tmp'. This allows to reuse image memory for repeated
+ * blurring. The images 'in', 'tmp' and 'out' must be distinct.
+ */
+void
+blur_gaussian (FloatImage::ConstPtr in, float sigma,
+    FloatImage::Ptr tmp, FloatImage::Ptr out);
+
 /**
  * Blurs the image using a box filter of integer size 'ks'.
  * The implementaion is separated, and much faster than Gaussian blur,
@@ -0,0 +1,180 @@
+/*
+ * Recall versus speed of the approximate k-d forest nearest neighbor
+ * search compared to the exhaustive search on SIFT descriptors.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+#include "util/aligned_memory.h"
+#include "util/timer.h"
+#include "util/string.h"
+#include "math/functions.h"
+#include "mve/image.h"
+#include "mve/image_io.h"
+
+#include "sfm/sift.h"
+#include "sfm/matching.h"
+#include "sfm/nearest_neighbor.h"
+#include "sfm/kd_forest.h"
+
+typedef util::AlignedMemory<unsigned short, 16> DescriptorSet;
+
+/* Converts SIFT descriptors the same way as the FeatureSet does. */
+void
+compute_descriptors (std::string const& filename, DescriptorSet* descr,
+    std::size_t* num_descr)
+{
+    std::cout << "Loading " << filename << "..." << std::endl;
+    mve::ByteImage::Ptr image = mve::image::load_file(filename);
+
+    sfm::Sift::Options sift_options;
+    sfm::Sift sift(sift_options);
+    sift.set_image(image);
+    sift.process();
+    sfm::Sift::Descriptors const& sift_descr = sift.get_descriptors();
+
+    *num_descr = sift_descr.size();
+    descr->allocate(sift_descr.size() * 128);
+    unsigned short* ptr = descr->begin();
+    for (std::size_t i = 0; i < sift_descr.size(); ++i)
+        for (int j = 0; j < 128; ++j, ++ptr)
+        {
+            float value = sift_descr[i].data[j];
+            value = math::clamp(value, 0.0f, 1.0f);
+            *ptr = static_cast<unsigned short>(math::round(value * 255.0f));
+        }
+    std::cout << "  " << *num_descr << " SIFT descriptors." << std::endl;
+}
+
+int
+main (int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Syntax: " << argv[0] << " image1 image2" << std::endl;
+        return 1;
+    }
+
+    DescriptorSet descr1, descr2;
+    std::size_t num_descr1 = 0, num_descr2 = 0;
+    try
+    {
+        compute_descriptors(argv[1], &descr1, &num_descr1);
+        compute_descriptors(argv[2], &descr2, &num_descr2);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (num_descr1 == 0 || num_descr2 == 0)
+    {
+        std::cerr << "Error: No descriptors to match." << std::endl;
+        return 1;
+    }
+
+    /* Exhaustive search as ground truth. */
+    sfm::Matching::Options matching_opts;
+    matching_opts.descriptor_length = 128;
+    std::vector<int> exact_nn(num_descr1);
+    std::vector<int> exact_matches;
+    std::size_t exact_nn_time, exact_match_time;
+    {
+        sfm::NearestNeighbor<unsigned short> nn;
+        nn.set_elements(descr2.begin(), num_descr2);
+        nn.set_element_dimensions(128);
+
+        util::WallTimer timer;
+        for (std::size_t i = 0; i < num_descr1; ++i)
+        {
+            sfm::NearestNeighbor<unsigned short>::Result result;
+            nn.find(descr1.begin() + i * 128, &result);
+            exact_nn[i] = result.index_1st_best;
+        }
+        exact_nn_time = timer.get_elapsed();
+
+        timer.reset();
+        sfm::Matching::oneway_match(matching_opts, descr1.begin(), num_descr1,
+            descr2.begin(), num_descr2, &exact_matches);
+        exact_match_time = timer.get_elapsed();
+    }
+
+    int num_exact_matches = 0;
+    for (std::size_t i = 0; i < exact_matches.size(); ++i)
+        num_exact_matches += exact_matches[i] >= 0 ? 1 : 0;
+
+    std::cout << std::endl << "Exhaustive: NN search " << exact_nn_time
+        << " ms, matching " << exact_match_time << " ms, "
+        << num_exact_matches << " matches." << std::endl << std::endl;
+
+    /* Approximate search with increasing budgets. */
+    std::cout << "trees  checks  build[ms]  search[ms]  speedup  "
+        << "NN-recall  match-recall  matches" << std::endl;
+    int const trees[] = { 1, 4, 8 };
+    int const checks[] = { 16, 32, 64, 128, 256, 512, 1024 };
+    for (int t = 0; t < 3; ++t)
+        for (int c = 0; c < 7; ++c)
+        {
+            util::WallTimer timer;
+            sfm::KdForest<unsigned short> forest;
+            forest.set_elements(descr2.begin(), num_descr2);
+            forest.set_element_dimensions(128);
+            forest.set_num_trees(trees[t]);
+            forest.set_max_checks(checks[c]);
+            forest.build();
+            std::size_t const build_time = timer.get_elapsed();
+
+            timer.reset();
+            std::size_t num_correct_nn = 0;
+            sfm::KdForest<unsigned short>::SearchBuffer buffer;
+            for (std::size_t i = 0; i < num_descr1; ++i)
+            {
+                sfm::KdForest<unsigned short>::Result result;
+                forest.find(descr1.begin() + i * 128, &result, &buffer);
+                if (result.index_1st_best == exact_nn[i])
+                    num_correct_nn += 1;
+            }
+            std::size_t const search_time = timer.get_elapsed();
+
+            sfm::Matching::Options approx_opts = matching_opts;
+            approx_opts.nn_search = sfm::Matching::NN_SEARCH_KD_FOREST;
+            approx_opts.kd_forest_num_trees = trees[t];
+            approx_opts.kd_forest_max_checks = checks[c];
+            std::vector<int> approx_matches;
+            sfm::Matching::oneway_match(approx_opts, descr1.begin(),
+                num_descr1, descr2.begin(), num_descr2, &approx_matches);
+
+            int num_approx_matches = 0;
+            int num_recalled_matches = 0;
+            for (std::size_t i = 0; i < approx_matches.size(); ++i)
+            {
+                if (approx_matches[i] < 0)
+                    continue;
+                num_approx_matches += 1;
+                if (approx_matches[i] == exact_matches[i])
+                    num_recalled_matches += 1;
+            }
+
+            float const speedup = static_cast<float>(exact_nn_time)
+                / static_cast<float>(std::max<std::size_t>(1,
+                build_time + search_time));
+            std::cout << util::string::get_filled(trees[t], 5, ' ') << "  "
+                << util::string::get_filled(checks[c], 6, ' ') << "  "
+                << util::string::get_filled(build_time, 9, ' ') << "  "
+                << util::string::get_filled(search_time, 10, ' ') << "  "
+                << util::string::get_filled(util::string::get_fixed
+                    (speedup, 2), 7, ' ') << "  "
+                << util::string::get_filled(util::string::get_fixed(100.0f
+                    * num_correct_nn / num_descr1, 2), 8, ' ') << "%  "
+                << util::string::get_filled(util::string::get_fixed(100.0f
+                    * num_recalled_matches / std::max(1, num_exact_matches),
+                    2), 11, ' ') << "%  "
+                << util::string::get_filled(num_approx_matches, 7, ' ')
+                << std::endl;
+        }
+
+    return 0;
+}
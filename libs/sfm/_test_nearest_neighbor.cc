@@ -0,0 +1,158 @@
+/*
+ * Micro-benchmark of the nearest neighbor search kernels (scalar, SSE,
+ * AVX2 and AVX-512) for SIFT (128-d) and SURF (64-d) descriptors.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "util/aligned_memory.h"
+#include "util/timer.h"
+#include "util/string.h"
+#include "sfm/nearest_neighbor.h"
+#include "sfm/block_nearest_neighbor.h"
+
+/* Fills normalized random vectors scaled to 'norm'. */
+template <typename T>
+void
+fill_random_vectors (T* elements, int num, int dim, float norm, bool positive)
+{
+    for (int i = 0; i < num; ++i)
+    {
+        std::vector<float> v(dim);
+        float square_len = 0.0f;
+        for (int j = 0; j < dim; ++j)
+        {
+            v[j] = static_cast<float>(std::rand()) / RAND_MAX;
+            if (!positive)
+                v[j] -= 0.5f;
+            square_len += v[j] * v[j];
+        }
+        for (int j = 0; j < dim; ++j)
+            elements[i * dim + j] = static_cast<T>
+                (v[j] * norm / std::sqrt(square_len));
+    }
+}
+
+char const*
+simd_name (sfm::SimdLevel simd)
+{
+    switch (simd)
+    {
+        case sfm::SIMD_NONE: return "scalar";
+        case sfm::SIMD_SSE: return "SSE";
+        case sfm::SIMD_AVX2: return "AVX2";
+        case sfm::SIMD_AVX512: return "AVX-512";
+        default: return "unknown";
+    }
+}
+
+template <typename T>
+void
+benchmark (std::string const& name, int dim, float norm, bool positive,
+    int num_queries, int num_elements)
+{
+    util::AlignedMemory<T> queries(num_queries * dim);
+    util::AlignedMemory<T> elements(num_elements * dim);
+    std::srand(0);
+    fill_random_vectors(queries.begin(), num_queries, dim, norm, positive);
+    fill_random_vectors(elements.begin(), num_elements, dim, norm, positive);
+
+    sfm::NearestNeighbor<T> nn;
+    nn.set_elements(elements.begin(), num_elements);
+    nn.set_element_dimensions(dim);
+
+    std::cout << name << " (" << dim << "-d, " << num_queries
+        << " x " << num_elements << "):" << std::endl;
+
+    std::vector<int> reference(num_queries);
+    std::size_t reference_time = 0;
+    sfm::SimdLevel const supported = sfm::detect_simd();
+    for (int level = sfm::SIMD_NONE; level <= supported; ++level)
+    {
+        nn.set_simd(static_cast<sfm::SimdLevel>(level));
+
+        util::WallTimer timer;
+        std::vector<int> indices(num_queries);
+        for (int i = 0; i < num_queries; ++i)
+        {
+            typename sfm::NearestNeighbor<T>::Result result;
+            nn.find(queries.begin() + i * dim, &result);
+            indices[i] = result.index_1st_best;
+        }
+        std::size_t const time = timer.get_elapsed();
+
+        if (level == sfm::SIMD_NONE)
+        {
+            reference = indices;
+            reference_time = time;
+        }
+
+        int num_mismatches = 0;
+        for (int i = 0; i < num_queries; ++i)
+            num_mismatches += indices[i] != reference[i] ? 1 : 0;
+
+        float const comparisons = static_cast<float>(num_queries)
+            * static_cast<float>(num_elements);
+        float const speedup = static_cast<float>(reference_time)
+            / static_cast<float>(std::max<std::size_t>(1, time));
+        std::string const simd = simd_name(nn.get_simd());
+        std::cout << "  " << simd << std::string(8 - simd.size(), ' ')
+            << util::string::get_filled(time, 6, ' ') << " ms  " << util::string::get_filled(util::string::get_fixed
+            (comparisons / std::max<std::size_t>(1, time) / 1000.0f, 1),
+            8, ' ') << " M/s  " << util::string::get_filled(util::string
+            ::get_fixed(speedup, 2), 6, ' ') << "x  "
+            << num_mismatches << " mismatches" << std::endl;
+    }
+
+    /* Blocked search, both directions in one pass. */
+    sfm::BlockNearestNeighbor<T> block_nn;
+    block_nn.set_elements(elements.begin(), num_elements);
+    block_nn.set_element_dimensions(dim);
+    util::WallTimer timer;
+    std::vector<typename sfm::NearestNeighbor<T>::Result> results_1, results_2;
+    block_nn.find_all(queries.begin(), num_queries, &results_1, &results_2);
+    std::size_t const time = timer.get_elapsed();
+
+    int num_mismatches = 0;
+    for (int i = 0; i < num_queries; ++i)
+        num_mismatches += results_1[i].index_1st_best != reference[i] ? 1 : 0;
+    std::cout << "  Blocked, both directions: "
+        << time << " ms, " << num_mismatches << " mismatches" << std::endl;
+}
+
+int
+main (int argc, char** argv)
+{
+    int num_queries = 2000;
+    int num_elements = 10000;
+    if (argc == 3)
+    {
+        num_queries = util::string::convert<int>(argv[1]);
+        num_elements = util::string::convert<int>(argv[2]);
+    }
+    else if (argc != 1)
+    {
+        std::cerr << "Syntax: " << argv[0]
+            << " [NUM_QUERIES NUM_ELEMENTS]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Detected SIMD: " << simd_name
+        (sfm::detect_simd()) << std::endl << std::endl;
+
+    benchmark<unsigned short>("SIFT, unsigned short", 128, 255.0f, true,
+        num_queries, num_elements);
+    benchmark<short>("SURF, signed short", 64, 127.0f, false,
+        num_queries, num_elements);
+    benchmark<float>("SIFT, float", 128, 1.0f, true,
+        num_queries, num_elements);
+    benchmark<float>("SURF, float", 64, 1.0f, false,
+        num_queries, num_elements);
+
+    return 0;
+}
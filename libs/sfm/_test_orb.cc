@@ -0,0 +1,91 @@
+/*
+ * Benchmark of the binary ORB features against SIFT features. Features
+ * are computed for an image and a shifted copy, and the time for feature
+ * computation and two-way matching is reported for both feature types.
+ */
+
+#include <iostream>
+#include <cstdlib>
+
+#include "util/timer.h"
+#include "mve/image.h"
+#include "mve/image_io.h"
+#include "mve/image_tools.h"
+#include "sfm/feature_set.h"
+
+/* Blurred random noise, which produces many keypoints at all scales. */
+mve::ByteImage::Ptr
+create_noise_image (int width, int height)
+{
+    std::srand(0);
+    mve::FloatImage::Ptr noise = mve::FloatImage::create(width, height, 1);
+    for (int i = 0; i < noise->get_value_amount(); ++i)
+        noise->at(i) = static_cast<float>(std::rand() % 256) / 255.0f;
+    noise = mve::image::blur_gaussian<float>(noise, 2.0f);
+    return mve::image::float_to_byte_image(noise);
+}
+
+/* Returns the image shifted by the given offset, like a video frame. */
+mve::ByteImage::Ptr
+shift_image (mve::ByteImage::ConstPtr image, int dx, int dy)
+{
+    return mve::image::crop<uint8_t>(image, image->width() - dx,
+        image->height() - dy, dx, dy, NULL);
+}
+
+void
+run_benchmark (std::string const& name, sfm::FeatureSet::FeatureTypes type,
+    mve::ByteImage::Ptr image1, mve::ByteImage::Ptr image2)
+{
+    sfm::FeatureSet::Options options;
+    options.feature_types = type;
+
+    util::WallTimer timer;
+    sfm::FeatureSet features1(options);
+    features1.compute_features(image1);
+    sfm::FeatureSet features2(options);
+    features2.compute_features(image2);
+    std::size_t const compute_time = timer.get_elapsed();
+
+    timer.reset();
+    sfm::Matching::Result result;
+    features1.match(features2, &result);
+    std::size_t const match_time = timer.get_elapsed();
+
+    std::cout << name << ": " << features1.positions.size() << " and "
+        << features2.positions.size() << " features in " << compute_time
+        << " ms, " << sfm::Matching::count_consistent_matches(result)
+        << " matches in " << match_time << " ms." << std::endl;
+}
+
+int
+main (int argc, char** argv)
+{
+    mve::ByteImage::Ptr image;
+    if (argc > 1)
+    {
+        try
+        {
+            image = mve::image::load_file(argv[1]);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << "Syntax: " << argv[0] << " [ IMAGE ]" << std::endl;
+        std::cout << "Using 2 MP noise image." << std::endl;
+        image = create_noise_image(1920, 1080);
+    }
+
+    mve::ByteImage::Ptr shifted = shift_image(image, 12, 7);
+    std::cout << "Image " << image->width() << "x" << image->height()
+        << std::endl;
+    run_benchmark("SIFT", sfm::FeatureSet::FEATURE_SIFT, image, shifted);
+    run_benchmark("ORB", sfm::FeatureSet::FEATURE_ORB, image, shifted);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Benchmark of the PBA solver on a recorded bundle adjustment problem,
+ * e.g. saved with "sfmrecon --ba-problem". The full bundle adjustment is
+ * run from the recorded parameters once for each given number of threads,
+ * and the time and the final mean squared error is reported.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+
+#include "util/timer.h"
+#include "sfm/bundler_pba_session.h"
+
+void
+run_benchmark (sfm::bundler::PbaSession const& problem, int num_threads)
+{
+    /* Copies do not share the solver, which allocates from scratch. */
+    sfm::bundler::PbaSession session(problem);
+    sfm::pba::SparseBundleCPU& pba = session.get_solver();
+    pba.EnableRadialDistortion(sfm::pba::MEASUREMENT_DISTORTION);
+    pba.SetNextTimeBudget(0);
+    pba.SetNextBundleMode(sfm::pba::BUNDLE_FULL);
+    pba.SetNumThreads(num_threads);
+    pba.GetInternalConfig()->__verbose_level = -1;
+
+    util::WallTimer timer;
+    session.run();
+    std::size_t const time = timer.get_elapsed();
+
+    std::cout << num_threads << " threads: " << time << " ms, MSE "
+        << pba.GetMeanSquaredError() << "." << std::endl;
+}
+
+int
+main (int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Syntax: " << argv[0] << " PROBLEM [ THREADS ... ]"
+            << std::endl;
+        std::cout << "Number of threads 0 uses all cores." << std::endl;
+        return 1;
+    }
+
+    sfm::bundler::PbaSession problem;
+    try
+    {
+        problem.load_problem(argv[1]);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Error loading problem: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Loaded problem with " << problem.num_cameras()
+        << " cameras, " << problem.num_points() << " points, "
+        << problem.num_observations() << " observations." << std::endl;
+
+    std::vector<int> num_threads;
+    for (int i = 2; i < argc; ++i)
+        num_threads.push_back(std::atoi(argv[i]));
+    if (num_threads.empty())
+        num_threads.push_back(0);
+
+    for (std::size_t i = 0; i < num_threads.size(); ++i)
+        run_benchmark(problem, num_threads[i]);
+
+    return 0;
+}
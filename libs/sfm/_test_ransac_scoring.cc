@@ -0,0 +1,167 @@
+/*
+ * Micro-benchmark of the batched RANSAC scoring kernels (scalar, SSE2,
+ * AVX2 and AVX-512) against the per-correspondence error functions.
+ * The models are the homography and the two-view pose used in the
+ * homography and pose unit tests.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "util/timer.h"
+#include "util/system.h"
+#include "math/matrix_tools.h"
+#include "sfm/correspondence.h"
+#include "sfm/fundamental.h"
+#include "sfm/homography.h"
+#include "sfm/pose.h"
+#include "sfm/ransac_scoring.h"
+
+#define NUM_MATCHES 10000
+#define NUM_REPETITIONS 1000
+
+char const*
+simd_name (sfm::SimdLevel simd)
+{
+    switch (simd)
+    {
+        case sfm::SIMD_NONE: return "scalar";
+        case sfm::SIMD_SSE: return "SSE2";
+        case sfm::SIMD_AVX2: return "AVX2";
+        case sfm::SIMD_AVX512: return "AVX-512";
+        default: return "unknown";
+    }
+}
+
+double
+random_coord (void)
+{
+    return (util::system::rand_int() % 20000) / 10000.0 - 1.0;
+}
+
+/* The homography from the homography unit test. */
+void
+homography_matches (sfm::HomographyMatrix* H, sfm::Correspondences* matches)
+{
+    double const sin = std::sin(MATH_PI_4);
+    double const cos = std::cos(MATH_PI_4);
+    sfm::HomographyMatrix& h = *H;
+    h(0,0) = cos;   h(0,1) = -sin;  h(0,2) = 0.8;
+    h(1,0) = sin;   h(1,1) = cos;   h(1,2) = -0.2;
+    h(2,0) = 0.0;   h(2,1) = 0.0;   h(2,2) = 1.0;
+
+    matches->resize(NUM_MATCHES);
+    for (int i = 0; i < NUM_MATCHES; ++i)
+    {
+        sfm::Correspondence& match = matches->at(i);
+        match.p1[0] = random_coord();
+        match.p1[1] = random_coord();
+        math::Vec3d p2 = h * math::Vec3d(match.p1[0], match.p1[1], 1.0);
+        match.p2[0] = p2[0] / p2[2];
+        match.p2[1] = p2[1] / p2[2];
+        /* Every third match is an outlier. */
+        if (i % 3 == 0)
+            match.p2[0] += random_coord();
+    }
+}
+
+/* The two-view pose from the pose unit test. */
+void
+fundamental_matches (sfm::FundamentalMatrix* F,
+    sfm::Correspondences* matches)
+{
+    sfm::CameraPose pose1, pose2;
+    pose1.set_k_matrix(800, 800 / 2, 600 / 2);
+    math::matrix_set_identity(*pose1.R, 3);
+    pose1.t.fill(0.0);
+    pose2.set_k_matrix(800, 800 / 2, 600 / 2);
+    pose2.R.fill(0.0);
+    double const angle = MATH_PI / 4;
+    pose2.R(0,0) = std::cos(angle); pose2.R(0,2) = std::sin(angle);
+    pose2.R(1,1) = 1.0;
+    pose2.R(2,0) = -std::sin(angle); pose2.R(2,2) = std::cos(angle);
+    pose2.t.fill(0.0); pose2.t[0] = 1.0;
+    pose2.t = pose2.R * -pose2.t;
+    sfm::fundamental_from_pose(pose1, pose2, F);
+
+    matches->resize(NUM_MATCHES);
+    for (int i = 0; i < NUM_MATCHES; ++i)
+    {
+        math::Vec3d point(0.5 * random_coord(), 0.5 * random_coord(),
+            1.0 + 0.4 * random_coord());
+        math::Vec3d p1 = pose1.K * (pose1.R * point + pose1.t);
+        math::Vec3d p2 = pose2.K * (pose2.R * point + pose2.t);
+        sfm::Correspondence& match = matches->at(i);
+        match.p1[0] = p1[0] / p1[2];
+        match.p1[1] = p1[1] / p1[2];
+        match.p2[0] = p2[0] / p2[2];
+        match.p2[1] = p2[1] / p2[2];
+        if (i % 3 == 0)
+            match.p2[1] += 100.0 * random_coord();
+    }
+}
+
+template <typename MODEL, typename SCALAR, typename BATCHED>
+void
+benchmark (char const* name, MODEL const& model,
+    sfm::Correspondences const& matches, SCALAR scalar, BATCHED batched)
+{
+    std::cout << name << " (" << matches.size() << " matches, "
+        << NUM_REPETITIONS << " repetitions):" << std::endl;
+
+    std::vector<double> errors(matches.size());
+    double checksum = 0.0;
+    util::WallTimer timer;
+    for (int r = 0; r < NUM_REPETITIONS; ++r)
+        for (std::size_t i = 0; i < matches.size(); ++i)
+            errors[i] = scalar(model, matches[i]);
+    std::size_t const scalar_time = timer.get_elapsed();
+    for (std::size_t i = 0; i < errors.size(); ++i)
+        checksum += errors[i];
+    std::cout << "  AoS per match: " << scalar_time << " ms" << std::endl;
+
+    sfm::CorrespondencesSoA matches_soa;
+    sfm::correspondences_to_soa(matches, &matches_soa);
+    sfm::SimdLevel const supported = sfm::detect_simd();
+    for (int level = sfm::SIMD_NONE; level <= supported; ++level)
+    {
+        timer.reset();
+        for (int r = 0; r < NUM_REPETITIONS; ++r)
+            batched(model, matches_soa, 0, matches_soa.size(), &errors[0],
+                static_cast<sfm::SimdLevel>(level));
+        std::size_t const time = timer.get_elapsed();
+
+        double batched_checksum = 0.0;
+        for (std::size_t i = 0; i < errors.size(); ++i)
+            batched_checksum += errors[i];
+        std::cout << "  SoA " << simd_name(static_cast
+            <sfm::SimdLevel>(level)) << ": " << time << " ms"
+            << ", speedup " << static_cast<double>(scalar_time)
+            / std::max<std::size_t>(1, time) << "x"
+            << ", relative checksum error "
+            << std::abs(checksum - batched_checksum) / checksum
+            << std::endl;
+    }
+}
+
+int
+main (void)
+{
+    util::system::rand_seed(0);
+
+    sfm::HomographyMatrix H;
+    sfm::Correspondences homography_corr;
+    homography_matches(&H, &homography_corr);
+    benchmark("Symmetric transfer error", H, homography_corr,
+        &sfm::symmetric_transfer_error, &sfm::symmetric_transfer_errors);
+
+    sfm::FundamentalMatrix F;
+    sfm::Correspondences fundamental_corr;
+    fundamental_matches(&F, &fundamental_corr);
+    benchmark("Sampson distance", F, fundamental_corr,
+        &sfm::sampson_distance, &sfm::sampson_distances);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Benchmark of the SIFT peak memory consumption with and without streaming
+ * octave processing. Every configuration runs in a child process to obtain
+ * its peak resident set size. The descriptors of both configurations are
+ * compared afterwards. Requires POSIX fork() and wait4().
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util/timer.h"
+#include "mve/image.h"
+#include "mve/image_io.h"
+#include "mve/image_tools.h"
+#include "sfm/sift.h"
+
+/* Blurred random noise, which produces many keypoints at all scales. */
+mve::ByteImage::Ptr
+create_noise_image (int width, int height)
+{
+    std::srand(0);
+    mve::FloatImage::Ptr noise = mve::FloatImage::create(width, height, 1);
+    for (int i = 0; i < noise->get_value_amount(); ++i)
+        noise->at(i) = static_cast<float>(std::rand() % 256) / 255.0f;
+    noise = mve::image::blur_gaussian<float>(noise, 2.0f);
+    return mve::image::float_to_byte_image(noise);
+}
+
+void
+run_sift (mve::ByteImage::ConstPtr image, bool streaming,
+    sfm::Sift::Descriptors* descriptors)
+{
+    sfm::Sift::Options options;
+    options.streaming_octaves = streaming;
+    sfm::Sift sift(options);
+    sift.set_image(image);
+    sift.process();
+    *descriptors = sift.get_descriptors();
+}
+
+/* Runs SIFT in a child process and reports time and peak memory. */
+void
+benchmark (mve::ByteImage::ConstPtr image, bool streaming)
+{
+    util::WallTimer timer;
+    pid_t const pid = fork();
+    if (pid < 0)
+    {
+        std::cerr << "Error: fork() failed" << std::endl;
+        std::exit(1);
+    }
+    if (pid == 0)
+    {
+        sfm::Sift::Descriptors descriptors;
+        run_sift(image, streaming, &descriptors);
+        std::exit(descriptors.empty() ? 1 : 0);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        std::cerr << "Error: SIFT process failed" << std::endl;
+        std::exit(1);
+    }
+
+    std::cout << (streaming ? "Streaming octaves: " : "All octaves:       ")
+        << timer.get_elapsed() << " ms, peak memory "
+        << (usage.ru_maxrss / 1024) << " MB" << std::endl;
+}
+
+int
+main (int argc, char** argv)
+{
+    mve::ByteImage::Ptr image;
+    if (argc > 1)
+    {
+        try
+        {
+            image = mve::image::load_file(argv[1]);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << "Syntax: " << argv[0] << " [ IMAGE ]" << std::endl;
+        std::cout << "Using 24 MP noise image." << std::endl;
+        image = create_noise_image(6000, 4000);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << "Image " << image->width() << "x" << image->height()
+        << ", baseline memory " << (usage.ru_maxrss / 1024) << " MB"
+        << std::endl;
+
+    benchmark(image, false);
+    benchmark(image, true);
+
+    /* Compare the results of both configurations. */
+    sfm::Sift::Descriptors all_descr, streaming_descr;
+    run_sift(image, false, &all_descr);
+    run_sift(image, true, &streaming_descr);
+    bool identical = all_descr.size() == streaming_descr.size();
+    for (std::size_t i = 0; identical && i < all_descr.size(); ++i)
+    {
+        sfm::Sift::Descriptor const& d1 = all_descr[i];
+        sfm::Sift::Descriptor const& d2 = streaming_descr[i];
+        identical = d1.x == d2.x && d1.y == d2.y && d1.scale == d2.scale
+            && d1.orientation == d2.orientation && d1.data == d2.data;
+    }
+    std::cout << all_descr.size() << " descriptors, results "
+        << (identical ? "identical" : "DIFFER") << "." << std::endl;
+
+    return identical ? 0 : 1;
+}
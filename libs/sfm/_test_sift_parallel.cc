@@ -0,0 +1,99 @@
+/*
+ * Benchmark of the parallel SIFT keypoint localization and descriptor
+ * generation. SIFT runs with a single thread and with all threads, and
+ * the descriptors of both runs are compared for bit-identical results.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#if defined(_OPENMP)
+#   include <omp.h>
+#endif
+
+#include "util/timer.h"
+#include "mve/image.h"
+#include "mve/image_io.h"
+#include "mve/image_tools.h"
+#include "sfm/sift.h"
+
+/* Blurred random noise, which produces many keypoints at all scales. */
+mve::ByteImage::Ptr
+create_noise_image (int width, int height)
+{
+    std::srand(0);
+    mve::FloatImage::Ptr noise = mve::FloatImage::create(width, height, 1);
+    for (int i = 0; i < noise->get_value_amount(); ++i)
+        noise->at(i) = static_cast<float>(std::rand() % 256) / 255.0f;
+    noise = mve::image::blur_gaussian<float>(noise, 2.0f);
+    return mve::image::float_to_byte_image(noise);
+}
+
+std::size_t
+run_sift (mve::ByteImage::ConstPtr image, int num_threads,
+    sfm::Sift::Descriptors* descriptors)
+{
+#if defined(_OPENMP)
+    omp_set_num_threads(num_threads);
+#else
+    (void)num_threads;
+#endif
+    util::WallTimer timer;
+    sfm::Sift sift((sfm::Sift::Options()));
+    sift.set_image(image);
+    sift.process();
+    *descriptors = sift.get_descriptors();
+    return timer.get_elapsed();
+}
+
+int
+main (int argc, char** argv)
+{
+    mve::ByteImage::Ptr image;
+    if (argc > 1)
+    {
+        try
+        {
+            image = mve::image::load_file(argv[1]);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << "Syntax: " << argv[0] << " [ IMAGE ]" << std::endl;
+        std::cout << "Using 12 MP noise image." << std::endl;
+        image = create_noise_image(4000, 3000);
+    }
+
+    int num_threads = 1;
+#if defined(_OPENMP)
+    num_threads = omp_get_max_threads();
+#endif
+
+    sfm::Sift::Descriptors serial_descr, parallel_descr;
+    std::size_t const serial_time = run_sift(image, 1, &serial_descr);
+    std::size_t const parallel_time
+        = run_sift(image, num_threads, &parallel_descr);
+    std::cout << "Image " << image->width() << "x" << image->height()
+        << ": 1 thread " << serial_time << " ms, " << num_threads
+        << " threads " << parallel_time << " ms, speedup "
+        << static_cast<double>(serial_time)
+        / std::max<std::size_t>(1, parallel_time) << "x" << std::endl;
+
+    bool identical = serial_descr.size() == parallel_descr.size();
+    for (std::size_t i = 0; identical && i < serial_descr.size(); ++i)
+    {
+        sfm::Sift::Descriptor const& d1 = serial_descr[i];
+        sfm::Sift::Descriptor const& d2 = parallel_descr[i];
+        identical = d1.x == d2.x && d1.y == d2.y && d1.scale == d2.scale
+            && d1.orientation == d2.orientation && d1.data == d2.data;
+    }
+    std::cout << serial_descr.size() << " descriptors, results "
+        << (identical ? "identical" : "DIFFER") << "." << std::endl;
+
+    return identical ? 0 : 1;
+}
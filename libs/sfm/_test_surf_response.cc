@@ -0,0 +1,162 @@
+/*
+ * Benchmark of the SURF Hessian response maps. The row-vectorized and
+ * parallel response maps are compared to the previous per-pixel
+ * implementation using the single pixel box filters. The complete SURF
+ * pipeline is timed afterwards.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "util/timer.h"
+#include "math/functions.h"
+#include "mve/image.h"
+#include "mve/image_io.h"
+#include "mve/image_tools.h"
+#include "sfm/surf.h"
+
+/* Blurred random noise, which produces many keypoints at all scales. */
+mve::ByteImage::Ptr
+create_noise_image (int width, int height)
+{
+    std::srand(0);
+    mve::FloatImage::Ptr noise = mve::FloatImage::create(width, height, 1);
+    for (int i = 0; i < noise->get_value_amount(); ++i)
+        noise->at(i) = static_cast<float>(std::rand() % 256) / 255.0f;
+    noise = mve::image::blur_gaussian<float>(noise, 2.0f);
+    return mve::image::float_to_byte_image(noise);
+}
+
+class SurfBenchmark : public sfm::Surf
+{
+public:
+    SurfBenchmark (void);
+    void run (mve::ByteImage::ConstPtr image);
+
+private:
+    void create_response_maps_per_pixel (Octaves* result);
+};
+
+SurfBenchmark::SurfBenchmark (void)
+    : sfm::Surf(sfm::Surf::Options())
+{
+}
+
+/* The previous per-pixel implementation of the response maps. */
+void
+SurfBenchmark::create_response_maps_per_pixel (Octaves* result)
+{
+    int const kernel_sizes[4][4] = { { 3, 5, 7, 9 }, { 5, 9, 13, 17 },
+        { 9, 17, 25, 33 }, { 17, 33, 49, 65 } };
+    int const w = this->get_sat()->width();
+    int const h = this->get_sat()->height();
+
+    result->resize(4);
+    for (int o = 0; o < 4; ++o)
+    {
+        result->at(o).imgs.resize(4);
+        for (int k = 0; k < 4; ++k)
+        {
+            int const fs = kernel_sizes[o][k];
+            int const step = math::fastpow(2, o);
+            float const weight = 0.912;
+            float const inv_karea = 1.0 / (fs * (2 * fs - 1));
+            Octave::RespImage::ConstPtr resp = this->get_octaves()[o].imgs[k];
+            int const ow = resp->width();
+            int const oh = resp->height();
+
+            Octave::RespImage::Ptr img = Octave::RespImage::create(ow, oh, 1);
+            int const border = fs + fs / 2 + 1;
+            for (int y = 0, i = 0; y < h; y += step)
+                for (int x = 0; x < w; x += step, ++i)
+                {
+                    if (x < border || x + border >= w
+                        || y < border || y + border >= h)
+                    {
+                        img->at(i) = 0.0f;
+                        continue;
+                    }
+
+                    float dxx = this->filter_dxx(fs, x, y) * inv_karea;
+                    float dyy = this->filter_dyy(fs, x, y) * inv_karea;
+                    float dxy = this->filter_dxy(fs, x, y) * inv_karea;
+                    img->at(i) = dxx * dyy - weight * dxy * dxy;
+                }
+            result->at(o).imgs[k] = img;
+        }
+    }
+}
+
+void
+SurfBenchmark::run (mve::ByteImage::ConstPtr image)
+{
+    this->set_image(image);
+
+    util::WallTimer timer;
+    this->create_octaves();
+    std::size_t const fast_time = timer.get_elapsed();
+
+    timer.reset();
+    Octaves expected;
+    this->create_response_maps_per_pixel(&expected);
+    std::size_t const per_pixel_time = timer.get_elapsed();
+
+    /* Relative error w.r.t. the magnitude of the responses. */
+    double max_error = 0.0;
+    for (int o = 0; o < 4; ++o)
+        for (int k = 0; k < 4; ++k)
+        {
+            Octave::RespImage::ConstPtr img1 = expected[o].imgs[k];
+            Octave::RespImage::ConstPtr img2 = this->get_octaves()[o].imgs[k];
+            for (int i = 0; i < img1->get_value_amount(); ++i)
+            {
+                double const value = img1->at(i);
+                max_error = std::max(max_error, std::abs(value
+                    - img2->at(i)) / (1.0 + std::abs(value)));
+            }
+        }
+
+    std::cout << "Response maps: per pixel " << per_pixel_time << " ms, "
+        << "row-vectorized " << fast_time << " ms, speedup "
+        << static_cast<double>(per_pixel_time)
+        / std::max<std::size_t>(1, fast_time) << "x, max relative error "
+        << max_error << std::endl;
+
+    timer.reset();
+    this->process();
+    std::cout << "SURF: " << this->get_descriptors().size()
+        << " descriptors in " << timer.get_elapsed() << " ms" << std::endl;
+}
+
+int
+main (int argc, char** argv)
+{
+    mve::ByteImage::Ptr image;
+    if (argc > 1)
+    {
+        try
+        {
+            image = mve::image::load_file(argv[1]);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << "Syntax: " << argv[0] << " [ IMAGE ]" << std::endl;
+        std::cout << "Using 12 MP noise image." << std::endl;
+        image = create_noise_image(4000, 3000);
+    }
+
+    std::cout << "Image " << image->width() << "x" << image->height()
+        << std::endl;
+    SurfBenchmark benchmark;
+    benchmark.run(image);
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Benchmark of the multi-view triangulation kernel against the SVD of the
+ * full DLT system. Synthetic tracks with 2 to 50 views and half a pixel of
+ * noise are triangulated with both methods, and the time and the mean
+ * distance to the ground truth points is reported per track length.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#include "util/timer.h"
+#include "math/vector.h"
+#include "sfm/pose.h"
+#include "sfm/triangulate.h"
+
+/* Cameras on a circle around the origin, which look at the origin. */
+void
+create_cameras (int num_cameras, std::vector<sfm::CameraPose>* cameras)
+{
+    cameras->resize(num_cameras);
+    for (int i = 0; i < num_cameras; ++i)
+    {
+        double const angle = 0.02 * i;
+        sfm::CameraPose& pose = cameras->at(i);
+        pose.set_k_matrix(1000.0, 500.0, 400.0);
+        pose.R.fill(0.0);
+        pose.R(0, 0) = std::cos(angle);
+        pose.R(0, 2) = -std::sin(angle);
+        pose.R(1, 1) = 1.0;
+        pose.R(2, 0) = std::sin(angle);
+        pose.R(2, 2) = std::cos(angle);
+        pose.t = math::Vec3d(0.0, 0.0, 6.0);
+    }
+}
+
+void
+run_benchmark (std::vector<sfm::CameraPose> const& cameras,
+    int num_views, int num_tracks)
+{
+    /* Project random points into the first views with noise. */
+    std::vector<math::Vec3d> points(num_tracks);
+    std::vector<math::Vec2f> pos;
+    std::vector<sfm::CameraPose const*> poses;
+    std::vector<int> offsets(1, 0);
+    for (int i = 0; i < num_tracks; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            points[i][j] = 2.0 * std::rand() / RAND_MAX - 1.0;
+        for (int j = 0; j < num_views; ++j)
+        {
+            sfm::CameraPose const& pose = cameras[j];
+            math::Vec3d x = pose.K * (pose.R * points[i] + pose.t);
+            pos.push_back(math::Vec2f(
+                x[0] / x[2] + std::rand() / (double)RAND_MAX - 0.5,
+                x[1] / x[2] + std::rand() / (double)RAND_MAX - 0.5));
+            poses.push_back(&pose);
+        }
+        offsets.push_back(pos.size());
+    }
+
+    /* Triangulate with the SVD of the DLT system. */
+    util::WallTimer timer;
+    double svd_error = 0.0;
+    for (int i = 0; i < num_tracks; ++i)
+    {
+        std::vector<math::Vec2f> track_pos(pos.begin() + offsets[i],
+            pos.begin() + offsets[i + 1]);
+        std::vector<sfm::CameraPose const*> track_poses(poses.begin()
+            + offsets[i], poses.begin() + offsets[i + 1]);
+        math::Vec3d x = sfm::triangulate_track_svd(track_pos, track_poses);
+        svd_error += (x - points[i]).norm();
+    }
+    std::size_t const svd_time = timer.get_elapsed();
+
+    /* Triangulate with the normal equations kernel. */
+    timer.reset();
+    double kernel_error = 0.0;
+    for (int i = 0; i < num_tracks; ++i)
+    {
+        math::Vec3d x = sfm::triangulate_track(&pos[offsets[i]],
+            &poses[offsets[i]], offsets[i + 1] - offsets[i]);
+        kernel_error += (x - points[i]).norm();
+    }
+    std::size_t const kernel_time = timer.get_elapsed();
+
+    std::cout << num_views << " views: SVD " << svd_time << " ms (error "
+        << svd_error / num_tracks << "), kernel " << kernel_time
+        << " ms (error " << kernel_error / num_tracks << ")." << std::endl;
+}
+
+int
+main (int argc, char** argv)
+{
+    int num_tracks = 20000;
+    if (argc > 1)
+        num_tracks = std::atoi(argv[1]);
+    else
+        std::cout << "Syntax: " << argv[0] << " [ NUM_TRACKS ]" << std::endl;
+
+    std::vector<sfm::CameraPose> cameras;
+    create_cameras(50, &cameras);
+
+    std::srand(0);
+    int const num_views[] = { 2, 3, 5, 10, 20, 50 };
+    for (int i = 0; i < 6; ++i)
+        run_benchmark(cameras, num_views[i], num_tracks);
+
+    return 0;
+}
@@ -0,0 +1,477 @@
+/*
+ * Blocked many-to-many nearest neighbor search.
+ *
+ * The inner products of a block of queries with a block of elements are
+ * computed with micro kernels that process two queries and four elements
+ * at once, which reuses every load from memory several times. Kernels are
+ * available for SSE2/SSE3 (if enabled at compile time) and AVX2 (selected
+ * at runtime), see simd.h for the instruction set handling.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <emmintrin.h> // SSE2
+#include <pmmintrin.h> // SSE3
+
+#include "sfm/block_nearest_neighbor.h"
+
+#if SFM_AVX_KERNELS
+#   include <immintrin.h> // AVX2
+#   define NN_AVX_KERNELS 1
+#   define NN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#   define NN_AVX_KERNELS 0
+#endif
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Number of queries per block. */
+    int const BLOCK_NUM_QUERIES = 64;
+    /* Size of the element block in bytes, which is kept in the L1 cache. */
+    int const BLOCK_ELEMENT_BYTES = 16384;
+
+    /*
+     * Stores the inner products of the micro kernel (two queries 'i' and
+     * 'i + 1', four elements 'j' to 'j + 3') clipped to the block size.
+     */
+    template <typename V>
+    inline void
+    store_kernel_result (V const* row_0, V const* row_1, int i, int j,
+        int num_queries, int num_elements, V* tile)
+    {
+        int const num = std::min(4, num_elements - j);
+        for (int k = 0; k < num; ++k)
+            tile[i * num_elements + j + k] = row_0[k];
+        if (i + 1 < num_queries)
+            for (int k = 0; k < num; ++k)
+                tile[(i + 1) * num_elements + j + k] = row_1[k];
+    }
+
+    template <typename T>
+    void
+    block_inner_products_scalar (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions,
+        typename InnerProduct<T>::Type* tile)
+    {
+        typedef typename InnerProduct<T>::Type V;
+        for (int i = 0; i < num_queries; ++i)
+        {
+            T const* query = queries + i * dimensions;
+            for (int j = 0; j < num_elements; ++j)
+            {
+                T const* element = elements + j * dimensions;
+                V inner_product = 0;
+                for (int k = 0; k < dimensions; ++k)
+                    inner_product += query[k] * element[k];
+                tile[i * num_elements + j] = inner_product;
+            }
+        }
+    }
+
+#if ENABLE_SSE2_NN_SEARCH && defined(__SSE2__)
+    /* Horizontal sums of four registers, without SSSE3 hadd. */
+    inline __m128i
+    sse2_sum_4 (__m128i a0, __m128i a1, __m128i a2, __m128i a3)
+    {
+        __m128i const s01 = _mm_add_epi32(_mm_unpacklo_epi32(a0, a1),
+            _mm_unpackhi_epi32(a0, a1));
+        __m128i const s23 = _mm_add_epi32(_mm_unpacklo_epi32(a2, a3),
+            _mm_unpackhi_epi32(a2, a3));
+        return _mm_add_epi32(_mm_unpacklo_epi64(s01, s23),
+            _mm_unpackhi_epi64(s01, s23));
+    }
+
+    /*
+     * The products of adjacent pairs are added to 32 bit integers
+     * (pmaddwd), which is exact for normalized descriptors. The dimension
+     * size must be divisible by 8.
+     */
+    template <typename T>
+    void
+    block_inner_products_sse2 (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* tile)
+    {
+        int const dim_8 = dimensions / 8;
+        for (int i = 0; i < num_queries; i += 2)
+        {
+            T const* q0 = queries + i * dimensions;
+            T const* q1 = i + 1 < num_queries ? q0 + dimensions : q0;
+            for (int j = 0; j < num_elements; j += 4)
+            {
+                T const* e[4];
+                for (int k = 0; k < 4; ++k)
+                    e[k] = elements + std::min(j + k, num_elements - 1)
+                        * dimensions;
+
+                __m128i acc[8];
+                for (int k = 0; k < 8; ++k)
+                    acc[k] = _mm_setzero_si128();
+                for (int k = 0; k < dim_8; ++k)
+                {
+                    __m128i const a0 = _mm_loadu_si128
+                        (reinterpret_cast<__m128i const*>(q0) + k);
+                    __m128i const a1 = _mm_loadu_si128
+                        (reinterpret_cast<__m128i const*>(q1) + k);
+                    for (int l = 0; l < 4; ++l)
+                    {
+                        __m128i const b = _mm_loadu_si128
+                            (reinterpret_cast<__m128i const*>(e[l]) + k);
+                        acc[l] = _mm_add_epi32(acc[l], _mm_madd_epi16(a0, b));
+                        acc[l + 4] = _mm_add_epi32(acc[l + 4],
+                            _mm_madd_epi16(a1, b));
+                    }
+                }
+
+                int row_0[4], row_1[4];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(row_0),
+                    sse2_sum_4(acc[0], acc[1], acc[2], acc[3]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(row_1),
+                    sse2_sum_4(acc[4], acc[5], acc[6], acc[7]));
+                store_kernel_result(row_0, row_1, i, j,
+                    num_queries, num_elements, tile);
+            }
+        }
+    }
+#endif
+
+#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
+    /* The dimension size must be divisible by 4. */
+    void
+    block_inner_products_sse3 (float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* tile)
+    {
+        int const dim_4 = dimensions / 4;
+        for (int i = 0; i < num_queries; i += 2)
+        {
+            float const* q0 = queries + i * dimensions;
+            float const* q1 = i + 1 < num_queries ? q0 + dimensions : q0;
+            for (int j = 0; j < num_elements; j += 4)
+            {
+                float const* e[4];
+                for (int k = 0; k < 4; ++k)
+                    e[k] = elements + std::min(j + k, num_elements - 1)
+                        * dimensions;
+
+                __m128 acc[8];
+                for (int k = 0; k < 8; ++k)
+                    acc[k] = _mm_setzero_ps();
+                for (int k = 0; k < dim_4; ++k)
+                {
+                    __m128 const a0 = _mm_loadu_ps(q0 + 4 * k);
+                    __m128 const a1 = _mm_loadu_ps(q1 + 4 * k);
+                    for (int l = 0; l < 4; ++l)
+                    {
+                        __m128 const b = _mm_loadu_ps(e[l] + 4 * k);
+                        acc[l] = _mm_add_ps(acc[l], _mm_mul_ps(a0, b));
+                        acc[l + 4] = _mm_add_ps(acc[l + 4], _mm_mul_ps(a1, b));
+                    }
+                }
+
+                float row_0[4], row_1[4];
+                _mm_storeu_ps(row_0, _mm_hadd_ps(_mm_hadd_ps(acc[0], acc[1]),
+                    _mm_hadd_ps(acc[2], acc[3])));
+                _mm_storeu_ps(row_1, _mm_hadd_ps(_mm_hadd_ps(acc[4], acc[5]),
+                    _mm_hadd_ps(acc[6], acc[7])));
+                store_kernel_result(row_0, row_1, i, j,
+                    num_queries, num_elements, tile);
+            }
+        }
+    }
+#endif
+
+#if NN_AVX_KERNELS
+    /* The dimension size must be divisible by 16. */
+    template <typename T>
+    NN_TARGET_AVX2 void
+    block_inner_products_avx2 (T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* tile)
+    {
+        int const dim_16 = dimensions / 16;
+        for (int i = 0; i < num_queries; i += 2)
+        {
+            T const* q0 = queries + i * dimensions;
+            T const* q1 = i + 1 < num_queries ? q0 + dimensions : q0;
+            for (int j = 0; j < num_elements; j += 4)
+            {
+                T const* e[4];
+                for (int k = 0; k < 4; ++k)
+                    e[k] = elements + std::min(j + k, num_elements - 1)
+                        * dimensions;
+
+                __m256i acc[8];
+                for (int k = 0; k < 8; ++k)
+                    acc[k] = _mm256_setzero_si256();
+                for (int k = 0; k < dim_16; ++k)
+                {
+                    __m256i const a0 = _mm256_loadu_si256
+                        (reinterpret_cast<__m256i const*>(q0) + k);
+                    __m256i const a1 = _mm256_loadu_si256
+                        (reinterpret_cast<__m256i const*>(q1) + k);
+                    for (int l = 0; l < 4; ++l)
+                    {
+                        __m256i const b = _mm256_loadu_si256
+                            (reinterpret_cast<__m256i const*>(e[l]) + k);
+                        acc[l] = _mm256_add_epi32(acc[l],
+                            _mm256_madd_epi16(a0, b));
+                        acc[l + 4] = _mm256_add_epi32(acc[l + 4],
+                            _mm256_madd_epi16(a1, b));
+                    }
+                }
+
+                int row_0[4], row_1[4];
+                for (int r = 0; r < 2; ++r)
+                {
+                    __m256i const sum = _mm256_hadd_epi32(
+                        _mm256_hadd_epi32(acc[4 * r], acc[4 * r + 1]),
+                        _mm256_hadd_epi32(acc[4 * r + 2], acc[4 * r + 3]));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>
+                        (r == 0 ? row_0 : row_1), _mm_add_epi32(
+                        _mm256_castsi256_si128(sum),
+                        _mm256_extracti128_si256(sum, 1)));
+                }
+                store_kernel_result(row_0, row_1, i, j,
+                    num_queries, num_elements, tile);
+            }
+        }
+    }
+
+    /* The dimension size must be divisible by 8. */
+    NN_TARGET_AVX2 void
+    block_inner_products_avx2 (float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* tile)
+    {
+        int const dim_8 = dimensions / 8;
+        for (int i = 0; i < num_queries; i += 2)
+        {
+            float const* q0 = queries + i * dimensions;
+            float const* q1 = i + 1 < num_queries ? q0 + dimensions : q0;
+            for (int j = 0; j < num_elements; j += 4)
+            {
+                float const* e[4];
+                for (int k = 0; k < 4; ++k)
+                    e[k] = elements + std::min(j + k, num_elements - 1)
+                        * dimensions;
+
+                __m256 acc[8];
+                for (int k = 0; k < 8; ++k)
+                    acc[k] = _mm256_setzero_ps();
+                for (int k = 0; k < dim_8; ++k)
+                {
+                    __m256 const a0 = _mm256_loadu_ps(q0 + 8 * k);
+                    __m256 const a1 = _mm256_loadu_ps(q1 + 8 * k);
+                    for (int l = 0; l < 4; ++l)
+                    {
+                        __m256 const b = _mm256_loadu_ps(e[l] + 8 * k);
+                        acc[l] = _mm256_add_ps(acc[l], _mm256_mul_ps(a0, b));
+                        acc[l + 4] = _mm256_add_ps(acc[l + 4],
+                            _mm256_mul_ps(a1, b));
+                    }
+                }
+
+                float row_0[4], row_1[4];
+                for (int r = 0; r < 2; ++r)
+                {
+                    __m256 const sum = _mm256_hadd_ps(
+                        _mm256_hadd_ps(acc[4 * r], acc[4 * r + 1]),
+                        _mm256_hadd_ps(acc[4 * r + 2], acc[4 * r + 3]));
+                    _mm_storeu_ps(r == 0 ? row_0 : row_1, _mm_add_ps(
+                        _mm256_castps256_ps128(sum),
+                        _mm256_extractf128_ps(sum, 1)));
+                }
+                store_kernel_result(row_0, row_1, i, j,
+                    num_queries, num_elements, tile);
+            }
+        }
+    }
+#endif
+
+    template <typename T>
+    void
+    block_inner_products (SimdLevel simd,
+        T const* queries, int num_queries,
+        T const* elements, int num_elements, int dimensions, int* tile)
+    {
+#if NN_AVX_KERNELS
+        if (simd >= SIMD_AVX2 && dimensions % 16 == 0)
+        {
+            block_inner_products_avx2(queries, num_queries,
+                elements, num_elements, dimensions, tile);
+            return;
+        }
+#endif
+#if ENABLE_SSE2_NN_SEARCH && defined(__SSE2__)
+        if (simd >= SIMD_SSE && dimensions % 8 == 0)
+        {
+            block_inner_products_sse2(queries, num_queries,
+                elements, num_elements, dimensions, tile);
+            return;
+        }
+#endif
+        (void)simd;
+        block_inner_products_scalar(queries, num_queries,
+            elements, num_elements, dimensions, tile);
+    }
+
+    void
+    block_inner_products (SimdLevel simd,
+        float const* queries, int num_queries,
+        float const* elements, int num_elements, int dimensions, float* tile)
+    {
+#if NN_AVX_KERNELS
+        if (simd >= SIMD_AVX2 && dimensions % 8 == 0)
+        {
+            block_inner_products_avx2(queries, num_queries,
+                elements, num_elements, dimensions, tile);
+            return;
+        }
+#endif
+#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
+        if (simd >= SIMD_SSE && dimensions % 4 == 0)
+        {
+            block_inner_products_sse3(queries, num_queries,
+                elements, num_elements, dimensions, tile);
+            return;
+        }
+#endif
+        (void)simd;
+        block_inner_products_scalar(queries, num_queries,
+            elements, num_elements, dimensions, tile);
+    }
+
+    /*
+     * Initializes and updates the results in the same way as
+     * NearestNeighbor<T>::find(). Distances are misused to store inner
+     * products until they are converted.
+     */
+    template <typename T>
+    inline void
+    init_result (typename NearestNeighbor<T>::Result* result)
+    {
+        result->dist_1st_best = -std::numeric_limits<T>::max();
+        result->dist_2nd_best = -std::numeric_limits<T>::max();
+        result->index_1st_best = 0;
+        result->index_2nd_best = 0;
+    }
+
+    /* Inner products of unsigned descriptors are never negative. */
+    template <>
+    inline void
+    init_result<unsigned short>
+        (NearestNeighbor<unsigned short>::Result* result)
+    {
+        result->dist_1st_best = 0;
+        result->dist_2nd_best = 0;
+        result->index_1st_best = 0;
+        result->index_2nd_best = 0;
+    }
+
+    template <typename T, typename V>
+    inline void
+    update_result (V inner_product, int index,
+        typename NearestNeighbor<T>::Result* result)
+    {
+        if (inner_product > result->dist_2nd_best)
+        {
+            if (inner_product > result->dist_1st_best)
+            {
+                result->index_2nd_best = result->index_1st_best;
+                result->dist_2nd_best = result->dist_1st_best;
+                result->index_1st_best = index;
+                result->dist_1st_best = inner_product;
+            }
+            else
+            {
+                result->index_2nd_best = index;
+                result->dist_2nd_best = inner_product;
+            }
+        }
+    }
+
+    /* Conversion from inner products to square distances. */
+    template <typename T>
+    inline void
+    finalize_result (typename NearestNeighbor<T>::Result* result)
+    {
+        result->dist_1st_best = inner_product_to_distance
+            (result->dist_1st_best, T());
+        result->dist_2nd_best = inner_product_to_distance
+            (result->dist_2nd_best, T());
+    }
+}  /* namespace */
+
+template <typename T>
+void
+BlockNearestNeighbor<T>::find_all (T const* queries, int num_queries,
+    std::vector<Result>* query_results,
+    std::vector<Result>* element_results) const
+{
+    typedef typename InnerProduct<T>::Type V;
+
+    query_results->resize(num_queries);
+    for (int i = 0; i < num_queries; ++i)
+        init_result<T>(&query_results->at(i));
+    if (element_results != 0)
+    {
+        element_results->resize(this->num_elements);
+        for (int i = 0; i < this->num_elements; ++i)
+            init_result<T>(&element_results->at(i));
+    }
+
+    int const dim = this->dimensions;
+    int const block_num_elements = std::max(4, BLOCK_ELEMENT_BYTES
+        / static_cast<int>(dim * sizeof(T)) / 4 * 4);
+    std::vector<V> tile(BLOCK_NUM_QUERIES * block_num_elements);
+
+    /*
+     * Query blocks in the outer loop and element blocks in the inner loop
+     * visit the candidates of every row and every column in ascending
+     * order, which yields the same tie breaking as the exhaustive search.
+     */
+    for (int qb = 0; qb < num_queries; qb += BLOCK_NUM_QUERIES)
+    {
+        int const qb_size = std::min(BLOCK_NUM_QUERIES, num_queries - qb);
+        T const* qb_ptr = queries + static_cast<std::size_t>(qb) * dim;
+        for (int eb = 0; eb < this->num_elements; eb += block_num_elements)
+        {
+            int const eb_size = std::min(block_num_elements,
+                this->num_elements - eb);
+            T const* eb_ptr = this->elements
+                + static_cast<std::size_t>(eb) * dim;
+            block_inner_products(this->simd, qb_ptr, qb_size,
+                eb_ptr, eb_size, dim, &tile[0]);
+
+            for (int i = 0; i < qb_size; ++i)
+            {
+                Result* result = &query_results->at(qb + i);
+                V const* row = &tile[i * eb_size];
+                for (int j = 0; j < eb_size; ++j)
+                    update_result<T>(row[j], eb + j, result);
+            }
+
+            if (element_results == 0)
+                continue;
+
+            for (int j = 0; j < eb_size; ++j)
+            {
+                Result* result = &element_results->at(eb + j);
+                for (int i = 0; i < qb_size; ++i)
+                    update_result<T>(tile[i * eb_size + j], qb + i, result);
+            }
+        }
+    }
+
+    for (int i = 0; i < num_queries; ++i)
+        finalize_result<T>(&query_results->at(i));
+    if (element_results != 0)
+        for (int i = 0; i < this->num_elements; ++i)
+            finalize_result<T>(&element_results->at(i));
+}
+
+/* Explicit instantiation for the supported types. */
+template class BlockNearestNeighbor<short>;
+template class BlockNearestNeighbor<unsigned short>;
+template class BlockNearestNeighbor<float>;
+
+SFM_NAMESPACE_END
@@ -0,0 +1,110 @@
+/*
+ * Blocked many-to-many nearest neighbor search.
+ */
+
+#ifndef SFM_BLOCK_NEAREST_NEIGHBOR_HEADER
+#define SFM_BLOCK_NEAREST_NEIGHBOR_HEADER
+
+#include <vector>
+
+#include "sfm/nearest_neighbor.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Nearest (and second nearest) neighbor search for many queries at once.
+ *
+ * Instead of streaming all elements from memory for every query as in
+ * NearestNeighbor<T>::find(), queries and elements are partitioned into
+ * blocks that fit into the caches, and the inner products of a block pair
+ * are computed like a small matrix product (GEMM) using register blocking.
+ * Best and second best neighbors are updated for every row of the block.
+ * Optionally, the same pass also yields the nearest neighbors of every
+ * element among the queries (the columns of the block), which computes
+ * both directions of a two-way matching at the cost of one.
+ *
+ * The results are identical to NearestNeighbor<T>::find() in both
+ * directions, except for rounding of float inner products, which also
+ * differs between instruction sets (see NearestNeighbor<T>). The same types
+ * are supported: signed short, unsigned short and float. The elements are
+ * referenced, not copied, and must stay valid as long as the search is used.
+ */
+template <typename T>
+class BlockNearestNeighbor
+{
+public:
+    typedef typename NearestNeighbor<T>::Result Result;
+
+public:
+    BlockNearestNeighbor (void);
+    /** For SfM, this is the descriptor memory block. */
+    void set_elements (T const* elements, int num_elements);
+    /** For SfM, this is the descriptor length. */
+    void set_element_dimensions (int element_dimensions);
+    /** Limits the SIMD instruction set, see NearestNeighbor<T>. */
+    void set_simd (SimdLevel simd);
+
+    /**
+     * Finds the nearest neighbors of all 'queries' among the elements.
+     * If 'element_results' is not null, it receives the nearest neighbors
+     * of all elements among the queries, computed in the same pass.
+     */
+    void find_all (T const* queries, int num_queries,
+        std::vector<Result>* query_results,
+        std::vector<Result>* element_results = 0) const;
+
+    int get_element_dimensions (void) const;
+
+private:
+    int dimensions;
+    T const* elements;
+    int num_elements;
+    SimdLevel simd;
+};
+
+/* ---------------------------------------------------------------- */
+
+template <typename T>
+inline
+BlockNearestNeighbor<T>::BlockNearestNeighbor (void)
+{
+    this->dimensions = 64;
+    this->elements = 0;
+    this->num_elements = 0;
+    this->simd = detect_simd();
+}
+
+template <typename T>
+inline void
+BlockNearestNeighbor<T>::set_elements (T const* elements, int num_elements)
+{
+    this->elements = elements;
+    this->num_elements = num_elements;
+}
+
+template <typename T>
+inline void
+BlockNearestNeighbor<T>::set_element_dimensions (int element_dimensions)
+{
+    this->dimensions = element_dimensions;
+}
+
+template <typename T>
+inline void
+BlockNearestNeighbor<T>::set_simd (SimdLevel simd)
+{
+    SimdLevel const supported = detect_simd();
+    this->simd = simd < supported ? simd : supported;
+}
+
+template <typename T>
+inline int
+BlockNearestNeighbor<T>::get_element_dimensions (void) const
+{
+    return this->dimensions;
+}
+
+SFM_NAMESPACE_END
+
+#endif  /* SFM_BLOCK_NEAREST_NEIGHBOR_HEADER */
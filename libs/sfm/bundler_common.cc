@@ -142,35 +142,55 @@ load_viewports_data (std::string const& filename,
 /* --------------- Data Structure for Feature Tracks -------------- */
 
 void
-Track::invalidate (void)
+TrackList::assign (std::vector<int>* offsets, FeatureReferenceList* features)
 {
-    std::fill(this->pos.begin(), this->pos.end(),
-        std::numeric_limits<float>::quiet_NaN());
+    this->offsets.swap(*offsets);
+    this->references.swap(*features);
+    if (this->offsets.empty())
+        this->offsets.push_back(0);
+
+    std::size_t const num_tracks = this->offsets.size() - 1;
+    this->sizes.resize(num_tracks);
+    for (std::size_t i = 0; i < num_tracks; ++i)
+        this->sizes[i] = this->offsets[i + 1] - this->offsets[i];
+    this->positions.clear();
+    this->positions.resize(num_tracks,
+        math::Vec3f(std::numeric_limits<float>::quiet_NaN()));
+    this->colors.clear();
+    this->colors.resize(num_tracks, math::Vec3uc(0, 0, 0));
 }
 
 void
-Track::remove_view (int view_id)
+TrackList::clear (void)
 {
-    for (FeatureReferenceList::iterator iter = this->features.begin();
-        iter != this->features.end();)
-    {
-        if (iter->view_id == view_id)
-            iter = this->features.erase(iter);
-        else
-            iter++;
-    }
+    std::vector<int> offsets;
+    FeatureReferenceList features;
+    this->assign(&offsets, &features);
+}
+
+void
+TrackList::remove_view (std::size_t track_id, int view_id)
+{
+    /* Compact the remaining references, the capacity is kept. */
+    FeatureReference* refs = &this->references[this->offsets[track_id]];
+    int const size = this->sizes[track_id];
+    int new_size = 0;
+    for (int i = 0; i < size; ++i)
+        if (refs[i].view_id != view_id)
+            refs[new_size++] = refs[i];
+    this->sizes[track_id] = new_size;
 }
 
 /* ----------------- Serialization of Descriptors ----------------- */
 
-template <typename DESC, int LEN>
+template <typename DESC, typename T, int LEN>
 mve::ByteImage::Ptr
 serialize_descriptors (std::vector<DESC> const& descriptors,
     int image_width, int image_height)
 {
     /* Allocate storate for the descriptors. */
     std::size_t size_of_header = DESCR_SIGNATURE_LEN + 3 * sizeof(int32_t);
-    std::size_t size_per_descriptor = 4 * sizeof(float) + LEN * sizeof(float);
+    std::size_t size_per_descriptor = 4 * sizeof(float) + LEN * sizeof(T);
     mve::ByteImage::Ptr data = mve::ByteImage::create
         (size_of_header + descriptors.size() * size_per_descriptor, 1, 1);
 
@@ -195,7 +215,7 @@ serialize_descriptors (std::vector<DESC> const& descriptors,
         out.write(reinterpret_cast<char const*>(&d.y), sizeof(float));
         out.write(reinterpret_cast<char const*>(&d.scale), sizeof(float));
         out.write(reinterpret_cast<char const*>(&d.orientation), sizeof(float));
-        out.write(reinterpret_cast<char const*>(*d.data), sizeof(float) * LEN);
+        out.write(reinterpret_cast<char const*>(*d.data), sizeof(T) * LEN);
     }
 
     return data;
@@ -203,7 +223,7 @@ serialize_descriptors (std::vector<DESC> const& descriptors,
 
 /* --------------- De-Serialization of Descriptors ---------------- */
 
-template <typename DESC, int LEN>
+template <typename DESC, typename T, int LEN>
 void
 deserialize_descriptors (mve::ByteImage::ConstPtr data,
     std::vector<DESC>* descriptors, int* width, int* height)
@@ -241,7 +261,7 @@ deserialize_descriptors (mve::ByteImage::ConstPtr data,
         in.read(reinterpret_cast<char*>(&d.y), sizeof(float));
         in.read(reinterpret_cast<char*>(&d.scale), sizeof(float));
         in.read(reinterpret_cast<char*>(&d.orientation), sizeof(float));
-        in.read(reinterpret_cast<char*>(*d.data), sizeof(float) * LEN);
+        in.read(reinterpret_cast<char*>(*d.data), sizeof(T) * LEN);
     }
 
     if (width != NULL)
@@ -256,7 +276,7 @@ mve::ByteImage::Ptr
 descriptors_to_embedding (Sift::Descriptors const& descriptors,
     int width, int height)
 {
-    return serialize_descriptors<Sift::Descriptor, 128>
+    return serialize_descriptors<Sift::Descriptor, float, 128>
         (descriptors, width, height);
 }
 
@@ -264,7 +284,7 @@ void
 embedding_to_descriptors (mve::ByteImage::ConstPtr data,
     Sift::Descriptors* descriptors, int* width, int* height)
 {
-    deserialize_descriptors<Sift::Descriptor, 128>
+    deserialize_descriptors<Sift::Descriptor, float, 128>
         (data, descriptors, width, height);
 }
 
@@ -272,7 +292,7 @@ mve::ByteImage::Ptr
 descriptors_to_embedding (Surf::Descriptors const& descriptors,
     int width, int height)
 {
-    return serialize_descriptors<Surf::Descriptor, 64>
+    return serialize_descriptors<Surf::Descriptor, float, 64>
         (descriptors, width, height);
 }
 
@@ -280,24 +300,33 @@ void
 embedding_to_descriptors (mve::ByteImage::ConstPtr data,
     Surf::Descriptors* descriptors, int* width, int* height)
 {
-    deserialize_descriptors<Surf::Descriptor, 64>
+    deserialize_descriptors<Surf::Descriptor, float, 64>
         (data, descriptors, width, height);
 }
 
-/* -------------- Input/Output for Feature Matching --------------- */
+mve::ByteImage::Ptr
+descriptors_to_embedding (Orb::Descriptors const& descriptors,
+    int width, int height)
+{
+    return serialize_descriptors<Orb::Descriptor, uint64_t, 4>
+        (descriptors, width, height);
+}
 
 void
-save_pairwise_matching (PairwiseMatching const& matching, std::ostream& out)
+embedding_to_descriptors (mve::ByteImage::ConstPtr data,
+    Orb::Descriptors* descriptors, int* width, int* height)
 {
-    /* Write file signature and header. */
-    out.write(MATCHING_SIGNATURE, MATCHING_SIGNATURE_LEN);
-    int32_t num_pairs = static_cast<int32_t>(matching.size());
-    out.write(reinterpret_cast<char const*>(&num_pairs), sizeof(int32_t));
+    deserialize_descriptors<Orb::Descriptor, uint64_t, 4>
+        (data, descriptors, width, height);
+}
 
-    /* Write matching result. */
-    for (std::size_t i = 0; i < matching.size(); ++i)
+/* -------------- Input/Output for Feature Matching --------------- */
+
+namespace
+{
+    void
+    save_two_view_matching (TwoViewMatching const& tvr, std::ostream& out)
     {
-        TwoViewMatching const& tvr = matching[i];
         int32_t id1 = static_cast<int32_t>(tvr.view_1_id);
         int32_t id2 = static_cast<int32_t>(tvr.view_2_id);
         out.write(reinterpret_cast<char const*>(&id1), sizeof(int32_t));
@@ -313,6 +342,19 @@ save_pairwise_matching (PairwiseMatching const& matching, std::ostream& out)
             out.write(reinterpret_cast<char const*>(&i2), sizeof(int32_t));
         }
     }
+}  /* namespace */
+
+void
+save_pairwise_matching (PairwiseMatching const& matching, std::ostream& out)
+{
+    /* Write file signature and header. */
+    out.write(MATCHING_SIGNATURE, MATCHING_SIGNATURE_LEN);
+    int32_t num_pairs = static_cast<int32_t>(matching.size());
+    out.write(reinterpret_cast<char const*>(&num_pairs), sizeof(int32_t));
+
+    /* Write matching result. */
+    for (std::size_t i = 0; i < matching.size(); ++i)
+        save_two_view_matching(matching[i], out);
 }
 
 void
@@ -393,6 +435,194 @@ load_pairwise_matching (std::string const& filename,
     in.close();
 }
 
+/* --------------- Streaming Log for Feature Matching ------------- */
+
+void
+create_matching_log_views (ViewportList const& viewports,
+    MatchingLogViews* views)
+{
+    views->resize(viewports.size());
+    for (std::size_t i = 0; i < viewports.size(); ++i)
+    {
+        FeatureSet const& features = viewports[i].features;
+        MatchingLogView& view = views->at(i);
+        view.width = features.width;
+        view.height = features.height;
+        view.num_features = static_cast<int>(features.positions.size());
+
+        /* FNV-1a hash of the feature position bytes. */
+        view.feature_hash = (static_cast<uint64_t>(0xcbf29ce4) << 32)
+            | 0x84222325;
+        unsigned char const* bytes = features.positions.empty() ? NULL
+            : reinterpret_cast<unsigned char const*>(&features.positions[0]);
+        std::size_t const num_bytes = features.positions.size()
+            * sizeof(math::Vec2f);
+        for (std::size_t j = 0; j < num_bytes; ++j)
+        {
+            view.feature_hash ^= bytes[j];
+            view.feature_hash *= (static_cast<uint64_t>(0x100) << 32)
+                | 0x1b3;
+        }
+    }
+}
+
+void
+write_matching_log_header (MatchingLogViews const& views, std::ostream& out)
+{
+    std::vector<int32_t> data;
+    data.reserve(1 + 5 * views.size());
+    data.push_back(static_cast<int32_t>(views.size()));
+    for (std::size_t i = 0; i < views.size(); ++i)
+    {
+        data.push_back(static_cast<int32_t>(views[i].width));
+        data.push_back(static_cast<int32_t>(views[i].height));
+        data.push_back(static_cast<int32_t>(views[i].num_features));
+        data.push_back(static_cast<int32_t>(views[i].feature_hash));
+        data.push_back(static_cast<int32_t>(views[i].feature_hash >> 32));
+    }
+
+    out.write(MATCHING_LOG_SIGNATURE, MATCHING_LOG_SIGNATURE_LEN);
+    out.write(reinterpret_cast<char const*>(&data[0]),
+        data.size() * sizeof(int32_t));
+    out.flush();
+}
+
+std::streamoff
+load_matching_log_index (std::string const& filename,
+    MatchingLogIndex* index, MatchingLogViews* views)
+{
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good())
+        throw util::FileException(filename, std::strerror(errno));
+
+    /* Read and check file signature. */
+    char signature[MATCHING_LOG_SIGNATURE_LEN + 1];
+    in.read(signature, MATCHING_LOG_SIGNATURE_LEN);
+    signature[MATCHING_LOG_SIGNATURE_LEN] = '\0';
+    if (std::string(MATCHING_LOG_SIGNATURE) != signature)
+        throw std::invalid_argument("Error matching log signature");
+
+    /* Read the views of the log header. */
+    int32_t num_views = 0;
+    in.read(reinterpret_cast<char*>(&num_views), sizeof(int32_t));
+    if (!in.good() || num_views < 0)
+        throw util::Exception("Premature EOF");
+    std::vector<int32_t> view_data(5 * num_views);
+    if (num_views > 0)
+        in.read(reinterpret_cast<char*>(&view_data[0]),
+            view_data.size() * sizeof(int32_t));
+    if (!in.good())
+        throw util::Exception("Premature EOF");
+    if (views != NULL)
+    {
+        views->resize(num_views);
+        for (int i = 0; i < num_views; ++i)
+        {
+            int32_t const* data = &view_data[5 * i];
+            MatchingLogView& view = views->at(i);
+            view.width = static_cast<int>(data[0]);
+            view.height = static_cast<int>(data[1]);
+            view.num_features = static_cast<int>(data[2]);
+            view.feature_hash = static_cast<uint64_t>
+                (static_cast<uint32_t>(data[3]))
+                | static_cast<uint64_t>(static_cast<uint32_t>(data[4])) << 32;
+        }
+    }
+
+    /* Read record headers and skip the matches. */
+    std::streamoff pos = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streamoff const file_size = in.tellg();
+    std::streamoff const header_size = 3 * sizeof(int32_t);
+    index->clear();
+    while (pos + header_size <= file_size)
+    {
+        int32_t header[3];
+        in.seekg(pos);
+        in.read(reinterpret_cast<char*>(header), header_size);
+        if (!in.good() || header[2] < 0)
+            break;
+        std::streamoff const record_end = pos + header_size
+            + static_cast<std::streamoff>(header[2]) * 2 * sizeof(int32_t);
+        if (record_end > file_size)
+            break;
+
+        MatchingLogEntry entry;
+        entry.view_1_id = static_cast<int>(header[0]);
+        entry.view_2_id = static_cast<int>(header[1]);
+        entry.num_matches = static_cast<int>(header[2]);
+        entry.offset = pos + header_size;
+        index->push_back(entry);
+        pos = record_end;
+    }
+    in.close();
+
+    return pos;
+}
+
+void
+load_matching_log_entry (std::istream& in, MatchingLogEntry const& entry,
+    TwoViewMatching* matching)
+{
+    matching->view_1_id = entry.view_1_id;
+    matching->view_2_id = entry.view_2_id;
+    matching->matches.resize(entry.num_matches);
+    if (entry.num_matches == 0)
+        return;
+
+    std::vector<int32_t> data(2 * entry.num_matches);
+    in.seekg(entry.offset);
+    in.read(reinterpret_cast<char*>(&data[0]),
+        data.size() * sizeof(int32_t));
+    if (!in.good())
+        throw util::Exception("Premature EOF");
+    for (int i = 0; i < entry.num_matches; ++i)
+    {
+        matching->matches[i].first = static_cast<int>(data[2 * i + 0]);
+        matching->matches[i].second = static_cast<int>(data[2 * i + 1]);
+    }
+}
+
+void
+load_matching_log (std::string const& filename, PairwiseMatching* matching)
+{
+    MatchingLogIndex index;
+    load_matching_log_index(filename, &index);
+
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good())
+        throw util::FileException(filename, std::strerror(errno));
+
+    matching->clear();
+    for (std::size_t i = 0; i < index.size(); ++i)
+    {
+        if (index[i].num_matches == 0)
+            continue;
+        matching->push_back(TwoViewMatching());
+        load_matching_log_entry(in, index[i], &matching->back());
+    }
+    in.close();
+}
+
+void
+append_to_matching_log (TwoViewMatching const& matching, std::ostream& out)
+{
+    /* The record is written at once to keep partial records short. */
+    std::vector<int32_t> data;
+    data.reserve(3 + 2 * matching.matches.size());
+    data.push_back(static_cast<int32_t>(matching.view_1_id));
+    data.push_back(static_cast<int32_t>(matching.view_2_id));
+    data.push_back(static_cast<int32_t>(matching.matches.size()));
+    for (std::size_t i = 0; i < matching.matches.size(); ++i)
+    {
+        data.push_back(static_cast<int32_t>(matching.matches[i].first));
+        data.push_back(static_cast<int32_t>(matching.matches[i].second));
+    }
+    out.write(reinterpret_cast<char const*>(&data[0]),
+        data.size() * sizeof(int32_t));
+    out.flush();
+}
+
 /* ---------------- Input/Output of the Pre-Bundle ---------------- */
 
 void
@@ -409,6 +639,42 @@ save_prebundle_to_file (ViewportList const& viewports,
     out.close();
 }
 
+void
+save_prebundle_from_matching_log (ViewportList const& viewports,
+    std::string const& matching_log, std::string const& filename)
+{
+    /* Only pairs with matches are written, sorted like the matching. */
+    MatchingLogIndex index;
+    load_matching_log_index(matching_log, &index);
+    std::sort(index.begin(), index.end());
+    int32_t num_pairs = 0;
+    for (std::size_t i = 0; i < index.size(); ++i)
+        if (index[i].num_matches > 0)
+            num_pairs += 1;
+
+    std::ifstream in(matching_log.c_str(), std::ios::binary);
+    if (!in.good())
+        throw util::FileException(matching_log, std::strerror(errno));
+    std::ofstream out(filename.c_str());
+    if (!out.good())
+        throw util::FileException(filename, std::strerror(errno));
+
+    save_viewports_data(viewports, out);
+    out.write(MATCHING_SIGNATURE, MATCHING_SIGNATURE_LEN);
+    out.write(reinterpret_cast<char const*>(&num_pairs), sizeof(int32_t));
+    TwoViewMatching tvm;
+    for (std::size_t i = 0; i < index.size(); ++i)
+    {
+        if (index[i].num_matches == 0)
+            continue;
+        load_matching_log_entry(in, index[i], &tvm);
+        save_two_view_matching(tvm, out);
+    }
+
+    in.close();
+    out.close();
+}
+
 void
 load_prebundle_from_file (std::string const& filename,
     ViewportList* viewports, PairwiseMatching* matching)
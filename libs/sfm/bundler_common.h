@@ -6,14 +6,17 @@
 #ifndef SFM_BUNDLER_COMMON_HEADER
 #define SFM_BUNDLER_COMMON_HEADER
 
+#include <limits>
 #include <string>
 #include <vector>
+#include <iostream>
 
 #include "math/vector.h"
 #include "util/aligned_memory.h"
 #include "mve/image.h"
 #include "sfm/sift.h"
 #include "sfm/surf.h"
+#include "sfm/orb.h"
 #include "sfm/feature_set.h"
 #include "sfm/correspondence.h"
 #include "sfm/defines.h"
@@ -27,6 +30,9 @@
 #define VIEWPORTS_SIGNATURE "MVE_VIEWPORTS\n"
 #define VIEWPORTS_SIGNATURE_LEN 14
 
+#define MATCHING_LOG_SIGNATURE "MVE_MATCHLOG2\n"
+#define MATCHING_LOG_SIGNATURE_LEN 14
+
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
@@ -88,20 +94,119 @@ struct FeatureReference
 /** The list of all feature references inside a track. */
 typedef std::vector<FeatureReference> FeatureReferenceList;
 
-/** Representation of a feature track. */
-struct Track
+/** A range of consecutive feature references, e.g. of a single track. */
+struct FeatureReferenceRange
+{
+    FeatureReference const* begin (void) const;
+    FeatureReference const* end (void) const;
+    std::size_t size (void) const;
+    bool empty (void) const;
+    FeatureReference const& operator[] (std::size_t index) const;
+
+    FeatureReference const* first;
+    FeatureReference const* last;
+};
+
+class Track;
+class ConstTrack;
+
+/**
+ * The list of all tracks. The feature references of all tracks are stored
+ * in a single array in CSR (compressed sparse row) layout, and the 3D
+ * positions and colors of the tracks are stored in separate arrays. This
+ * avoids one heap allocation per track and keeps passes over all tracks
+ * and their features cache friendly. The feature references of a track
+ * are iterated with begin() and end(), or with features(). Code written
+ * for single tracks can use the Track views returned by operator[].
+ */
+class TrackList
+{
+public:
+    TrackList (void);
+
+    /**
+     * Initializes the tracks from the CSR layout where the references of
+     * track i are features[offsets[i]] to features[offsets[i + 1] - 1].
+     * The vectors are swapped into the track list. All tracks are
+     * initially invalid and black.
+     */
+    void assign (std::vector<int>* offsets, FeatureReferenceList* features);
+    void clear (void);
+    std::size_t size (void) const;
+    bool empty (void) const;
+
+    /** Returns the first feature reference of a track. */
+    FeatureReference const* begin (std::size_t track_id) const;
+    /** Returns the end of the feature references of a track. */
+    FeatureReference const* end (std::size_t track_id) const;
+    /** Returns the number of feature references of a track. */
+    std::size_t num_features (std::size_t track_id) const;
+    /** Returns the feature references of a track. */
+    FeatureReferenceRange features (std::size_t track_id) const;
+    /** Removes all references to the given view from a track. */
+    void remove_view (std::size_t track_id, int view_id);
+
+    /** Access to the 3D position of a track. */
+    math::Vec3f& position (std::size_t track_id);
+    math::Vec3f const& position (std::size_t track_id) const;
+    /** Access to the color of a track. */
+    math::Vec3uc& color (std::size_t track_id);
+    math::Vec3uc const& color (std::size_t track_id) const;
+
+    /** Returns whether the track has a valid 3D position. */
+    bool is_valid (std::size_t track_id) const;
+    /** Invalidates the 3D position of the track. */
+    void invalidate (std::size_t track_id);
+
+    /** Returns a view of a single track. */
+    Track operator[] (std::size_t track_id);
+    ConstTrack operator[] (std::size_t track_id) const;
+
+private:
+    std::vector<int> offsets;
+    std::vector<int> sizes;
+    FeatureReferenceList references;
+    std::vector<math::Vec3f> positions;
+    std::vector<math::Vec3uc> colors;
+};
+
+/**
+ * Lightweight view of a single track in a track list, with the members
+ * of a stand-alone track. The view refers to the track list and must not
+ * be used after the track list is assigned or destroyed.
+ */
+class Track
 {
+public:
+    Track (TrackList* tracks, std::size_t track_id);
+
     bool is_valid (void) const;
     void invalidate (void);
+    /** Removes all references to the given view, updates the features. */
     void remove_view (int view_id);
 
-    math::Vec3f pos;
-    math::Vec3uc color;
-    FeatureReferenceList features;
+    math::Vec3f& pos;
+    math::Vec3uc& color;
+    FeatureReferenceRange features;
+
+private:
+    TrackList* tracks;
+    std::size_t track_id;
 };
 
-/** The list of all tracks. */
-typedef std::vector<Track> TrackList;
+/** Read-only view of a single track in a track list. */
+class ConstTrack
+{
+public:
+    ConstTrack (TrackList const* tracks, std::size_t track_id);
+    ConstTrack (Track const& track);
+
+    bool is_valid (void) const;
+
+    math::Vec3f const& pos;
+    math::Vec3uc const& color;
+    FeatureReferenceRange features;
+};
 
 /* ------------- Data Structures for Feature Matching ------------- */
 
@@ -128,6 +233,94 @@ void
 load_pairwise_matching (std::string const& filename,
     PairwiseMatching* matching);
 
+/* --------------- Streaming Log for Feature Matching ------------- */
+
+/*
+ * The matching log stores two-view matchings one at a time while the
+ * matching is in progress (see bundler::Matching). The format is the
+ * file signature, a header with the features of every view the matches
+ * refer to, and records in the pairwise matching format:
+ *
+ * MVE_MATCHLOG2\n
+ * <number of views>
+ *   <width> <height> <number of features> <feature hash (64 bit)>
+ *   ...
+ * <view ID 1> <view ID 2> <number of matches>
+ *   <match 1 feature ID 1> <match 1 feature ID 2>
+ *   ...
+ * <view ID 3> <view ID 4> <number of matches>
+ * ...
+ *
+ * Rejected pairs are recorded with zero matches. A partially written
+ * last record (e.g. after a crash) is ignored.
+ */
+
+/**
+ * Features of a view in the matching log header. Feature IDs in the log
+ * are only valid for identical features, e.g. features computed with a
+ * different image size or feature type have a different hash.
+ */
+struct MatchingLogView
+{
+    bool operator== (MatchingLogView const& rhs) const;
+
+    int width;
+    int height;
+    int num_features;
+    /** Hash of the feature positions. */
+    uint64_t feature_hash;
+};
+
+/** The features of all views in the matching log header. */
+typedef std::vector<MatchingLogView> MatchingLogViews;
+
+/** Location of a two-view matching in the matching log. */
+struct MatchingLogEntry
+{
+    bool operator< (MatchingLogEntry const& rhs) const;
+
+    int view_1_id;
+    int view_2_id;
+    int num_matches;
+    /** File offset of the first match of the record. */
+    std::streamoff offset;
+};
+
+/** The locations of all two-view matchings in the matching log. */
+typedef std::vector<MatchingLogEntry> MatchingLogIndex;
+
+/** Computes the matching log header for the features of the viewports. */
+void
+create_matching_log_views (ViewportList const& viewports,
+    MatchingLogViews* views);
+
+/** Writes the signature and the header of a new matching log. */
+void
+write_matching_log_header (MatchingLogViews const& views, std::ostream& out);
+
+/**
+ * Reads the view IDs and the number of matches of all complete records
+ * in the matching log without reading the matches, and optionally the
+ * views in the header. Returns the size of the log up to the end of the
+ * last complete record.
+ */
+std::streamoff
+load_matching_log_index (std::string const& filename,
+    MatchingLogIndex* index, MatchingLogViews* views = NULL);
+
+/** Reads the matches of a single record from the matching log. */
+void
+load_matching_log_entry (std::istream& in, MatchingLogEntry const& entry,
+    TwoViewMatching* matching);
+
+/** Reads all pairs with matches from the matching log. */
+void
+load_matching_log (std::string const& filename, PairwiseMatching* matching);
+
+/** Appends a record to the matching log and flushes the stream. */
+void
+append_to_matching_log (TwoViewMatching const& matching, std::ostream& out);
+
 /* ---------------- Input/Output of the Pre-Bundle ---------------- */
 
 /**
@@ -138,6 +331,14 @@ void
 save_prebundle_to_file (ViewportList const& viewports,
     PairwiseMatching const& matching, std::string const& filename);
 
+/**
+ * Saves the pre-bundle data to file with the pairs from the matching log.
+ * Only the matches of a single pair are kept in memory at any time.
+ */
+void
+save_prebundle_from_matching_log (ViewportList const& viewports,
+    std::string const& matching_log, std::string const& filename);
+
 /**
  * Loads the pre-bundle data from file, initializing viewports and matching.
  */
@@ -145,7 +346,7 @@ void
 load_prebundle_from_file (std::string const& filename,
     ViewportList* viewports, PairwiseMatching* matching);
 
-/* ------------- (De-)Serialization of SIFT and SURF -------------- */
+/* ---------- (De-)Serialization of SIFT, SURF and ORB ----------- */
 
 /*
  * The feature embedding has the following binary format:
@@ -157,7 +358,8 @@ load_prebundle_from_file (std::string const& filename,
  *
  * The first line is the file signature, the second line is the header.
  * The <data> field corresponds to the whole descriptor with either
- * 128 unsigned (SIFT) or 64 signed (SURF) floating point values.
+ * 128 unsigned (SIFT) or 64 signed (SURF) floating point values, or
+ * 4 64-bit words with the descriptor bits (ORB).
  */
 
 /** Conversion from SIFT descriptors to binary format. */
@@ -180,6 +382,16 @@ void
 embedding_to_descriptors (mve::ByteImage::ConstPtr data,
     Surf::Descriptors* descriptors, int* width, int* height);
 
+/** Conversion from ORB descriptors to binary format. */
+mve::ByteImage::Ptr
+descriptors_to_embedding (Orb::Descriptors const& descriptors,
+    int width, int height);
+
+/** Conversion from binary format to ORB descriptors. */
+void
+embedding_to_descriptors (mve::ByteImage::ConstPtr data,
+    Orb::Descriptors* descriptors, int* width, int* height);
+
 /* ------------------------ Implementation ------------------------ */
 
 inline bool
@@ -190,6 +402,22 @@ TwoViewMatching::operator< (TwoViewMatching const& rhs) const
         : this->view_1_id < rhs.view_1_id;
 }
 
+inline bool
+MatchingLogView::operator== (MatchingLogView const& rhs) const
+{
+    return this->width == rhs.width && this->height == rhs.height
+        && this->num_features == rhs.num_features
+        && this->feature_hash == rhs.feature_hash;
+}
+
+inline bool
+MatchingLogEntry::operator< (MatchingLogEntry const& rhs) const
+{
+    return this->view_1_id == rhs.view_1_id
+        ? this->view_2_id < rhs.view_2_id
+        : this->view_1_id < rhs.view_1_id;
+}
+
 inline
 Viewport::Viewport (void)
     : width(0)
@@ -199,8 +427,177 @@ Viewport::Viewport (void)
 {
 }
 
+inline FeatureReference const*
+FeatureReferenceRange::begin (void) const
+{
+    return this->first;
+}
+
+inline FeatureReference const*
+FeatureReferenceRange::end (void) const
+{
+    return this->last;
+}
+
+inline std::size_t
+FeatureReferenceRange::size (void) const
+{
+    return this->last - this->first;
+}
+
+inline bool
+FeatureReferenceRange::empty (void) const
+{
+    return this->first == this->last;
+}
+
+inline FeatureReference const&
+FeatureReferenceRange::operator[] (std::size_t index) const
+{
+    return this->first[index];
+}
+
+inline
+TrackList::TrackList (void)
+{
+    this->offsets.push_back(0);
+}
+
+inline std::size_t
+TrackList::size (void) const
+{
+    return this->sizes.size();
+}
+
+inline bool
+TrackList::empty (void) const
+{
+    return this->sizes.empty();
+}
+
+inline FeatureReference const*
+TrackList::begin (std::size_t track_id) const
+{
+    return this->references.empty() ? NULL
+        : &this->references[0] + this->offsets[track_id];
+}
+
+inline FeatureReference const*
+TrackList::end (std::size_t track_id) const
+{
+    return this->begin(track_id) + this->sizes[track_id];
+}
+
+inline std::size_t
+TrackList::num_features (std::size_t track_id) const
+{
+    return this->sizes[track_id];
+}
+
+inline FeatureReferenceRange
+TrackList::features (std::size_t track_id) const
+{
+    FeatureReferenceRange range;
+    range.first = this->begin(track_id);
+    range.last = this->end(track_id);
+    return range;
+}
+
+inline math::Vec3f&
+TrackList::position (std::size_t track_id)
+{
+    return this->positions[track_id];
+}
+
+inline math::Vec3f const&
+TrackList::position (std::size_t track_id) const
+{
+    return this->positions[track_id];
+}
+
+inline math::Vec3uc&
+TrackList::color (std::size_t track_id)
+{
+    return this->colors[track_id];
+}
+
+inline math::Vec3uc const&
+TrackList::color (std::size_t track_id) const
+{
+    return this->colors[track_id];
+}
+
+inline bool
+TrackList::is_valid (std::size_t track_id) const
+{
+    return !std::isnan(this->positions[track_id][0]);
+}
+
+inline void
+TrackList::invalidate (std::size_t track_id)
+{
+    this->positions[track_id].fill(std::numeric_limits<float>::quiet_NaN());
+}
+
+inline Track
+TrackList::operator[] (std::size_t track_id)
+{
+    return Track(this, track_id);
+}
+
+inline ConstTrack
+TrackList::operator[] (std::size_t track_id) const
+{
+    return ConstTrack(this, track_id);
+}
+
+inline
+Track::Track (TrackList* tracks, std::size_t track_id)
+    : pos(tracks->position(track_id))
+    , color(tracks->color(track_id))
+    , features(tracks->features(track_id))
+    , tracks(tracks)
+    , track_id(track_id)
+{
+}
+
 inline bool
 Track::is_valid (void) const
+{
+    return this->tracks->is_valid(this->track_id);
+}
+
+inline void
+Track::invalidate (void)
+{
+    this->tracks->invalidate(this->track_id);
+}
+
+inline void
+Track::remove_view (int view_id)
+{
+    this->tracks->remove_view(this->track_id, view_id);
+    this->features = this->tracks->features(this->track_id);
+}
+
+inline
+ConstTrack::ConstTrack (TrackList const* tracks, std::size_t track_id)
+    : pos(tracks->position(track_id))
+    , color(tracks->color(track_id))
+    , features(tracks->features(track_id))
+{
+}
+
+inline
+ConstTrack::ConstTrack (Track const& track)
+    : pos(track.pos)
+    , color(track.color)
+    , features(track.features)
+{
+}
+
+inline bool
+ConstTrack::is_valid (void) const
 {
     return !std::isnan(this->pos[0]);
 }
@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "util/timer.h"
 #include "mve/image_exif.h"
 #include "mve/image_tools.h"
@@ -8,6 +10,32 @@
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Increase if the cached data changes, invalidates all caches. */
+    int const FEATURE_CACHE_VERSION = 4;
+
+    /* Updates the 64 bit FNV-1a hash with the given bytes. */
+    void
+    hash_bytes (void const* data, std::size_t size, uint64_t* hash)
+    {
+        uint64_t const prime = (static_cast<uint64_t>(0x100) << 32) | 0x1b3;
+        unsigned char const* bytes = static_cast<unsigned char const*>(data);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            *hash ^= bytes[i];
+            *hash *= prime;
+        }
+    }
+
+    template <typename T>
+    void
+    hash_value (T const& value, uint64_t* hash)
+    {
+        hash_bytes(&value, sizeof(T), hash);
+    }
+}  /* namespace */
+
 void
 Features::compute (mve::Scene::Ptr scene, ViewportList* viewports)
 {
@@ -29,6 +57,7 @@ Features::compute (mve::Scene::Ptr scene, ViewportList* viewports)
     std::size_t num_views = viewports->size();
     std::size_t num_done = 0;
     std::size_t total_features = 0;
+    std::size_t num_cached = 0;
 
     /* Iterate the scene and compute features. */
 #pragma omp parallel for schedule(dynamic,1)
@@ -51,17 +80,34 @@ Features::compute (mve::Scene::Ptr scene, ViewportList* viewports)
         if (image == NULL)
             continue;
 
+        /* The cache key is computed on the original image. */
+        util::WallTimer timer;
+        bool const use_cache = !this->opts.feature_cache_embedding.empty();
+        uint64_t const cache_key = use_cache
+            ? this->feature_cache_key(image) : 0;
 
         /* Rescale image until maximum image size is met. */
-        util::WallTimer timer;
         while (this->opts.max_image_size > 0
             && image->width() * image->height() > this->opts.max_image_size)
             image = mve::image::rescale_half_size<uint8_t>(image);
 
-        /* Compute features for view. */
+        /* Load cached features or compute features for view. */
         Viewport* viewport = &viewports->at(i);
         viewport->features.set_options(this->opts.feature_options);
-        viewport->features.compute_features(image);
+        bool const cached = use_cache
+            && this->load_feature_cache(view, cache_key, image, viewport);
+        if (!cached && use_cache)
+        {
+            Sift::Descriptors sift_descr;
+            Surf::Descriptors surf_descr;
+            Orb::Descriptors orb_descr;
+            viewport->features.compute_features(image,
+                &sift_descr, &surf_descr, &orb_descr);
+            this->save_feature_cache(view, cache_key, image,
+                sift_descr, surf_descr, orb_descr);
+        }
+        else if (!cached)
+            viewport->features.compute_features(image);
         viewport->width = image->width();
         viewport->height = image->height();
         std::size_t num_feats = viewport->features.positions.size();
@@ -80,14 +126,176 @@ Features::compute (mve::Scene::Ptr scene, ViewportList* viewports)
                 << viewport->width << "x" << viewport->height << "), "
                 << util::string::get_filled(num_feats, 5, ' ') << " features, "
                 << "flen: " << viewport->focal_length << ", took "
-                << timer.get_elapsed() << " ms." << std::endl;
+                << timer.get_elapsed() << " ms"
+                << (cached ? " (cached)." : ".") << std::endl;
             total_features += viewport->features.positions.size();
+            num_cached += cached ? 1 : 0;
         }
     }
 
     std::cout << "\rComputed " << total_features << " features "
         << "for " << num_views << " views (average "
-        << (total_features / num_views) << ")." << std::endl;
+        << (total_features / num_views) << ")";
+    if (!this->opts.feature_cache_embedding.empty())
+        std::cout << ", " << num_cached << " views from cache";
+    std::cout << "." << std::endl;
+}
+
+uint64_t
+Features::feature_cache_key (mve::ByteImage::ConstPtr image) const
+{
+    uint64_t hash = (static_cast<uint64_t>(0xcbf29ce4) << 32) | 0x84222325;
+    hash_value(FEATURE_CACHE_VERSION, &hash);
+
+    /* Image dimensions and content. */
+    hash_value(image->width(), &hash);
+    hash_value(image->height(), &hash);
+    hash_value(image->channels(), &hash);
+    hash_bytes(image->get_data_pointer(), image->get_byte_size(), &hash);
+
+    /*
+     * Options that affect the features. The option structs are not hashed
+     * as a whole because of padding bytes and verbosity flags.
+     */
+    FeatureSet::Options const& fopts = this->opts.feature_options;
+    hash_value(this->opts.max_image_size, &hash);
+    hash_value(static_cast<int>(fopts.feature_types), &hash);
+    if (fopts.feature_types & FeatureSet::FEATURE_SIFT)
+    {
+        Sift::Options const& sopts = fopts.sift_opts;
+        hash_value(sopts.num_samples_per_octave, &hash);
+        hash_value(sopts.min_octave, &hash);
+        hash_value(sopts.max_octave, &hash);
+        hash_value(sopts.contrast_threshold, &hash);
+        hash_value(sopts.edge_ratio_threshold, &hash);
+        hash_value(sopts.base_blur_sigma, &hash);
+        hash_value(sopts.inherent_blur_sigma, &hash);
+    }
+    if (fopts.feature_types & FeatureSet::FEATURE_SURF)
+    {
+        Surf::Options const& sopts = fopts.surf_opts;
+        hash_value(sopts.contrast_threshold, &hash);
+        hash_value(sopts.use_upright_descriptor, &hash);
+    }
+    if (fopts.feature_types & FeatureSet::FEATURE_ORB)
+    {
+        Orb::Options const& oopts = fopts.orb_opts;
+        hash_value(oopts.max_features, &hash);
+        hash_value(oopts.num_levels, &hash);
+        hash_value(oopts.scale_factor, &hash);
+        hash_value(oopts.fast_threshold, &hash);
+    }
+
+    return hash;
+}
+
+bool
+Features::load_feature_cache (mve::View::Ptr view, uint64_t cache_key,
+    mve::ByteImage::ConstPtr image, Viewport* viewport) const
+{
+    std::string const& name = this->opts.feature_cache_embedding;
+    mve::ByteImage::Ptr key_data = view->get_data(name + "-key");
+    if (key_data == NULL
+        || key_data->get_byte_size() != sizeof(uint64_t)
+        || std::memcmp(key_data->get_data_pointer(), &cache_key,
+        sizeof(uint64_t)) != 0)
+        return false;
+
+    FeatureSet::FeatureTypes const types
+        = this->opts.feature_options.feature_types;
+    Sift::Descriptors sift_descr;
+    Surf::Descriptors surf_descr;
+    Orb::Descriptors orb_descr;
+    try
+    {
+        int width, height;
+        if (types & FeatureSet::FEATURE_SIFT)
+        {
+            mve::ByteImage::Ptr data = view->get_data(name + "-sift");
+            if (data == NULL)
+                return false;
+            embedding_to_descriptors(data, &sift_descr, &width, &height);
+            if (width != image->width() || height != image->height())
+                return false;
+        }
+        if (types & FeatureSet::FEATURE_SURF)
+        {
+            mve::ByteImage::Ptr data = view->get_data(name + "-surf");
+            if (data == NULL)
+                return false;
+            embedding_to_descriptors(data, &surf_descr, &width, &height);
+            if (width != image->width() || height != image->height())
+                return false;
+        }
+        if (types & FeatureSet::FEATURE_ORB)
+        {
+            mve::ByteImage::Ptr data = view->get_data(name + "-orb");
+            if (data == NULL)
+                return false;
+            embedding_to_descriptors(data, &orb_descr, &width, &height);
+            if (width != image->width() || height != image->height())
+                return false;
+        }
+    }
+    catch (std::exception& e)
+    {
+#pragma omp critical
+        std::cout << "Warning: Ignoring invalid feature cache for view "
+            << view->get_id() << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    viewport->features.set_features(image, sift_descr, surf_descr,
+        orb_descr);
+    return true;
+}
+
+void
+Features::save_feature_cache (mve::View::Ptr view, uint64_t cache_key,
+    mve::ByteImage::ConstPtr image, Sift::Descriptors const& sift_descr,
+    Surf::Descriptors const& surf_descr,
+    Orb::Descriptors const& orb_descr) const
+{
+    std::string const& name = this->opts.feature_cache_embedding;
+    FeatureSet::FeatureTypes const types
+        = this->opts.feature_options.feature_types;
+    if (types & FeatureSet::FEATURE_SIFT)
+        view->set_data(name + "-sift", descriptors_to_embedding(sift_descr,
+            image->width(), image->height()));
+    else
+        view->remove_embedding(name + "-sift");
+    if (types & FeatureSet::FEATURE_SURF)
+        view->set_data(name + "-surf", descriptors_to_embedding(surf_descr,
+            image->width(), image->height()));
+    else
+        view->remove_embedding(name + "-surf");
+    if (types & FeatureSet::FEATURE_ORB)
+        view->set_data(name + "-orb", descriptors_to_embedding(orb_descr,
+            image->width(), image->height()));
+    else
+        view->remove_embedding(name + "-orb");
+
+    /* The key is written last, a view without key is never loaded. */
+    mve::ByteImage::Ptr key_data = mve::ByteImage::create(sizeof(uint64_t),
+        1, 1);
+    std::memcpy(key_data->get_data_pointer(), &cache_key, sizeof(uint64_t));
+    view->set_data(name + "-key", key_data);
+
+    /*
+     * Saving rewrites the whole view file. Views are saved one at a time
+     * to avoid concurrent bulk writes from all feature threads.
+     */
+#pragma omp critical(feature_cache_save)
+    try
+    {
+        view->save_mve_file();
+    }
+    catch (std::exception& e)
+    {
+#pragma omp critical
+        std::cout << "Warning: Cannot save feature cache for view "
+            << view->get_id() << ": " << e.what() << std::endl;
+    }
 }
 
 void
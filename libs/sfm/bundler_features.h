@@ -24,6 +24,12 @@ SFM_BUNDLER_NAMESPACE_BEGIN
  * The component computes features for every view in the scene and stores
  * the features in the viewports. It also estimates the focal length from
  * the EXIF data stored in the views.
+ *
+ * If a feature cache embedding is given, the descriptors of every view are
+ * stored in the view and reused in later runs. The cache is keyed by a hash
+ * of the image and the feature options, and features are only recomputed
+ * for views with missing or outdated cache entries. Note that the cache
+ * adds several MB of descriptors to every view file.
  */
 class Features
 {
@@ -40,6 +46,12 @@ public:
         int max_image_size;
         /** Feature set options. */
         FeatureSet::Options feature_options;
+        /**
+         * The embedding name prefix for cached features. The descriptors
+         * are stored in "<name>-sift", "<name>-surf" and "<name>-orb", the
+         * cache key in "<name>-key". Caching is disabled if empty (default).
+         */
+        std::string feature_cache_embedding;
     };
 
 public:
@@ -53,6 +65,13 @@ public:
     void compute (mve::Scene::Ptr scene, ViewportList* viewports);
 
 private:
+    bool load_feature_cache (mve::View::Ptr view, uint64_t cache_key,
+        mve::ByteImage::ConstPtr image, Viewport* viewport) const;
+    void save_feature_cache (mve::View::Ptr view, uint64_t cache_key,
+        mve::ByteImage::ConstPtr image, Sift::Descriptors const& sift_descr,
+        Surf::Descriptors const& surf_descr,
+        Orb::Descriptors const& orb_descr) const;
+    uint64_t feature_cache_key (mve::ByteImage::ConstPtr image) const;
     void estimate_focal_length (mve::View::Ptr view, Viewport* viewport) const;
     void fallback_focal_length (mve::View::Ptr view, Viewport* viewport) const;
 
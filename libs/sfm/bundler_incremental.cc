@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <functional>
 #include <limits>
 #include <iostream>
 
@@ -9,6 +11,19 @@
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Outcome of the triangulation of a single track. */
+    enum TriangulationResult
+    {
+        TRIANGULATION_SKIPPED,
+        TRIANGULATION_NEW_TRACK,
+        TRIANGULATION_LARGE_ERROR,
+        TRIANGULATION_BEHIND_CAMERA,
+        TRIANGULATION_SMALL_ANGLE
+    };
+}
+
 void
 Incremental::initialize (ViewportList* viewports, TrackList* tracks)
 {
@@ -17,13 +32,19 @@ Incremental::initialize (ViewportList* viewports, TrackList* tracks)
 
     this->cameras.clear();
     this->cameras.resize(viewports->size());
+    this->visible_tracks.clear();
+    this->visible_tracks.resize(viewports->size(), 0);
+    this->ba_session.clear();
+    this->num_camera_updates = 0;
+    this->camera_stamps.clear();
+    this->camera_stamps.resize(viewports->size(), 0);
+    this->rejected_stamps.clear();
+    this->rejected_stamps.resize(tracks->size(), -1);
+    this->rejected_tracks.clear();
 
     /* Set track positions to invalid state. */
     for (std::size_t i = 0; i < tracks->size(); ++i)
-    {
-        Track& track = tracks->at(i);
-        track.invalidate();
-    }
+        tracks->invalidate(i);
 }
 
 bool
@@ -54,13 +75,13 @@ Incremental::reconstruct_initial_pair (int view_1_id, int view_2_id)
         {
             int view_1_feature_id = -1;
             int view_2_feature_id = -1;
-            Track const& track = this->tracks->at(i);
-            for (std::size_t j = 0; j < track.features.size(); ++j)
+            for (FeatureReference const* ref = this->tracks->begin(i);
+                ref != this->tracks->end(i); ++ref)
             {
-                if (track.features[j].view_id == view_1_id)
-                    view_1_feature_id = track.features[j].feature_id;
-                if (track.features[j].view_id == view_2_id)
-                    view_2_feature_id = track.features[j].feature_id;
+                if (ref->view_id == view_1_id)
+                    view_1_feature_id = ref->feature_id;
+                if (ref->view_id == view_2_id)
+                    view_2_feature_id = ref->feature_id;
             }
 
             if (view_1_feature_id != -1 && view_2_feature_id != -1)
@@ -164,6 +185,8 @@ Incremental::reconstruct_initial_pair (int view_1_id, int view_2_id)
     /* Store recovered pose in viewport. */
     this->cameras[view_1_id] = pose1;
     this->cameras[view_2_id] = pose2;
+    this->ba_session.add_camera(view_1_id);
+    this->ba_session.add_camera(view_2_id);
 }
 
 /* ---------------------------------------------------------------- */
@@ -175,100 +198,208 @@ Incremental::find_next_view (void) const
      * The next view is selected by finding the unreconstructed view with
      * most reconstructed tracks.
      */
-    std::vector<int> valid_tracks_counter(this->cameras.size(), 0);
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    int next_view = -1;
+    int max_visible_tracks = 6;
+    std::size_t const num_views = std::min(this->cameras.size(),
+        this->visible_tracks.size());
+    for (std::size_t i = 0; i < num_views; ++i)
     {
-        Track const& track = this->tracks->at(i);
-        if (!track.is_valid())
+        if (this->cameras[i].is_valid())
             continue;
-
-        for (std::size_t j = 0; j < track.features.size(); ++j)
+        if (this->visible_tracks[i] > max_visible_tracks)
         {
-            int const view_id = track.features[j].view_id;
-            if (this->cameras[view_id].is_valid())
-                continue;
-            valid_tracks_counter[view_id] += 1;
+            next_view = static_cast<int>(i);
+            max_visible_tracks = this->visible_tracks[i];
         }
     }
 
-    std::size_t next_view = math::algo::max_element_id
-        (valid_tracks_counter.begin(), valid_tracks_counter.end());
-
-    return valid_tracks_counter[next_view] > 6 ? next_view : -1;
+    return next_view;
 }
 
 /* ---------------------------------------------------------------- */
 
 void
 Incremental::find_next_views (std::vector<int>* next_views)
+{
+    this->find_next_views(this->viewports->size(), next_views);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::find_next_views (std::size_t max_views,
+    std::vector<int>* next_views)
 {
     /* Update internal camera vector after viewports are externally updated. */
     if (this->viewports->size() != this->cameras.size())
         this->cameras.resize(this->viewports->size());
+    if (this->viewports->size() != this->visible_tracks.size())
+        this->visible_tracks.resize(this->viewports->size(), 0);
+    if (this->viewports->size() != this->camera_stamps.size())
+        this->camera_stamps.resize(this->viewports->size(), 0);
 
-    std::vector<std::pair<int, int> > valid_tracks(this->cameras.size());
-    for (std::size_t i = 0; i < valid_tracks.size(); ++i)
-        valid_tracks[i] = std::pair<int, int>(0, static_cast<int>(i));
+    std::vector<std::pair<int, int> > valid_tracks;
+    for (std::size_t i = 0; i < this->cameras.size(); ++i)
+    {
+        if (this->cameras[i].is_valid() || this->visible_tracks[i] <= 6)
+            continue;
+        valid_tracks.push_back(std::pair<int, int>
+            (this->visible_tracks[i], static_cast<int>(i)));
+    }
 
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    /* Only the top views are sorted. */
+    std::size_t const num_views = std::min(max_views, valid_tracks.size());
+    std::partial_sort(valid_tracks.rbegin(), valid_tracks.rbegin()
+        + num_views, valid_tracks.rend());
+
+    next_views->clear();
+    for (std::size_t i = 0; i < num_views; ++i)
+        next_views->push_back(valid_tracks.rbegin()[i].second);
+}
+
+/* ---------------------------------------------------------------- */
+
+int
+Incremental::num_visible_tracks (int view_id) const
+{
+    return this->visible_tracks[view_id];
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::update_visible_tracks (std::size_t track_id, int delta)
+{
+    for (FeatureReference const* ref = this->tracks->begin(track_id);
+        ref != this->tracks->end(track_id); ++ref)
+        this->visible_tracks[ref->view_id] += delta;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::invalidate_track (std::size_t track_id)
+{
+    if (!this->tracks->is_valid(track_id))
+        return;
+    this->update_visible_tracks(track_id, -1);
+    this->tracks->invalidate(track_id);
+    this->ba_session.remove_track(track_id);
+    this->reject_track(track_id);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::reject_track (std::size_t track_id)
+{
+    if (this->rejected_stamps[track_id] < 0)
+        this->rejected_tracks.push_back(static_cast<int>(track_id));
+    this->rejected_stamps[track_id] = this->num_camera_updates;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::update_camera (int view_id)
+{
+    this->camera_stamps[view_id] = this->num_camera_updates;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::get_retry_tracks (std::vector<int>* track_ids)
+{
+    /* Drop tracks which have been triangulated in the meantime. */
+    std::size_t num_rejected = 0;
+    for (std::size_t i = 0; i < this->rejected_tracks.size(); ++i)
     {
-        Track const& track = this->tracks->at(i);
-        if (!track.is_valid())
+        int const track_id = this->rejected_tracks[i];
+        if (this->rejected_stamps[track_id] < 0)
             continue;
+        this->rejected_tracks[num_rejected++] = track_id;
 
-        for (std::size_t j = 0; j < track.features.size(); ++j)
+        int const stamp = this->rejected_stamps[track_id];
+        for (FeatureReference const* ref = this->tracks->begin(track_id);
+            ref != this->tracks->end(track_id); ++ref)
         {
-            int const view_id = track.features[j].view_id;
-            if (this->cameras[view_id].is_valid())
-                continue;
-            valid_tracks[view_id].first += 1;
+            if (this->cameras[ref->view_id].is_valid()
+                && this->camera_stamps[ref->view_id] > stamp)
+            {
+                track_ids->push_back(track_id);
+                break;
+            }
         }
     }
+    this->rejected_tracks.resize(num_rejected);
+}
 
-    std::sort(valid_tracks.rbegin(), valid_tracks.rend());
+/* ---------------------------------------------------------------- */
 
-    next_views->clear();
-    for (std::size_t i = 0; i < valid_tracks.size(); ++i)
+bool
+Incremental::reconstruct_next_view (int view_id)
+{
+    ViewPose view_pose;
+    this->estimate_view_pose(view_id, &view_pose);
+    this->print_view_pose(view_pose);
+    if (!view_pose.accepted)
+        return false;
+
+    this->add_view_pose(view_pose);
+    return true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::reconstruct_next_views (std::vector<int> const& view_ids,
+    std::vector<int>* accepted_views)
+{
+    /* The poses are estimated in parallel with the same tracks. */
+    std::vector<ViewPose> view_poses(view_ids.size());
+    int const num_views = static_cast<int>(view_ids.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < num_views; ++i)
+        this->estimate_view_pose(view_ids[i], &view_poses[i]);
+
+    accepted_views->clear();
+    for (std::size_t i = 0; i < view_poses.size(); ++i)
     {
-        if (valid_tracks[i].first > 6)
-            next_views->push_back(valid_tracks[i].second);
+        this->print_view_pose(view_poses[i]);
+        if (!view_poses[i].accepted)
+            continue;
+        this->add_view_pose(view_poses[i]);
+        accepted_views->push_back(view_poses[i].view_id);
     }
 }
 
 /* ---------------------------------------------------------------- */
 
-bool
-Incremental::reconstruct_next_view (int view_id)
+void
+Incremental::estimate_view_pose (int view_id, ViewPose* result) const
 {
     Viewport const& viewport = this->viewports->at(view_id);
     FeatureSet const& features = viewport.features;
 
     /* Collect all 2D-3D correspondences. */
     Correspondences2D3D corr;
-    std::vector<int> track_ids;
     std::vector<int> feature_ids;
     for (std::size_t i = 0; i < viewport.track_ids.size(); ++i)
     {
         int const track_id = viewport.track_ids[i];
-        if (track_id < 0 || !this->tracks->at(track_id).is_valid())
+        if (track_id < 0 || !this->tracks->is_valid(track_id))
             continue;
         math::Vec2f const& pos2d = features.positions[i];
-        math::Vec3f const& pos3d = this->tracks->at(track_id).pos;
+        math::Vec3f const& pos3d = this->tracks->position(track_id);
 
         corr.push_back(Correspondence2D3D());
         Correspondence2D3D& c = corr.back();
         std::copy(pos3d.begin(), pos3d.end(), c.p3d);
         std::copy(pos2d.begin(), pos2d.end(), c.p2d);
-        track_ids.push_back(track_id);
         feature_ids.push_back(i);
     }
 
-    if (this->opts.verbose_output)
-    {
-        std::cout << "Collected " << corr.size()
-            << " 2D-3D correspondences." << std::endl;
-    }
-
     /* Initialize a temporary camera. */
     float const maxdim = static_cast<float>
         (std::max(viewport.width, viewport.height));
@@ -282,152 +413,262 @@ Incremental::reconstruct_next_view (int view_id)
     RansacPoseP3P::Result ransac_result;
     ransac.estimate(corr, temp_camera.K, &ransac_result);
 
-    if (this->opts.verbose_output)
-    {
-        std::cout << "Selected " << ransac_result.inliers.size()
-            << " 2D-3D correspondences inliers." << std::endl;
-    }
-
     /* Cancel if inliers are below a threshold. */
-    if (3 * ransac_result.inliers.size() < corr.size())
-        return false;
+    result->view_id = view_id;
+    result->num_correspondences = corr.size();
+    result->num_inliers = ransac_result.inliers.size();
+    result->accepted = 3 * ransac_result.inliers.size() >= corr.size();
+    result->outlier_features.clear();
+    if (!result->accepted)
+        return;
 
-    /* Remove outliers from tracks and tracks from viewport. */
-    int removed_outliers = 0;
+    /* Collect the outlier features. */
     for (std::size_t i = 0; i < ransac_result.inliers.size(); ++i)
-        track_ids[ransac_result.inliers[i]] = -1;
-    for (std::size_t i = 0; i < track_ids.size(); ++i)
+        feature_ids[ransac_result.inliers[i]] = -1;
+    for (std::size_t i = 0; i < feature_ids.size(); ++i)
+        if (feature_ids[i] >= 0)
+            result->outlier_features.push_back(feature_ids[i]);
+
+    /* In the P3P case, just use the known K and computed R and t. */
+    result->pose = temp_camera;
+    result->pose.R = ransac_result.pose.delete_col(3);
+    result->pose.t = ransac_result.pose.col(3);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::add_view_pose (ViewPose const& view_pose)
+{
+    /* Remove outliers from tracks and tracks from viewport. */
+    int const view_id = view_pose.view_id;
+    std::vector<int>& track_ids = this->viewports->at(view_id).track_ids;
+    for (std::size_t i = 0; i < view_pose.outlier_features.size(); ++i)
     {
-        if (track_ids[i] < 0)
+        int const feature_id = view_pose.outlier_features[i];
+        int const track_id = track_ids[feature_id];
+        if (track_id < 0)
             continue;
-        this->tracks->at(track_ids[i]).remove_view(view_id);
-        this->viewports->at(view_id).track_ids[feature_ids[i]] = -1;
-        removed_outliers += 1;
+        this->tracks->remove_view(track_id, view_id);
+        if (this->tracks->is_valid(track_id))
+            this->visible_tracks[view_id] -= 1;
+        track_ids[feature_id] = -1;
     }
-    track_ids.clear();
-    feature_ids.clear();
 
-    /* In the P3P case, just use the known K and computed R and t. */
-    this->cameras[view_id] = temp_camera;
-    this->cameras[view_id].R = ransac_result.pose.delete_col(3);
-    this->cameras[view_id].t = ransac_result.pose.col(3);
+    this->cameras[view_id] = view_pose.pose;
+    this->num_camera_updates += 1;
+    this->update_camera(view_id);
+
+    /* Add the camera and its observations of reconstructed tracks. */
+    this->ba_session.add_camera(view_id);
+    for (std::size_t i = 0; i < track_ids.size(); ++i)
+        if (track_ids[i] >= 0 && this->tracks->is_valid(track_ids[i]))
+            this->ba_session.add_observation(track_ids[i], view_id,
+                this->get_pba_observation(view_id, i));
 
     if (this->opts.verbose_output)
     {
         std::cout << "Reconstructed new camera with focal length: "
             << this->cameras[view_id].get_focal_length() << std::endl;
     }
+}
 
-    return true;
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::print_view_pose (ViewPose const& view_pose) const
+{
+    if (!this->opts.verbose_output)
+        return;
+
+    std::cout << "View " << view_pose.view_id << ": Collected "
+        << view_pose.num_correspondences << " 2D-3D correspondences, "
+        << "selected " << view_pose.num_inliers << " inliers." << std::endl;
 }
 
 /* ---------------------------------------------------------------- */
 
 void
 Incremental::triangulate_new_tracks (void)
+{
+    std::vector<int> track_ids;
+    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+        if (!this->tracks->is_valid(i))
+            track_ids.push_back(i);
+    this->triangulate_tracks(track_ids);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::triangulate_new_tracks (std::vector<int> const& view_ids)
+{
+    /* Only tracks with a feature in one of the views can change. */
+    std::vector<int> track_ids;
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+    {
+        std::vector<int> const& view_tracks
+            = this->viewports->at(view_ids[i]).track_ids;
+        for (std::size_t j = 0; j < view_tracks.size(); ++j)
+            if (view_tracks[j] >= 0 && !this->tracks->is_valid(view_tracks[j]))
+                track_ids.push_back(view_tracks[j]);
+    }
+
+    /* Rejected tracks are retried if their cameras changed. */
+    this->get_retry_tracks(&track_ids);
+    std::sort(track_ids.begin(), track_ids.end());
+    track_ids.erase(std::unique(track_ids.begin(), track_ids.end()),
+        track_ids.end());
+    this->triangulate_tracks(track_ids);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::triangulate_tracks (std::vector<int> const& track_ids)
 {
     /* Thresholds. */
     double const square_thres = MATH_POW2(this->opts.new_track_error_threshold);
     double const cos_angle_thres = std::cos(this->opts.min_triangulation_angle);
 
-    /* Statistics. */
-    int num_new_tracks = 0;
-    int num_large_error_tracks = 0;
-    int num_behind_camera_tracks = 0;
-    int num_too_small_angle = 0;
+    /* Camera centers are computed once instead of once per track. */
+    std::vector<math::Vec3d> camera_centers(this->cameras.size());
+    for (std::size_t i = 0; i < this->cameras.size(); ++i)
+        if (this->cameras[i].is_valid())
+            this->cameras[i].fill_camera_pos(&camera_centers[i]);
 
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    /*
+     * Tracks are triangulated in parallel with per-thread buffers, which
+     * only allocate while growing. The results are applied afterwards in
+     * track order, which gives the same result as a serial run.
+     */
+    int const num_tracks = static_cast<int>(track_ids.size());
+    std::vector<char> results(num_tracks, TRIANGULATION_SKIPPED);
+    std::vector<math::Vec3d> positions(num_tracks);
+#pragma omp parallel
     {
-        /* Skip tracks that have already been reconstructed. */
-        Track& track = this->tracks->at(i);
-        if (track.is_valid())
-            continue;
-
-        /*
-         * Triangulate a new track using all cameras.
-         * There can be more than two cameras if the track has been rejected
-         * in previous attempts to triangulate the track.
-         */
         std::vector<math::Vec2f> pos;
         std::vector<CameraPose const*> poses;
-        for (std::size_t j = 0; j < track.features.size(); ++j)
-        {
-            int const view_id = track.features[j].view_id;
-            if (!this->cameras[view_id].is_valid())
-                continue;
-            int const feature_id = track.features[j].feature_id;
-            pos.push_back(this->viewports->at(view_id)
-                .features.positions[feature_id]);
-            poses.push_back(&this->cameras[view_id]);
-        }
-
-        /* Skip tracks with too few valid cameras. */
-        if (poses.size() < 2)
-            continue;
+        std::vector<math::Vec3d> rays;
 
-        /* Triangulate track. */
-        math::Vec3d track_pos = triangulate_track(pos, poses);
-
-        /* Skip tracks with too small triangulation angle. */
-        double smallest_cos_angle = 1.0;
-        if (this->opts.min_triangulation_angle > 0.0)
+#pragma omp for schedule(dynamic, 64)
+        for (int i = 0; i < num_tracks; ++i)
         {
-            std::vector<math::Vec3d> rays(poses.size());
-            for (std::size_t j = 0; j < poses.size(); ++j)
+            /*
+             * Triangulate a new track using all cameras.
+             * There can be more than two cameras if the track has been
+             * rejected in previous attempts to triangulate the track.
+             */
+            int const track_id = track_ids[i];
+            pos.clear();
+            poses.clear();
+            rays.clear();
+            for (FeatureReference const* ref = this->tracks->begin(track_id);
+                ref != this->tracks->end(track_id); ++ref)
             {
-                math::Vec3d camera_pos;
-                poses[j]->fill_camera_pos(&camera_pos);
-                rays[j] = (track_pos - camera_pos).normalized();
+                if (!this->cameras[ref->view_id].is_valid())
+                    continue;
+                pos.push_back(this->viewports->at(ref->view_id)
+                    .features.positions[ref->feature_id]);
+                poses.push_back(&this->cameras[ref->view_id]);
+                rays.push_back(camera_centers[ref->view_id]);
             }
 
-            for (std::size_t j = 0; j < rays.size(); ++j)
-                for (std::size_t k = 0; k < j; ++k)
+            /* Skip tracks with too few valid cameras. */
+            if (poses.size() < 2)
+                continue;
+
+            /* Triangulate track. */
+            math::Vec3d const track_pos = triangulate_track(pos, poses);
+            positions[i] = track_pos;
+
+            /* Skip tracks with too small triangulation angle. */
+            if (this->opts.min_triangulation_angle > 0.0)
+            {
+                for (std::size_t j = 0; j < rays.size(); ++j)
+                    rays[j] = (track_pos - rays[j]).normalized();
+
+                /* Stop as soon as a large enough angle is found. */
+                bool large_angle = false;
+                for (std::size_t j = 1; !large_angle && j < rays.size(); ++j)
+                    for (std::size_t k = 0; k < j; ++k)
+                        large_angle |= rays[j].dot(rays[k]) <= cos_angle_thres;
+                if (!large_angle)
                 {
-                    double const cos_a = rays[j].dot(rays[k]);
-                    smallest_cos_angle = std::min(smallest_cos_angle, cos_a);
+                    results[i] = TRIANGULATION_SMALL_ANGLE;
+                    continue;
                 }
-            if (smallest_cos_angle > cos_angle_thres)
+            }
+
+            /* Compute reprojection error of the track. */
+            double square_error = 0.0;
+            bool track_behind_camera = false;
+            for (std::size_t j = 0; j < poses.size(); ++j)
             {
-                num_too_small_angle += 1;
-                continue;
+                math::Vec3d x = poses[j]->R * track_pos + poses[j]->t;
+                track_behind_camera |= x[2] < 0.0;
+                x = poses[j]->K * x;
+                math::Vec2d x2d(x[0] / x[2], x[1] / x[2]);
+                square_error += (pos[j] - x2d).square_norm();
             }
+            square_error /= static_cast<double>(poses.size());
+
+            /* Reject track if it appears behind the camera. */
+            if (track_behind_camera)
+                results[i] = TRIANGULATION_BEHIND_CAMERA;
+            /* Reject track if the reprojection error is too large. */
+            else if (square_error > square_thres)
+                results[i] = TRIANGULATION_LARGE_ERROR;
+            else
+                results[i] = TRIANGULATION_NEW_TRACK;
         }
+    }
+
+    /* Statistics. */
+    int num_new_tracks = 0;
+    int num_large_error_tracks = 0;
+    int num_behind_camera_tracks = 0;
+    int num_too_small_angle = 0;
 
-        /* Compute reprojection error of the track. */
-        double square_error = 0.0;
-        bool track_behind_camera = false;
-        for (std::size_t j = 0; j < poses.size(); ++j)
+    for (int i = 0; i < num_tracks; ++i)
+    {
+        int const track_id = track_ids[i];
+        switch (results[i])
         {
-            math::Vec3d x = poses[j]->R * track_pos + poses[j]->t;
-            if (x[2] < 0.0)
-            {
-                track_behind_camera = true;
+            case TRIANGULATION_SMALL_ANGLE:
+                num_too_small_angle += 1;
+                this->reject_track(track_id);
                 break;
-            }
 
-            x = poses[j]->K * x;
-            math::Vec2d x2d(x[0] / x[2], x[1] / x[2]);
-            square_error += (pos[j] - x2d).square_norm();
-        }
-        square_error /= static_cast<double>(poses.size());
+            case TRIANGULATION_BEHIND_CAMERA:
+                num_behind_camera_tracks += 1;
+                this->invalidate_track(track_id);
+                this->reject_track(track_id);
+                break;
 
-        /* Reject track if it appears behind the camera. */
-        if (track_behind_camera)
-        {
-            num_behind_camera_tracks += 1;
-            this->tracks->at(i).invalidate();
-            continue;
-        }
+            case TRIANGULATION_LARGE_ERROR:
+                num_large_error_tracks += 1;
+                this->reject_track(track_id);
+                break;
 
-        /* Reject track if the reprojection error is too large. */
-        if (square_error > square_thres)
-        {
-            num_large_error_tracks += 1;
-            continue;
-        }
+            case TRIANGULATION_NEW_TRACK:
+                this->tracks->position(track_id) = positions[i];
+                this->rejected_stamps[track_id] = -1;
+                this->update_visible_tracks(track_id, 1);
+                num_new_tracks += 1;
+
+                this->ba_session.add_track(track_id);
+                for (FeatureReference const* ref = this->tracks->begin
+                    (track_id); ref != this->tracks->end(track_id); ++ref)
+                    if (this->cameras[ref->view_id].is_valid())
+                        this->ba_session.add_observation(track_id,
+                            ref->view_id, this->get_pba_observation
+                            (ref->view_id, ref->feature_id));
+                break;
 
-        track.pos = track_pos;
-        num_new_tracks += 1;
+            default:
+                break;
+        }
     }
 
     if (this->opts.verbose_output)
@@ -454,7 +695,57 @@ Incremental::triangulate_new_tracks (void)
 void
 Incremental::bundle_adjustment_full (void)
 {
-    this->bundle_adjustment_intern(-1);
+    /*
+     * Full bundle adjustment uses the persistent problem of all cameras and
+     * reconstructed tracks, only the parameters are updated before the run.
+     */
+    this->update_ba_session();
+    this->configure_pba(&this->ba_session.get_solver(), false);
+    this->ba_session.run();
+
+    /* Transfer camera info and track positions back. */
+    this->num_camera_updates += 1;
+    for (std::size_t i = 0; i < this->ba_session.num_cameras(); ++i)
+        this->get_pba_camera(this->ba_session.get_view_id(i),
+            this->ba_session.camera(i), this->opts.verbose_output);
+    for (std::size_t i = 0; i < this->ba_session.num_points(); ++i)
+    {
+        int const track_id = this->ba_session.get_track_id(i);
+        pba::Point3D const& point = this->ba_session.point(i);
+        std::copy(point.xyz, point.xyz + 3,
+            this->tracks->position(track_id).begin());
+        if (this->tracks->is_valid(track_id))
+            continue;
+        this->update_visible_tracks(track_id, -1);
+        this->ba_session.remove_track(track_id);
+        this->reject_track(track_id);
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::update_ba_session (void)
+{
+    this->ba_session.apply_changes();
+    for (std::size_t i = 0; i < this->ba_session.num_cameras(); ++i)
+        this->set_pba_camera(this->ba_session.get_view_id(i),
+            &this->ba_session.camera(i));
+    for (std::size_t i = 0; i < this->ba_session.num_points(); ++i)
+    {
+        math::Vec3f const& pos
+            = this->tracks->position(this->ba_session.get_track_id(i));
+        std::copy(pos.begin(), pos.end(), this->ba_session.point(i).xyz);
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::save_bundle_adjustment_problem (std::string const& filename)
+{
+    this->update_ba_session();
+    this->ba_session.save_problem(filename);
 }
 
 /* ---------------------------------------------------------------- */
@@ -462,7 +753,69 @@ Incremental::bundle_adjustment_full (void)
 void
 Incremental::bundle_adjustment_single_cam (int view_id)
 {
-    this->bundle_adjustment_intern(view_id);
+    this->bundle_adjustment_intern(std::vector<int>(1, view_id), true);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::bundle_adjustment_cams (std::vector<int> const& view_ids)
+{
+    if (!view_ids.empty())
+        this->bundle_adjustment_intern(view_ids, true);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::bundle_adjustment_local (std::vector<int> const& view_ids)
+{
+    if (view_ids.empty())
+        return;
+
+    /* Count the reconstructed tracks shared with the given cameras. */
+    std::vector<int> covisible(this->cameras.size(), 0);
+    std::vector<bool> in_window(this->cameras.size(), false);
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+        in_window[view_ids[i]] = true;
+    for (std::size_t i = 0; i < view_ids.size(); ++i)
+    {
+        std::vector<int> const& track_ids
+            = this->viewports->at(view_ids[i]).track_ids;
+        for (std::size_t j = 0; j < track_ids.size(); ++j)
+        {
+            if (track_ids[j] < 0 || !this->tracks->is_valid(track_ids[j]))
+                continue;
+            for (FeatureReference const* ref = this->tracks->begin
+                (track_ids[j]); ref != this->tracks->end(track_ids[j]); ++ref)
+                if (!in_window[ref->view_id]
+                    && this->cameras[ref->view_id].is_valid())
+                    covisible[ref->view_id] += 1;
+        }
+    }
+
+    /* Add the most covisible cameras to the window. */
+    std::vector<std::pair<int, int> > neighbors;
+    for (std::size_t i = 0; i < covisible.size(); ++i)
+        if (covisible[i] > 0)
+            neighbors.push_back(std::make_pair(covisible[i],
+                static_cast<int>(i)));
+    std::size_t const num_neighbors = std::min(neighbors.size(),
+        static_cast<std::size_t>(this->opts.local_ba_num_neighbors));
+    std::partial_sort(neighbors.begin(), neighbors.begin() + num_neighbors,
+        neighbors.end(), std::greater<std::pair<int, int> >());
+
+    std::vector<int> window(view_ids);
+    for (std::size_t i = 0; i < num_neighbors; ++i)
+        window.push_back(neighbors[i].second);
+
+    if (this->opts.verbose_output)
+    {
+        std::cout << "Running local bundle adjustment with "
+            << window.size() << " cameras..." << std::endl;
+    }
+
+    this->bundle_adjustment_intern(window, false);
 }
 
 /* ---------------------------------------------------------------- */
@@ -472,100 +825,180 @@ Incremental::bundle_adjustment_single_cam (int view_id)
 //#define PBA_DISTORTION_TYPE pba::NO_DISTORTION
 
 void
-Incremental::bundle_adjustment_intern (int single_camera_ba)
+Incremental::configure_pba (pba::SparseBundleCPU* pba, bool motion_only) const
 {
-    /* Configure PBA. */
-    pba::SparseBundleCPU pba;
-    pba.EnableRadialDistortion(PBA_DISTORTION_TYPE);
-    pba.SetNextTimeBudget(0);
-    if (single_camera_ba >= 0)
-        pba.SetNextBundleMode(pba::BUNDLE_ONLY_MOTION);
+    pba->EnableRadialDistortion(PBA_DISTORTION_TYPE);
+    pba->SetNextTimeBudget(0);
+    if (motion_only)
+        pba->SetNextBundleMode(pba::BUNDLE_ONLY_MOTION);
     else
-        pba.SetNextBundleMode(pba::BUNDLE_FULL);
-
-    if (this->opts.ba_fixed_intrinsics)
-        pba.SetFixedIntrinsics(true);
-
-    pba.GetInternalConfig()->__verbose_cg_iteration = false;
-    pba.GetInternalConfig()->__verbose_level = -1;
-    pba.GetInternalConfig()->__verbose_function_time = false;
-    pba.GetInternalConfig()->__verbose_allocation = false;
-    pba.GetInternalConfig()->__verbose_sse = false;
-    //pba.GetInternalConfig()->__lm_max_iteration = 100;
-    //pba.GetInternalConfig()->__cg_min_iteration = 30;
-    //pba.GetInternalConfig()->__cg_max_iteration = 300;
-    //pba.GetInternalConfig()->__lm_delta_threshold = 1E-7;
-    //pba.GetInternalConfig()->__lm_mse_threshold = 1E-2;
+        pba->SetNextBundleMode(pba::BUNDLE_FULL);
+
+    pba->SetFixedIntrinsics(this->opts.ba_fixed_intrinsics);
+    /* This sets the process-wide PBA thread count, see Options. */
+    pba->SetNumThreads(this->opts.ba_num_threads);
+
+    pba->GetInternalConfig()->__verbose_cg_iteration = false;
+    pba->GetInternalConfig()->__verbose_level = -1;
+    pba->GetInternalConfig()->__verbose_function_time = false;
+    pba->GetInternalConfig()->__verbose_allocation = false;
+    pba->GetInternalConfig()->__verbose_sse = false;
+    //pba->GetInternalConfig()->__lm_max_iteration = 100;
+    //pba->GetInternalConfig()->__cg_min_iteration = 30;
+    //pba->GetInternalConfig()->__cg_max_iteration = 300;
+    //pba->GetInternalConfig()->__lm_delta_threshold = 1E-7;
+    //pba->GetInternalConfig()->__lm_mse_threshold = 1E-2;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::set_pba_camera (int view_id, pba::CameraT* cam) const
+{
+    CameraPose const& pose = this->cameras[view_id];
+    cam->f = pose.get_focal_length();
+    std::copy(pose.t.begin(), pose.t.end(), cam->t);
+    std::copy(pose.R.begin(), pose.R.end(), cam->m[0]);
+    cam->radial = this->viewports->at(view_id).radial_distortion;
+    cam->distortion_type = PBA_DISTORTION_TYPE;
+    cam->SetVariableCamera();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::get_pba_camera (int view_id, pba::CameraT const& cam,
+    bool verbose)
+{
+    CameraPose& pose = this->cameras[view_id];
+    Viewport& view = this->viewports->at(view_id);
+    this->update_camera(view_id);
+    std::copy(cam.t, cam.t + 3, pose.t.begin());
+    std::copy(cam.m[0], cam.m[0] + 9, pose.R.begin());
+
+    if (verbose)
+    {
+        std::cout << "Camera " << view_id << ", focal length: "
+            << pose.get_focal_length() << " -> " << cam.f
+            << ", distortion: " << cam.radial << std::endl;
+    }
+
+    pose.K[0] = cam.f;
+    pose.K[4] = cam.f;
+    view.radial_distortion = cam.radial;
+}
+
+/* ---------------------------------------------------------------- */
+
+pba::Point2D
+Incremental::get_pba_observation (int view_id, int feature_id) const
+{
+    Viewport const& view = this->viewports->at(view_id);
+    math::Vec2f const& f2d = view.features.positions[feature_id];
+
+    pba::Point2D point;
+    point.x = f2d[0] - static_cast<float>(view.width) / 2.0f;
+    point.y = f2d[1] - static_cast<float>(view.height) / 2.0f;
+    return point;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Incremental::bundle_adjustment_intern (std::vector<int> const& variable_views,
+    bool motion_only)
+{
+    /*
+     * Configure PBA. The sub-problem changes with every run and is built
+     * from scratch, unlike the persistent problem for full BA.
+     */
+    pba::SparseBundleCPU pba;
+    this->configure_pba(&pba, motion_only);
+
+    /*
+     * Select the tracks for bundle adjustment. Without variable cameras
+     * all cameras and tracks are optimized. Otherwise only the tracks seen
+     * by the variable cameras are used, and the other cameras which see
+     * these tracks are kept constant.
+     */
+    bool const full_ba = variable_views.empty();
+    std::vector<bool> variable_cams(this->cameras.size(), full_ba);
+    std::vector<bool> used_cams(this->cameras.size(), full_ba);
+    for (std::size_t i = 0; i < variable_views.size(); ++i)
+    {
+        variable_cams[variable_views[i]] = true;
+        used_cams[variable_views[i]] = true;
+    }
+
+    std::vector<int> ba_tracks;
+    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    {
+        if (!this->tracks->is_valid(i))
+            continue;
+
+        bool selected = full_ba;
+        for (FeatureReference const* ref = this->tracks->begin(i);
+            !selected && ref != this->tracks->end(i); ++ref)
+            selected = variable_cams[ref->view_id]
+                && this->cameras[ref->view_id].is_valid();
+        if (!selected)
+            continue;
+
+        ba_tracks.push_back(i);
+        if (full_ba)
+            continue;
+        for (FeatureReference const* ref = this->tracks->begin(i);
+            ref != this->tracks->end(i); ++ref)
+            used_cams[ref->view_id] = true;
+    }
 
     /* Prepare camera data. */
     std::vector<pba::CameraT> pba_cams;
     std::vector<int> pba_cams_mapping(this->cameras.size(), -1);
     for (std::size_t i = 0; i < this->cameras.size(); ++i)
     {
-        if (!this->cameras[i].is_valid())
+        if (!this->cameras[i].is_valid() || !used_cams[i])
             continue;
 
-        CameraPose const& pose = this->cameras[i];
         pba::CameraT cam;
-        cam.f = pose.get_focal_length();
-        std::copy(pose.t.begin(), pose.t.end(), cam.t);
-        std::copy(pose.R.begin(), pose.R.end(), cam.m[0]);
-        cam.radial = this->viewports->at(i).radial_distortion;
-        cam.distortion_type = PBA_DISTORTION_TYPE;
-        pba_cams_mapping[i] = pba_cams.size();
-
-        if (single_camera_ba >= 0 && (int)i != single_camera_ba)
+        this->set_pba_camera(i, &cam);
+        if (!variable_cams[i])
             cam.SetConstantCamera();
 
+        pba_cams_mapping[i] = pba_cams.size();
         pba_cams.push_back(cam);
     }
+    if (pba_cams.empty() || ba_tracks.empty())
+        return;
     pba.SetCameraData(pba_cams.size(), &pba_cams[0]);
 
-    /* Prepare tracks data. */
-    std::vector<pba::Point3D> pba_tracks;
-    std::vector<int> pba_tracks_mapping(this->tracks->size(), -1);
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
-    {
-        Track const& track = this->tracks->at(i);
-        if (!track.is_valid())
-            continue;
-
-        pba::Point3D point;
-        std::copy(track.pos.begin(), track.pos.end(), point.xyz);
-        pba_tracks_mapping[i] = pba_tracks.size();
-        pba_tracks.push_back(point);
-    }
-    pba.SetPointData(pba_tracks.size(), &pba_tracks[0]);
-
-    /* Prepare feature positions in the images. */
+    /*
+     * Prepare tracks data and feature positions in the images in a single
+     * sequential pass over the track positions and feature references.
+     */
+    std::vector<pba::Point3D> pba_tracks(ba_tracks.size());
     std::vector<pba::Point2D> pba_2d_points;
     std::vector<int> pba_track_ids;
     std::vector<int> pba_cam_ids;
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    for (std::size_t i = 0; i < ba_tracks.size(); ++i)
     {
-        Track const& track = this->tracks->at(i);
-        if (!track.is_valid())
-            continue;
+        int const track_id = ba_tracks[i];
+        math::Vec3f const& pos = this->tracks->position(track_id);
+        std::copy(pos.begin(), pos.end(), pba_tracks[i].xyz);
 
-        for (std::size_t j = 0; j < track.features.size(); ++j)
+        for (FeatureReference const* ref = this->tracks->begin(track_id);
+            ref != this->tracks->end(track_id); ++ref)
         {
-            int const view_id = track.features[j].view_id;
-            if (!this->cameras[view_id].is_valid())
+            if (pba_cams_mapping[ref->view_id] < 0)
                 continue;
 
-            int const feature_id = track.features[j].feature_id;
-            Viewport const& view = this->viewports->at(view_id);
-            math::Vec2f f2d = view.features.positions[feature_id];
-
-            pba::Point2D point;
-            point.x = f2d[0] - static_cast<float>(view.width) / 2.0f;
-            point.y = f2d[1] - static_cast<float>(view.height) / 2.0f;
-
-            pba_2d_points.push_back(point);
-            pba_track_ids.push_back(pba_tracks_mapping[i]);
-            pba_cam_ids.push_back(pba_cams_mapping[view_id]);
+            pba_2d_points.push_back(this->get_pba_observation
+                (ref->view_id, ref->feature_id));
+            pba_track_ids.push_back(static_cast<int>(i));
+            pba_cam_ids.push_back(pba_cams_mapping[ref->view_id]);
         }
     }
+    pba.SetPointData(pba_tracks.size(), &pba_tracks[0]);
     pba.SetProjection(pba_2d_points.size(),
         &pba_2d_points[0], &pba_track_ids[0], &pba_cam_ids[0]);
 
@@ -573,42 +1006,25 @@ Incremental::bundle_adjustment_intern (int single_camera_ba)
     pba.RunBundleAdjustment();
 
     /* Transfer camera info and track positions back. */
-    std::size_t pba_cam_counter = 0;
+    this->num_camera_updates += 1;
     for (std::size_t i = 0; i < this->cameras.size(); ++i)
-    {
-        if (!this->cameras[i].is_valid())
-            continue;
+        if (pba_cams_mapping[i] >= 0 && variable_cams[i])
+            this->get_pba_camera(i, pba_cams[pba_cams_mapping[i]], false);
 
-        CameraPose& pose = this->cameras[i];
-        Viewport& view = this->viewports->at(i);
-        pba::CameraT const& cam = pba_cams[pba_cam_counter];
-        std::copy(cam.t, cam.t + 3, pose.t.begin());
-        std::copy(cam.m[0], cam.m[0] + 9, pose.R.begin());
-
-        if (this->opts.verbose_output && single_camera_ba < 0)
-        {
-            std::cout << "Camera " << i << ", focal length: "
-                << pose.get_focal_length() << " -> " << cam.f
-                << ", distortion: " << cam.radial << std::endl;
-        }
-
-        pose.K[0] = cam.f;
-        pose.K[4] = cam.f;
-        view.radial_distortion = cam.radial;
-        pba_cam_counter += 1;
-    }
+    if (motion_only)
+        return;
 
-    std::size_t pba_track_counter = 0;
-    for (std::size_t i = 0; i < this->tracks->size(); ++i)
+    for (std::size_t i = 0; i < ba_tracks.size(); ++i)
     {
-        Track& track = this->tracks->at(i);
-        if (!track.is_valid())
+        int const track_id = ba_tracks[i];
+        pba::Point3D const& point = pba_tracks[i];
+        std::copy(point.xyz, point.xyz + 3,
+            this->tracks->position(track_id).begin());
+        if (this->tracks->is_valid(track_id))
             continue;
-
-        pba::Point3D const& point = pba_tracks[pba_track_counter];
-        std::copy(point.xyz, point.xyz + 3, track.pos.begin());
-
-        pba_track_counter += 1;
+        this->update_visible_tracks(track_id, -1);
+        this->ba_session.remove_track(track_id);
+        this->reject_track(track_id);
     }
 }
 
@@ -622,20 +1038,20 @@ Incremental::invalidate_large_error_tracks (void)
     std::size_t num_valid_tracks = 0;
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        if (!this->tracks->at(i).is_valid())
+        if (!this->tracks->is_valid(i))
             continue;
 
         num_valid_tracks += 1;
-        math::Vec3f const& pos3d = this->tracks->at(i).pos;
-        FeatureReferenceList const& ref = this->tracks->at(i).features;
+        math::Vec3f const& pos3d = this->tracks->position(i);
 
         double total_error = 0.0f;
         int num_valid = 0;
-        for (std::size_t j = 0; j < ref.size(); ++j)
+        for (FeatureReference const* ref = this->tracks->begin(i);
+            ref != this->tracks->end(i); ++ref)
         {
             /* Get pose and 2D position of feature. */
-            int view_id = ref[j].view_id;
-            int feature_id = ref[j].feature_id;
+            int view_id = ref->view_id;
+            int feature_id = ref->feature_id;
             CameraPose const& pose = this->cameras[view_id];
             if (!pose.is_valid())
                 continue;
@@ -669,7 +1085,7 @@ Incremental::invalidate_large_error_tracks (void)
     {
         if (all_errors[i].first > square_threshold)
         {
-            this->tracks->at(all_errors[i].second).invalidate();
+            this->invalidate_track(all_errors[i].second);
             num_deleted_tracks += 1;
         }
     }
@@ -718,10 +1134,11 @@ Incremental::normalize_scene (void)
     /* Transform every point. */
     for (std::size_t i = 0; i < this->tracks->size(); ++i)
     {
-        if (!this->tracks->at(i).is_valid())
+        if (!this->tracks->is_valid(i))
             continue;
 
-        this->tracks->at(i).pos = (this->tracks->at(i).pos + trans) * scale;
+        math::Vec3f& pos = this->tracks->position(i);
+        pos = (pos + trans) * scale;
     }
 
     /* Transform every camera. */
@@ -783,25 +1200,27 @@ Incremental::create_bundle (void) const
         bundle_feats.reserve(this->tracks->size());
         for (std::size_t i = 0; i < this->tracks->size(); ++i)
         {
-            Track const& track = this->tracks->at(i);
-            if (!track.is_valid())
+            if (!this->tracks->is_valid(i))
                 continue;
 
             /* Copy position and color of the track. */
+            math::Vec3f const& pos = this->tracks->position(i);
+            math::Vec3uc const& color = this->tracks->color(i);
             bundle_feats.push_back(mve::Bundle::Feature3D());
             mve::Bundle::Feature3D& f3d = bundle_feats.back();
-            std::copy(track.pos.begin(), track.pos.end(), f3d.pos);
-            f3d.color[0] = track.color[0] / 255.0f;
-            f3d.color[1] = track.color[1] / 255.0f;
-            f3d.color[2] = track.color[2] / 255.0f;
-            f3d.refs.reserve(track.features.size());
-            for (std::size_t j = 0; j < track.features.size(); ++j)
+            std::copy(pos.begin(), pos.end(), f3d.pos);
+            f3d.color[0] = color[0] / 255.0f;
+            f3d.color[1] = color[1] / 255.0f;
+            f3d.color[2] = color[2] / 255.0f;
+            f3d.refs.reserve(this->tracks->num_features(i));
+            for (FeatureReference const* ref = this->tracks->begin(i);
+                ref != this->tracks->end(i); ++ref)
             {
                 /* For each reference copy view ID, feature ID and 2D pos. */
                 f3d.refs.push_back(mve::Bundle::Feature2D());
                 mve::Bundle::Feature2D& f2d = f3d.refs.back();
-                f2d.view_id = track.features[j].view_id;
-                f2d.feature_id = track.features[j].feature_id;
+                f2d.view_id = ref->view_id;
+                f2d.feature_id = ref->feature_id;
 
                 FeatureSet const& features
                     = this->viewports->at(f2d.view_id).features;
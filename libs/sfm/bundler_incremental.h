@@ -6,11 +6,15 @@
 #ifndef SFM_BUNDLER_INCREMENTAL_HEADER
 #define SFM_BUNDLER_INCREMENTAL_HEADER
 
+#include <string>
+#include <vector>
+
 #include "mve/bundle.h"
 #include "sfm/fundamental.h"
 #include "sfm/ransac_fundamental.h"
 #include "sfm/ransac_pose_p3p.h"
 #include "sfm/bundler_common.h"
+#include "sfm/bundler_pba_session.h"
 #include "sfm/pose.h"
 #include "sfm/defines.h"
 
@@ -39,6 +43,14 @@ public:
         double min_triangulation_angle;
         /** Bundle Adjustment fixed intrinsics. */
         bool ba_fixed_intrinsics;
+        /** Number of covisible cameras optimized in local BA. */
+        int local_ba_num_neighbors;
+        /**
+         * Number of Bundle Adjustment threads, 0 uses all cores. PBA keeps
+         * the thread count in a process-wide global, so it also applies to
+         * all other PBA solvers in the process.
+         */
+        int ba_num_threads;
         /** Produce status messages on the console. */
         bool verbose_output;
     };
@@ -64,16 +76,51 @@ public:
     int find_next_view (void) const;
     /** Returns a list of suitable view ID or emtpy list on failure. */
     void find_next_views (std::vector<int>* next_views);
+    /**
+     * Returns up to max_views suitable view IDs, ordered by decreasing
+     * number of visible reconstructed tracks, or an empty list on failure.
+     */
+    void find_next_views (std::size_t max_views, std::vector<int>* next_views);
+    /** Returns the number of reconstructed tracks visible in a view. */
+    int num_visible_tracks (int view_id) const;
     /** Incrementally adds the given view to the bundle. */
     bool reconstruct_next_view (int view_id);
+    /**
+     * Incrementally adds a batch of views to the bundle. The poses of all
+     * views are estimated in parallel from the current tracks, and the
+     * views with a valid pose are added. The added views, which should be
+     * bundle adjusted together, are returned in order.
+     */
+    void reconstruct_next_views (std::vector<int> const& view_ids,
+        std::vector<int>* accepted_views);
     /** Triangulates tracks without 3D position and at least 2 views. */
     void triangulate_new_tracks (void);
+    /**
+     * Triangulates tracks without 3D position and at least 2 views, which
+     * have a feature in one of the given (newly added) views. Tracks that
+     * were rejected or invalidated before are retried as soon as one of
+     * their cameras has changed since, e.g. by bundle adjustment.
+     */
+    void triangulate_new_tracks (std::vector<int> const& view_ids);
     /** Deletes tracks with a large reprojection error. */
     void invalidate_large_error_tracks (void);
     /** Runs bundle adjustment on both, structure and motion. */
     void bundle_adjustment_full (void);
     /** Runs bundle adjustment on a single camera without structure. */
     void bundle_adjustment_single_cam (int view_id);
+    /** Runs bundle adjustment on the given cameras without structure. */
+    void bundle_adjustment_cams (std::vector<int> const& view_ids);
+    /**
+     * Runs local bundle adjustment on the given cameras, their most
+     * covisible cameras and the tracks seen by these cameras. All other
+     * cameras which see these tracks are kept constant.
+     */
+    void bundle_adjustment_local (std::vector<int> const& view_ids);
+    /**
+     * Saves the full bundle adjustment problem with the current cameras
+     * and tracks to file, e.g. for benchmarking the solver.
+     */
+    void save_bundle_adjustment_problem (std::string const& filename);
     /** Transforms the bundle for numerical stability. */
     void normalize_scene (void);
 
@@ -83,13 +130,60 @@ public:
     mve::Bundle::Ptr create_bundle (void) const;
 
 private:
-    void bundle_adjustment_intern (int single_camera_ba);
+    /* Pose of a new view and the view's outlier features. */
+    struct ViewPose
+    {
+        int view_id;
+        bool accepted;
+        std::size_t num_correspondences;
+        std::size_t num_inliers;
+        CameraPose pose;
+        std::vector<int> outlier_features;
+    };
+
+private:
+    void estimate_view_pose (int view_id, ViewPose* result) const;
+    void add_view_pose (ViewPose const& view_pose);
+    void print_view_pose (ViewPose const& view_pose) const;
+    void triangulate_tracks (std::vector<int> const& track_ids);
+    void configure_pba (pba::SparseBundleCPU* pba, bool motion_only) const;
+    void set_pba_camera (int view_id, pba::CameraT* cam) const;
+    void get_pba_camera (int view_id, pba::CameraT const& cam, bool verbose);
+    pba::Point2D get_pba_observation (int view_id, int feature_id) const;
+    void update_ba_session (void);
+    void bundle_adjustment_intern (std::vector<int> const& variable_views,
+        bool motion_only);
+    void update_visible_tracks (std::size_t track_id, int delta);
+    void invalidate_track (std::size_t track_id);
+    void reject_track (std::size_t track_id);
+    void update_camera (int view_id);
+    void get_retry_tracks (std::vector<int>* track_ids);
 
 private:
     Options opts;
     ViewportList* viewports;
     TrackList* tracks;
     std::vector<CameraPose> cameras;
+    /*
+     * Per-view number of reconstructed tracks with a feature in the view,
+     * which is updated whenever tracks are triangulated or invalidated.
+     */
+    std::vector<int> visible_tracks;
+    /*
+     * Bundle adjustment problem of all reconstructed cameras and tracks,
+     * which is updated whenever cameras or tracks are added or removed.
+     * It is only used for full bundle adjustment, see PbaSession.
+     */
+    PbaSession ba_session;
+    /*
+     * Tracks are retried if a camera changed after the track was rejected.
+     * The per-view and per-track stamps are the camera update count when
+     * the camera changed and when the track was rejected (-1 if not).
+     */
+    int num_camera_updates;
+    std::vector<int> camera_stamps;
+    std::vector<int> rejected_stamps;
+    std::vector<int> rejected_tracks;
 };
 
 /* ------------------------ Implementation ------------------------ */
@@ -100,6 +194,8 @@ Incremental::Options::Options (void)
     , new_track_error_threshold(10.0)
     , min_triangulation_angle(MATH_DEG2RAD(1.0))
     , ba_fixed_intrinsics(false)
+    , local_ba_num_neighbors(10)
+    , ba_num_threads(0)
     , verbose_output(false)
 {
 }
@@ -109,6 +205,7 @@ Incremental::Incremental (Options const& options)
     : opts(options)
     , viewports(NULL)
     , tracks(NULL)
+    , num_camera_updates(0)
 {
 }
 
@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <vector>
+#include <cstring>
+#include <cerrno>
 
+#include "util/exception.h"
 #include "sfm/ransac_homography.h"
 #include "sfm/bundler_init_pair.h"
 
@@ -18,6 +23,14 @@ namespace
             return matching->at(a).matches.size() > matching->at(b).matches.size();
         }
     };
+
+    struct MoreLogMatches
+    {
+        bool operator() (MatchingLogEntry const& a, MatchingLogEntry const& b)
+        {
+            return a.num_matches > b.num_matches;
+        }
+    };
 }  /* namespace */
 
 void
@@ -37,61 +50,112 @@ InitialPair::compute (ViewportList const& viewports,
     PairsComparator cmp(matching);
     std::sort(pairs.begin(), pairs.end(), cmp);
 
-    /* Prepare homography RANSAC. */
+    /* Search for the first pair that is not explained by a homography. */
     if (this->opts.verbose_output)
         std::cout << "Searching for initial pair..." << std::endl;
 
     RansacHomography homography_ransac(this->opts.homography_opts);
-    Correspondences correspondences;
     for (std::size_t i = 0; i < pairs.size(); ++i)
     {
         TwoViewMatching const& tvm = matching[pairs[i]];
-        FeatureSet const& view1 = viewports[tvm.view_1_id].features;
-        FeatureSet const& view2 = viewports[tvm.view_2_id].features;
-
-        /* Prepare correspondences for RANSAC. */
-        correspondences.resize(tvm.matches.size());
-        for (std::size_t j = 0; j < tvm.matches.size(); ++j)
+        if (this->is_initial_pair(viewports, tvm, &homography_ransac))
         {
-            Correspondence& c = correspondences[j];
-            math::Vec2f const& pos1 = view1.positions[tvm.matches[j].first];
-            math::Vec2f const& pos2 = view2.positions[tvm.matches[j].second];
-            std::copy(pos1.begin(), pos1.end(), c.p1);
-            std::copy(pos2.begin(), pos2.end(), c.p2);
+            result->view_1_id = tvm.view_1_id;
+            result->view_2_id = tvm.view_2_id;
+            break;
         }
+    }
 
-        /* Run RANSAC. */
-        RansacHomography::Result ransac_result;
-        homography_ransac.estimate(correspondences, &ransac_result);
+    /* Check if initial pair is valid. */
+    if (result->view_1_id == -1 || result->view_2_id == -1)
+        throw std::runtime_error("Initial pair failure");
+}
 
-        /* Compute homography inliers percentage. */
-        float num_matches = tvm.matches.size();
-        float num_inliers = ransac_result.inliers.size();
-        float percentage = num_inliers / num_matches;
+void
+InitialPair::compute (ViewportList const& viewports,
+    std::string const& matching_log, Result* result)
+{
+    result->view_1_id = -1;
+    result->view_2_id = -1;
 
-        if (this->opts.verbose_output)
-        {
-            std::cout << "  Pair "
-                << "(" << tvm.view_1_id << "," << tvm.view_2_id << "): "
-                << num_matches << " matches, "
-                << num_inliers << " homography inliers ("
-                << util::string::get_fixed(100.0f * percentage, 2)
-                << "%)." << std::endl;
-        }
+    /* Sort the log records according to number of matches. */
+    if (this->opts.verbose_output)
+        std::cout << "Sorting pairwise matches..." << std::endl;
+
+    MatchingLogIndex index;
+    load_matching_log_index(matching_log, &index);
+    std::sort(index.begin(), index.end());
+    std::stable_sort(index.begin(), index.end(), MoreLogMatches());
+
+    std::ifstream in(matching_log.c_str(), std::ios::binary);
+    if (!in.good())
+        throw util::FileException(matching_log, std::strerror(errno));
+
+    /* Search for the first pair that is not explained by a homography. */
+    if (this->opts.verbose_output)
+        std::cout << "Searching for initial pair..." << std::endl;
 
-        if (percentage < this->opts.max_homography_inliers)
+    RansacHomography homography_ransac(this->opts.homography_opts);
+    TwoViewMatching tvm;
+    for (std::size_t i = 0; i < index.size(); ++i)
+    {
+        if (index[i].num_matches == 0)
+            break;
+        load_matching_log_entry(in, index[i], &tvm);
+        if (this->is_initial_pair(viewports, tvm, &homography_ransac))
         {
             result->view_1_id = tvm.view_1_id;
             result->view_2_id = tvm.view_2_id;
             break;
         }
     }
+    in.close();
 
     /* Check if initial pair is valid. */
     if (result->view_1_id == -1 || result->view_2_id == -1)
         throw std::runtime_error("Initial pair failure");
 }
 
+bool
+InitialPair::is_initial_pair (ViewportList const& viewports,
+    TwoViewMatching const& tvm, RansacHomography* ransac)
+{
+    FeatureSet const& view1 = viewports[tvm.view_1_id].features;
+    FeatureSet const& view2 = viewports[tvm.view_2_id].features;
+
+    /* Prepare correspondences for RANSAC. */
+    Correspondences correspondences(tvm.matches.size());
+    for (std::size_t j = 0; j < tvm.matches.size(); ++j)
+    {
+        Correspondence& c = correspondences[j];
+        math::Vec2f const& pos1 = view1.positions[tvm.matches[j].first];
+        math::Vec2f const& pos2 = view2.positions[tvm.matches[j].second];
+        std::copy(pos1.begin(), pos1.end(), c.p1);
+        std::copy(pos2.begin(), pos2.end(), c.p2);
+    }
+
+    /* Run RANSAC. */
+    RansacHomography::Result ransac_result;
+    ransac->estimate(correspondences, &ransac_result);
+
+    /* Compute homography inliers percentage. */
+    float num_matches = tvm.matches.size();
+    float num_inliers = ransac_result.inliers.size();
+    float percentage = num_inliers / num_matches;
+
+    if (this->opts.verbose_output)
+    {
+        std::cout << "  Pair "
+            << "(" << tvm.view_1_id << "," << tvm.view_2_id << "): "
+            << num_matches << " matches, "
+            << num_inliers << " homography inliers ("
+            << util::string::get_fixed(100.0f * percentage, 2)
+            << "%)." << std::endl;
+    }
+
+    return percentage < this->opts.max_homography_inliers;
+}
+
 SFM_BUNDLER_NAMESPACE_END
 SFM_NAMESPACE_END
 
@@ -6,6 +6,8 @@
 #ifndef SFM_BUNDLER_INIT_PAIR_HEADER
 #define SFM_BUNDLER_INIT_PAIR_HEADER
 
+#include <string>
+
 #include "sfm/ransac_homography.h"
 #include "sfm/ransac_fundamental.h"
 #include "sfm/fundamental.h"
@@ -56,6 +58,17 @@ public:
     void compute (ViewportList const& viewports,
         PairwiseMatching const& matching, Result* result);
 
+    /**
+     * Finds the initial pair in the pairs of the matching log (see
+     * bundler_common.h). Only the matches of the tested pair are read.
+     */
+    void compute (ViewportList const& viewports,
+        std::string const& matching_log, Result* result);
+
+private:
+    bool is_initial_pair (ViewportList const& viewports,
+        TwoViewMatching const& tvm, RansacHomography* ransac);
+
 private:
     Options opts;
 };
@@ -1,10 +1,15 @@
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <cstring>
 #include <cerrno>
+#include <cmath>
+#include <stdexcept>
 
 #include "util/exception.h"
+#include "util/file_system.h"
 #include "util/timer.h"
+#include "math/functions.h"
 #include "sfm/sift.h"
 #include "sfm/ransac.h"
 #include "sfm/bundler_matching.h"
@@ -12,12 +17,370 @@
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Orders view IDs by descending retrieval score, then by ID. */
+    struct ScoreGreater
+    {
+        std::vector<float> const* scores;
+
+        bool operator() (int a, int b) const
+        {
+            if (this->scores->at(a) != this->scores->at(b))
+                return this->scores->at(a) > this->scores->at(b);
+            return a < b;
+        }
+    };
+
+    /* Appends every 'stride'-th descriptor to the training descriptors. */
+    template <typename T>
+    void
+    append_training_descriptors (T const* descriptors, int num_descriptors,
+        int dimensions, std::size_t stride, std::size_t* counter,
+        std::vector<T>* training)
+    {
+        for (int i = 0; i < num_descriptors; ++i)
+        {
+            if ((*counter)++ % stride == 0)
+                training->insert(training->end(), descriptors + i * dimensions,
+                    descriptors + (i + 1) * dimensions);
+        }
+    }
+
+    /*
+     * Uniform grid over the feature positions of a view. The features of
+     * every cell are stored contiguously. Features near a line are found
+     * by visiting only the cells that intersect the band around the line.
+     */
+    class FeatureGrid
+    {
+    public:
+        FeatureGrid (FeatureSet const& features, float cell_size);
+
+        /* Appends the features within 'max_dist' of the given line. */
+        void find_near_line (math::Vec3d const& line, double max_dist,
+            std::vector<int>* result) const;
+
+    private:
+        void find_in_cell (int cx, int cy, math::Vec3d const& line,
+            double max_dist, std::vector<int>* result) const;
+
+    private:
+        std::vector<math::Vec2f> const& positions;
+        double cell_size;
+        int cols;
+        int rows;
+        std::vector<int> cell_offsets;
+        std::vector<int> cell_features;
+    };
+
+    FeatureGrid::FeatureGrid (FeatureSet const& features, float cell_size)
+        : positions(features.positions)
+        , cell_size(cell_size)
+    {
+        this->cols = std::max(1, static_cast<int>
+            (std::ceil(features.width / cell_size)));
+        this->rows = std::max(1, static_cast<int>
+            (std::ceil(features.height / cell_size)));
+
+        /* Counting sort of the features into the cells. */
+        int const num_features = static_cast<int>(this->positions.size());
+        std::vector<int> feature_cells(num_features);
+        this->cell_offsets.resize(this->cols * this->rows + 1, 0);
+        for (int i = 0; i < num_features; ++i)
+        {
+            int const cx = math::clamp(static_cast<int>(std::floor(
+                this->positions[i][0] / cell_size)), 0, this->cols - 1);
+            int const cy = math::clamp(static_cast<int>(std::floor(
+                this->positions[i][1] / cell_size)), 0, this->rows - 1);
+            feature_cells[i] = cy * this->cols + cx;
+            this->cell_offsets[feature_cells[i] + 1] += 1;
+        }
+        for (std::size_t i = 1; i < this->cell_offsets.size(); ++i)
+            this->cell_offsets[i] += this->cell_offsets[i - 1];
+
+        std::vector<int> fill(this->cell_offsets.begin(),
+            this->cell_offsets.end() - 1);
+        this->cell_features.resize(num_features);
+        for (int i = 0; i < num_features; ++i)
+            this->cell_features[fill[feature_cells[i]]++] = i;
+    }
+
+    void
+    FeatureGrid::find_near_line (math::Vec3d const& line, double max_dist,
+        std::vector<int>* result) const
+    {
+        double const norm = std::sqrt(MATH_POW2(line[0]) + MATH_POW2(line[1]));
+        if (norm <= 0.0)
+            return;
+        math::Vec3d const l = line / norm;
+
+        /*
+         * Iterate along the major direction of the line. For every column
+         * (or row) of cells, the band covers a contiguous range of rows
+         * (or columns).
+         */
+        bool const along_x = std::abs(l[1]) >= std::abs(l[0]);
+        int const major = along_x ? 0 : 1;
+        int const minor = along_x ? 1 : 0;
+        int const num_major = along_x ? this->cols : this->rows;
+        int const num_minor = along_x ? this->rows : this->cols;
+        double const half_width = max_dist / std::abs(l[minor]);
+        for (int i = 0; i < num_major; ++i)
+        {
+            double const m0 = i * this->cell_size;
+            double const m1 = m0 + this->cell_size;
+            double const v0 = -(l[major] * m0 + l[2]) / l[minor];
+            double const v1 = -(l[major] * m1 + l[2]) / l[minor];
+            double const v_min = std::min(v0, v1) - half_width;
+            double const v_max = std::max(v0, v1) + half_width;
+            if (v_max < 0.0 || v_min >= num_minor * this->cell_size)
+                continue;
+            int const j0 = std::max(0,
+                static_cast<int>(std::floor(v_min / this->cell_size)));
+            int const j1 = std::min(num_minor - 1,
+                static_cast<int>(std::floor(v_max / this->cell_size)));
+            for (int j = j0; j <= j1; ++j)
+            {
+                if (along_x)
+                    this->find_in_cell(i, j, l, max_dist, result);
+                else
+                    this->find_in_cell(j, i, l, max_dist, result);
+            }
+        }
+    }
+
+    void
+    FeatureGrid::find_in_cell (int cx, int cy, math::Vec3d const& line,
+        double max_dist, std::vector<int>* result) const
+    {
+        int const cell = cy * this->cols + cx;
+        for (int k = this->cell_offsets[cell];
+            k < this->cell_offsets[cell + 1]; ++k)
+        {
+            int const index = this->cell_features[k];
+            math::Vec2f const& pos = this->positions[index];
+            double const dist = line[0] * pos[0] + line[1] * pos[1] + line[2];
+            if (std::abs(dist) <= max_dist)
+                result->push_back(index);
+        }
+    }
+
+    /*
+     * Collects the candidates near the epipolar lines F * x of all features
+     * x of the first view in the grid of the second view. The candidates
+     * of feature i are candidates[offsets[i]] to candidates[offsets[i+1]-1].
+     */
+    void
+    find_epipolar_candidates (FeatureSet const& view_1,
+        FeatureGrid const& grid_2, FundamentalMatrix const& fundamental,
+        double max_dist, std::vector<int>* offsets,
+        std::vector<int>* candidates)
+    {
+        std::size_t const num_features = view_1.positions.size();
+        offsets->clear();
+        offsets->reserve(num_features + 1);
+        offsets->push_back(0);
+        candidates->clear();
+        for (std::size_t i = 0; i < num_features; ++i)
+        {
+            math::Vec2f const& pos = view_1.positions[i];
+            math::Vec3d const line = fundamental
+                * math::Vec3d(pos[0], pos[1], 1.0);
+            grid_2.find_near_line(line, max_dist, candidates);
+            offsets->push_back(static_cast<int>(candidates->size()));
+        }
+    }
+
+    /*
+     * Prints the matching progress to the console at most once per
+     * interval (in milliseconds). Threads only enter the critical section
+     * if the interval has elapsed since the last report.
+     */
+    class ProgressReporter
+    {
+    public:
+        ProgressReporter (std::size_t num_total, std::size_t interval);
+        void report (std::size_t num_done, std::size_t const* num_matched,
+            bool force = false);
+
+    private:
+        util::WallTimer timer;
+        std::size_t num_total;
+        std::size_t interval;
+        std::size_t next_report;
+    };
+
+    ProgressReporter::ProgressReporter (std::size_t num_total,
+        std::size_t interval)
+        : num_total(num_total)
+        , interval(interval)
+        , next_report(0)
+    {
+    }
+
+    void
+    ProgressReporter::report (std::size_t num_done,
+        std::size_t const* num_matched, bool force)
+    {
+        std::size_t const now = this->timer.get_elapsed();
+        std::size_t next_report;
+#pragma omp atomic read
+        next_report = this->next_report;
+        if (!force && now < next_report)
+            return;
+
+#pragma omp critical(matching_output)
+        if (force || now >= this->next_report)
+        {
+#pragma omp atomic write
+            this->next_report = now + this->interval;
+            std::size_t matched;
+#pragma omp atomic read
+            matched = *num_matched;
+
+            float const percent = this->num_total == 0 ? 100.0f
+                : (num_done * 1000 / this->num_total) / 10.0f;
+            std::cout << "\rMatching pair " << num_done << " of "
+                << this->num_total << " (" << percent << "%), "
+                << matched << " matched..." << std::flush;
+        }
+    }
+
+    /*
+     * Opens the matching log for appending and reads the index. A new log
+     * is created with the header. An existing log for different features
+     * (or in an old format) is discarded, and a partially written last
+     * record is removed by copying the complete records.
+     */
+    void
+    open_matching_log (std::string const& filename,
+        MatchingLogViews const& views, std::ofstream* out,
+        MatchingLogIndex* index)
+    {
+        std::streamoff log_size = 0;
+        bool valid_log = false;
+        if (util::fs::file_exists(filename.c_str()))
+        {
+            MatchingLogViews log_views;
+            try
+            {
+                log_size = load_matching_log_index(filename, index,
+                    &log_views);
+                valid_log = log_views == views;
+            }
+            catch (std::exception&)
+            {
+            }
+
+            if (!valid_log)
+                std::cout << "Discarding matching log for different "
+                    << "features..." << std::endl;
+        }
+
+        if (!valid_log)
+        {
+            index->clear();
+            out->open(filename.c_str(), std::ios::binary | std::ios::trunc);
+            if (!out->good())
+                throw util::FileException(filename, std::strerror(errno));
+            write_matching_log_header(views, *out);
+            return;
+        }
+
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        in.seekg(0, std::ios::end);
+        if (log_size < static_cast<std::streamoff>(in.tellg()))
+        {
+            std::cout << "Removing incomplete record from matching log..."
+                << std::endl;
+            std::string const tmp_filename = filename + ".tmp";
+            std::ofstream tmp(tmp_filename.c_str(), std::ios::binary);
+            if (!tmp.good())
+                throw util::FileException(tmp_filename, std::strerror(errno));
+            std::vector<char> buffer(1 << 20);
+            in.seekg(0);
+            for (std::streamoff pos = 0; pos < log_size;)
+            {
+                std::streamsize const size = static_cast<std::streamsize>
+                    (std::min<std::streamoff>(buffer.size(), log_size - pos));
+                in.read(&buffer[0], size);
+                tmp.write(&buffer[0], size);
+                pos += size;
+            }
+            tmp.close();
+            in.close();
+            if (!util::fs::rename(tmp_filename.c_str(), filename.c_str()))
+                throw util::FileException(filename, std::strerror(errno));
+        }
+        in.close();
+
+        out->open(filename.c_str(), std::ios::binary | std::ios::app);
+        if (!out->good())
+            throw util::FileException(filename, std::strerror(errno));
+    }
+}  /* namespace */
+
 void
 Matching::compute (ViewportList const& viewports,
     PairwiseMatching* pairwise_matching)
 {
-    std::size_t num_pairs = viewports.size() * (viewports.size() - 1) / 2;
+    /* Retrieve candidate pairs, or match all pairs of views. */
+    bool use_retrieval = this->opts.num_retrieval_candidates > 0
+        && static_cast<std::size_t>(this->opts.num_retrieval_candidates) + 1
+        < viewports.size();
+    ViewPairList candidate_pairs;
+    if (use_retrieval)
+        use_retrieval = this->retrieve_candidate_pairs(viewports,
+            &candidate_pairs);
+
+    std::size_t num_pairs = use_retrieval ? candidate_pairs.size()
+        : viewports.size() * (viewports.size() - 1) / 2;
     std::size_t num_done = 0;
+    std::size_t num_matched_pairs = 0;
+
+    /* Resumed and new pairs are sorted after the existing pairs. */
+    std::size_t const num_previous = pairwise_matching != NULL
+        ? pairwise_matching->size() : 0;
+
+    /* Resume from the matching log, completed pairs are skipped. */
+    bool const use_log = !this->opts.matching_log_file.empty();
+    std::ofstream log_out;
+    ViewPairList completed_pairs;
+    if (use_log)
+    {
+        MatchingLogIndex index;
+        MatchingLogViews log_views;
+        create_matching_log_views(viewports, &log_views);
+        open_matching_log(this->opts.matching_log_file, log_views,
+            &log_out, &index);
+        for (std::size_t i = 0; i < index.size(); ++i)
+        {
+            MatchingLogEntry const& entry = index[i];
+            if (entry.view_1_id < 0 || entry.view_2_id < 0
+                || entry.view_1_id >= static_cast<int>(viewports.size())
+                || entry.view_2_id >= static_cast<int>(viewports.size()))
+                throw util::Exception("Matching log does not match views");
+            completed_pairs.push_back(std::make_pair(
+                std::max(entry.view_1_id, entry.view_2_id),
+                std::min(entry.view_1_id, entry.view_2_id)));
+            if (entry.num_matches > 0)
+                num_matched_pairs += 1;
+        }
+        std::sort(completed_pairs.begin(), completed_pairs.end());
+
+        if (pairwise_matching != NULL && num_matched_pairs > 0)
+        {
+            PairwiseMatching resumed;
+            load_matching_log(this->opts.matching_log_file, &resumed);
+            pairwise_matching->insert(pairwise_matching->end(),
+                resumed.begin(), resumed.end());
+        }
+
+        if (!index.empty())
+            std::cout << "Resuming matching, skipping " << index.size()
+                << " pairs from the matching log." << std::endl;
+    }
 
     if (this->progress != NULL)
     {
@@ -25,59 +388,123 @@ Matching::compute (ViewportList const& viewports,
         this->progress->num_done = 0;
     }
 
-#pragma omp parallel for schedule(dynamic)
-    for (std::size_t i = 0; i < num_pairs; ++i)
+    /*
+     * Every thread collects its results in a separate buffer. The progress
+     * is counted atomically, and only the matching log requires a lock.
+     */
+    ProgressReporter reporter(num_pairs, 250);
+#pragma omp parallel
     {
-#pragma omp critical
+        PairwiseMatching thread_matching;
+#pragma omp for schedule(dynamic) nowait
+        for (std::size_t i = 0; i < num_pairs; ++i)
         {
-            num_done += 1;
+            std::size_t done;
+#pragma omp atomic capture
+            done = ++num_done;
             if (this->progress != NULL)
+            {
+#pragma omp atomic
                 this->progress->num_done += 1;
+            }
+            reporter.report(done, &num_matched_pairs);
 
-            float percent = (num_done * 1000 / num_pairs) / 10.0f;
-            std::cout << "\rMatching pair " << num_done << " of "
-                << num_pairs << " (" << percent << "%)..." << std::flush;
-        }
+            std::size_t view_1_id, view_2_id;
+            if (use_retrieval)
+            {
+                view_1_id = candidate_pairs[i].first;
+                view_2_id = candidate_pairs[i].second;
+            }
+            else
+            {
+                view_1_id = (std::size_t)(0.5 + std::sqrt(0.25 + 2.0 * i));
+                view_2_id = i - view_1_id * (view_1_id - 1) / 2;
+            }
+            if (!completed_pairs.empty() && std::binary_search(
+                completed_pairs.begin(), completed_pairs.end(),
+                std::make_pair(static_cast<int>(view_1_id),
+                static_cast<int>(view_2_id))))
+                continue;
 
-        std::size_t view_1_id = (std::size_t)(0.5 + std::sqrt(0.25 + 2.0 * i));
-        std::size_t view_2_id = i - view_1_id * (view_1_id - 1) / 2;
-        FeatureSet const& view_1 = viewports[view_1_id].features;
-        FeatureSet const& view_2 = viewports[view_2_id].features;
-        if (view_1.positions.empty() || view_2.positions.empty())
-            continue;
+            FeatureSet const& view_1 = viewports[view_1_id].features;
+            FeatureSet const& view_2 = viewports[view_2_id].features;
+            if (view_1.positions.empty() || view_2.positions.empty())
+                continue;
 
-        /* Match the views. */
-        util::WallTimer timer;
-        std::stringstream message;
-        CorrespondenceIndices matches;
-        this->two_view_matching(view_1, view_2, &matches, message);
-        std::size_t matching_time = timer.get_elapsed();
+            /* Match the views. */
+            util::WallTimer timer;
+            std::stringstream message;
+            CorrespondenceIndices matches;
+            this->two_view_matching(view_1, view_2, &matches, message);
+            std::size_t matching_time = timer.get_elapsed();
 
-        if (matches.empty())
-        {
-#pragma omp critical
-            std::cout << "\rPair (" << view_1_id << ","
-                << view_2_id << ") rejected, "
-                << message.str() << std::endl;
-            continue;
-        }
+            TwoViewMatching matching;
+            matching.view_1_id = view_1_id;
+            matching.view_2_id = view_2_id;
+            std::swap(matching.matches, matches);
 
-        /* Successful two view matching. Add the pair. */
-        TwoViewMatching matching;
-        matching.view_1_id = view_1_id;
-        matching.view_2_id = view_2_id;
-        std::swap(matching.matches, matches);
+            /* Rejected pairs are logged to skip them when resuming. */
+            if (use_log)
+            {
+#pragma omp critical(matching_log)
+                append_to_matching_log(matching, log_out);
+            }
 
-#pragma omp critical
+            if (matching.matches.empty())
+            {
+                if (this->opts.verbose_output)
+                {
+#pragma omp critical(matching_output)
+                    std::cout << "\rPair (" << view_1_id << ","
+                        << view_2_id << ") rejected, "
+                        << message.str() << std::endl;
+                }
+                continue;
+            }
+
+            /* Successful two view matching. Add the pair. */
+#pragma omp atomic
+            num_matched_pairs += 1;
+            if (this->opts.verbose_output)
+            {
+#pragma omp critical(matching_output)
+                std::cout << "\rPair (" << view_1_id << ","
+                    << view_2_id << ") matched, " << matching.matches.size()
+                    << " inliers, took " << matching_time << " ms."
+                    << std::endl;
+            }
+            if (pairwise_matching != NULL)
+            {
+                thread_matching.push_back(TwoViewMatching());
+                std::swap(thread_matching.back(), matching);
+            }
+        }
+
+        /* Merge the per-thread results. */
+        if (pairwise_matching != NULL)
         {
-            pairwise_matching->push_back(matching);
-            std::cout << "\rPair (" << view_1_id << ","
-                << view_2_id << ") matched, " << matching.matches.size()
-                << " inliers, took " << matching_time << " ms." << std::endl;
+#pragma omp critical(matching_merge)
+            pairwise_matching->insert(pairwise_matching->end(),
+                thread_matching.begin(), thread_matching.end());
         }
     }
+    reporter.report(num_done, &num_matched_pairs, true);
+    std::cout << std::endl;
+
+    /*
+     * Sort the resumed and new pairs, the order depends neither on the
+     * threads of this run nor on the threads of the resumed run.
+     */
+    if (pairwise_matching != NULL)
+        std::sort(pairwise_matching->begin() + num_previous,
+            pairwise_matching->end());
 
-    std::cout << "\rFound a total of " << pairwise_matching->size()
+    if (use_log && !log_out.good())
+        throw util::FileException(this->opts.matching_log_file,
+            "Error writing matching log");
+    log_out.close();
+
+    std::cout << "\rFound a total of " << num_matched_pairs
         << " matching image pairs." << std::endl;
 }
 
@@ -161,6 +588,227 @@ Matching::two_view_matching (FeatureSet const& view_1,
         int const inlier_id = ransac_result.inliers[i];
         matches->push_back(unfiltered_indices[inlier_id]);
     }
+
+    /* Recover more matches near the epipolar lines. */
+    if (this->opts.use_guided_matching)
+        this->guided_matching(view_1, view_2, ransac_result.fundamental,
+            matches);
+}
+
+void
+Matching::guided_matching (FeatureSet const& view_1,
+    FeatureSet const& view_2, FundamentalMatrix const& fundamental,
+    CorrespondenceIndices* matches)
+{
+    /* Candidates are looked up in both directions using the grids. */
+    double const max_dist = this->opts.guided_matching_threshold;
+    float const cell_size = std::max(16.0f,
+        4.0f * this->opts.guided_matching_threshold);
+    std::vector<int> offsets_1_2, candidates_1_2;
+    find_epipolar_candidates(view_1, FeatureGrid(view_2, cell_size),
+        fundamental, max_dist, &offsets_1_2, &candidates_1_2);
+    std::vector<int> offsets_2_1, candidates_2_1;
+    find_epipolar_candidates(view_2, FeatureGrid(view_1, cell_size),
+        fundamental.transposed(), max_dist, &offsets_2_1, &candidates_2_1);
+
+    sfm::Matching::Result result;
+    view_1.match_candidates(view_2, offsets_1_2, candidates_1_2,
+        &result.matches_1_2);
+    view_2.match_candidates(view_1, offsets_2_1, candidates_2_1,
+        &result.matches_2_1);
+    sfm::Matching::remove_inconsistent_matches(&result);
+
+    /* Keep the RANSAC inliers whose features are not matched again. */
+    std::vector<int> const& m12 = result.matches_1_2;
+    std::vector<int> const& m21 = result.matches_2_1;
+    CorrespondenceIndices guided_matches;
+    for (std::size_t i = 0; i < m12.size(); ++i)
+        if (m12[i] >= 0)
+            guided_matches.push_back(std::make_pair(i, m12[i]));
+    for (std::size_t i = 0; i < matches->size(); ++i)
+    {
+        CorrespondenceIndex const& match = matches->at(i);
+        if (m12[match.first] < 0 && m21[match.second] < 0)
+            guided_matches.push_back(match);
+    }
+    std::sort(guided_matches.begin(), guided_matches.end());
+    std::swap(*matches, guided_matches);
+}
+
+bool
+Matching::retrieve_candidate_pairs (ViewportList const& viewports,
+    ViewPairList* pairs)
+{
+    int const num_views = static_cast<int>(viewports.size());
+    int const sift_dim = 128;
+    int const orb_words = 4;
+
+    /*
+     * The vocabulary is trained on SIFT descriptors, or on the binary ORB
+     * descriptors if there are no SIFT descriptors (e.g. ORB-only scenes).
+     */
+    std::size_t num_sift = 0;
+    std::size_t num_orb = 0;
+    for (int i = 0; i < num_views; ++i)
+    {
+        num_sift += viewports[i].features.get_num_sift_descriptors();
+        num_orb += viewports[i].features.get_num_orb_descriptors();
+    }
+    bool const use_orb = num_sift == 0;
+    std::size_t const num_descriptors = use_orb ? num_orb : num_sift;
+    if (num_descriptors == 0)
+    {
+        std::cout << "Warning: No descriptors for image retrieval, "
+            << "matching all pairs." << std::endl;
+        return false;
+    }
+
+    /* Collect evenly spaced training descriptors from all views. */
+    std::size_t const max_training = std::max(1,
+        this->opts.max_vocabulary_training_features);
+    std::size_t const stride = (num_descriptors + max_training - 1)
+        / max_training;
+    std::vector<FeatureSet::SiftDescriptorValue> sift_training;
+    std::vector<uint64_t> orb_training;
+    std::size_t counter = 0;
+    for (int i = 0; i < num_views; ++i)
+    {
+        FeatureSet const& features = viewports[i].features;
+        if (use_orb)
+            append_training_descriptors(features.get_orb_descriptors(),
+                features.get_num_orb_descriptors(), orb_words, stride,
+                &counter, &orb_training);
+        else
+            append_training_descriptors(features.get_sift_descriptors(),
+                features.get_num_sift_descriptors(), sift_dim, stride,
+                &counter, &sift_training);
+    }
+
+    std::size_t const num_training = use_orb
+        ? orb_training.size() / orb_words : sift_training.size() / sift_dim;
+    std::cout << "Training vocabulary tree with " << num_training
+        << (use_orb ? " ORB" : " SIFT") << " descriptors..." << std::endl;
+    util::WallTimer timer;
+    VocabularyTree vocabulary(this->opts.vocabulary_opts);
+    if (use_orb)
+        vocabulary.train_binary(&orb_training[0], num_training, orb_words);
+    else
+        vocabulary.train(&sift_training[0], num_training, sift_dim);
+    std::vector<FeatureSet::SiftDescriptorValue>().swap(sift_training);
+    std::vector<uint64_t>().swap(orb_training);
+    int const num_words = vocabulary.get_num_words();
+
+    /* Quantize the descriptors of every view to visual word histograms. */
+    typedef std::vector<std::pair<int, float> > WordVector;
+    std::vector<WordVector> view_words(num_views);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < num_views; ++i)
+    {
+        FeatureSet const& features = viewports[i].features;
+        std::vector<int> words;
+        if (use_orb)
+        {
+            uint64_t const* descr = features.get_orb_descriptors();
+            words.resize(features.get_num_orb_descriptors());
+            for (std::size_t j = 0; j < words.size(); ++j)
+                words[j] = vocabulary.quantize_binary(descr + j * orb_words);
+        }
+        else
+        {
+            FeatureSet::SiftDescriptorValue const* descr
+                = features.get_sift_descriptors();
+            words.resize(features.get_num_sift_descriptors());
+            for (std::size_t j = 0; j < words.size(); ++j)
+                words[j] = vocabulary.quantize(descr + j * sift_dim);
+        }
+        std::sort(words.begin(), words.end());
+        for (std::size_t j = 0; j < words.size(); ++j)
+        {
+            if (j == 0 || words[j] != words[j - 1])
+                view_words[i].push_back(std::make_pair(words[j], 0.0f));
+            view_words[i].back().second += 1.0f;
+        }
+    }
+
+    /* TF-IDF weighting with L1 normalization, and the inverted file. */
+    std::vector<int> document_frequency(num_words, 0);
+    for (int i = 0; i < num_views; ++i)
+        for (std::size_t j = 0; j < view_words[i].size(); ++j)
+            document_frequency[view_words[i][j].first] += 1;
+
+    std::vector<WordVector> inverted_file(num_words);
+    for (int i = 0; i < num_views; ++i)
+    {
+        WordVector& words = view_words[i];
+        float norm = 0.0f;
+        for (std::size_t j = 0; j < words.size(); ++j)
+        {
+            words[j].second *= std::log(static_cast<float>(num_views)
+                / static_cast<float>(document_frequency[words[j].first]));
+            norm += words[j].second;
+        }
+        for (std::size_t j = 0; j < words.size(); ++j)
+        {
+            if (norm > 0.0f)
+                words[j].second /= norm;
+            inverted_file[words[j].first].push_back
+                (std::make_pair(i, words[j].second));
+        }
+    }
+
+    /*
+     * Score all views against every view. For L1 normalized vectors, the
+     * L1 distance is 2 - 2 * sum(min(q_i, d_i)) over common words.
+     */
+    std::size_t const num_candidates = std::min<std::size_t>
+        (this->opts.num_retrieval_candidates, num_views - 1);
+#pragma omp parallel
+    {
+        std::vector<float> scores(num_views);
+        std::vector<int> view_ids(num_views);
+        ViewPairList thread_pairs;
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < num_views; ++i)
+        {
+            std::fill(scores.begin(), scores.end(), 0.0f);
+            WordVector const& words = view_words[i];
+            for (std::size_t j = 0; j < words.size(); ++j)
+            {
+                WordVector const& docs = inverted_file[words[j].first];
+                for (std::size_t k = 0; k < docs.size(); ++k)
+                    scores[docs[k].first] += std::min(words[j].second,
+                        docs[k].second);
+            }
+            scores[i] = -1.0f;
+
+            for (int j = 0; j < num_views; ++j)
+                view_ids[j] = j;
+            ScoreGreater greater;
+            greater.scores = &scores;
+            std::partial_sort(view_ids.begin(), view_ids.begin()
+                + num_candidates, view_ids.end(), greater);
+
+            for (std::size_t j = 0; j < num_candidates; ++j)
+            {
+                if (scores[view_ids[j]] <= 0.0f)
+                    break;
+                thread_pairs.push_back(std::make_pair(
+                    std::max(i, view_ids[j]), std::min(i, view_ids[j])));
+            }
+        }
+#pragma omp critical
+        pairs->insert(pairs->end(), thread_pairs.begin(), thread_pairs.end());
+    }
+
+    /* Matching is symmetric, remove duplicated pairs. */
+    std::sort(pairs->begin(), pairs->end());
+    pairs->erase(std::unique(pairs->begin(), pairs->end()), pairs->end());
+
+    std::cout << "Retrieved " << pairs->size() << " of "
+        << (static_cast<std::size_t>(num_views) * (num_views - 1) / 2)
+        << " pairs using " << num_words << " visual words, took "
+        << timer.get_elapsed() << " ms." << std::endl;
+    return true;
 }
 
 SFM_BUNDLER_NAMESPACE_END
@@ -12,6 +12,7 @@
 
 #include "sfm/matching.h"
 #include "sfm/ransac_fundamental.h"
+#include "sfm/vocabulary_tree.h"
 #include "sfm/bundler_common.h"
 #include "sfm/defines.h"
 
@@ -22,7 +23,9 @@ SFM_BUNDLER_NAMESPACE_BEGIN
  * Bundler Component: Matching between views in an MVE scene.
  *
  * For every view the feature embedding is loaded and matched to all other
- * views with smaller ID (since the matching is symmetric). Two-view matching
+ * views with smaller ID (since the matching is symmetric). For large scenes,
+ * image retrieval with a vocabulary tree can restrict matching to the most
+ * similar views of every view (see Options). Two-view matching
  * involves RANSAC to compute the fundamental matrix (geometric filtering).
  * Only views with a minimum number of matches are considered "connected".
  *
@@ -37,8 +40,17 @@ SFM_BUNDLER_NAMESPACE_BEGIN
  * <view ID 3> <view ID 4> <number of matches>
  * ...
  *
+ * For long running matching, every pair can be streamed to a matching log
+ * as soon as it is done (see Options). Completed pairs in the log are
+ * skipped if matching is restarted after a crash with identical features.
+ * Tracks, the initial pair and the pre-bundle can be computed from the log
+ * without loading all matches into memory.
+ *
  * Note:
- * - Only supports SIFT at the moment.
+ * - Views are matched with the SIFT, SURF and ORB features of their
+ *   feature sets (see FeatureSet::match()).
+ * - Image retrieval uses only SIFT descriptors, or ORB descriptors if
+ *   there are no SIFT descriptors.
  */
 class Matching
 {
@@ -53,6 +65,15 @@ public:
         int min_feature_matches;
         /** Minimum number of matching features after RANSAC. */
         int min_matching_inliers;
+        /**
+         * After RANSAC, match features again, but only to features within
+         * a band around their epipolar line. This recovers matches which
+         * are rejected by the ratio test in the unconstrained matching.
+         * Disabled by default.
+         */
+        bool use_guided_matching;
+        /** Maximum distance in pixels to the epipolar line. */
+        float guided_matching_threshold;
         /** Perform low-resolution matching to reject unlikely pairs. */
         bool use_lowres_matching;
         /** Number of features used for low-res matching. */
@@ -61,8 +82,30 @@ public:
         int min_lowres_matches;
         /** Only match to a few previous frames. Disabled by default. */
         int match_num_previous_frames;
+        /**
+         * Only match every view to its N most similar views, which are
+         * found with bag-of-words image retrieval using a vocabulary tree
+         * trained on the SIFT descriptors, or on the ORB descriptors if there
+         * are no SIFT descriptors. Pairs are matched if either view is a
+         * candidate of the other. Disabled (0) by default.
+         */
+        int num_retrieval_candidates;
+        /** Options for the vocabulary tree used for image retrieval. */
+        VocabularyTree::Options vocabulary_opts;
+        /** Maximum number of descriptors to train the vocabulary tree. */
+        int max_vocabulary_training_features;
+        /**
+         * Appends every matched or rejected pair to this matching log
+         * (see bundler_common.h) as soon as it is done. If the log exists
+         * and was written for the same features, the pairs in the log are
+         * not matched again, otherwise it is discarded. Disabled by default.
+         */
+        std::string matching_log_file;
+        /** Produce status messages for every pair on the console. */
+        bool verbose_output;
     };
 
+    /** Matching progress, which is updated atomically. */
     struct Progress
     {
         std::size_t num_total;
@@ -75,14 +118,24 @@ public:
     /**
      * Computes the pairwise matching between all pairs of views.
      * Computation requires both descriptor data and 2D feature positions
-     * in the viewports.
+     * in the viewports. The pairwise matching contains the pairs from the
+     * matching log, if any. If a matching log is used, the pairwise matching
+     * can be NULL to keep the matches out of memory.
      */
     void compute (ViewportList const& viewports,
         PairwiseMatching* pairwise_matching);
 
+private:
+    typedef std::vector<std::pair<int, int> > ViewPairList;
+
 private:
     void two_view_matching (FeatureSet const& view_1, FeatureSet const& view_2,
         CorrespondenceIndices* matches, std::stringstream& message);
+    void guided_matching (FeatureSet const& view_1, FeatureSet const& view_2,
+        FundamentalMatrix const& fundamental,
+        CorrespondenceIndices* matches);
+    bool retrieve_candidate_pairs (ViewportList const& viewports,
+        ViewPairList* pairs);
 
 private:
     Options opts;
@@ -95,10 +148,15 @@ inline
 Matching::Options::Options (void)
     : min_feature_matches(24)
     , min_matching_inliers(12)
+    , use_guided_matching(false)
+    , guided_matching_threshold(3.0f)
     , use_lowres_matching(false)
     , num_lowres_features(500)
     , min_lowres_matches(5)
     , match_num_previous_frames(0)
+    , num_retrieval_candidates(0)
+    , max_vocabulary_training_features(500000)
+    , verbose_output(false)
 {
 }
 
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include "util/exception.h"
+#include "util/stdint_compat.h"
+#include "sfm/bundler_pba_session.h"
+
+#define PBA_PROBLEM_SIGNATURE "MVE_PBA_PROBLEM\n"
+#define PBA_PROBLEM_SIGNATURE_LEN 16
+
+SFM_NAMESPACE_BEGIN
+SFM_BUNDLER_NAMESPACE_BEGIN
+
+namespace
+{
+    template <typename T>
+    void
+    write_array (std::vector<T> const& data, std::ostream& out)
+    {
+        int32_t const size = static_cast<int32_t>(data.size());
+        out.write(reinterpret_cast<char const*>(&size), sizeof(int32_t));
+        if (size > 0)
+            out.write(reinterpret_cast<char const*>(&data[0]),
+                sizeof(T) * size);
+    }
+
+    template <typename T>
+    void
+    read_array (std::istream& in, std::vector<T>* data)
+    {
+        int32_t size = 0;
+        in.read(reinterpret_cast<char*>(&size), sizeof(int32_t));
+        if (!in.good() || size < 0)
+            throw util::Exception("Premature EOF");
+        data->resize(size);
+        if (size > 0)
+            in.read(reinterpret_cast<char*>(&(*data)[0]), sizeof(T) * size);
+    }
+}
+
+void
+PbaSession::clear (void)
+{
+    this->cameras.clear();
+    this->camera_views.clear();
+    this->view_cameras.clear();
+    this->points.clear();
+    this->point_tracks.clear();
+    this->track_points.clear();
+    this->projections.clear();
+    this->projection_points.clear();
+    this->projection_cameras.clear();
+    this->removed_points.clear();
+    this->num_removed_points = 0;
+    this->new_observations.clear();
+    this->projections_changed = true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::copy_problem (PbaSession const& other)
+{
+    this->cameras = other.cameras;
+    this->camera_views = other.camera_views;
+    this->view_cameras = other.view_cameras;
+    this->points = other.points;
+    this->point_tracks = other.point_tracks;
+    this->track_points = other.track_points;
+    this->projections = other.projections;
+    this->projection_points = other.projection_points;
+    this->projection_cameras = other.projection_cameras;
+    this->removed_points = other.removed_points;
+    this->num_removed_points = other.num_removed_points;
+    this->new_observations = other.new_observations;
+    this->projections_changed = true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::add_camera (int view_id)
+{
+    if (view_id >= static_cast<int>(this->view_cameras.size()))
+        this->view_cameras.resize(view_id + 1, -1);
+    if (this->view_cameras[view_id] >= 0)
+        return;
+
+    this->view_cameras[view_id] = this->cameras.size();
+    this->cameras.push_back(pba::CameraT());
+    this->camera_views.push_back(view_id);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::add_track (int track_id)
+{
+    if (track_id >= static_cast<int>(this->track_points.size()))
+        this->track_points.resize(track_id + 1, -1);
+    if (this->track_points[track_id] >= 0)
+        return;
+
+    this->track_points[track_id] = this->points.size();
+    this->points.push_back(pba::Point3D());
+    this->point_tracks.push_back(track_id);
+    this->removed_points.push_back(false);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::add_observation (int track_id, int view_id,
+    pba::Point2D const& pos)
+{
+    Observation obs;
+    obs.point_id = this->track_points[track_id];
+    obs.camera_id = this->view_cameras[view_id];
+    obs.pos = pos;
+    this->new_observations.push_back(obs);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::remove_track (int track_id)
+{
+    if (track_id >= static_cast<int>(this->track_points.size()))
+        return;
+    int const point_id = this->track_points[track_id];
+    if (point_id < 0)
+        return;
+
+    /* The track may be added again before the changes are applied. */
+    this->removed_points[point_id] = true;
+    this->num_removed_points += 1;
+    this->track_points[track_id] = -1;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::apply_changes (void)
+{
+    if (this->num_removed_points == 0 && this->new_observations.empty())
+        return;
+
+    /* Compact the points, which keeps the order of the remaining points. */
+    std::vector<int> point_remap(this->points.size(), -1);
+    std::size_t num_points = 0;
+    for (std::size_t i = 0; i < this->points.size(); ++i)
+    {
+        if (this->removed_points[i])
+            continue;
+        point_remap[i] = num_points;
+        this->points[num_points] = this->points[i];
+        this->point_tracks[num_points] = this->point_tracks[i];
+        this->track_points[this->point_tracks[i]] = num_points;
+        num_points += 1;
+    }
+    this->points.resize(num_points);
+    this->point_tracks.resize(num_points);
+    this->removed_points.assign(num_points, false);
+    this->num_removed_points = 0;
+
+    /* Sort the new observations of the remaining points. */
+    std::size_t num_new = 0;
+    for (std::size_t i = 0; i < this->new_observations.size(); ++i)
+    {
+        Observation obs = this->new_observations[i];
+        obs.point_id = point_remap[obs.point_id];
+        if (obs.point_id >= 0)
+            this->new_observations[num_new++] = obs;
+    }
+    this->new_observations.resize(num_new);
+    std::stable_sort(this->new_observations.begin(),
+        this->new_observations.end(), ObservationOrder());
+
+    /* Merge the remaining and the new observations by point. */
+    this->merged_projections.clear();
+    this->merged_points.clear();
+    this->merged_cameras.clear();
+    std::size_t const num_old = this->projections.size();
+    std::size_t i = 0, j = 0;
+    while (i < num_old || j < num_new)
+    {
+        if (i < num_old && point_remap[this->projection_points[i]] < 0)
+        {
+            i += 1;
+            continue;
+        }
+
+        if (j == num_new || (i < num_old
+            && point_remap[this->projection_points[i]]
+            <= this->new_observations[j].point_id))
+        {
+            this->merged_projections.push_back(this->projections[i]);
+            this->merged_points.push_back
+                (point_remap[this->projection_points[i]]);
+            this->merged_cameras.push_back(this->projection_cameras[i]);
+            i += 1;
+        }
+        else
+        {
+            Observation const& obs = this->new_observations[j];
+            this->merged_projections.push_back(obs.pos);
+            this->merged_points.push_back(obs.point_id);
+            this->merged_cameras.push_back(obs.camera_id);
+            j += 1;
+        }
+    }
+
+    std::swap(this->projections, this->merged_projections);
+    std::swap(this->projection_points, this->merged_points);
+    std::swap(this->projection_cameras, this->merged_cameras);
+    this->new_observations.clear();
+    this->projections_changed = true;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::save_problem (std::string const& filename)
+{
+    this->apply_changes();
+
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    if (!out.good())
+        throw util::FileException(filename, std::strerror(errno));
+
+    out.write(PBA_PROBLEM_SIGNATURE, PBA_PROBLEM_SIGNATURE_LEN);
+    write_array(this->cameras, out);
+    write_array(this->camera_views, out);
+    write_array(this->points, out);
+    write_array(this->point_tracks, out);
+    write_array(this->projections, out);
+    write_array(this->projection_points, out);
+    write_array(this->projection_cameras, out);
+    out.close();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::load_problem (std::string const& filename)
+{
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good())
+        throw util::FileException(filename, std::strerror(errno));
+
+    char signature[PBA_PROBLEM_SIGNATURE_LEN + 1];
+    in.read(signature, PBA_PROBLEM_SIGNATURE_LEN);
+    signature[PBA_PROBLEM_SIGNATURE_LEN] = '\0';
+    if (std::string(PBA_PROBLEM_SIGNATURE) != signature)
+        throw std::invalid_argument("Error matching signature");
+
+    this->clear();
+    try
+    {
+        read_array(in, &this->cameras);
+        read_array(in, &this->camera_views);
+        read_array(in, &this->points);
+        read_array(in, &this->point_tracks);
+        read_array(in, &this->projections);
+        read_array(in, &this->projection_points);
+        read_array(in, &this->projection_cameras);
+        if (in.eof())
+            throw util::Exception("Premature EOF");
+        in.close();
+        this->restore_mappings();
+    }
+    catch (...)
+    {
+        this->clear();
+        throw;
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::restore_mappings (void)
+{
+    if (this->camera_views.size() != this->cameras.size()
+        || this->point_tracks.size() != this->points.size()
+        || this->projection_points.size() != this->projections.size()
+        || this->projection_cameras.size() != this->projections.size())
+        throw util::Exception("Inconsistent problem sizes");
+
+    /* Observations must refer to loaded cameras and sorted points. */
+    int const num_cameras = static_cast<int>(this->cameras.size());
+    int const num_points = static_cast<int>(this->points.size());
+    for (std::size_t i = 0; i < this->projections.size(); ++i)
+    {
+        int const camera_id = this->projection_cameras[i];
+        int const point_id = this->projection_points[i];
+        if (camera_id < 0 || camera_id >= num_cameras)
+            throw util::Exception("Invalid camera index in problem");
+        if (point_id < 0 || point_id >= num_points
+            || (i > 0 && point_id < this->projection_points[i - 1]))
+            throw util::Exception("Invalid point index in problem");
+    }
+
+    /* Restore the mappings from unique view and track IDs. */
+    for (std::size_t i = 0; i < this->camera_views.size(); ++i)
+    {
+        int const view_id = this->camera_views[i];
+        if (view_id < 0)
+            throw util::Exception("Invalid view ID in problem");
+        if (view_id >= static_cast<int>(this->view_cameras.size()))
+            this->view_cameras.resize(view_id + 1, -1);
+        if (this->view_cameras[view_id] >= 0)
+            throw util::Exception("Duplicate view ID in problem");
+        this->view_cameras[view_id] = i;
+    }
+    for (std::size_t i = 0; i < this->point_tracks.size(); ++i)
+    {
+        int const track_id = this->point_tracks[i];
+        if (track_id < 0)
+            throw util::Exception("Invalid track ID in problem");
+        if (track_id >= static_cast<int>(this->track_points.size()))
+            this->track_points.resize(track_id + 1, -1);
+        if (this->track_points[track_id] >= 0)
+            throw util::Exception("Duplicate track ID in problem");
+        this->track_points[track_id] = i;
+    }
+    this->removed_points.resize(this->points.size(), false);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+PbaSession::run (void)
+{
+    this->apply_changes();
+    if (this->cameras.empty() || this->points.empty()
+        || this->projections.empty())
+        return;
+
+    /* The solver keeps its index maps unless the projections changed. */
+    this->solver.SetCameraData(this->cameras.size(), &this->cameras[0]);
+    this->solver.SetPointData(this->points.size(), &this->points[0]);
+    if (this->projections_changed)
+    {
+        this->solver.SetProjection(this->projections.size(),
+            &this->projections[0], &this->projection_points[0],
+            &this->projection_cameras[0]);
+        this->projections_changed = false;
+    }
+
+    this->solver.RunBundleAdjustment();
+}
+
+SFM_BUNDLER_NAMESPACE_END
+SFM_NAMESPACE_END
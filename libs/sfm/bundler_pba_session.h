@@ -0,0 +1,236 @@
+/*
+ * Persistent bundle adjustment problem for the incremental bundler.
+ */
+
+#ifndef SFM_BUNDLER_PBA_SESSION_HEADER
+#define SFM_BUNDLER_PBA_SESSION_HEADER
+
+#include <string>
+#include <vector>
+
+#include "sfm/pba_cpu.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+SFM_BUNDLER_NAMESPACE_BEGIN
+
+/**
+ * Bundle adjustment problem which persists across bundle adjustment runs.
+ *
+ * The session keeps the PBA solver with its internal buffers, the camera,
+ * point and observation arrays and the mapping from view and track IDs to
+ * PBA indices. The problem is updated with deltas: cameras, tracks and
+ * observations are added and tracks are removed. Pending changes are
+ * merged into the observations, which PBA requires to be sorted by point,
+ * in a single sequential pass. The solver only rebuilds its index maps if
+ * the problem structure changed since the last run.
+ *
+ * The session only holds the full problem and is only used for full
+ * bundle adjustment. Local and camera-only bundle adjustment solve small
+ * sub-problems with different cameras and tracks on every run, which are
+ * built from scratch. Running them on the full problem with constant
+ * cameras would make every solver iteration pass over all observations.
+ *
+ * Copies of a session share no solver buffers and rebuild on the next run.
+ */
+class PbaSession
+{
+public:
+    PbaSession (void);
+    PbaSession (PbaSession const& other);
+    PbaSession& operator= (PbaSession const& other);
+
+    /** Removes all cameras, points and observations. */
+    void clear (void);
+
+    /** Adds the camera of the given view. */
+    void add_camera (int view_id);
+    /** Adds a point for the given track. */
+    void add_track (int track_id);
+    /** Adds an observation of a track in a view, both must be added. */
+    void add_observation (int track_id, int view_id, pba::Point2D const& pos);
+    /** Removes the point of a track and its observations, if any. */
+    void remove_track (int track_id);
+
+    /** Merges the pending changes into the problem. */
+    void apply_changes (void);
+
+    /** Returns the number of cameras, points or observations. */
+    std::size_t num_cameras (void) const;
+    std::size_t num_points (void) const;
+    std::size_t num_observations (void) const;
+
+    /** Returns the view ID of a camera or the track ID of a point. */
+    int get_view_id (std::size_t camera_id) const;
+    int get_track_id (std::size_t point_id) const;
+
+    /**
+     * Access to camera and point parameters and the observations after
+     * changes have been applied. Observations are ordered by point.
+     */
+    pba::CameraT& camera (std::size_t camera_id);
+    pba::Point3D& point (std::size_t point_id);
+    int observation_camera (std::size_t observation_id) const;
+    int observation_point (std::size_t observation_id) const;
+
+    /**
+     * Saves the problem with the current parameters to file. Loading a
+     * problem replaces the session, the saved view and track IDs are kept.
+     * Loading throws on invalid IDs or indices and leaves an empty session.
+     */
+    void save_problem (std::string const& filename);
+    void load_problem (std::string const& filename);
+
+    /** Returns the solver for configuration before the next run. */
+    pba::SparseBundleCPU& get_solver (void);
+
+    /**
+     * Applies pending changes and runs bundle adjustment with the current
+     * camera and point parameters, which are updated in place.
+     */
+    void run (void);
+
+private:
+    /* A pending observation with PBA camera and point index. */
+    struct Observation
+    {
+        int point_id;
+        int camera_id;
+        pba::Point2D pos;
+    };
+
+    /* Orders observations by point, used for the stable merge. */
+    struct ObservationOrder
+    {
+        bool operator() (Observation const& a, Observation const& b) const;
+    };
+
+    void copy_problem (PbaSession const& other);
+    void restore_mappings (void);
+
+private:
+    pba::SparseBundleCPU solver;
+
+    /* Cameras and the mapping between views and cameras. */
+    std::vector<pba::CameraT> cameras;
+    std::vector<int> camera_views;
+    std::vector<int> view_cameras;
+
+    /* Points and the mapping between tracks and points. */
+    std::vector<pba::Point3D> points;
+    std::vector<int> point_tracks;
+    std::vector<int> track_points;
+
+    /* Observations, sorted by point. */
+    std::vector<pba::Point2D> projections;
+    std::vector<int> projection_points;
+    std::vector<int> projection_cameras;
+
+    /* Pending changes. */
+    std::vector<bool> removed_points;
+    std::size_t num_removed_points;
+    std::vector<Observation> new_observations;
+    bool projections_changed;
+
+    /* Buffers for merging the observations, kept for the next merge. */
+    std::vector<pba::Point2D> merged_projections;
+    std::vector<int> merged_points;
+    std::vector<int> merged_cameras;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+PbaSession::PbaSession (void)
+    : num_removed_points(0)
+    , projections_changed(true)
+{
+}
+
+inline
+PbaSession::PbaSession (PbaSession const& other)
+    : num_removed_points(0)
+    , projections_changed(true)
+{
+    this->copy_problem(other);
+}
+
+inline PbaSession&
+PbaSession::operator= (PbaSession const& other)
+{
+    if (this != &other)
+        this->copy_problem(other);
+    return *this;
+}
+
+inline std::size_t
+PbaSession::num_cameras (void) const
+{
+    return this->cameras.size();
+}
+
+inline std::size_t
+PbaSession::num_points (void) const
+{
+    return this->points.size();
+}
+
+inline std::size_t
+PbaSession::num_observations (void) const
+{
+    return this->projections.size();
+}
+
+inline int
+PbaSession::get_view_id (std::size_t camera_id) const
+{
+    return this->camera_views[camera_id];
+}
+
+inline int
+PbaSession::get_track_id (std::size_t point_id) const
+{
+    return this->point_tracks[point_id];
+}
+
+inline pba::CameraT&
+PbaSession::camera (std::size_t camera_id)
+{
+    return this->cameras[camera_id];
+}
+
+inline pba::Point3D&
+PbaSession::point (std::size_t point_id)
+{
+    return this->points[point_id];
+}
+
+inline int
+PbaSession::observation_camera (std::size_t observation_id) const
+{
+    return this->projection_cameras[observation_id];
+}
+
+inline int
+PbaSession::observation_point (std::size_t observation_id) const
+{
+    return this->projection_points[observation_id];
+}
+
+inline pba::SparseBundleCPU&
+PbaSession::get_solver (void)
+{
+    return this->solver;
+}
+
+inline bool
+PbaSession::ObservationOrder::operator() (Observation const& a,
+    Observation const& b) const
+{
+    return a.point_id < b.point_id;
+}
+
+SFM_BUNDLER_NAMESPACE_END
+SFM_NAMESPACE_END
+
+#endif /* SFM_BUNDLER_PBA_SESSION_HEADER */
@@ -1,188 +1,521 @@
+#include <algorithm>
 #include <iostream>
-#include <set>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
 
 #include "mve/image_tools.h"
 #include "mve/image_drawing.h"
+#include "util/exception.h"
 #include "sfm/bundler_tracks.h"
 
+/* Unions are performed in parallel if atomic operations are available. */
+#if defined(_OPENMP) && defined(__GNUC__)
+#   define TRACKS_PARALLEL_UNION 1
+#else
+#   define TRACKS_PARALLEL_UNION 0
+#endif
+
+/* The maximum number of matches read from the matching log at once. */
+#define TRACKS_LOG_BATCH_SIZE (1 << 22)
+
 SFM_NAMESPACE_BEGIN
 SFM_BUNDLER_NAMESPACE_BEGIN
 
-void
-Tracks::compute (PairwiseMatching const& matching,
-    ViewportList* viewports, TrackList* tracks)
+namespace
 {
-    /* Initialize per-viewport track IDs. */
-    for (std::size_t i = 0; i < viewports->size(); ++i)
+    inline bool
+    compare_and_swap (int* value, int expected, int desired)
     {
-        Viewport& viewport = viewports->at(i);
-        viewport.track_ids.resize(viewport.features.positions.size(), -1);
+#if TRACKS_PARALLEL_UNION
+        return __sync_bool_compare_and_swap(value, expected, desired);
+#else
+        if (*value != expected)
+            return false;
+        *value = desired;
+        return true;
+#endif
     }
 
-    /* Propagate track IDs. */
-    if (this->opts.verbose_output)
-        std::cout << "Propagating track IDs..." << std::endl;
+    /* Checks if the sorted vectors have a common element. */
+    bool
+    have_common_element (std::vector<int> const& a, std::vector<int> const& b)
+    {
+        if (a.size() > b.size())
+            return have_common_element(b, a);
+        for (std::size_t i = 0; i < a.size(); ++i)
+            if (std::binary_search(b.begin(), b.end(), a[i]))
+                return true;
+        return false;
+    }
 
-    std::size_t track_counter = 0;
-    std::size_t num_conflicts = 0;
+    /* Returns the view of a global feature index. */
+    inline int
+    view_of (std::vector<int> const& view_offsets, int feature)
+    {
+        return std::upper_bound(view_offsets.begin(), view_offsets.end(),
+            feature) - view_offsets.begin() - 1;
+    }
 
-    /* Iterate over all pairwise matchings. */
-    for (std::size_t i = 0; i < matching.size(); ++i)
+    /*
+     * Disjoint set forest over the global feature indices of all views.
+     * The features of a view are numbered after the features of all
+     * previous views. The root of a set is always its smallest index,
+     * which makes the sets independent of the order of the unions.
+     */
+    class FeatureSets
+    {
+    public:
+        explicit FeatureSets (ViewportList const& viewports);
+
+        /* Unites the features of all matches of the pair (thread-safe). */
+        void unite (TwoViewMatching const& tvm);
+
+        /*
+         * Detaches all sets with multiple features in one view into single
+         * features, which are rebuilt with unite_conflicting(). Returns the
+         * number of detached sets.
+         */
+        std::size_t detach_conflicting (void);
+
+        /*
+         * Unites the matches between detached features unless the united
+         * set contains multiple features in one view.
+         */
+        void unite_conflicting (TwoViewMatching const& tvm);
+
+        /* Returns all sets with at least two features in CSR layout. */
+        void get_sets (std::vector<int>* offsets, std::vector<int>* features);
+
+        std::vector<int> const& get_view_offsets (void) const;
+
+    private:
+        int find (int feature);
+        bool link (int root_1, int root_2);
+        std::vector<int>& get_set_views (int root);
+
+    private:
+        std::vector<int> view_offsets;
+        std::vector<int> parent;
+        std::vector<bool> detached;
+        /* Sorted detached features and the views of their sets. */
+        std::vector<int> detached_features;
+        std::vector<std::vector<int> > detached_views;
+    };
+
+    FeatureSets::FeatureSets (ViewportList const& viewports)
     {
-        TwoViewMatching const& tvm = matching[i];
-        Viewport& viewport1 = viewports->at(tvm.view_1_id);
-        Viewport& viewport2 = viewports->at(tvm.view_2_id);
+        this->view_offsets.resize(viewports.size() + 1, 0);
+        std::size_t num_features = 0;
+        for (std::size_t i = 0; i < viewports.size(); ++i)
+        {
+            num_features += viewports[i].features.positions.size();
+            if (num_features > static_cast<std::size_t>
+                (std::numeric_limits<int>::max()))
+                throw std::runtime_error("Too many features for tracks");
+            this->view_offsets[i + 1] = static_cast<int>(num_features);
+        }
 
-        /* Iterate over matches for a pair. */
-        for (std::size_t j = 0; j < tvm.matches.size(); ++j)
+        this->parent.resize(num_features);
+        for (std::size_t i = 0; i < num_features; ++i)
+            this->parent[i] = static_cast<int>(i);
+    }
+
+    inline int
+    FeatureSets::find (int feature)
+    {
+        /* Path halving, which is safe with concurrent unions. */
+        int next = this->parent[feature];
+        while (next != feature)
         {
-            CorrespondenceIndex idx = tvm.matches[j];
-            if (viewport1.track_ids[idx.first] == -1
-                && viewport2.track_ids[idx.second] == -1)
-            {
-                /* No track ID associated with the match. Create track. */
-                viewport1.track_ids[idx.first] = track_counter;
-                viewport2.track_ids[idx.second] = track_counter;
-                track_counter += 1;
-            }
-            else if (viewport1.track_ids[idx.first] == -1
-                && viewport2.track_ids[idx.second] != -1)
-            {
-                /* Propagate track ID from first to second view. */
-                viewport1.track_ids[idx.first]
-                    = viewport2.track_ids[idx.second];
-            }
-            else if (viewport1.track_ids[idx.first] != -1
-                && viewport2.track_ids[idx.second] == -1)
+            int const grandparent = this->parent[next];
+            if (grandparent != next)
+                compare_and_swap(&this->parent[feature], next, grandparent);
+            feature = grandparent;
+            next = this->parent[feature];
+        }
+        return feature;
+    }
+
+    inline bool
+    FeatureSets::link (int root_1, int root_2)
+    {
+        /* Fails if the root was linked by another thread in the meantime. */
+        if (root_1 > root_2)
+            std::swap(root_1, root_2);
+        return compare_and_swap(&this->parent[root_2], root_2, root_1);
+    }
+
+    void
+    FeatureSets::unite (TwoViewMatching const& tvm)
+    {
+        int const offset_1 = this->view_offsets[tvm.view_1_id];
+        int const offset_2 = this->view_offsets[tvm.view_2_id];
+        for (std::size_t i = 0; i < tvm.matches.size(); ++i)
+        {
+            int root_1 = offset_1 + tvm.matches[i].first;
+            int root_2 = offset_2 + tvm.matches[i].second;
+            do
             {
-                /* Propagate track ID from second to first view. */
-                viewport2.track_ids[idx.second]
-                    = viewport1.track_ids[idx.first];
+                root_1 = this->find(root_1);
+                root_2 = this->find(root_2);
             }
-            else if (viewport1.track_ids[idx.first]
-                == viewport2.track_ids[idx.second])
+            while (root_1 != root_2 && !this->link(root_1, root_2));
+        }
+    }
+
+    std::size_t
+    FeatureSets::detach_conflicting (void)
+    {
+        std::vector<int> offsets, features;
+        this->get_sets(&offsets, &features);
+
+        /* Features of a set are sorted, thus grouped by view. */
+        std::size_t num_detached = 0;
+        this->detached.clear();
+        this->detached.resize(this->parent.size(), false);
+        this->detached_features.clear();
+        for (std::size_t i = 0; i + 1 < offsets.size(); ++i)
+        {
+            bool conflicting = false;
+            int last_view = -1;
+            for (int j = offsets[i]; !conflicting && j < offsets[i + 1]; ++j)
             {
-                /* Track ID already propagated. */
+                int const view = view_of(this->view_offsets, features[j]);
+                conflicting = (view == last_view);
+                last_view = view;
             }
-            else
+            if (!conflicting)
+                continue;
+
+            num_detached += 1;
+            for (int j = offsets[i]; j < offsets[i + 1]; ++j)
             {
-                /*
-                 * A track ID is already associated with both ends of a match,
-                 * however, is not consistent.
-                 */
-                num_conflicts += 1;
+                this->detached[features[j]] = true;
+                this->parent[features[j]] = features[j];
+                this->detached_features.push_back(features[j]);
             }
         }
+        std::sort(this->detached_features.begin(),
+            this->detached_features.end());
+        this->detached_views.clear();
+        this->detached_views.resize(this->detached_features.size());
+        return num_detached;
     }
 
-    std::cerr << "Warning: " << num_conflicts
-        << " conflicts while propagating track IDs." << std::endl;
+    std::vector<int>&
+    FeatureSets::get_set_views (int root)
+    {
+        std::size_t const id = std::lower_bound(
+            this->detached_features.begin(), this->detached_features.end(),
+            root) - this->detached_features.begin();
+        std::vector<int>& views = this->detached_views[id];
+        if (views.empty())
+            views.push_back(view_of(this->view_offsets, root));
+        return views;
+    }
 
-    /* Create tracks. */
-    tracks->clear();
-    tracks->resize(track_counter);
-    for (std::size_t i = 0; i < viewports->size(); ++i)
+    void
+    FeatureSets::unite_conflicting (TwoViewMatching const& tvm)
     {
-        Viewport const& viewport = viewports->at(i);
-        for (std::size_t j = 0; j < viewport.track_ids.size(); ++j)
+        int const offset_1 = this->view_offsets[tvm.view_1_id];
+        int const offset_2 = this->view_offsets[tvm.view_2_id];
+        std::vector<int> views;
+        for (std::size_t i = 0; i < tvm.matches.size(); ++i)
         {
-            int const track_id = viewport.track_ids[j];
-            if (track_id < 0)
+            int root_1 = offset_1 + tvm.matches[i].first;
+            int root_2 = offset_2 + tvm.matches[i].second;
+            if (!this->detached[root_1] || !this->detached[root_2])
+                continue;
+            root_1 = this->find(root_1);
+            root_2 = this->find(root_2);
+            if (root_1 == root_2)
                 continue;
-            FeatureReference feature_ref;
-            feature_ref.view_id = i;
-            feature_ref.feature_id = j;
-            tracks->at(track_id).features.push_back(feature_ref);
+
+            /* Reject the match if both sets share a view. */
+            if (root_1 > root_2)
+                std::swap(root_1, root_2);
+            std::vector<int>& views_1 = this->get_set_views(root_1);
+            std::vector<int>& views_2 = this->get_set_views(root_2);
+            if (have_common_element(views_1, views_2))
+                continue;
+
+            /* Merge the sorted views into the set with the smaller root. */
+            views.clear();
+            std::merge(views_1.begin(), views_1.end(),
+                views_2.begin(), views_2.end(), std::back_inserter(views));
+            views_1.swap(views);
+            std::vector<int>().swap(views_2);
+            this->link(root_1, root_2);
         }
     }
 
-    /* Find and remove tracks with conflicts. */
-    if (this->opts.verbose_output)
-        std::cout << "Removing tracks with conflicts..." << std::flush;
-    std::size_t const num_total_tracks = tracks->size();
-    std::size_t const num_invalid_tracks
-        = this->remove_invalid_tracks(viewports, tracks);
-    if (this->opts.verbose_output)
-        std::cout << " deleted " << num_invalid_tracks << " of "
-            << num_total_tracks << " tracks." << std::endl;
-
-    /* Compute color for every track. */
-    if (this->opts.verbose_output)
-        std::cout << "Colorizing tracks..." << std::endl;
-    for (std::size_t i = 0; i < tracks->size(); ++i)
+    void
+    FeatureSets::get_sets (std::vector<int>* offsets,
+        std::vector<int>* features)
     {
-        Track& track = tracks->at(i);
-        math::Vec4f color(0.0f, 0.0f, 0.0f, 0.0f);
-        for (std::size_t j = 0; j < track.features.size(); ++j)
+        /* Point every feature directly to its root. */
+        int const num_features = static_cast<int>(this->parent.size());
+#if TRACKS_PARALLEL_UNION
+#   pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < num_features; ++i)
+            this->parent[i] = this->find(i);
+
+        /* Count features per set, assign IDs to sets of two or more. */
+        std::vector<int> set_ids(num_features, 0);
+        for (int i = 0; i < num_features; ++i)
+            set_ids[this->parent[i]] += 1;
+        offsets->clear();
+        offsets->push_back(0);
+        for (int i = 0; i < num_features; ++i)
         {
-            FeatureReference const& ref = track.features[j];
-            FeatureSet const& features = viewports->at(ref.view_id).features;
-            math::Vec3f const feature_color(features.colors[ref.feature_id]);
-            color += math::Vec4f(feature_color, 1.0f);
+            if (set_ids[i] < 2)
+            {
+                set_ids[i] = -1;
+                continue;
+            }
+            offsets->push_back(offsets->back() + set_ids[i]);
+            set_ids[i] = static_cast<int>(offsets->size()) - 2;
+        }
+
+        /* Scatter the features into their sets in increasing order. */
+        std::vector<int> positions(offsets->begin(), offsets->end() - 1);
+        features->resize(offsets->back());
+        for (int i = 0; i < num_features; ++i)
+        {
+            int const set_id = set_ids[this->parent[i]];
+            if (set_id >= 0)
+                features->at(positions[set_id]++) = i;
         }
-        track.color[0] = static_cast<uint8_t>(color[0] / color[3] + 0.5f);
-        track.color[1] = static_cast<uint8_t>(color[1] / color[3] + 0.5f);
-        track.color[2] = static_cast<uint8_t>(color[2] / color[3] + 0.5f);
     }
-}
 
-/* ---------------------------------------------------------------- */
+    inline std::vector<int> const&
+    FeatureSets::get_view_offsets (void) const
+    {
+        return this->view_offsets;
+    }
+
+    /* Unites the matches of all pairs in parallel. */
+    void
+    unite_matches (PairwiseMatching const& matching, FeatureSets* sets)
+    {
+        int const num_pairs = static_cast<int>(matching.size());
+#if TRACKS_PARALLEL_UNION
+#   pragma omp parallel for schedule(dynamic)
+#endif
+        for (int i = 0; i < num_pairs; ++i)
+            sets->unite(matching[i]);
+    }
+
+    /* The number of matches and the views of a pair for ordering. */
+    struct PairSize
+    {
+        int num_matches;
+        int view_1_id;
+        int view_2_id;
+    };
 
-int
-Tracks::remove_invalid_tracks (ViewportList* viewports, TrackList* tracks)
-{
     /*
-     * Detect invalid tracks where a track contains no features, or
-     * multiple features from a single view.
+     * Compares indices by decreasing number of matches. Ties are broken by
+     * the view IDs, so the order does not depend on the order of the pairs.
      */
-    std::vector<bool> delete_tracks(tracks->size());
-    std::size_t num_invalid_tracks = 0;
-    for (std::size_t i = 0; i < tracks->size(); ++i)
+    struct MoreMatches
     {
-        if (tracks->at(i).features.empty())
+        MoreMatches (std::vector<PairSize> const& pairs)
+            : pairs(pairs) {}
+        bool operator() (std::size_t a, std::size_t b) const
         {
-            num_invalid_tracks += 1;
-            delete_tracks[i] = true;
-            continue;
+            PairSize const& pa = this->pairs[a];
+            PairSize const& pb = this->pairs[b];
+            if (pa.num_matches != pb.num_matches)
+                return pa.num_matches > pb.num_matches;
+            if (pa.view_1_id != pb.view_1_id)
+                return pa.view_1_id < pb.view_1_id;
+            return pa.view_2_id < pb.view_2_id;
         }
+        std::vector<PairSize> const& pairs;
+    };
+
+    /*
+     * Returns the pair indices ordered by decreasing number of matches, so
+     * conflicting tracks are split along the weakest pairs.
+     */
+    std::vector<std::size_t>
+    order_by_num_matches (std::vector<PairSize> const& pairs)
+    {
+        std::vector<std::size_t> order(pairs.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), MoreMatches(pairs));
+        return order;
+    }
+}
+
+void
+Tracks::compute (PairwiseMatching const& matching,
+    ViewportList* viewports, TrackList* tracks)
+{
+    /* Unite matching features. */
+    if (this->opts.verbose_output)
+        std::cout << "Uniting matching features..." << std::endl;
 
-        std::set<int> view_ids;
-        for (std::size_t j = 0; j < tracks->at(i).features.size(); ++j)
+    FeatureSets sets(*viewports);
+    unite_matches(matching, &sets);
+
+    /* Split sets with conflicts. */
+    std::size_t const num_conflicts = sets.detach_conflicting();
+    if (num_conflicts > 0)
+    {
+        if (this->opts.verbose_output)
+            std::cout << "Splitting " << num_conflicts
+                << " tracks with conflicts..." << std::endl;
+
+        std::vector<PairSize> pairs(matching.size());
+        for (std::size_t i = 0; i < matching.size(); ++i)
         {
-            FeatureReference const& ref = tracks->at(i).features[j];
-            if (view_ids.insert(ref.view_id).second == false)
-            {
-                num_invalid_tracks += 1;
-                delete_tracks[i] = true;
-                break;
-            }
+            pairs[i].num_matches
+                = static_cast<int>(matching[i].matches.size());
+            pairs[i].view_1_id = matching[i].view_1_id;
+            pairs[i].view_2_id = matching[i].view_2_id;
         }
+        std::vector<std::size_t> order = order_by_num_matches(pairs);
+        for (std::size_t i = 0; i < order.size(); ++i)
+            sets.unite_conflicting(matching[order[i]]);
     }
 
-    /* Create a mapping from old to new track IDs. */
-    std::vector<int> id_mapping(delete_tracks.size(), -1);
-    int valid_track_counter = 0;
-    for (std::size_t i = 0; i < delete_tracks.size(); ++i)
+    std::vector<int> track_offsets, track_features;
+    sets.get_sets(&track_offsets, &track_features);
+    this->create_tracks(sets.get_view_offsets(), track_offsets,
+        track_features, viewports, tracks);
+}
+
+void
+Tracks::compute (std::string const& matching_log,
+    ViewportList* viewports, TrackList* tracks)
+{
+    /* Sort the pairs like the pairwise matching. */
+    MatchingLogIndex index;
+    load_matching_log_index(matching_log, &index);
+    std::sort(index.begin(), index.end());
+
+    std::ifstream in(matching_log.c_str(), std::ios::binary);
+    if (!in.good())
+        throw util::FileException(matching_log, std::strerror(errno));
+
+    /* Unite matching features, reading batches of pairs. */
+    if (this->opts.verbose_output)
+        std::cout << "Uniting matching features from matching log..."
+            << std::endl;
+
+    FeatureSets sets(*viewports);
+    PairwiseMatching batch;
+    std::size_t batch_size = 0;
+    for (std::size_t i = 0; i < index.size(); ++i)
     {
-        if (delete_tracks[i])
+        if (index[i].num_matches == 0)
+            continue;
+        batch.push_back(TwoViewMatching());
+        load_matching_log_entry(in, index[i], &batch.back());
+        batch_size += index[i].num_matches;
+        if (batch_size < TRACKS_LOG_BATCH_SIZE)
             continue;
-        id_mapping[i] = valid_track_counter;
-        valid_track_counter += 1;
+        unite_matches(batch, &sets);
+        batch.clear();
+        batch_size = 0;
     }
+    unite_matches(batch, &sets);
+    PairwiseMatching().swap(batch);
 
-    /* Fix track IDs stored in the viewports. */
+    /* Split sets with conflicts, reading the log once more. */
+    std::size_t const num_conflicts = sets.detach_conflicting();
+    if (num_conflicts > 0)
+    {
+        if (this->opts.verbose_output)
+            std::cout << "Splitting " << num_conflicts
+                << " tracks with conflicts..." << std::endl;
+
+        std::vector<PairSize> pairs(index.size());
+        for (std::size_t i = 0; i < index.size(); ++i)
+        {
+            pairs[i].num_matches = index[i].num_matches;
+            pairs[i].view_1_id = index[i].view_1_id;
+            pairs[i].view_2_id = index[i].view_2_id;
+        }
+        std::vector<std::size_t> order = order_by_num_matches(pairs);
+        TwoViewMatching tvm;
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            if (index[order[i]].num_matches == 0)
+                break;
+            load_matching_log_entry(in, index[order[i]], &tvm);
+            sets.unite_conflicting(tvm);
+        }
+    }
+    in.close();
+
+    std::vector<int> track_offsets, track_features;
+    sets.get_sets(&track_offsets, &track_features);
+    this->create_tracks(sets.get_view_offsets(), track_offsets,
+        track_features, viewports, tracks);
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Tracks::create_tracks (std::vector<int> const& view_offsets,
+    std::vector<int> const& track_offsets,
+    std::vector<int> const& track_features,
+    ViewportList* viewports, TrackList* tracks)
+{
+    /* Initialize per-viewport track IDs. */
     for (std::size_t i = 0; i < viewports->size(); ++i)
     {
-        std::vector<int>& track_ids = viewports->at(i).track_ids;
-        for (std::size_t j = 0; j < track_ids.size(); ++j)
-            if (track_ids[j] >= 0)
-                track_ids[j] = id_mapping[track_ids[j]];
+        Viewport& viewport = viewports->at(i);
+        viewport.track_ids.clear();
+        viewport.track_ids.resize(viewport.features.positions.size(), -1);
     }
 
-    /* Clean the tracks from the vector. */
-    math::algo::vector_clean(delete_tracks, tracks);
+    /* Create tracks from the global feature indices. */
+    if (this->opts.verbose_output)
+        std::cout << "Creating and colorizing tracks..." << std::endl;
+    int const num_tracks = static_cast<int>(track_offsets.size()) - 1;
+    std::vector<int> offsets(track_offsets);
+    FeatureReferenceList features(track_features.size());
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_tracks; ++i)
+        for (int j = track_offsets[i]; j < track_offsets[i + 1]; ++j)
+        {
+            FeatureReference& ref = features[j];
+            ref.view_id = view_of(view_offsets, track_features[j]);
+            ref.feature_id = track_features[j] - view_offsets[ref.view_id];
+            viewports->at(ref.view_id).track_ids[ref.feature_id] = i;
+        }
+    tracks->assign(&offsets, &features);
+
+    /* Compute color for every track. */
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_tracks; ++i)
+    {
+        math::Vec4f color(0.0f, 0.0f, 0.0f, 0.0f);
+        for (FeatureReference const* ref = tracks->begin(i);
+            ref != tracks->end(i); ++ref)
+        {
+            FeatureSet const& features = viewports->at(ref->view_id).features;
+            math::Vec3f const feature_color(features.colors[ref->feature_id]);
+            color += math::Vec4f(feature_color, 1.0f);
+        }
+        math::Vec3uc& track_color = tracks->color(i);
+        track_color[0] = static_cast<uint8_t>(color[0] / color[3] + 0.5f);
+        track_color[1] = static_cast<uint8_t>(color[1] / color[3] + 0.5f);
+        track_color[2] = static_cast<uint8_t>(color[2] / color[3] + 0.5f);
+    }
 
-    return num_invalid_tracks;
+    if (this->opts.verbose_output)
+        std::cout << "Created " << num_tracks << " tracks." << std::endl;
 }
 
 /* ---------------------------------------------------------------- */
@@ -192,9 +525,9 @@ Tracks::remove_invalid_tracks (ViewportList* viewports, TrackList* tracks)
     for (std::size_t i = 0; i < track_list.size(); ++i)
     {
         std::cout << "Track " << i << ":";
-        for (std::size_t j = 0; j < track_list[i].features.size(); ++j)
-            std::cout << " (" << track_list[i].features[j].view_id
-                << "," << track_list[i].features[j].feature_id << ")";
+        for (FeatureReference const* ref = track_list.begin(i);
+            ref != track_list.end(i); ++ref)
+            std::cout << " (" << ref->view_id << "," << ref->feature_id << ")";
         std::cout << std::endl;
     }
 
@@ -227,11 +560,14 @@ struct ImageInfo
 };
 
 mve::ByteImage::Ptr
-visualize_track (Track const& track, ViewportList const& viewports,
-    mve::Scene::Ptr scene, std::string const& image_embedding,
+visualize_track (TrackList const& tracks, std::size_t track_id,
+    ViewportList const& viewports, mve::Scene::Ptr scene,
+    std::string const& image_embedding,
     PairwiseMatching const& pairwise_matching)
 {
-    std::cout << "DEBUG: Track with " << track.features.size()
+    FeatureReferenceList const refs(tracks.begin(track_id),
+        tracks.end(track_id));
+    std::cout << "DEBUG: Track with " << refs.size()
         << " features." << std::endl;
 
     int const max_width = 400;
@@ -240,11 +576,11 @@ visualize_track (Track const& track, ViewportList const& viewports,
 
     /* Fill image information. */
     std::vector<ImageInfo> images;
-    images.resize(track.features.size());
-    for (std::size_t i = 0; i < track.features.size(); ++i)
+    images.resize(refs.size());
+    for (std::size_t i = 0; i < refs.size(); ++i)
     {
-        int const view_id = track.features[i].view_id;
-        int const feature_id = track.features[i].feature_id;
+        int const view_id = refs[i].view_id;
+        int const feature_id = refs[i].feature_id;
 
         Viewport const& viewport = viewports[view_id];
         mve::View::Ptr view = scene->get_view_by_id(view_id);
@@ -287,7 +623,7 @@ visualize_track (Track const& track, ViewportList const& viewports,
 #endif
     }
 
-    int num_cols = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(track.features.size()))));
+    int num_cols = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(refs.size()))));
     mve::ByteImage::Ptr image = mve::ByteImage::create(
         num_cols * max_width + (num_cols - 1) * margin,
         num_cols * max_height + (num_cols - 1) * margin, 3);
@@ -323,7 +659,7 @@ visualize_track (Track const& track, ViewportList const& viewports,
     }
 
     /* Draw circles for each feature. */
-    for (std::size_t i = 0; i < track.features.size(); ++i)
+    for (std::size_t i = 0; i < refs.size(); ++i)
     {
         uint8_t color[3] = { 255, 0, 0};
         mve::image::draw_circle(*image,
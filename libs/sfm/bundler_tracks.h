@@ -6,6 +6,9 @@
 #ifndef SFM_BUNDLER_TRACKS_HEADER
 #define SFM_BUNDLER_TRACKS_HEADER
 
+#include <string>
+#include <vector>
+
 #include "mve/scene.h"
 #include "sfm/bundler_matching.h"
 #include "sfm/defines.h"
@@ -18,6 +21,13 @@ SFM_BUNDLER_NAMESPACE_BEGIN
  *
  * As input this component requires all the pairwise matching results.
  * Additionally, to color the tracks, a color for each feature must be set.
+ *
+ * Tracks are the connected components of the match graph, which are found
+ * with a disjoint set forest over the features of all views. Unions are
+ * performed in parallel. Components with multiple features in one view are
+ * not discarded but split into conflict-free tracks by uniting the matches
+ * again, pairs with many matches first, and skipping matches that would
+ * join two features of the same view.
  */
 class Tracks
 {
@@ -34,7 +44,7 @@ public:
     explicit Tracks (Options const& options);
 
     /**
-     * Computes viewport connectivity information by propagating track IDs.
+     * Computes viewport connectivity information from the matching.
      * Computation requires feature positions and colors in the viewports.
      * A color for each track is computed as the average color from features.
      * Per-feature track IDs are added to the viewports.
@@ -42,8 +52,19 @@ public:
     void compute (PairwiseMatching const& matching,
         ViewportList* viewports, TrackList* tracks);
 
+    /**
+     * Computes the tracks from the pairs in the matching log (see
+     * bundler_common.h). The result is the same as for the sorted pairwise
+     * matching, but only a bounded batch of matches is kept in memory.
+     */
+    void compute (std::string const& matching_log,
+        ViewportList* viewports, TrackList* tracks);
+
 private:
-    int remove_invalid_tracks (ViewportList* viewports, TrackList* tracks);
+    void create_tracks (std::vector<int> const& view_offsets,
+        std::vector<int> const& track_offsets,
+        std::vector<int> const& track_features,
+        ViewportList* viewports, TrackList* tracks);
 
 private:
     Options opts;
@@ -56,9 +77,9 @@ private:
  * Requries per-viewport width, height and positions.
  */
 mve::ByteImage::Ptr
-visualize_track (Track const& track, ViewportList const& viewports,
-    mve::Scene::Ptr scene, std::string const& image_embedding,
-    PairwiseMatching const& matching);
+visualize_track (TrackList const& tracks, std::size_t track_id,
+    ViewportList const& viewports, mve::Scene::Ptr scene,
+    std::string const& image_embedding, PairwiseMatching const& matching);
 
 /* ------------------------ Implementation ------------------------ */
 
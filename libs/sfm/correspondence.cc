@@ -66,6 +66,44 @@ apply_normalization  (math::Matrix<double, 3, 3> const& transform1,
     }
 }
 
+void
+correspondences_to_soa (Correspondences const& correspondences,
+    CorrespondencesSoA* result)
+{
+    std::size_t const num = correspondences.size();
+    result->x1.resize(num);
+    result->y1.resize(num);
+    result->x2.resize(num);
+    result->y2.resize(num);
+    for (std::size_t i = 0; i < num; ++i)
+    {
+        Correspondence const& c = correspondences[i];
+        result->x1[i] = c.p1[0];
+        result->y1[i] = c.p1[1];
+        result->x2[i] = c.p2[0];
+        result->y2[i] = c.p2[1];
+    }
+}
+
+void
+correspondences_to_soa (Correspondences const& correspondences,
+    std::vector<int> const& order, CorrespondencesSoA* result)
+{
+    std::size_t const num = order.size();
+    result->x1.resize(num);
+    result->y1.resize(num);
+    result->x2.resize(num);
+    result->y2.resize(num);
+    for (std::size_t i = 0; i < num; ++i)
+    {
+        Correspondence const& c = correspondences[order[i]];
+        result->x1[i] = c.p1[0];
+        result->y1[i] = c.p1[1];
+        result->x2[i] = c.p2[0];
+        result->y2[i] = c.p2[1];
+    }
+}
+
 void
 compute_normalization (Correspondences2D3D const& correspondences,
     math::Matrix<double, 3, 3>* transform_2d,
@@ -35,6 +35,21 @@ struct Correspondence
     double p2[2];
 };
 
+/**
+ * Structure-of-arrays layout of 2D-2D correspondences. The coordinates of
+ * all correspondences are stored in separate arrays such that consecutive
+ * correspondences can be processed with vector instructions.
+ */
+struct CorrespondencesSoA
+{
+    std::size_t size (void) const;
+
+    std::vector<double> x1;
+    std::vector<double> y1;
+    std::vector<double> x2;
+    std::vector<double> y2;
+};
+
 /**
  * A 3D point and an image coordinate which correspond to each other in terms
  * of the image observing this 3D point in the scene.
@@ -63,6 +78,21 @@ apply_normalization (math::Matrix<double, 3, 3> const& transform1,
     math::Matrix<double, 3, 3> const& transform2,
     Correspondences* correspondences);
 
+/**
+ * Converts the correspondences to the structure-of-arrays layout.
+ */
+void
+correspondences_to_soa (Correspondences const& correspondences,
+    CorrespondencesSoA* result);
+
+/**
+ * Converts the correspondences to the structure-of-arrays layout in the
+ * given order, i.e. element i is correspondence 'order[i]'.
+ */
+void
+correspondences_to_soa (Correspondences const& correspondences,
+    std::vector<int> const& order, CorrespondencesSoA* result);
+
 /**
  * Computes two transformations for the 2D-3D correspondences such that
  * mean of the points is zero and the points fit in the unit squre/cube.
@@ -80,6 +110,14 @@ apply_normalization (math::Matrix<double, 3, 3> const& transform_2d,
     math::Matrix<double, 4, 4> const& transform_3d,
     Correspondences2D3D* correspondences);
 
+/* ------------------------ Implementation ------------------------ */
+
+inline std::size_t
+CorrespondencesSoA::size (void) const
+{
+    return this->x1.size();
+}
+
 SFM_NAMESPACE_END
 
 #endif  // SFM_CORRESPONDENCE_HEADER
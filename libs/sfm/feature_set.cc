@@ -1,5 +1,6 @@
 #include <iostream>
 #include <algorithm>
+#include <limits>
 
 #include "sfm/feature_set.h"
 
@@ -49,10 +50,76 @@ namespace
     {
         return descr1.scale > descr2.scale;
     }
+
+    /* Squared Euclidean distance of discretized descriptors. */
+    template <typename T>
+    float
+    squared_distance (T const* descr1, T const* descr2, int dimensions)
+    {
+        int dist = 0;
+        for (int i = 0; i < dimensions; ++i)
+        {
+            int const diff = static_cast<int>(descr1[i])
+                - static_cast<int>(descr2[i]);
+            dist += diff * diff;
+        }
+        return static_cast<float>(dist);
+    }
+
+#if !DISCRETIZE_DESCRIPTORS
+    template <>
+    float
+    squared_distance (float const* descr1, float const* descr2,
+        int dimensions)
+    {
+        float dist = 0.0f;
+        for (int i = 0; i < dimensions; ++i)
+            dist += MATH_POW2(descr1[i] - descr2[i]);
+        return dist;
+    }
+#endif
+
+    /* Appends a partial matching result with offsets into the other set. */
+    void
+    append_matches (std::vector<int> const& partial, int other_offset,
+        std::vector<int>* matches)
+    {
+        for (std::size_t i = 0; i < partial.size(); ++i)
+            matches->push_back(partial[i] >= 0
+                ? partial[i] + other_offset : partial[i]);
+    }
 }  /* namespace */
 
 void
-FeatureSet::compute_features (mve::ByteImage::Ptr image)
+FeatureSet::compute_features (mve::ByteImage::Ptr image,
+    Sift::Descriptors* sift_descriptors, Surf::Descriptors* surf_descriptors,
+    Orb::Descriptors* orb_descriptors)
+{
+    Sift::Descriptors sift_descr;
+    Surf::Descriptors surf_descr;
+    Orb::Descriptors orb_descr;
+    if (this->opts.feature_types & FEATURE_SIFT)
+        this->compute_sift(image, &sift_descr);
+    if (this->opts.feature_types & FEATURE_SURF)
+        this->compute_surf(image, &surf_descr);
+    if (this->opts.feature_types & FEATURE_ORB)
+        this->compute_orb(image, &orb_descr);
+
+    this->set_features(image, sift_descr, surf_descr, orb_descr);
+
+    if (sift_descriptors != NULL)
+        std::swap(*sift_descriptors, sift_descr);
+    if (surf_descriptors != NULL)
+        std::swap(*surf_descriptors, surf_descr);
+    if (orb_descriptors != NULL)
+        std::swap(*orb_descriptors, orb_descr);
+}
+
+void
+FeatureSet::set_features (mve::ByteImage::ConstPtr image,
+    Sift::Descriptors const& sift_descriptors,
+    Surf::Descriptors const& surf_descriptors,
+    Orb::Descriptors const& orb_descriptors)
 {
     this->colors.clear();
     this->positions.clear();
@@ -60,27 +127,32 @@ FeatureSet::compute_features (mve::ByteImage::Ptr image)
     this->height = image->height();
 
     /* Make sure these are in the right order. Matching relies on it. */
-    if (this->opts.feature_types & FEATURE_SIFT)
-        this->compute_sift(image);
-    if (this->opts.feature_types & FEATURE_SURF)
-        this->compute_surf(image);
+    this->set_sift(image, sift_descriptors);
+    this->set_surf(image, surf_descriptors);
+    this->set_orb(image, orb_descriptors);
 }
 
 void
-FeatureSet::compute_sift (mve::ByteImage::ConstPtr image)
+FeatureSet::compute_sift (mve::ByteImage::ConstPtr image,
+    Sift::Descriptors* descriptors)
 {
     /* Compute features. */
-    Sift::Descriptors descr;
     {
         Sift sift(this->opts.sift_opts);
         sift.set_image(image);
         sift.process();
-        descr = sift.get_descriptors();
+        *descriptors = sift.get_descriptors();
     }
 
     /* Sort features by scale for low-res matching. */
-    std::sort(descr.begin(), descr.end(), compare_scale<sfm::Sift::Descriptor>);
+    std::sort(descriptors->begin(), descriptors->end(),
+        compare_scale<sfm::Sift::Descriptor>);
+}
 
+void
+FeatureSet::set_sift (mve::ByteImage::ConstPtr image,
+    Sift::Descriptors const& descr)
+{
     /* Prepare and copy to data structures. */
     std::size_t offset = this->positions.size();
     this->positions.resize(offset + descr.size());
@@ -103,20 +175,26 @@ FeatureSet::compute_sift (mve::ByteImage::ConstPtr image)
 }
 
 void
-FeatureSet::compute_surf (mve::ByteImage::ConstPtr image)
+FeatureSet::compute_surf (mve::ByteImage::ConstPtr image,
+    Surf::Descriptors* descriptors)
 {
     /* Compute features. */
-    Surf::Descriptors descr;
     {
         Surf surf(this->opts.surf_opts);
         surf.set_image(image);
         surf.process();
-        descr = surf.get_descriptors();
+        *descriptors = surf.get_descriptors();
     }
 
     /* Sort features by scale for low-res matching. */
-    std::sort(descr.begin(), descr.end(), compare_scale<sfm::Surf::Descriptor>);
+    std::sort(descriptors->begin(), descriptors->end(),
+        compare_scale<sfm::Surf::Descriptor>);
+}
 
+void
+FeatureSet::set_surf (mve::ByteImage::ConstPtr image,
+    Surf::Descriptors const& descr)
+{
     /* Prepare and copy to data structures. */
     std::size_t offset = this->positions.size();
     this->positions.resize(offset + descr.size());
@@ -138,6 +216,44 @@ FeatureSet::compute_surf (mve::ByteImage::ConstPtr image)
     }
 }
 
+void
+FeatureSet::compute_orb (mve::ByteImage::ConstPtr image,
+    Orb::Descriptors* descriptors)
+{
+    /* Compute features. */
+    {
+        Orb orb(this->opts.orb_opts);
+        orb.set_image(image);
+        orb.process();
+        *descriptors = orb.get_descriptors();
+    }
+
+    /* Sort features by scale for low-res matching. */
+    std::stable_sort(descriptors->begin(), descriptors->end(),
+        compare_scale<sfm::Orb::Descriptor>);
+}
+
+void
+FeatureSet::set_orb (mve::ByteImage::ConstPtr image,
+    Orb::Descriptors const& descr)
+{
+    /* Prepare and copy to data structures. */
+    std::size_t offset = this->positions.size();
+    this->positions.resize(offset + descr.size());
+    this->colors.resize(offset + descr.size());
+    this->orb_descr.allocate(descr.size() * 4);
+    this->num_orb_descriptors = descr.size();
+
+    uint64_t* ptr = this->orb_descr.begin();
+    for (std::size_t i = 0; i < descr.size(); ++i, ptr += 4)
+    {
+        Orb::Descriptor const& d = descr[i];
+        std::copy(d.data.begin(), d.data.end(), ptr);
+        this->positions[offset + i] = math::Vec2f(d.x, d.y);
+        image->linear_at(d.x, d.y, this->colors[offset + i].begin());
+    }
+}
+
 int
 FeatureSet::match_lowres (FeatureSet const& other, int num_features) const
 {
@@ -167,6 +283,19 @@ FeatureSet::match_lowres (FeatureSet const& other, int num_features) const
         return sfm::Matching::count_consistent_matches(surf_result);
     }
 
+    /* ORB lowres matching. */
+    if (this->num_orb_descriptors > 0)
+    {
+        sfm::Matching::Result orb_result;
+        sfm::Matching::twoway_match_hamming(this->opts.orb_matching_opts,
+            this->orb_descr.begin(),
+            std::min(num_features, this->num_orb_descriptors),
+            other.orb_descr.begin(),
+            std::min(num_features, other.num_orb_descriptors),
+            &orb_result);
+        return sfm::Matching::count_consistent_matches(orb_result);
+    }
+
     return 0;
 }
 
@@ -195,38 +324,117 @@ FeatureSet::match (FeatureSet const& other, Matching::Result* result) const
         sfm::Matching::remove_inconsistent_matches(&surf_result);
     }
 
-    /* Fix offsets in the matching result. */
-    int other_surf_offset = other.num_sift_descriptors;
-    if (other_surf_offset > 0)
-        for (std::size_t i = 0; i < surf_result.matches_1_2.size(); ++i)
-            if (surf_result.matches_1_2[i] >= 0)
-                surf_result.matches_1_2[i] += other_surf_offset;
-
-    int this_surf_offset = this->num_sift_descriptors;
-    if (this_surf_offset > 0)
-        for (std::size_t i = 0; i < surf_result.matches_2_1.size(); ++i)
-            if (surf_result.matches_2_1[i] >= 0)
-                surf_result.matches_2_1[i] += this_surf_offset;
+    /* ORB matching. */
+    sfm::Matching::Result orb_result;
+    if (this->num_orb_descriptors > 0)
+    {
+        sfm::Matching::twoway_match_hamming(this->opts.orb_matching_opts,
+            this->orb_descr.begin(), this->num_orb_descriptors,
+            other.orb_descr.begin(), other.num_orb_descriptors,
+            &orb_result);
+        sfm::Matching::remove_inconsistent_matches(&orb_result);
+    }
 
-    /* Create a combined matching result. */
+    /* Create a combined matching result with offsets for each type. */
     std::size_t this_num_descriptors = this->num_sift_descriptors
-        + this->num_surf_descriptors;
+        + this->num_surf_descriptors + this->num_orb_descriptors;
     std::size_t other_num_descriptors = other.num_sift_descriptors
-        + other.num_surf_descriptors;
+        + other.num_surf_descriptors + other.num_orb_descriptors;
 
     result->matches_1_2.clear();
     result->matches_1_2.reserve(this_num_descriptors);
-    result->matches_1_2.insert(result->matches_1_2.end(),
-        sift_result.matches_1_2.begin(), sift_result.matches_1_2.end());
-    result->matches_1_2.insert(result->matches_1_2.end(),
-        surf_result.matches_1_2.begin(), surf_result.matches_1_2.end());
+    append_matches(sift_result.matches_1_2, 0, &result->matches_1_2);
+    append_matches(surf_result.matches_1_2, other.num_sift_descriptors,
+        &result->matches_1_2);
+    append_matches(orb_result.matches_1_2, other.num_sift_descriptors
+        + other.num_surf_descriptors, &result->matches_1_2);
 
     result->matches_2_1.clear();
     result->matches_2_1.reserve(other_num_descriptors);
-    result->matches_2_1.insert(result->matches_2_1.end(),
-        sift_result.matches_2_1.begin(), sift_result.matches_2_1.end());
-    result->matches_2_1.insert(result->matches_2_1.end(),
-        surf_result.matches_2_1.begin(), surf_result.matches_2_1.end());
+    append_matches(sift_result.matches_2_1, 0, &result->matches_2_1);
+    append_matches(surf_result.matches_2_1, this->num_sift_descriptors,
+        &result->matches_2_1);
+    append_matches(orb_result.matches_2_1, this->num_sift_descriptors
+        + this->num_surf_descriptors, &result->matches_2_1);
+}
+
+void
+FeatureSet::match_candidates (FeatureSet const& other,
+    std::vector<int> const& offsets, std::vector<int> const& candidates,
+    std::vector<int>* result) const
+{
+    /* Features are ordered by type: SIFT, SURF, ORB. */
+    int const this_surf_offset = this->num_sift_descriptors;
+    int const this_orb_offset = this_surf_offset + this->num_surf_descriptors;
+    int const other_surf_offset = other.num_sift_descriptors;
+    int const other_orb_offset = other_surf_offset
+        + other.num_surf_descriptors;
+    int const other_end = other_orb_offset + other.num_orb_descriptors;
+
+    int const num_features = static_cast<int>(this->positions.size());
+    result->clear();
+    result->resize(num_features, -1);
+    for (int i = 0; i < num_features; ++i)
+    {
+        float dist_1st_best = std::numeric_limits<float>::max();
+        float dist_2nd_best = std::numeric_limits<float>::max();
+        int index_1st_best = -1;
+        for (int k = offsets[i]; k < offsets[i + 1]; ++k)
+        {
+            int const j = candidates[k];
+            float dist;
+            if (i < this_surf_offset)
+            {
+                if (j >= other_surf_offset)
+                    continue;
+                dist = squared_distance(this->sift_descr.begin() + i * 128,
+                    other.sift_descr.begin() + j * 128, 128);
+            }
+            else if (i < this_orb_offset)
+            {
+                if (j < other_surf_offset || j >= other_orb_offset)
+                    continue;
+                dist = squared_distance(this->surf_descr.begin()
+                    + (i - this_surf_offset) * 64, other.surf_descr.begin()
+                    + (j - other_surf_offset) * 64, 64);
+            }
+            else
+            {
+                if (j < other_orb_offset || j >= other_end)
+                    continue;
+                dist = static_cast<float>(Matching::hamming_distance(
+                    this->orb_descr.begin() + (i - this_orb_offset) * 4,
+                    other.orb_descr.begin() + (j - other_orb_offset) * 4, 4));
+            }
+
+            if (dist < dist_1st_best)
+            {
+                dist_2nd_best = dist_1st_best;
+                dist_1st_best = dist;
+                index_1st_best = j;
+            }
+            else if (dist < dist_2nd_best)
+                dist_2nd_best = dist;
+        }
+        if (index_1st_best < 0)
+            continue;
+
+        /* Binary distances are linear, the other distances are squared. */
+        bool const is_orb = i >= this_orb_offset;
+        Matching::Options const& opts = i < this_surf_offset
+            ? this->opts.sift_matching_opts : (is_orb
+            ? this->opts.orb_matching_opts : this->opts.surf_matching_opts);
+        float const dist_thres = is_orb ? opts.distance_threshold
+            : MATH_POW2(opts.distance_threshold);
+        float const lowe_thres = is_orb ? opts.lowe_ratio_threshold
+            : MATH_POW2(opts.lowe_ratio_threshold);
+        if (dist_1st_best > dist_thres)
+            continue;
+        if (dist_2nd_best < std::numeric_limits<float>::max()
+            && dist_1st_best > lowe_thres * dist_2nd_best)
+            continue;
+        result->at(i) = index_1st_best;
+    }
 }
 
 void
@@ -236,6 +444,8 @@ FeatureSet::clear_descriptors (void)
     this->sift_descr.deallocate();
     this->num_surf_descriptors = 0;
     this->surf_descr.deallocate();
+    this->num_orb_descriptors = 0;
+    this->orb_descr.deallocate();
 }
 
 SFM_NAMESPACE_END
@@ -12,6 +12,7 @@
 #include "util/aligned_memory.h"
 #include "sfm/sift.h"
 #include "sfm/surf.h"
+#include "sfm/orb.h"
 #include "sfm/matching.h"
 #include "sfm/defines.h"
 
@@ -27,14 +28,27 @@ SFM_NAMESPACE_BEGIN
 class FeatureSet
 {
 public:
-    /** Bitmask with feature types. */
+    /**
+     * Bitmask with feature types. The binary ORB features are much faster
+     * to compute and match but less distinctive, and they are not part of
+     * FEATURE_ALL. They are intended to be used on their own, e.g. for
+     * video sequences.
+     */
     enum FeatureTypes
     {
         FEATURE_SIFT = 1 << 0,
         FEATURE_SURF = 1 << 1,
-        FEATURE_ALL = 0xFF
+        FEATURE_ORB = 1 << 2,
+        FEATURE_ALL = FEATURE_SIFT | FEATURE_SURF
     };
 
+    /** Value type of the SIFT descriptors used for matching. */
+#if DISCRETIZE_DESCRIPTORS
+    typedef unsigned short SiftDescriptorValue;
+#else
+    typedef float SiftDescriptorValue;
+#endif
+
     /** Options for feature detection and matching. */
     struct Options
     {
@@ -43,8 +57,11 @@ public:
         FeatureTypes feature_types;
         Sift::Options sift_opts;
         Surf::Options surf_opts;
+        Orb::Options orb_opts;
         Matching::Options sift_matching_opts;
         Matching::Options surf_matching_opts;
+        /** ORB matching options, the descriptor length is in bits. */
+        Matching::Options orb_matching_opts;
     };
 
 public:
@@ -52,8 +69,24 @@ public:
     explicit FeatureSet (Options const& options);
     void set_options (Options const& options);
 
-    /** Computes the features specified in the options. */
-    void compute_features (mve::ByteImage::Ptr image);
+    /**
+     * Computes the features specified in the options. Optionally, the
+     * SIFT, SURF and ORB descriptors are returned, which allows to restore
+     * the features later with set_features() without recomputation.
+     */
+    void compute_features (mve::ByteImage::Ptr image,
+        Sift::Descriptors* sift_descriptors = NULL,
+        Surf::Descriptors* surf_descriptors = NULL,
+        Orb::Descriptors* orb_descriptors = NULL);
+
+    /**
+     * Initializes the features from descriptors returned by
+     * compute_features(). The image is only used for the feature colors.
+     */
+    void set_features (mve::ByteImage::ConstPtr image,
+        Sift::Descriptors const& sift_descriptors,
+        Surf::Descriptors const& surf_descriptors,
+        Orb::Descriptors const& orb_descriptors = Orb::Descriptors());
 
     /** Matches all feature types yielding a single matching result. */
     void match (FeatureSet const& other, Matching::Result* result) const;
@@ -65,9 +98,30 @@ public:
      */
     int match_lowres (FeatureSet const& other, int num_features) const;
 
+    /**
+     * Matches every feature of this set to a list of candidate features in
+     * the other set, e.g. for guided matching. The candidates of feature i
+     * are candidates[offsets[i]] to candidates[offsets[i + 1] - 1]. Only
+     * candidates of the same feature type are considered, and the distance
+     * and Lowe ratio thresholds of the feature type are applied among the
+     * candidates. Unmatched features are indicated with a negative index.
+     */
+    void match_candidates (FeatureSet const& other,
+        std::vector<int> const& offsets, std::vector<int> const& candidates,
+        std::vector<int>* result) const;
+
     /** Clear descriptor data. */
     void clear_descriptors (void);
 
+    /** Returns the SIFT descriptor data with 128 values per descriptor. */
+    SiftDescriptorValue const* get_sift_descriptors (void) const;
+    /** Returns the number of SIFT descriptors. */
+    int get_num_sift_descriptors (void) const;
+    /** Returns the ORB descriptor data with 4 words per descriptor. */
+    uint64_t const* get_orb_descriptors (void) const;
+    /** Returns the number of ORB descriptors. */
+    int get_num_orb_descriptors (void) const;
+
 public:
     /** Image dimension used for feature computation. */
     int width, height;
@@ -77,20 +131,31 @@ public:
     std::vector<math::Vec3uc> colors;
 
 private:
-    void compute_sift (mve::ByteImage::ConstPtr image);
-    void compute_surf (mve::ByteImage::ConstPtr image);
+    void compute_sift (mve::ByteImage::ConstPtr image,
+        Sift::Descriptors* descriptors);
+    void compute_surf (mve::ByteImage::ConstPtr image,
+        Surf::Descriptors* descriptors);
+    void set_sift (mve::ByteImage::ConstPtr image,
+        Sift::Descriptors const& descriptors);
+    void set_surf (mve::ByteImage::ConstPtr image,
+        Surf::Descriptors const& descriptors);
+    void compute_orb (mve::ByteImage::ConstPtr image,
+        Orb::Descriptors* descriptors);
+    void set_orb (mve::ByteImage::ConstPtr image,
+        Orb::Descriptors const& descriptors);
 
 private:
     Options opts;
     int num_sift_descriptors;
     int num_surf_descriptors;
+    int num_orb_descriptors;
+    util::AlignedMemory<SiftDescriptorValue, 16> sift_descr;
 #if DISCRETIZE_DESCRIPTORS
-    util::AlignedMemory<unsigned short, 16> sift_descr;
     util::AlignedMemory<signed short, 16> surf_descr;
 #else
-    util::AlignedMemory<float, 16> sift_descr;
     util::AlignedMemory<float, 16> surf_descr;
 #endif
+    util::AlignedMemory<uint64_t, 16> orb_descr;
 };
 
 /* ------------------------ Implementation ------------------------ */
@@ -103,12 +168,15 @@ FeatureSet::Options::Options (void)
     this->sift_matching_opts.descriptor_length = 128;
     this->surf_matching_opts.lowe_ratio_threshold = 0.7f;
     this->surf_matching_opts.descriptor_length = 64;
+    this->orb_matching_opts.lowe_ratio_threshold = 0.8f;
+    this->orb_matching_opts.descriptor_length = 256;
 }
 
 inline
 FeatureSet::FeatureSet (void)
     : num_sift_descriptors(0)
     , num_surf_descriptors(0)
+    , num_orb_descriptors(0)
 {
 }
 
@@ -117,6 +185,7 @@ FeatureSet::FeatureSet (Options const& options)
     : opts(options)
     , num_sift_descriptors(0)
     , num_surf_descriptors(0)
+    , num_orb_descriptors(0)
 {
 }
 
@@ -126,6 +195,30 @@ FeatureSet::set_options (Options const& options)
     this->opts = options;
 }
 
+inline FeatureSet::SiftDescriptorValue const*
+FeatureSet::get_sift_descriptors (void) const
+{
+    return this->sift_descr.begin();
+}
+
+inline int
+FeatureSet::get_num_sift_descriptors (void) const
+{
+    return this->num_sift_descriptors;
+}
+
+inline uint64_t const*
+FeatureSet::get_orb_descriptors (void) const
+{
+    return this->orb_descr.begin();
+}
+
+inline int
+FeatureSet::get_num_orb_descriptors (void) const
+{
+    return this->num_orb_descriptors;
+}
+
 SFM_NAMESPACE_END
 
 #endif /* SFM_FEATURE_SET_HEADER */
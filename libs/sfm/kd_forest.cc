@@ -0,0 +1,306 @@
+/*
+ * Approximate nearest neighbor search using randomized k-d trees.
+ */
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <utility>
+
+#include "sfm/kd_forest.h"
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Maximum number of elements in a leaf node. */
+    int const KD_LEAF_SIZE = 8;
+    /* Number of elements sampled to compute the split dimension. */
+    int const KD_NUM_SAMPLES = 100;
+    /* Number of highest variance dimensions to randomly choose from. */
+    int const KD_NUM_RANDOM_DIMS = 5;
+
+    /*
+     * Simple linear congruential generator. This is used instead of
+     * std::rand() to keep the build deterministic and to leave the
+     * global random state (e.g. for RANSAC) untouched.
+     */
+    inline unsigned int
+    kd_random (unsigned int* state)
+    {
+        *state = *state * 1103515245u + 12345u;
+        return (*state >> 16) & 0x7fff;
+    }
+
+    template <typename T>
+    inline typename InnerProduct<T>::Type
+    dot_product (T const* v1, T const* v2, int dimensions)
+    {
+        typename InnerProduct<T>::Type result = 0;
+        for (int i = 0; i < dimensions; ++i)
+            result += v1[i] * v2[i];
+        return result;
+    }
+
+    /* Predicate that partitions elements at a split value. */
+    template <typename T>
+    struct SplitPredicate
+    {
+        T const* elements;
+        int dimensions;
+        int split_dim;
+        float split_value;
+
+        bool operator() (int index) const
+        {
+            return static_cast<float>(this->elements[index
+                * this->dimensions + this->split_dim]) < this->split_value;
+        }
+    };
+
+    /* Comparator that orders elements by a single dimension. */
+    template <typename T>
+    struct DimensionLess
+    {
+        T const* elements;
+        int dimensions;
+        int split_dim;
+
+        bool operator() (int a, int b) const
+        {
+            return this->elements[a * this->dimensions + this->split_dim]
+                < this->elements[b * this->dimensions + this->split_dim];
+        }
+    };
+}  /* namespace */
+
+template <typename T>
+void
+KdForest<T>::build (void)
+{
+    this->trees.clear();
+    this->trees.resize(this->num_trees);
+    if (this->elements == 0 || this->num_elements == 0)
+        return;
+
+    unsigned int rng = 0x5eedu;
+    for (std::size_t i = 0; i < this->trees.size(); ++i)
+    {
+        Tree& tree = this->trees[i];
+        tree.indices.resize(this->num_elements);
+        for (int j = 0; j < this->num_elements; ++j)
+            tree.indices[j] = j;
+        tree.nodes.reserve(4 * this->num_elements / KD_LEAF_SIZE + 1);
+        this->build_node(&tree, 0, this->num_elements, &rng);
+    }
+}
+
+template <typename T>
+int
+KdForest<T>::build_node (Tree* tree, int begin, int end, unsigned int* rng)
+{
+    int const node_id = static_cast<int>(tree->nodes.size());
+    tree->nodes.push_back(Node());
+
+    if (end - begin <= KD_LEAF_SIZE)
+    {
+        Node& node = tree->nodes[node_id];
+        node.split_dim = -1;
+        node.split_value = 0.0f;
+        node.left = begin;
+        node.right = end;
+        return node_id;
+    }
+
+    /* Compute mean and variance per dimension from random samples. */
+    int const dim = this->dimensions;
+    int const num_samples = std::min(end - begin, KD_NUM_SAMPLES);
+    std::vector<double> mean(dim, 0.0);
+    std::vector<double> var(dim, 0.0);
+    for (int i = 0; i < num_samples; ++i)
+    {
+        int const offset = num_samples == end - begin
+            ? i : static_cast<int>(kd_random(rng) % (end - begin));
+        T const* elem = this->elements
+            + static_cast<std::size_t>(tree->indices[begin + offset]) * dim;
+        for (int j = 0; j < dim; ++j)
+        {
+            double const value = static_cast<double>(elem[j]);
+            mean[j] += value;
+            var[j] += value * value;
+        }
+    }
+
+    std::vector<std::pair<double, int> > dim_variance(dim);
+    for (int j = 0; j < dim; ++j)
+    {
+        mean[j] /= static_cast<double>(num_samples);
+        var[j] = var[j] / static_cast<double>(num_samples) - mean[j] * mean[j];
+        dim_variance[j] = std::make_pair(var[j], j);
+    }
+
+    /* Randomly choose a split dimension among the highest variances. */
+    int const num_random_dims = std::min(dim, KD_NUM_RANDOM_DIMS);
+    std::partial_sort(dim_variance.begin(),
+        dim_variance.begin() + num_random_dims, dim_variance.end(),
+        std::greater<std::pair<double, int> >());
+    int const split_dim = dim_variance[kd_random(rng)
+        % num_random_dims].second;
+    float split_value = static_cast<float>(mean[split_dim]);
+
+    /* Partition the elements at the mean. */
+    SplitPredicate<T> predicate;
+    predicate.elements = this->elements;
+    predicate.dimensions = dim;
+    predicate.split_dim = split_dim;
+    predicate.split_value = split_value;
+    int middle = static_cast<int>(std::partition(
+        tree->indices.begin() + begin, tree->indices.begin() + end,
+        predicate) - tree->indices.begin());
+
+    /* Fall back to a median split if the mean split is degenerated. */
+    if (middle == begin || middle == end)
+    {
+        DimensionLess<T> less;
+        less.elements = this->elements;
+        less.dimensions = dim;
+        less.split_dim = split_dim;
+        middle = begin + (end - begin) / 2;
+        std::nth_element(tree->indices.begin() + begin,
+            tree->indices.begin() + middle,
+            tree->indices.begin() + end, less);
+        std::size_t const median_id = tree->indices[middle];
+        split_value = static_cast<float>
+            (this->elements[median_id * dim + split_dim]);
+    }
+
+    int const left = this->build_node(tree, begin, middle, rng);
+    int const right = this->build_node(tree, middle, end, rng);
+
+    /* The node vector may have been reallocated, don't keep references. */
+    Node& node = tree->nodes[node_id];
+    node.split_dim = split_dim;
+    node.split_value = split_value;
+    node.left = left;
+    node.right = right;
+    return node_id;
+}
+
+template <typename T>
+void
+KdForest<T>::find (T const* query, Result* result,
+    SearchBuffer* buffer) const
+{
+    typedef typename InnerProduct<T>::Type InnerProductType;
+    typedef typename SearchBuffer::Branch Branch;
+
+    /* Largest inner products correspond to smallest distances. */
+    InnerProductType best_1st = -std::numeric_limits<InnerProductType>::max();
+    InnerProductType best_2nd = -std::numeric_limits<InnerProductType>::max();
+    result->index_1st_best = 0;
+    result->index_2nd_best = 0;
+
+    /* Elements can be referenced by more than one tree. */
+    std::vector<bool>& checked = buffer->checked;
+    std::vector<int>& checked_ids = buffer->checked_ids;
+    if (checked.size() != static_cast<std::size_t>(this->num_elements))
+        checked.assign(this->num_elements, false);
+
+    std::vector<Branch>& queue = buffer->queue;
+    queue.clear();
+    for (std::size_t i = 0; i < this->trees.size(); ++i)
+        if (!this->trees[i].nodes.empty())
+            queue.push_back(Branch(0.0f, i, 0));
+    std::make_heap(queue.begin(), queue.end());
+
+    int num_checks = 0;
+    while (!queue.empty() && num_checks < this->max_checks)
+    {
+        std::pop_heap(queue.begin(), queue.end());
+        Branch const branch = queue.back();
+        queue.pop_back();
+
+        /* Descend to a leaf, remember the branches not taken. */
+        Tree const& tree = this->trees[branch.tree_id];
+        int node_id = branch.node_id;
+        while (tree.nodes[node_id].split_dim >= 0)
+        {
+            Node const& node = tree.nodes[node_id];
+            float const diff = static_cast<float>(query[node.split_dim])
+                - node.split_value;
+            if (diff < 0.0f)
+            {
+                queue.push_back(Branch(branch.dist + diff * diff,
+                    branch.tree_id, node.right));
+                node_id = node.left;
+            }
+            else
+            {
+                queue.push_back(Branch(branch.dist + diff * diff,
+                    branch.tree_id, node.left));
+                node_id = node.right;
+            }
+            std::push_heap(queue.begin(), queue.end());
+        }
+
+        /* Check all elements in the leaf. */
+        Node const& leaf = tree.nodes[node_id];
+        for (int i = leaf.left; i < leaf.right; ++i)
+        {
+            int const element_id = tree.indices[i];
+            if (checked[element_id])
+                continue;
+            checked[element_id] = true;
+            checked_ids.push_back(element_id);
+            num_checks += 1;
+
+            InnerProductType const inner_product = dot_product(query,
+                this->elements + static_cast<std::size_t>(element_id)
+                * this->dimensions, this->dimensions);
+
+            /* Check if new largest inner product has been found. */
+            if (inner_product > best_2nd)
+            {
+                if (inner_product > best_1st)
+                {
+                    result->index_2nd_best = result->index_1st_best;
+                    best_2nd = best_1st;
+                    result->index_1st_best = element_id;
+                    best_1st = inner_product;
+                }
+                else
+                {
+                    result->index_2nd_best = element_id;
+                    best_2nd = inner_product;
+                }
+            }
+        }
+    }
+
+    /* Reset the checked flags in O(checks) for the next query. */
+    for (std::size_t i = 0; i < checked_ids.size(); ++i)
+        checked[checked_ids[i]] = false;
+    checked_ids.clear();
+
+    result->dist_1st_best = inner_product_to_distance(best_1st, T());
+    result->dist_2nd_best = inner_product_to_distance(best_2nd, T());
+}
+
+template <typename T>
+void
+KdForest<T>::find_all (T const* queries, int num_queries,
+    std::vector<Result>* results) const
+{
+    SearchBuffer buffer;
+    results->resize(num_queries);
+    for (int i = 0; i < num_queries; ++i)
+        this->find(queries + static_cast<std::size_t>(i) * this->dimensions,
+            &results->at(i), &buffer);
+}
+
+/* Explicit instantiation for the supported types. */
+template class KdForest<short>;
+template class KdForest<unsigned short>;
+template class KdForest<float>;
+
+SFM_NAMESPACE_END
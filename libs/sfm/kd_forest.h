@@ -0,0 +1,199 @@
+/*
+ * Approximate nearest neighbor search using randomized k-d trees.
+ */
+
+#ifndef SFM_KD_FOREST_HEADER
+#define SFM_KD_FOREST_HEADER
+
+#include <vector>
+
+#include "sfm/nearest_neighbor.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Approximate nearest (and second nearest) neighbor search for normalized
+ * vectors using a forest of randomized k-d trees (Silpa-Anan and Hartley,
+ * "Optimised KD-trees for fast image descriptor matching", CVPR 2008).
+ *
+ * Every tree splits the elements recursively at the mean of a dimension
+ * randomly chosen among the dimensions with highest variance. All trees
+ * are searched simultaneously with a single priority queue (best bin
+ * first), and the search is stopped after a fixed number of candidates
+ * has been checked. The number of checks trades recall for speed.
+ *
+ * The search result has the same semantics as the exhaustive search in
+ * NearestNeighbor<T>, which allows to use both interchangeably. The same
+ * types are supported: signed short, unsigned short and float.
+ *
+ * The elements are referenced, not copied, and must stay valid as long as
+ * the forest is used. Building the forest is deterministic.
+ *
+ * A search keeps its state (visited elements and the priority queue) in a
+ * SearchBuffer. Reusing a buffer for many queries avoids allocating and
+ * clearing per-element memory for every query. A buffer must not be shared
+ * between threads, the forest itself can be searched concurrently.
+ */
+template <typename T>
+class KdForest
+{
+public:
+    typedef typename NearestNeighbor<T>::Result Result;
+
+    /** Search state that is reused between queries. */
+    struct SearchBuffer
+    {
+        /* Unexplored branch in the priority search. */
+        struct Branch
+        {
+            Branch (float dist, int tree_id, int node_id);
+            /* Inverted to turn the max-heap into a min-heap. */
+            bool operator< (Branch const& rhs) const;
+
+            float dist;
+            int tree_id;
+            int node_id;
+        };
+
+        /* Checked flags, only the checked elements are reset per query. */
+        std::vector<bool> checked;
+        std::vector<int> checked_ids;
+        std::vector<Branch> queue;
+    };
+
+public:
+    KdForest (void);
+    /** For SfM, this is the descriptor memory block. */
+    void set_elements (T const* elements, int num_elements);
+    /** For SfM, this is the descriptor length. */
+    void set_element_dimensions (int element_dimensions);
+    /** Sets the number of randomized trees. Defaults to 4. */
+    void set_num_trees (int num_trees);
+    /** Sets the maximum number of candidates per query. Defaults to 256. */
+    void set_max_checks (int max_checks);
+
+    /** Builds the trees. Required before searching. */
+    void build (void);
+    /** Find the approximate nearest neighbor with a temporary buffer. */
+    void find (T const* query, Result* result) const;
+    /** Find the approximate nearest neighbor using the given buffer. */
+    void find (T const* query, Result* result, SearchBuffer* buffer) const;
+    /** Find the approximate nearest neighbors of all 'queries'. */
+    void find_all (T const* queries, int num_queries,
+        std::vector<Result>* results) const;
+
+    int get_element_dimensions (void) const;
+
+private:
+    /**
+     * Tree node. For inner nodes, 'left' and 'right' are the child node
+     * indices. For leaf nodes, 'split_dim' is negative and 'left' and
+     * 'right' delimit the range of element indices in the tree.
+     */
+    struct Node
+    {
+        int split_dim;
+        float split_value;
+        int left;
+        int right;
+    };
+
+    struct Tree
+    {
+        std::vector<Node> nodes;
+        std::vector<int> indices;
+    };
+
+private:
+    int build_node (Tree* tree, int begin, int end, unsigned int* rng);
+
+private:
+    int dimensions;
+    T const* elements;
+    int num_elements;
+    int num_trees;
+    int max_checks;
+    std::vector<Tree> trees;
+};
+
+/* ---------------------------------------------------------------- */
+
+template <typename T>
+inline
+KdForest<T>::KdForest (void)
+{
+    this->dimensions = 64;
+    this->elements = 0;
+    this->num_elements = 0;
+    this->num_trees = 4;
+    this->max_checks = 256;
+}
+
+template <typename T>
+inline
+KdForest<T>::SearchBuffer::Branch::Branch (float dist, int tree_id,
+    int node_id)
+    : dist(dist)
+    , tree_id(tree_id)
+    , node_id(node_id)
+{
+}
+
+template <typename T>
+inline bool
+KdForest<T>::SearchBuffer::Branch::operator< (Branch const& rhs) const
+{
+    return this->dist > rhs.dist;
+}
+
+template <typename T>
+inline void
+KdForest<T>::find (T const* query, Result* result) const
+{
+    SearchBuffer buffer;
+    this->find(query, result, &buffer);
+}
+
+template <typename T>
+inline void
+KdForest<T>::set_elements (T const* elements, int num_elements)
+{
+    this->elements = elements;
+    this->num_elements = num_elements;
+    this->trees.clear();
+}
+
+template <typename T>
+inline void
+KdForest<T>::set_element_dimensions (int element_dimensions)
+{
+    this->dimensions = element_dimensions;
+    this->trees.clear();
+}
+
+template <typename T>
+inline void
+KdForest<T>::set_num_trees (int num_trees)
+{
+    this->num_trees = num_trees;
+    this->trees.clear();
+}
+
+template <typename T>
+inline void
+KdForest<T>::set_max_checks (int max_checks)
+{
+    this->max_checks = max_checks;
+}
+
+template <typename T>
+inline int
+KdForest<T>::get_element_dimensions (void) const
+{
+    return this->dimensions;
+}
+
+SFM_NAMESPACE_END
+
+#endif  /* SFM_KD_FOREST_HEADER */
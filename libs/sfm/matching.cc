@@ -1,11 +1,261 @@
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 
 #include "math/algo.h"
 #include "sfm/nearest_neighbor.h"
+#include "sfm/simd.h"
 #include "sfm/matching.h"
 
+/*
+ * The Hamming distance kernel is compiled a second time with a function
+ * specific target attribute for the POPCNT instruction and selected at
+ * runtime, see simd.h.
+ */
+#if SFM_AVX_KERNELS
+#   define MATCHING_POPCNT_KERNEL 1
+#   define MATCHING_TARGET_POPCNT __attribute__((target("popcnt")))
+#else
+#   define MATCHING_POPCNT_KERNEL 0
+#endif
+
+#if defined(__GNUC__)
+#   define MATCHING_ALWAYS_INLINE __attribute__((always_inline))
+#else
+#   define MATCHING_ALWAYS_INLINE
+#endif
+
 SFM_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Best and second best Hamming distance and index of the best. */
+    struct HammingResult
+    {
+        int dist_1st_best;
+        int dist_2nd_best;
+        int index_1st_best;
+    };
+
+    inline MATCHING_ALWAYS_INLINE int
+    hamming_popcount (uint64_t value)
+    {
+#if defined(__GNUC__)
+        return __builtin_popcountll(value);
+#else
+        uint32_t v[2] = { static_cast<uint32_t>(value),
+            static_cast<uint32_t>(value >> 32) };
+        int count = 0;
+        for (int i = 0; i < 2; ++i)
+        {
+            v[i] = v[i] - ((v[i] >> 1) & 0x55555555);
+            v[i] = (v[i] & 0x33333333) + ((v[i] >> 2) & 0x33333333);
+            count += (((v[i] + (v[i] >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+        }
+        return count;
+#endif
+    }
+
+    inline MATCHING_ALWAYS_INLINE void
+    hamming_update (int dist, int index, HammingResult* result)
+    {
+        if (dist < result->dist_1st_best)
+        {
+            result->dist_2nd_best = result->dist_1st_best;
+            result->dist_1st_best = dist;
+            result->index_1st_best = index;
+        }
+        else if (dist < result->dist_2nd_best)
+            result->dist_2nd_best = dist;
+    }
+
+    inline MATCHING_ALWAYS_INLINE int
+    hamming_words (uint64_t const* descr1, uint64_t const* descr2, int words)
+    {
+        int dist = 0;
+        for (int k = 0; k < words; ++k)
+            dist += hamming_popcount(descr1[k] ^ descr2[k]);
+        return dist;
+    }
+
+    /*
+     * Exhaustive Hamming search of all elements of set 1 in set 2. If
+     * 'results_2' is not NULL, the search for all elements of set 2 in
+     * set 1 is performed in the same pass.
+     */
+    inline MATCHING_ALWAYS_INLINE void
+    hamming_search (uint64_t const* set_1, int set_1_size,
+        uint64_t const* set_2, int set_2_size, int words,
+        HammingResult* results_1, HammingResult* results_2)
+    {
+        for (int i = 0; i < set_1_size; ++i)
+        {
+            uint64_t const* query = set_1 + i * words;
+            HammingResult* result = results_1 + i;
+            for (int j = 0; j < set_2_size; ++j)
+            {
+                uint64_t const* elem = set_2 + j * words;
+                int const dist = hamming_words(query, elem, words);
+                hamming_update(dist, j, result);
+                if (results_2 != NULL)
+                    hamming_update(dist, i, results_2 + j);
+            }
+        }
+    }
+
+    /* The common ORB length of 4 words is unrolled by the compiler. */
+    void
+    hamming_search_default (uint64_t const* set_1, int set_1_size,
+        uint64_t const* set_2, int set_2_size, int words,
+        HammingResult* results_1, HammingResult* results_2)
+    {
+        if (words == 4)
+            hamming_search(set_1, set_1_size, set_2, set_2_size, 4,
+                results_1, results_2);
+        else
+            hamming_search(set_1, set_1_size, set_2, set_2_size, words,
+                results_1, results_2);
+    }
+
+    int
+    hamming_distance_default (uint64_t const* descr1,
+        uint64_t const* descr2, int words)
+    {
+        return hamming_words(descr1, descr2, words);
+    }
+
+#if MATCHING_POPCNT_KERNEL
+    MATCHING_TARGET_POPCNT int
+    hamming_distance_popcnt (uint64_t const* descr1,
+        uint64_t const* descr2, int words)
+    {
+        return hamming_words(descr1, descr2, words);
+    }
+
+    MATCHING_TARGET_POPCNT void
+    hamming_search_popcnt (uint64_t const* set_1, int set_1_size,
+        uint64_t const* set_2, int set_2_size, int words,
+        HammingResult* results_1, HammingResult* results_2)
+    {
+        if (words == 4)
+            hamming_search(set_1, set_1_size, set_2, set_2_size, 4,
+                results_1, results_2);
+        else
+            hamming_search(set_1, set_1_size, set_2, set_2_size, words,
+                results_1, results_2);
+    }
+
+    bool
+    hamming_cpu_popcnt (void)
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("popcnt");
+    }
+#endif
+
+    void
+    hamming_match (Matching::Options const& options,
+        uint64_t const* set_1, std::size_t set_1_size,
+        uint64_t const* set_2, std::size_t set_2_size,
+        std::vector<int>* matches_1_2, std::vector<int>* matches_2_1)
+    {
+        if (options.descriptor_length <= 0
+            || options.descriptor_length % 64 != 0)
+            throw std::invalid_argument("Invalid binary descriptor length");
+
+        HammingResult init;
+        init.dist_1st_best = std::numeric_limits<int>::max();
+        init.dist_2nd_best = std::numeric_limits<int>::max();
+        init.index_1st_best = -1;
+        std::vector<HammingResult> results_1_2(set_1_size, init);
+        std::vector<HammingResult> results_2_1;
+        if (matches_2_1 != NULL)
+            results_2_1.resize(set_2_size, init);
+
+        int const size_1 = static_cast<int>(set_1_size);
+        int const size_2 = static_cast<int>(set_2_size);
+        int const words = options.descriptor_length / 64;
+        HammingResult* results_2_ptr = matches_2_1 != NULL
+            ? &results_2_1[0] : NULL;
+#if MATCHING_POPCNT_KERNEL
+        static bool const has_popcnt = hamming_cpu_popcnt();
+        if (has_popcnt)
+            hamming_search_popcnt(set_1, size_1, set_2, size_2, words,
+                &results_1_2[0], results_2_ptr);
+        else
+#endif
+            hamming_search_default(set_1, size_1, set_2, size_2, words,
+                &results_1_2[0], results_2_ptr);
+
+        /* Apply distance and ratio thresholds. */
+        std::vector<HammingResult> const* results[2]
+            = { &results_1_2, &results_2_1 };
+        std::vector<int>* matches[2] = { matches_1_2, matches_2_1 };
+        for (int r = 0; r < 2; ++r)
+        {
+            if (matches[r] == NULL)
+                continue;
+            matches[r]->clear();
+            matches[r]->resize(results[r]->size(), -1);
+            for (std::size_t i = 0; i < results[r]->size(); ++i)
+            {
+                HammingResult const& res = results[r]->at(i);
+                float const dist_1st = static_cast<float>(res.dist_1st_best);
+                float const dist_2nd = static_cast<float>(res.dist_2nd_best);
+                if (dist_1st > options.distance_threshold)
+                    continue;
+                if (dist_1st > options.lowe_ratio_threshold * dist_2nd)
+                    continue;
+                matches[r]->at(i) = res.index_1st_best;
+            }
+        }
+    }
+}  /* namespace */
+
+void
+Matching::oneway_match_hamming (Matching::Options const& options,
+    uint64_t const* set_1, std::size_t set_1_size,
+    uint64_t const* set_2, std::size_t set_2_size,
+    std::vector<int>* result)
+{
+    result->clear();
+    result->resize(set_1_size, -1);
+    if (set_1_size == 0 || set_2_size == 0)
+        return;
+    hamming_match(options, set_1, set_1_size, set_2, set_2_size,
+        result, NULL);
+}
+
+void
+Matching::twoway_match_hamming (Matching::Options const& options,
+    uint64_t const* set_1, std::size_t set_1_size,
+    uint64_t const* set_2, std::size_t set_2_size,
+    Matching::Result* matches)
+{
+    if (set_1_size == 0 || set_2_size == 0)
+    {
+        matches->matches_1_2.clear();
+        matches->matches_1_2.resize(set_1_size, -1);
+        matches->matches_2_1.clear();
+        matches->matches_2_1.resize(set_2_size, -1);
+        return;
+    }
+    hamming_match(options, set_1, set_1_size, set_2, set_2_size,
+        &matches->matches_1_2, &matches->matches_2_1);
+}
+
+int
+Matching::hamming_distance (uint64_t const* descr1, uint64_t const* descr2,
+    int words)
+{
+#if MATCHING_POPCNT_KERNEL
+    static bool const has_popcnt = hamming_cpu_popcnt();
+    if (has_popcnt)
+        return hamming_distance_popcnt(descr1, descr2, words);
+#endif
+    return hamming_distance_default(descr1, descr2, words);
+}
+
 void
 Matching::remove_inconsistent_matches (Matching::Result* matches)
 {
@@ -9,15 +9,31 @@
 #include <vector>
 #include <limits>
 
+#include "util/stdint_compat.h"
 #include "math/defines.h"
 #include "sfm/defines.h"
 #include "sfm/nearest_neighbor.h"
+#include "sfm/block_nearest_neighbor.h"
+#include "sfm/kd_forest.h"
 
 SFM_NAMESPACE_BEGIN
 
 class Matching
 {
 public:
+    /** Nearest neighbor search algorithms. */
+    enum NearestNeighborSearch
+    {
+        /**
+         * Exact search, matches each query against all candidates. The
+         * search is blocked for cache efficiency, and the two-way matching
+         * computes both directions in a single pass.
+         */
+        NN_SEARCH_EXHAUSTIVE,
+        /** Approximate search using randomized k-d trees. */
+        NN_SEARCH_KD_FOREST
+    };
+
     /**
      * Feature matching options.
      */
@@ -27,6 +43,8 @@ public:
 
         /**
          * The length of the descriptor. Typically 128 for SIFT, 64 for SURF.
+         * For binary descriptors, the length is given in bits, e.g. 256 for
+         * ORB, and must be a multiple of 64.
          */
         int descriptor_length;
 
@@ -40,9 +58,30 @@ public:
         /**
          * Does not accept matches with distances larger than this value.
          * This needs to be tuned to the descriptor and data type used.
+         * For binary descriptors, this is the Hamming distance in bits.
          * Disabled by default.
          */
         float distance_threshold;
+
+        /**
+         * The nearest neighbor search algorithm. The approximate k-d forest
+         * search is much faster for large feature sets but does not always
+         * find the nearest neighbor. Defaults to exhaustive search.
+         */
+        NearestNeighborSearch nn_search;
+
+        /**
+         * The number of randomized trees for the k-d forest search.
+         * Defaults to 4.
+         */
+        int kd_forest_num_trees;
+
+        /**
+         * The maximum number of candidates checked per query in the k-d
+         * forest search. This is the recall budget: Larger values find more
+         * exact nearest neighbors but take longer. Defaults to 256.
+         */
+        int kd_forest_max_checks;
     };
 
     /**
@@ -83,6 +122,36 @@ public:
         T const* set_2, std::size_t set_2_size,
         Result* matches);
 
+    /**
+     * Matches binary descriptors in set 1 to binary descriptors in set 2
+     * using the Hamming distance. Each descriptor consists of
+     * descriptor_length / 64 words. The Lowe ratio test is applied to the
+     * Hamming distances (not squared). The search is exhaustive.
+     */
+    static void
+    oneway_match_hamming (Options const& options,
+        uint64_t const* set_1, std::size_t set_1_size,
+        uint64_t const* set_2, std::size_t set_2_size,
+        std::vector<int>* result);
+
+    /**
+     * Matches binary descriptors in both directions using the Hamming
+     * distance. Both directions are computed in a single pass.
+     */
+    static void
+    twoway_match_hamming (Options const& options,
+        uint64_t const* set_1, std::size_t set_1_size,
+        uint64_t const* set_2, std::size_t set_2_size,
+        Result* matches);
+
+    /**
+     * Returns the Hamming distance of two binary descriptors with the given
+     * number of 64 bit words. The POPCNT instruction is used if available.
+     */
+    static int
+    hamming_distance (uint64_t const* descr1, uint64_t const* descr2,
+        int words);
+
     /**
      * This function removes inconsistent matches.
      * A consistent match of a feature F1 in the first image to
@@ -96,6 +165,18 @@ public:
      */
     static int
     count_consistent_matches (Result const& matches);
+
+private:
+    template <typename T>
+    static void
+    apply_thresholds (Matching::Options const& options,
+        std::vector<typename NearestNeighbor<T>::Result> const& nn_results,
+        std::vector<int>* result);
+
+    template <typename T>
+    static int
+    threshold_match (Matching::Options const& options,
+        typename NearestNeighbor<T>::Result const& nn_result);
 };
 
 /* ---------------------------------------------------------------- */
@@ -105,6 +186,9 @@ Matching::Options::Options (void)
     : descriptor_length(128)
     , lowe_ratio_threshold(0.8f)
     , distance_threshold(std::numeric_limits<float>::max())
+    , nn_search(NN_SEARCH_EXHAUSTIVE)
+    , kd_forest_num_trees(4)
+    , kd_forest_max_checks(256)
 {
 }
 
@@ -120,27 +204,59 @@ Matching::oneway_match (Matching::Options const& options,
     if (set_1_size == 0 || set_2_size == 0)
         return;
 
-    float const square_lowe_thres = MATH_POW2(options.lowe_ratio_threshold);
-    float const square_dist_thres = MATH_POW2(options.distance_threshold);
-    NearestNeighbor<T> nn;
-    nn.set_elements(set_2, set_2_size);
-    nn.set_element_dimensions(options.descriptor_length);
-
-    for (std::size_t i = 0; i < set_1_size; ++i)
+    /* The k-d forest only pays off if it checks fewer candidates. */
+    if (options.nn_search == NN_SEARCH_KD_FOREST
+        && set_2_size > static_cast<std::size_t>(options.kd_forest_max_checks))
+    {
+        KdForest<T> nn;
+        nn.set_elements(set_2, set_2_size);
+        nn.set_element_dimensions(options.descriptor_length);
+        nn.set_num_trees(options.kd_forest_num_trees);
+        nn.set_max_checks(options.kd_forest_max_checks);
+        nn.build();
+        std::vector<typename NearestNeighbor<T>::Result> nn_results;
+        nn.find_all(set_1, set_1_size, &nn_results);
+        Matching::apply_thresholds<T>(options, nn_results, result);
+    }
+    else
     {
-        typename NearestNeighbor<T>::Result nn_result;
-        T const* query_pointer = set_1 + i * options.descriptor_length;
-        nn.find(query_pointer, &nn_result);
-        if (nn_result.dist_1st_best > square_dist_thres)
-            continue;
-        if (static_cast<float>(nn_result.dist_1st_best)
-            / static_cast<float>(nn_result.dist_2nd_best)
-            > square_lowe_thres)
-            continue;
-        result->at(i) = nn_result.index_1st_best;
+        BlockNearestNeighbor<T> nn;
+        nn.set_elements(set_2, set_2_size);
+        nn.set_element_dimensions(options.descriptor_length);
+        std::vector<typename NearestNeighbor<T>::Result> nn_results;
+        nn.find_all(set_1, set_1_size, &nn_results);
+        Matching::apply_thresholds<T>(options, nn_results, result);
     }
 }
 
+template <typename T>
+void
+Matching::apply_thresholds (Matching::Options const& options,
+    std::vector<typename NearestNeighbor<T>::Result> const& nn_results,
+    std::vector<int>* result)
+{
+    result->clear();
+    result->resize(nn_results.size(), -1);
+    for (std::size_t i = 0; i < nn_results.size(); ++i)
+        result->at(i) = Matching::threshold_match<T>(options, nn_results[i]);
+}
+
+template <typename T>
+int
+Matching::threshold_match (Matching::Options const& options,
+    typename NearestNeighbor<T>::Result const& nn_result)
+{
+    float const square_lowe_thres = MATH_POW2(options.lowe_ratio_threshold);
+    float const square_dist_thres = MATH_POW2(options.distance_threshold);
+    if (nn_result.dist_1st_best > square_dist_thres)
+        return -1;
+    if (static_cast<float>(nn_result.dist_1st_best)
+        / static_cast<float>(nn_result.dist_2nd_best)
+        > square_lowe_thres)
+        return -1;
+    return nn_result.index_1st_best;
+}
+
 template <typename T>
 void
 Matching::twoway_match (Matching::Options const& options,
@@ -148,10 +264,26 @@ Matching::twoway_match (Matching::Options const& options,
     T const* set_2, std::size_t set_2_size,
     Matching::Result* matches)
 {
-    Matching::oneway_match(options, set_1, set_1_size,
-        set_2, set_2_size, &matches->matches_1_2);
-    Matching::oneway_match(options, set_2, set_2_size,
-        set_1, set_1_size, &matches->matches_2_1);
+    if (options.nn_search == NN_SEARCH_KD_FOREST
+        || set_1_size == 0 || set_2_size == 0)
+    {
+        Matching::oneway_match(options, set_1, set_1_size,
+            set_2, set_2_size, &matches->matches_1_2);
+        Matching::oneway_match(options, set_2, set_2_size,
+            set_1, set_1_size, &matches->matches_2_1);
+        return;
+    }
+
+    /* Both directions from one pass over the inner products. */
+    BlockNearestNeighbor<T> nn;
+    nn.set_elements(set_2, set_2_size);
+    nn.set_element_dimensions(options.descriptor_length);
+    std::vector<typename NearestNeighbor<T>::Result> results_1_2, results_2_1;
+    nn.find_all(set_1, set_1_size, &results_1_2, &results_2_1);
+    Matching::apply_thresholds<T>(options, results_1_2,
+        &matches->matches_1_2);
+    Matching::apply_thresholds<T>(options, results_2_1,
+        &matches->matches_2_1);
 }
 
 SFM_NAMESPACE_END
@@ -18,17 +18,21 @@
  * - xmmintrin.h     X86 SSE1
  * - emmintrin.h     X86 SSE2
  * - pmmintrin.h     X86 SSE3
+ * - immintrin.h     X86 AVX, AVX2, AVX-512
  *
  * MMX/SSE Data Types:
  * - MMX:  __m64 64 bits of integers.
  * - SSE1: __m128 128 bits: four single precision floats.
  * - SSE2: __m128i 128 bits of packed integers, __m128d 128 bits: two doubles.
+ * - AVX2: __m256i 256 bits of packed integers, __m256 eight floats.
+ * - AVX-512: __m512i 512 bits of packed integers, __m512 sixteen floats.
  *
  * Macros to check for availability:
  * - X86 MMX            __MMX__
  * - X86 SSE            __SSE__
  * - X86 SSE2           __SSE2__
  * - X86 SSE3           __SSE3__
+ * - X86 AVX2/AVX-512   __builtin_cpu_supports("avx2") (at runtime)
  * - altivec functions  __VEC__
  * - neon functions     __ARM_NEON__
  */
@@ -41,16 +45,66 @@
 
 #include "sfm/nearest_neighbor.h"
 
+/* The AVX2 and AVX-512 kernels are selected at runtime, see simd.h. */
+#if SFM_AVX_KERNELS
+#   include <immintrin.h> // AVX2, AVX-512
+#   define NN_AVX_KERNELS 1
+#   define NN_TARGET_AVX2 __attribute__((target("avx2")))
+#   define NN_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#   define NN_AVX_KERNELS 0
+#endif
+
 SFM_NAMESPACE_BEGIN
 
 namespace
 {
+    /* Check if new largest inner product has been found. */
+    template <typename T, typename V>
+    inline void
+    nn_update_result (V inner_product, int index,
+        typename NearestNeighbor<T>::Result* result)
+    {
+        if (inner_product > result->dist_2nd_best)
+        {
+            if (inner_product > result->dist_1st_best)
+            {
+                result->index_2nd_best = result->index_1st_best;
+                result->dist_2nd_best = result->dist_1st_best;
+                result->index_1st_best = index;
+                result->dist_1st_best = inner_product;
+            }
+            else
+            {
+                result->index_2nd_best = index;
+                result->dist_2nd_best = inner_product;
+            }
+        }
+    }
+
     template <typename T>
     void
-    nn_find_short (T const* query, typename NearestNeighbor<T>::Result* result,
+    nn_find_short_scalar (T const* query,
+        typename NearestNeighbor<T>::Result* result,
         T const* elements, int num_elements, int dimensions)
     {
+        T const* descr_ptr = elements;
+        for (int i = 0; i < num_elements; ++i)
+        {
+            int inner_product = 0;
+            for (int j = 0; j < dimensions; ++j, ++descr_ptr)
+                inner_product += query[j] * *descr_ptr;
+            nn_update_result<T>(inner_product, i, result);
+        }
+    }
+
 #if ENABLE_SSE2_NN_SEARCH && defined(__SSE2__)
+    template <typename T>
+    void
+    nn_find_short_sse2 (T const* query,
+        typename NearestNeighbor<T>::Result* result,
+        T const* elements, int num_elements, int dimensions)
+    {
         /*
          * SSE inner product implementation.
          * Note that query and result should be 16 byte aligned.
@@ -79,51 +133,239 @@ namespace
             int inner_product = tmp[0] + tmp[1] + tmp[2] + tmp[3]
                 + tmp[4] + tmp[5] + tmp[6] + tmp[7];
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product > result->dist_2nd_best)
+            nn_update_result<T>(inner_product, descr_iter, result);
+        }
+    }
+#endif
+
+#if NN_AVX_KERNELS
+    /*
+     * AVX2 and AVX-512 inner product implementations.
+     * Instead of 16 bit products and sums, the products of adjacent pairs
+     * are added to 32 bit integers (vpmaddwd), which is always exact. The
+     * SSE2 kernel only yields the same results for the value ranges of
+     * signed and unsigned short given in the header. The dimension size
+     * must be divisible by 16 (AVX2) or 32 (AVX-512). Unaligned loads are
+     * used since the descriptors are only guaranteed to be 16 byte aligned.
+     */
+    template <typename T>
+    NN_TARGET_AVX2 void
+    nn_find_short_avx2 (T const* query,
+        typename NearestNeighbor<T>::Result* result,
+        T const* elements, int num_elements, int dimensions)
+    {
+        int const dim_16 = dimensions / 16;
+        __m256i const* descr_ptr = reinterpret_cast<__m256i const*>(elements);
+        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        {
+            __m256i const* query_ptr = reinterpret_cast<__m256i const*>(query);
+            __m256i reg_result = _mm256_setzero_si256();
+            for (int i = 0; i < dim_16; ++i, ++query_ptr, ++descr_ptr)
             {
-                if (inner_product > result->dist_1st_best)
-                {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = descr_iter;
-                    result->dist_1st_best = inner_product;
-                }
-                else
-                {
-                    result->index_2nd_best = descr_iter;
-                    result->dist_2nd_best = inner_product;
-                }
+                __m256i reg_query = _mm256_loadu_si256(query_ptr);
+                __m256i reg_subject = _mm256_loadu_si256(descr_ptr);
+                reg_result = _mm256_add_epi32(reg_result,
+                    _mm256_madd_epi16(reg_query, reg_subject));
             }
+            __m128i reg_sum = _mm_add_epi32(
+                _mm256_castsi256_si128(reg_result),
+                _mm256_extracti128_si256(reg_result, 1));
+            reg_sum = _mm_hadd_epi32(reg_sum, reg_sum);
+            reg_sum = _mm_hadd_epi32(reg_sum, reg_sum);
+            int inner_product = _mm_cvtsi128_si32(reg_sum);
+
+            nn_update_result<T>(inner_product, descr_iter, result);
         }
-#else
-        T const* descr_ptr = elements;
-        for (int i = 0; i < num_elements; ++i)
-        {
-            int inner_product = 0;
-            for (int i = 0; i < dimensions; ++i, ++descr_ptr)
-                inner_product += query[i] * *descr_ptr;
+    }
 
-            /* Check if new largest inner product has been found. */
-            if (inner_product > result->dist_2nd_best)
+/* GCC reports false positives for the _mm512_reduce_add_*() internals. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    template <typename T>
+    NN_TARGET_AVX512 void
+    nn_find_short_avx512 (T const* query,
+        typename NearestNeighbor<T>::Result* result,
+        T const* elements, int num_elements, int dimensions)
+    {
+        int const dim_32 = dimensions / 32;
+        __m512i const* descr_ptr = reinterpret_cast<__m512i const*>(elements);
+        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        {
+            __m512i const* query_ptr = reinterpret_cast<__m512i const*>(query);
+            __m512i reg_result = _mm512_setzero_si512();
+            for (int i = 0; i < dim_32; ++i, ++query_ptr, ++descr_ptr)
             {
-                if (inner_product > result->dist_1st_best)
-                {
-                    result->index_2nd_best = result->index_1st_best;
-                    result->dist_2nd_best = result->dist_1st_best;
-                    result->index_1st_best = i;
-                    result->dist_1st_best = inner_product;
-                }
-                else
-                {
-                    result->index_2nd_best = i;
-                    result->dist_2nd_best = inner_product;
-                }
+                __m512i reg_query = _mm512_loadu_si512(query_ptr);
+                __m512i reg_subject = _mm512_loadu_si512(descr_ptr);
+                reg_result = _mm512_add_epi32(reg_result,
+                    _mm512_madd_epi16(reg_query, reg_subject));
             }
+            int inner_product = _mm512_reduce_add_epi32(reg_result);
+
+            nn_update_result<T>(inner_product, descr_iter, result);
+        }
+    }
+#pragma GCC diagnostic pop
+#endif
+
+    template <typename T>
+    void
+    nn_find_short (SimdLevel simd, T const* query,
+        typename NearestNeighbor<T>::Result* result,
+        T const* elements, int num_elements, int dimensions)
+    {
+#if NN_AVX_KERNELS
+        if (simd >= SIMD_AVX512 && dimensions % 32 == 0)
+        {
+            nn_find_short_avx512<T>(query, result,
+                elements, num_elements, dimensions);
+            return;
+        }
+        if (simd >= SIMD_AVX2 && dimensions % 16 == 0)
+        {
+            nn_find_short_avx2<T>(query, result,
+                elements, num_elements, dimensions);
+            return;
+        }
+#endif
+#if ENABLE_SSE2_NN_SEARCH && defined(__SSE2__)
+        if (simd >= SIMD_SSE && dimensions % 8 == 0)
+        {
+            nn_find_short_sse2<T>(query, result,
+                elements, num_elements, dimensions);
+            return;
         }
 #endif
+        nn_find_short_scalar<T>(query, result,
+            elements, num_elements, dimensions);
     }
 
+    void
+    nn_find_float_scalar (float const* query,
+        NearestNeighbor<float>::Result* result,
+        float const* elements, int num_elements, int dimensions)
+    {
+        float const* descr_ptr = elements;
+        for (int i = 0; i < num_elements; ++i)
+        {
+            float inner_product = 0.0f;
+            for (int j = 0; j < dimensions; ++j, ++descr_ptr)
+                inner_product += query[j] * *descr_ptr;
+            nn_update_result<float>(inner_product, i, result);
+        }
+    }
+
+#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
+    void
+    nn_find_float_sse3 (float const* query,
+        NearestNeighbor<float>::Result* result,
+        float const* elements, int num_elements, int dimensions)
+    {
+        /*
+         * SSE inner product implementation.
+         * Note that query and result should be 16 byte aligned.
+         * Otherwise loading and storing values into/from registers is slow.
+         * The dimension size must be divisible by 4, each __m128 register
+         * can load 4 floats = 16 bytes = 128 bit.
+         */
+
+        __m128 const* descr_ptr = reinterpret_cast<__m128 const*>(elements);
+        int const dim_4 = dimensions / 4;
+        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        {
+            /* Compute dot product between query and candidate. */
+            __m128 const* query_ptr = reinterpret_cast<__m128 const*>(query);
+            __m128 sum = _mm_setzero_ps();
+            for (int i = 0; i < dim_4; ++i, ++query_ptr, ++descr_ptr)
+                sum = _mm_add_ps(sum, _mm_mul_ps(*query_ptr, *descr_ptr));
+            sum = _mm_hadd_ps(sum, sum);
+            sum = _mm_hadd_ps(sum, sum);
+
+            float inner_product = _mm_cvtss_f32(sum);
+            nn_update_result<float>(inner_product, descr_iter, result);
+        }
+    }
+#endif
+
+#if NN_AVX_KERNELS
+    NN_TARGET_AVX2 void
+    nn_find_float_avx2 (float const* query,
+        NearestNeighbor<float>::Result* result,
+        float const* elements, int num_elements, int dimensions)
+    {
+        int const dim_8 = dimensions / 8;
+        float const* descr_ptr = elements;
+        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        {
+            float const* query_ptr = query;
+            __m256 sum = _mm256_setzero_ps();
+            for (int i = 0; i < dim_8; ++i, query_ptr += 8, descr_ptr += 8)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(
+                    _mm256_loadu_ps(query_ptr), _mm256_loadu_ps(descr_ptr)));
+            __m128 sum_128 = _mm_add_ps(_mm256_castps256_ps128(sum),
+                _mm256_extractf128_ps(sum, 1));
+            sum_128 = _mm_hadd_ps(sum_128, sum_128);
+            sum_128 = _mm_hadd_ps(sum_128, sum_128);
+
+            float inner_product = _mm_cvtss_f32(sum_128);
+            nn_update_result<float>(inner_product, descr_iter, result);
+        }
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    NN_TARGET_AVX512 void
+    nn_find_float_avx512 (float const* query,
+        NearestNeighbor<float>::Result* result,
+        float const* elements, int num_elements, int dimensions)
+    {
+        int const dim_16 = dimensions / 16;
+        float const* descr_ptr = elements;
+        for (int descr_iter = 0; descr_iter < num_elements; ++descr_iter)
+        {
+            float const* query_ptr = query;
+            __m512 sum = _mm512_setzero_ps();
+            for (int i = 0; i < dim_16; ++i, query_ptr += 16, descr_ptr += 16)
+                sum = _mm512_add_ps(sum, _mm512_mul_ps(
+                    _mm512_loadu_ps(query_ptr), _mm512_loadu_ps(descr_ptr)));
+
+            float inner_product = _mm512_reduce_add_ps(sum);
+            nn_update_result<float>(inner_product, descr_iter, result);
+        }
+    }
+#pragma GCC diagnostic pop
+#endif
+
+    void
+    nn_find_float (SimdLevel simd, float const* query,
+        NearestNeighbor<float>::Result* result,
+        float const* elements, int num_elements, int dimensions)
+    {
+#if NN_AVX_KERNELS
+        if (simd >= SIMD_AVX512 && dimensions % 16 == 0)
+        {
+            nn_find_float_avx512(query, result,
+                elements, num_elements, dimensions);
+            return;
+        }
+        if (simd >= SIMD_AVX2 && dimensions % 8 == 0)
+        {
+            nn_find_float_avx2(query, result,
+                elements, num_elements, dimensions);
+            return;
+        }
+#endif
+#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
+        if (simd >= SIMD_SSE && dimensions % 4 == 0)
+        {
+            nn_find_float_sse3(query, result,
+                elements, num_elements, dimensions);
+            return;
+        }
+#endif
+        nn_find_float_scalar(query, result,
+            elements, num_elements, dimensions);
+    }
 }
 
 template <>
@@ -137,19 +379,14 @@ NearestNeighbor<short>::find (short const* query,
     result->index_1st_best = 0;
     result->index_2nd_best = 0;
 
-    nn_find_short<short>(query, result, this->elements,
+    nn_find_short<short>(this->simd, query, result, this->elements,
         this->num_elements, this->dimensions);
 
-    /*
-     * Compute actual square distances.
-     * The distance with 'signed char' vectors is: 2 * 127^2 - 2 * <Q, Ci>.
-     * The maximum distance is (2*127)^2, which unfortunately does not fit
-     * in a signed short. Therefore, the distance is clapmed at 127^2.
-     */
-    result->dist_1st_best = std::min(16129, std::max(0, (int)result->dist_1st_best));
-    result->dist_2nd_best = std::min(16129, std::max(0, (int)result->dist_2nd_best));
-    result->dist_1st_best = 32258 - 2 * result->dist_1st_best;
-    result->dist_2nd_best = 32258 - 2 * result->dist_2nd_best;
+    /* Compute actual square distances. */
+    result->dist_1st_best = inner_product_to_distance
+        (result->dist_1st_best, short());
+    result->dist_2nd_best = inner_product_to_distance
+        (result->dist_2nd_best, short());
 }
 
 template <>
@@ -157,29 +394,23 @@ void
 NearestNeighbor<unsigned short>::find (unsigned short const* query,
     NearestNeighbor<unsigned short>::Result* result) const
 {
-    /* Result distances are shamelessly misused to store inner products. */
-    result->dist_1st_best = -std::numeric_limits<unsigned short>::max();
-    result->dist_2nd_best = -std::numeric_limits<unsigned short>::max();
+    /*
+     * Result distances are shamelessly misused to store inner products,
+     * which are never negative for unsigned descriptors.
+     */
+    result->dist_1st_best = 0;
+    result->dist_2nd_best = 0;
     result->index_1st_best = 0;
     result->index_2nd_best = 0;
 
-    nn_find_short<unsigned short>(query, result, this->elements,
-        this->num_elements, this->dimensions);
+    nn_find_short<unsigned short>(this->simd, query, result,
+        this->elements, this->num_elements, this->dimensions);
 
-    /*
-     * Compute actual square distances.
-     * The distance with 'unsigned char' vectors is: 2 * 255^2 - 2 * <Q, Ci>.
-     * The maximum distance is (2*255)^2, which unfortunately does not fit
-     * in a unsigned short. Therefore, the result distance is clapmed:
-     * 2 * 255^2 - 2 * <Q, Ci> = 2 * (255^2 - <Q, Ci>) and (255^2 - <Q, Ci>)
-     * is clamped to 32767 and then multiplied by 2.
-     */
-    result->dist_1st_best = std::min(65025, (int)result->dist_1st_best);
-    result->dist_2nd_best = std::min(65025, (int)result->dist_2nd_best);
-    result->dist_1st_best = 65025 - result->dist_1st_best;
-    result->dist_2nd_best = 65025 - result->dist_2nd_best;
-    result->dist_1st_best = std::min(32767, (int)result->dist_1st_best) * 2;
-    result->dist_2nd_best = std::min(32767, (int)result->dist_2nd_best) * 2;
+    /* Compute actual square distances. */
+    result->dist_1st_best = inner_product_to_distance
+        (result->dist_1st_best, (unsigned short)0);
+    result->dist_2nd_best = inner_product_to_distance
+        (result->dist_2nd_best, (unsigned short)0);
 }
 
 template <>
@@ -193,79 +424,14 @@ NearestNeighbor<float>::find (float const* query,
     result->index_1st_best = 0;
     result->index_2nd_best = 0;
 
-#if ENABLE_SSE3_NN_SEARCH && defined(__SSE3__)
-    /*
-     * SSE inner product implementation.
-     * Note that query and result should be 16 byte aligned.
-     * Otherwise loading and storing values into/from registers is slow.
-     * The dimension size must be divisible by 4, each __m128 register
-     * can load 4 floats = 16 bytes = 128 bit.
-     */
-
-    __m128 const* descr_ptr = reinterpret_cast<__m128 const*>(this->elements);
-    int const dim_4 = this->dimensions / 4;
-    for (int descr_iter = 0; descr_iter < this->num_elements; ++descr_iter)
-    {
-        /* Compute dot product between query and candidate. */
-        __m128 const* query_ptr = reinterpret_cast<__m128 const*>(query);
-        __m128 sum = _mm_setzero_ps();
-        for (int i = 0; i < dim_4; ++i, ++query_ptr, ++descr_ptr)
-            sum = _mm_add_ps(sum, _mm_mul_ps(*query_ptr, *descr_ptr));
-        sum = _mm_hadd_ps(sum, sum);
-        sum = _mm_hadd_ps(sum, sum);
-
-        /* Check if new largest inner product has been found. */
-        float inner_product = _mm_cvtss_f32(sum);
-        if (inner_product > result->dist_2nd_best)
-        {
-            if (inner_product > result->dist_1st_best)
-            {
-                result->index_2nd_best = result->index_1st_best;
-                result->dist_2nd_best = result->dist_1st_best;
-                result->index_1st_best = descr_iter;
-                result->dist_1st_best = inner_product;
-            }
-            else
-            {
-                result->index_2nd_best = descr_iter;
-                result->dist_2nd_best = inner_product;
-            }
-        }
-    }
-#else
-    float const* descr_ptr = this->elements;
-    for (int i = 0; i < this->num_elements; ++i)
-    {
-        float inner_product = 0.0f;
-        for (int j = 0; j < this->dimensions; ++j, ++descr_ptr)
-            inner_product += query[j] * *descr_ptr;
-
-        /* Check if new largest inner product has been found. */
-        if (inner_product > result->dist_2nd_best)
-        {
-            if (inner_product > result->dist_1st_best)
-            {
-                result->index_2nd_best = result->index_1st_best;
-                result->dist_2nd_best = result->dist_1st_best;
-                result->index_1st_best = i;
-                result->dist_1st_best = inner_product;
-            }
-            else
-            {
-                result->index_2nd_best = i;
-                result->dist_2nd_best = inner_product;
-            }
-        }
-    }
-#endif
+    nn_find_float(this->simd, query, result, this->elements,
+        this->num_elements, this->dimensions);
 
-    /*
-     * Compute actual (square) distances.
-     */
-    result->dist_1st_best = std::min(1.0f, std::max(0.0f,
-        2.0f - 2.0f * result->dist_1st_best));
-    result->dist_2nd_best = std::min(1.0f, std::max(0.0f,
-        2.0f - 2.0f * result->dist_2nd_best));
+    /* Compute actual (square) distances. */
+    result->dist_1st_best = inner_product_to_distance
+        (result->dist_1st_best, float());
+    result->dist_2nd_best = inner_product_to_distance
+        (result->dist_2nd_best, float());
 }
 
 SFM_NAMESPACE_END
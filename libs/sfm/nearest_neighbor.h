@@ -6,7 +6,10 @@
 #ifndef SFM_NEAREST_NEIGHBOR_HEADER
 #define SFM_NEAREST_NEIGHBOR_HEADER
 
+#include <algorithm>
+
 #include "sfm/defines.h"
+#include "sfm/simd.h"
 
 #define ENABLE_SSE2_NN_SEARCH 1
 #define ENABLE_SSE3_NN_SEARCH 1
@@ -28,7 +31,10 @@ SFM_NAMESPACE_BEGIN
  *
  * Notes: For SSE accellerated dot products, vector dimension must be a factor
  * of 8 (i.e. 128 bit registers for SSE). Query and elements must be 16 byte
- * aligned for efficient memory access.
+ * aligned for efficient memory access. The AVX2 (256 bit) and AVX-512
+ * (512 bit) kernels are used if the CPU supports them and the dimension
+ * is a factor of the register width, otherwise the SSE kernels are used.
+ * Dimensions that are not a factor of 8 fall back to the plain C++ code.
  *
  * The following types are supported:
  *   - signed short using SSE2
@@ -37,6 +43,16 @@ SFM_NAMESPACE_BEGIN
  *     value range 0 to 255, normalized to 255, max distance 65534
  *   - float using SSE3
  *     any value range, normalized to 1, any distance possible
+ *
+ * For short types, all kernels yield identical results only within these
+ * value ranges. The SSE2 kernel sums products in 16 bit with wraparound,
+ * whereas the AVX kernels and the plain C++ code accumulate in 32 bit.
+ *
+ * For float, the kernels sum the products in as many partial sums as the
+ * vector has lanes. Thus, the inner products and, for near ties, the best
+ * and second best neighbors may differ by rounding between instruction
+ * sets, i.e., between CPUs. FMA is not used, so every product is rounded
+ * like in the SSE kernel and the plain C++ code.
  */
 template <typename T>
 class NearestNeighbor
@@ -59,15 +75,52 @@ public:
     void set_element_dimensions (int element_dimensions);
     /** Find the nearest neighbor of 'query'. */
     void find (T const* query, Result* result) const;
+    /**
+     * Limits the SIMD instruction set, e.g. for benchmarking. Instruction
+     * sets not supported by the CPU are ignored. Defaults to the widest
+     * instruction set supported by the CPU.
+     */
+    void set_simd (SimdLevel simd);
 
     int get_element_dimensions (void) const;
+    SimdLevel get_simd (void) const;
 
 private:
     int dimensions;
     T const* elements;
     int num_elements;
+    SimdLevel simd;
+};
+
+/**
+ * Type of the inner products of the search, which are computed in int
+ * for the short types and in float for float.
+ */
+template <typename T>
+struct InnerProduct
+{
+    typedef int Type;
 };
 
+template <>
+struct InnerProduct<float>
+{
+    typedef float Type;
+};
+
+/**
+ * Converts the inner product of normalized vectors to the square distance
+ * of the result, clamped to the range given above. The second argument
+ * only selects the vector type. This is shared by all searches, which
+ * find the largest inner products.
+ */
+short
+inner_product_to_distance (int inner_product, short);
+unsigned short
+inner_product_to_distance (int inner_product, unsigned short);
+float
+inner_product_to_distance (float inner_product, float);
+
 /* ---------------------------------------------------------------- */
 
 template <typename T>
@@ -77,6 +130,7 @@ NearestNeighbor<T>::NearestNeighbor (void)
     this->dimensions = 64;
     this->elements = 0;
     this->num_elements = 0;
+    this->simd = detect_simd();
 }
 
 template <typename T>
@@ -94,6 +148,14 @@ NearestNeighbor<T>::set_element_dimensions (int element_dimensions)
     this->dimensions = element_dimensions;
 }
 
+template <typename T>
+inline void
+NearestNeighbor<T>::set_simd (SimdLevel simd)
+{
+    SimdLevel const supported = detect_simd();
+    this->simd = simd < supported ? simd : supported;
+}
+
 template <typename T>
 inline int
 NearestNeighbor<T>::get_element_dimensions (void) const
@@ -101,6 +163,44 @@ NearestNeighbor<T>::get_element_dimensions (void) const
     return this->dimensions;
 }
 
+template <typename T>
+inline SimdLevel
+NearestNeighbor<T>::get_simd (void) const
+{
+    return this->simd;
+}
+
+/*
+ * The distance with 'signed char' vectors is: 2 * 127^2 - 2 * <Q, Ci>.
+ * The maximum distance is (2*127)^2, which unfortunately does not fit
+ * in a signed short. Therefore, the distance is clapmed at 127^2.
+ */
+inline short
+inner_product_to_distance (int inner_product, short)
+{
+    return 32258 - 2 * std::min(16129, std::max(0, inner_product));
+}
+
+/*
+ * The distance with 'unsigned char' vectors is: 2 * 255^2 - 2 * <Q, Ci>.
+ * The maximum distance is (2*255)^2, which unfortunately does not fit
+ * in a unsigned short. Therefore, the result distance is clapmed:
+ * 2 * 255^2 - 2 * <Q, Ci> = 2 * (255^2 - <Q, Ci>) and (255^2 - <Q, Ci>)
+ * is clamped to 32767 and then multiplied by 2.
+ */
+inline unsigned short
+inner_product_to_distance (int inner_product, unsigned short)
+{
+    int const dist = 65025 - std::min(65025, std::max(0, inner_product));
+    return std::min(32767, dist) * 2;
+}
+
+inline float
+inner_product_to_distance (float inner_product, float)
+{
+    return std::min(1.0f, std::max(0.0f, 2.0f - 2.0f * inner_product));
+}
+
 SFM_NAMESPACE_END
 
 #endif  /* SFM_NEAREST_NEIGHBOR_HEADER */
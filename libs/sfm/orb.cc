@@ -0,0 +1,430 @@
+/*
+ * ORB implementation.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+#include "util/timer.h"
+#include "math/defines.h"
+#include "math/functions.h"
+#include "mve/image_tools.h"
+#include "sfm/orb.h"
+
+/* Radius of the circular patch for orientation and descriptor. */
+#define ORB_PATCH_RADIUS 15
+/* Keypoints closer to the level boundary are discarded. */
+#define ORB_BORDER (ORB_PATCH_RADIUS + 1)
+/* Half size of the Harris corner measure window. */
+#define ORB_HARRIS_RADIUS 3
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    /*
+     * The BRIEF test pattern with 256 point pairs. The points are drawn
+     * from an isotropic Gaussian with sigma = S / 5 for the patch size
+     * S = 31, and restricted to the circular patch such that rotated
+     * points stay within the patch. A fixed linear congruential generator
+     * makes the pattern independent of the platform.
+     */
+    struct OrbPattern
+    {
+        OrbPattern (void);
+        int points[256][4];
+    };
+
+    OrbPattern::OrbPattern (void)
+    {
+        uint32_t state = 0x2545f491;
+        float const sigma = (2 * ORB_PATCH_RADIUS + 1) / 5.0f;
+        for (int i = 0; i < 256; ++i)
+        {
+            for (int j = 0; j < 4; j += 2)
+            {
+                int x, y;
+                do
+                {
+                    /* Box-Muller transform of two uniform samples. */
+                    double u[2];
+                    for (int k = 0; k < 2; ++k)
+                    {
+                        state = state * 1664525u + 1013904223u;
+                        u[k] = static_cast<double>((state >> 8) + 1)
+                            / static_cast<double>(1 << 24);
+                    }
+                    double const r = sigma * std::sqrt(-2.0 * std::log(u[0]));
+                    double const phi = 2.0 * MATH_PI * u[1];
+                    x = static_cast<int>(math::round(r * std::cos(phi)));
+                    y = static_cast<int>(math::round(r * std::sin(phi)));
+                }
+                while (x * x + y * y > MATH_POW2(ORB_PATCH_RADIUS - 1)
+                    || (j == 2 && x == this->points[i][0]
+                    && y == this->points[i][1]));
+                this->points[i][j + 0] = x;
+                this->points[i][j + 1] = y;
+            }
+        }
+    }
+
+    OrbPattern const orb_pattern;
+
+    /* Offsets of the 16 pixels on the FAST circle with radius 3. */
+    int const fast_circle[16][2] = {
+        { 0, -3 }, { 1, -3 }, { 2, -2 }, { 3, -1 },
+        { 3, 0 }, { 3, 1 }, { 2, 2 }, { 1, 3 },
+        { 0, 3 }, { -1, 3 }, { -2, 2 }, { -3, 1 },
+        { -3, 0 }, { -3, -1 }, { -2, -2 }, { -1, -3 }
+    };
+
+    /* Checks for a contiguous arc of at least 9 bits in the 16 bit mask. */
+    inline bool
+    fast_has_arc (uint32_t mask)
+    {
+        uint32_t const circular = mask | (mask << 16);
+        uint32_t run = circular;
+        for (int i = 1; i < 9; ++i)
+            run &= circular >> i;
+        return run != 0;
+    }
+
+    /* Returns true if the pixel is a FAST-9 corner. */
+    inline bool
+    fast_test (uint8_t const* ptr, int const* offsets, int threshold)
+    {
+        int const center = *ptr;
+        int const upper = center + threshold;
+        int const lower = center - threshold;
+
+        /* A 9 pixel arc covers at least two of the four compass pixels. */
+        int const c0 = ptr[offsets[0]];
+        int const c4 = ptr[offsets[4]];
+        int const c8 = ptr[offsets[8]];
+        int const c12 = ptr[offsets[12]];
+        int const num_bright = (c0 > upper) + (c4 > upper)
+            + (c8 > upper) + (c12 > upper);
+        int const num_dark = (c0 < lower) + (c4 < lower)
+            + (c8 < lower) + (c12 < lower);
+        if (num_bright < 2 && num_dark < 2)
+            return false;
+
+        uint32_t bright = 0, dark = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int const value = ptr[offsets[i]];
+            bright |= static_cast<uint32_t>(value > upper) << i;
+            dark |= static_cast<uint32_t>(value < lower) << i;
+        }
+        return fast_has_arc(bright) || fast_has_arc(dark);
+    }
+
+    /* Harris corner measure with central differences and k = 0.04. */
+    float
+    harris_score (uint8_t const* ptr, int stride)
+    {
+        int a = 0, b = 0, c = 0;
+        for (int y = -ORB_HARRIS_RADIUS; y <= ORB_HARRIS_RADIUS; ++y)
+        {
+            uint8_t const* row = ptr + y * stride;
+            for (int x = -ORB_HARRIS_RADIUS; x <= ORB_HARRIS_RADIUS; ++x)
+            {
+                int const dx = row[x + 1] - row[x - 1];
+                int const dy = row[x + stride] - row[x - stride];
+                a += dx * dx;
+                b += dy * dy;
+                c += dx * dy;
+            }
+        }
+        float const fa = static_cast<float>(a);
+        float const fb = static_cast<float>(b);
+        float const fc = static_cast<float>(c);
+        return fa * fb - fc * fc - 0.04f * (fa + fb) * (fa + fb);
+    }
+
+    /* Orders keypoints by decreasing score and position for ties. */
+    bool
+    compare_keypoints (Orb::Keypoint const& kp1, Orb::Keypoint const& kp2)
+    {
+        if (kp1.score != kp2.score)
+            return kp1.score > kp2.score;
+        if (kp1.y != kp2.y)
+            return kp1.y < kp2.y;
+        return kp1.x < kp2.x;
+    }
+}  /* namespace */
+
+Orb::Orb (Options const& options)
+    : options(options)
+{
+    if (this->options.num_levels < 1)
+        throw std::invalid_argument("Invalid number of levels");
+    if (this->options.scale_factor <= 1.0f)
+        throw std::invalid_argument("Invalid scale factor");
+}
+
+void
+Orb::set_image (mve::ByteImage::ConstPtr image)
+{
+    if (image->channels() != 1 && image->channels() != 3)
+        throw std::invalid_argument("Gray or color image expected");
+    if (image->channels() == 3)
+        image = mve::image::desaturate<uint8_t>(image,
+            mve::image::DESATURATE_LIGHTNESS);
+    this->orig = image;
+}
+
+void
+Orb::process (void)
+{
+    util::ClockTimer timer, total_timer;
+
+    /* Create the image pyramid. */
+    if (this->options.verbose_output)
+    {
+        std::cout << "ORB: Creating " << this->options.num_levels
+            << " pyramid levels..." << std::endl;
+    }
+    timer.reset();
+    this->create_pyramid();
+    if (this->options.debug_output)
+    {
+        std::cout << "ORB: Creating pyramid took "
+            << timer.get_elapsed() << "ms." << std::endl;
+    }
+
+    /* Detect and select keypoints. */
+    if (this->options.verbose_output)
+        std::cout << "ORB: Detecting keypoints..." << std::endl;
+    timer.reset();
+    this->keypoint_detection();
+    if (this->options.debug_output)
+    {
+        std::cout << "ORB: Detected " << this->keypoints.size()
+            << " keypoints, took " << timer.get_elapsed() << "ms."
+            << std::endl;
+    }
+
+    /* Compute orientation and descriptor for every keypoint. */
+    if (this->options.verbose_output)
+        std::cout << "ORB: Generating keypoint descriptors..." << std::endl;
+    timer.reset();
+    this->descriptor_generation();
+    if (this->options.debug_output)
+    {
+        std::cout << "ORB: Generated " << this->descriptors.size()
+            << " descriptors, took " << timer.get_elapsed() << "ms."
+            << std::endl;
+    }
+
+    if (this->options.verbose_output)
+    {
+        std::cout << "ORB: Generated " << this->descriptors.size()
+            << " descriptors from " << this->keypoints.size()
+            << " keypoints. Took " << total_timer.get_elapsed()
+            << "ms." << std::endl;
+    }
+
+    /* Free memory. */
+    this->pyramid.clear();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Orb::create_pyramid (void)
+{
+    if (this->orig == NULL)
+        throw std::runtime_error("Input image not set");
+
+    int const min_size = 2 * ORB_BORDER + 1;
+    this->pyramid.clear();
+    this->pyramid.push_back(mve::ByteImage::create(*this->orig));
+    for (int i = 1; i < this->options.num_levels; ++i)
+    {
+        float const scale = this->level_scale(i);
+        int const width = static_cast<int>
+            (math::round(this->orig->width() / scale));
+        int const height = static_cast<int>
+            (math::round(this->orig->height() / scale));
+        if (width < min_size || height < min_size)
+            break;
+        this->pyramid.push_back(mve::image::rescale<uint8_t>
+            (this->pyramid.back(), mve::image::RESCALE_LINEAR,
+            width, height));
+    }
+}
+
+float
+Orb::level_scale (int level) const
+{
+    return std::pow(this->options.scale_factor, static_cast<float>(level));
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Orb::keypoint_detection (void)
+{
+    int const num_levels = static_cast<int>(this->pyramid.size());
+    std::vector<Keypoints> level_keypoints(num_levels);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < num_levels; ++i)
+        this->keypoint_detection(i, &level_keypoints[i]);
+
+    /* Distribute the feature budget proportional to the level area. */
+    double total_area = 0.0;
+    for (int i = 0; i < num_levels; ++i)
+        total_area += static_cast<double>(this->pyramid[i]->width())
+            * static_cast<double>(this->pyramid[i]->height());
+
+    this->keypoints.clear();
+    int remaining = this->options.max_features;
+    for (int i = 0; i < num_levels; ++i)
+    {
+        Keypoints& kps = level_keypoints[i];
+        double const area = static_cast<double>(this->pyramid[i]->width())
+            * static_cast<double>(this->pyramid[i]->height());
+        int budget = (i + 1 == num_levels) ? remaining
+            : static_cast<int>(this->options.max_features * area / total_area
+            + 0.5);
+        budget = std::min(budget, remaining);
+        if (static_cast<int>(kps.size()) > budget)
+        {
+            std::partial_sort(kps.begin(), kps.begin() + budget, kps.end(),
+                compare_keypoints);
+            kps.resize(budget);
+        }
+        remaining -= kps.size();
+        this->keypoints.insert(this->keypoints.end(), kps.begin(), kps.end());
+    }
+}
+
+void
+Orb::keypoint_detection (int level, Keypoints* result)
+{
+    mve::ByteImage const& img = *this->pyramid[level];
+    int const w = img.width();
+    int const h = img.height();
+    uint8_t const* data = img.get_data_pointer();
+
+    int offsets[16];
+    for (int i = 0; i < 16; ++i)
+        offsets[i] = fast_circle[i][0] + fast_circle[i][1] * w;
+
+    /* FAST corners with Harris scores, zero for non-corners. */
+    std::vector<float> scores(w * h, 0.0f);
+    for (int y = ORB_BORDER - 1; y < h - ORB_BORDER + 1; ++y)
+        for (int x = ORB_BORDER - 1, i = y * w + x; x < w - ORB_BORDER + 1;
+            ++x, ++i)
+        {
+            if (!fast_test(data + i, offsets, this->options.fast_threshold))
+                continue;
+            scores[i] = std::max(1e-6f, harris_score(data + i, w));
+        }
+
+    /* Non-maximum suppression in the 3x3 neighborhood. */
+    result->clear();
+    for (int y = ORB_BORDER; y < h - ORB_BORDER; ++y)
+        for (int x = ORB_BORDER, i = y * w + x; x < w - ORB_BORDER; ++x, ++i)
+        {
+            float const score = scores[i];
+            if (score <= 0.0f
+                || score <= scores[i - w - 1] || score <= scores[i - w]
+                || score <= scores[i - w + 1] || score <= scores[i - 1]
+                || score < scores[i + 1] || score < scores[i + w - 1]
+                || score < scores[i + w] || score < scores[i + w + 1])
+                continue;
+
+            Keypoint kp;
+            kp.level = level;
+            kp.x = x;
+            kp.y = y;
+            kp.score = score;
+            result->push_back(kp);
+        }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Orb::descriptor_generation (void)
+{
+    /* The binary tests are evaluated on smoothed images. */
+    int const num_levels = static_cast<int>(this->pyramid.size());
+    Pyramid blurred(num_levels);
+    for (int i = 0; i < num_levels; ++i)
+        blurred[i] = mve::image::blur_gaussian<uint8_t>(this->pyramid[i], 2.0f);
+
+    int const num_keypoints = static_cast<int>(this->keypoints.size());
+    this->descriptors.clear();
+    this->descriptors.resize(num_keypoints);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_keypoints; ++i)
+    {
+        Keypoint const& kp = this->keypoints[i];
+        Descriptor& descr = this->descriptors[i];
+        float const orientation = this->keypoint_orientation
+            (*this->pyramid[kp.level], kp.x, kp.y);
+        this->descriptor_computation(*blurred[kp.level], kp.x, kp.y,
+            orientation, &descr);
+
+        /* Level coordinates to input image coordinates. */
+        float const scale = this->level_scale(kp.level);
+        descr.x = (static_cast<float>(kp.x) + 0.5f) * scale - 0.5f;
+        descr.y = (static_cast<float>(kp.y) + 0.5f) * scale - 0.5f;
+        descr.scale = ORB_PATCH_RADIUS * scale;
+        descr.orientation = orientation;
+    }
+}
+
+float
+Orb::keypoint_orientation (mve::ByteImage const& img, int x, int y)
+{
+    /* Intensity centroid within the circular patch. */
+    int const w = img.width();
+    uint8_t const* center = img.get_data_pointer() + y * w + x;
+    int m01 = 0, m10 = 0;
+    for (int dy = -ORB_PATCH_RADIUS; dy <= ORB_PATCH_RADIUS; ++dy)
+    {
+        uint8_t const* row = center + dy * w;
+        int const dx_max = static_cast<int>(std::sqrt(static_cast<float>
+            (MATH_POW2(ORB_PATCH_RADIUS) - dy * dy)));
+        int row_sum = 0;
+        for (int dx = -dx_max; dx <= dx_max; ++dx)
+        {
+            row_sum += row[dx];
+            m10 += dx * row[dx];
+        }
+        m01 += dy * row_sum;
+    }
+    return std::atan2(static_cast<float>(m01), static_cast<float>(m10));
+}
+
+void
+Orb::descriptor_computation (mve::ByteImage const& img, int x, int y,
+    float orientation, Descriptor* descr)
+{
+    int const w = img.width();
+    uint8_t const* center = img.get_data_pointer() + y * w + x;
+    float const ca = std::cos(orientation);
+    float const sa = std::sin(orientation);
+
+    descr->data.fill(0);
+    for (int i = 0; i < 256; ++i)
+    {
+        int const* p = orb_pattern.points[i];
+        int const x1 = static_cast<int>(math::round(ca * p[0] - sa * p[1]));
+        int const y1 = static_cast<int>(math::round(sa * p[0] + ca * p[1]));
+        int const x2 = static_cast<int>(math::round(ca * p[2] - sa * p[3]));
+        int const y2 = static_cast<int>(math::round(sa * p[2] + ca * p[3]));
+        if (center[y1 * w + x1] < center[y2 * w + x2])
+            descr->data[i / 64] |= static_cast<uint64_t>(1) << (i % 64);
+    }
+}
+
+SFM_NAMESPACE_END
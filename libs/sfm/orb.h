@@ -0,0 +1,172 @@
+/*
+ * ORB implementation.
+ *
+ * Some useful references:
+ * - "Machine learning for high-speed corner detection"
+ *   by Edward Rosten and Tom Drummond
+ * - "BRIEF: Binary Robust Independent Elementary Features"
+ *   by Michael Calonder, Vincent Lepetit, Christoph Strecha and Pascal Fua
+ */
+#ifndef SFM_ORB_HEADER
+#define SFM_ORB_HEADER
+
+#include <vector>
+
+#include "math/vector.h"
+#include "mve/image.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Implementation of the ORB feature detector and descriptor as described in:
+ *
+ *   ORB: An efficient alternative to SIFT or SURF
+ *   by Ethan Rublee, Vincent Rabaud, Kurt Konolige and Gary Bradski
+ *
+ * Keypoints are detected with FAST-9 on an image pyramid, ranked with the
+ * Harris corner measure and oriented using the intensity centroid. The
+ * descriptor is a steered BRIEF descriptor with 256 binary tests which is
+ * matched using the Hamming distance. ORB is an order of magnitude faster
+ * than SIFT but less distinctive and only invariant to moderate changes in
+ * scale, which makes it a good choice for video sequences.
+ *
+ * The binary tests are drawn from a fixed pseudo-random sequence instead
+ * of the learned test pattern in the paper, so descriptors are not
+ * compatible with other ORB implementations.
+ */
+class Orb
+{
+public:
+    /**
+     * ORB options.
+     */
+    struct Options
+    {
+        Options (void);
+
+        /**
+         * The maximum number of features, which are distributed over the
+         * pyramid levels proportional to the level area. Defaults to 4000.
+         */
+        int max_features;
+
+        /** The number of pyramid levels. Defaults to 8. */
+        int num_levels;
+
+        /** The scale factor between pyramid levels. Defaults to 1.2. */
+        float scale_factor;
+
+        /**
+         * The FAST threshold on the intensity difference between the center
+         * pixel and the pixels on the circle. Defaults to 20.
+         */
+        int fast_threshold;
+
+        /**
+         * Produce status messages on the console.
+         */
+        bool verbose_output;
+
+        /**
+         * Produce even more messages on the console.
+         */
+        bool debug_output;
+    };
+
+    /**
+     * Representation of an ORB keypoint.
+     */
+    struct Keypoint
+    {
+        int level; ///< Pyramid level of the keypoint
+        int x; ///< Keypoint X coordinate in the pyramid level
+        int y; ///< Keypoint Y coordinate in the pyramid level
+        float score; ///< Harris corner response of the keypoint
+    };
+
+    /**
+     * Representation of an ORB descriptor. The descriptor consists of 256
+     * bits, packed into four 64 bit words.
+     */
+    struct Descriptor
+    {
+        /** The x-coordinate of the image keypoint. */
+        float x;
+        /** The y-coordinate of the image keypoint. */
+        float y;
+        /** The scale (radius of the descriptor patch) of the keypoint. */
+        float scale;
+        /** The orientation of the image keypoint in [-PI, PI]. */
+        float orientation;
+        /** The descriptor bits, bit i is stored in word i / 64. */
+        math::Vector<uint64_t, 4> data;
+    };
+
+public:
+    typedef std::vector<Keypoint> Keypoints;
+    typedef std::vector<Descriptor> Descriptors;
+
+public:
+    explicit Orb (Options const& options);
+
+    /** Sets the input image. */
+    void set_image (mve::ByteImage::ConstPtr image);
+
+    /** Starts ORB keypoint detection and descriptor extraction. */
+    void process (void);
+
+    /** Returns the list of keypoints. */
+    Keypoints const& get_keypoints (void) const;
+    /** Returns the list of descriptors. */
+    Descriptors const& get_descriptors (void) const;
+
+protected:
+    typedef std::vector<mve::ByteImage::Ptr> Pyramid;
+
+protected:
+    void create_pyramid (void);
+    void keypoint_detection (void);
+    void keypoint_detection (int level, Keypoints* result);
+    void descriptor_generation (void);
+    float keypoint_orientation (mve::ByteImage const& img, int x, int y);
+    void descriptor_computation (mve::ByteImage const& img, int x, int y,
+        float orientation, Descriptor* descr);
+    float level_scale (int level) const;
+
+protected:
+    Options options;
+    mve::ByteImage::ConstPtr orig;
+    Pyramid pyramid;
+    Keypoints keypoints;
+    Descriptors descriptors;
+};
+
+/* ---------------------------------------------------------------- */
+
+inline
+Orb::Options::Options (void)
+    : max_features(4000)
+    , num_levels(8)
+    , scale_factor(1.2f)
+    , fast_threshold(20)
+    , verbose_output(false)
+    , debug_output(false)
+{
+}
+
+inline Orb::Keypoints const&
+Orb::get_keypoints (void) const
+{
+    return this->keypoints;
+}
+
+inline Orb::Descriptors const&
+Orb::get_descriptors (void) const
+{
+    return this->descriptors;
+}
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_ORB_HEADER */
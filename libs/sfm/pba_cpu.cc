@@ -71,7 +71,7 @@ inline int omp_get_num_procs (void) { return 1; }
 #endif
 
 //maximum thread count
-#define THREAD_NUM_MAX 64
+#define THREAD_NUM_MAX 256
 //compute the number of threads for vector operatoins, pure heuristics...
 #define AUTO_MT_NUM(sz) int((log((double) sz) / log(2.0) - 18.5 ) * __num_cpu_cores / 16.0)
 
@@ -2307,17 +2307,29 @@ SparseBundleCPU:: SparseBundleCPU()
     , _imgpt_data(NULL)
     , _camera_idx(NULL)
     , _point_idx(NULL)
+    , _focal_mask(NULL)
+    , _projection_changed(true)
     , _projection_sse(0)
     , _num_imgpt_q(0)
 {
     __cpu_data_precision = sizeof(double);
     if(__num_cpu_cores == 0)	__num_cpu_cores = omp_get_num_procs();
+    SetNumThreads(__num_cpu_cores);
     if(__verbose_level)			std::cout  << "CPU " << (__cpu_data_precision == 4 ? "single" : "double")
                                            << "-precisoin solver; " << __num_cpu_cores << " cores"
 #ifdef CPUPBA_USE_AVX
                                            << " (AVX)"
 #endif
                                            << ".\n";
+}
+
+//sets the number of threads for all solver functions, which is shared by
+//all solvers. zero uses all processors.
+void SparseBundleCPU::SetNumThreads(int num_threads)
+{
+    if(num_threads <= 0) num_threads = omp_get_num_procs();
+    __num_cpu_cores = std::min(num_threads, THREAD_NUM_MAX / 2);
+
     //the following configuration are totally based my personal experience
     //on two computers.. you should adjust them according to your system.
     //try run driver filename -profile --float to see how speed varies
@@ -2358,6 +2370,7 @@ SparseBundleCPU:: SparseBundleCPU()
 void SparseBundleCPU:: SetCameraData(size_t ncam,  CameraT* cams)
 {
     if(sizeof(CameraT) != 16 * sizeof(float)) return;  //never gonna happen...?
+    if(_num_camera != (int) ncam) _projection_changed = true;
      _num_camera = (int) ncam;
     _camera_data = cams;
     _focal_mask  = NULL;
@@ -2372,6 +2385,7 @@ void SparseBundleCPU::SetFocalMask(const int* fmask, float weight)
 
 void SparseBundleCPU:: SetPointData(size_t npoint, Point3D* pts)
 {
+    if(_num_point != (int) npoint) _projection_changed = true;
     _num_point = (int) npoint;
     _point_data = (float*) pts;
 }
@@ -2382,6 +2396,7 @@ void SparseBundleCPU:: SetProjection(size_t nproj, const Point2D* imgpts, const
     _imgpt_data = (float*) imgpts;
     _camera_idx = cam_idx;
     _point_idx = point_idx;
+    _projection_changed = true;
 }
 
 float SparseBundleCPU::GetMeanSquaredError()
@@ -2508,15 +2523,21 @@ bool SparseBundleCPU::InitializeStorageForSFM()
 
     //////////////////////////////////////////
     BundleTimerSwap(TIMER_PREPROCESSING, TIMER_GPU_ALLOCATION);
+    ////the index maps only depend on the projection structure
+    bool update_maps = _projection_changed || _num_imgpt_q > 0;
     ////mapping from camera to measuremnts
     std::vector<int>& cpi = _cuCameraMeasurementMap;     cpi.resize(_num_camera + 1);
     std::vector<int>& cpidx = _cuCameraMeasurementList;  cpidx.resize(_num_imgpt);
-    std::vector<int> cpnum(_num_camera, 0);              cpi[0] = 0;
-    for(int i = 0; i < _num_imgpt; ++i) cpnum[_camera_idx[i]]++;
-    for(int i = 1; i <= _num_camera; ++i) cpi[i] = cpi[i - 1] + cpnum[i - 1];
-    ///////////////////////////////////////////////////////
-    std::vector<int> cptidx = cpi;
-    for(int i = 0; i < _num_imgpt; ++i) cpidx[cptidx[_camera_idx[i]] ++] = i;
+    std::vector<int> cpnum(update_maps ? _num_camera : 0, 0);
+    if(update_maps)
+    {
+        cpi[0] = 0;
+        for(int i = 0; i < _num_imgpt; ++i) cpnum[_camera_idx[i]]++;
+        for(int i = 1; i <= _num_camera; ++i) cpi[i] = cpi[i - 1] + cpnum[i - 1];
+        ///////////////////////////////////////////////////////
+        std::vector<int> cptidx = cpi;
+        for(int i = 0; i < _num_imgpt; ++i) cpidx[cptidx[_camera_idx[i]] ++] = i;
+    }
 
     ///////////////////////////////////////////////////////////
     if(_cuCameraMeasurementListT.size())
@@ -2546,23 +2567,27 @@ bool SparseBundleCPU::InitializeStorageForSFM()
 
 
 
-    ////////////////////////////////////////////
-    ///////mapping from point to measurment
-    std::vector<int> & ppi = _cuPointMeasurementMap;  ppi.resize(_num_point + 1);
-    for(int i = 0, last_point = -1; i < _num_imgpt; ++i)
+    if(update_maps)
     {
-        int pt = _point_idx[i];
-        while(last_point < pt) ppi[++last_point] = i;
-    }
-    ppi[_num_point] = _num_imgpt;
+        ////////////////////////////////////////////
+        ///////mapping from point to measurment
+        std::vector<int> & ppi = _cuPointMeasurementMap;  ppi.resize(_num_point + 1);
+        for(int i = 0, last_point = -1; i < _num_imgpt; ++i)
+        {
+            int pt = _point_idx[i];
+            while(last_point < pt) ppi[++last_point] = i;
+        }
+        ppi[_num_point] = _num_imgpt;
 
-    //////////projection map
-    std::vector<int>& pmp = _cuProjectionMap; pmp.resize(_num_imgpt *2);
-    for(int i = 0; i < _num_imgpt; ++i)
-    {
-        int* imp = &pmp[i * 2];
-        imp[0] =  _camera_idx[i];
-        imp[1] = _point_idx[i];
+        //////////projection map
+        std::vector<int>& pmp = _cuProjectionMap; pmp.resize(_num_imgpt *2);
+        for(int i = 0; i < _num_imgpt; ++i)
+        {
+            int* imp = &pmp[i * 2];
+            imp[0] =  _camera_idx[i];
+            imp[1] = _point_idx[i];
+        }
+        _projection_changed = false;
     }
     BundleTimerSwap(TIMER_PREPROCESSING, TIMER_GPU_ALLOCATION);
     //////////////////////////////////////////////////////////////
@@ -143,6 +143,7 @@ protected:      //cpu data
     const int*      _camera_idx;
     const int*      _point_idx;
     const int*		_focal_mask;
+    bool            _projection_changed;
 
     ///////////sumed square error
     float         _projection_sse;
@@ -239,6 +240,9 @@ public:
     virtual void SetPointData(size_t npoint, Point3D* pts);
     virtual void SetProjection(size_t nproj, const Point2D* imgpts, const int* point_idx, const int* cam_idx);
     virtual void SetFocalMask(const int* fmask, float weight);
+    //sets the number of threads, zero uses all processors. the count is a
+    //process-wide global shared by all solvers, also by ones created later.
+    virtual void SetNumThreads(int num_threads);
     virtual float GetMeanSquaredError();
     virtual int RunBundleAdjustment();
 };
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
+#include "util/system.h"
 #include "math/functions.h"
 #include "sfm/ransac.h"
 
@@ -11,9 +14,131 @@ compute_ransac_iterations (double inlier_ratio,
     double desired_success_rate)
 {
     double prob_all_good = math::fastpow(inlier_ratio, num_samples);
+    if (prob_all_good <= 0.0)
+        return std::numeric_limits<int>::max();
+    if (prob_all_good >= 1.0)
+        return 0;
     double num_iterations = std::log(1.0 - desired_success_rate)
         / std::log(1.0 - prob_all_good);
+    if (num_iterations >= static_cast<double>(std::numeric_limits<int>::max()))
+        return std::numeric_limits<int>::max();
     return static_cast<int>(math::round(num_iterations));
 }
 
+/* ---------------------------------------------------------------- */
+
+void
+compute_verification_order (std::size_t num_correspondences, bool shuffle,
+    std::vector<int>* order)
+{
+    order->resize(num_correspondences);
+    for (std::size_t i = 0; i < num_correspondences; ++i)
+        order->at(i) = static_cast<int>(i);
+    if (!shuffle)
+        return;
+
+    /* Fisher-Yates shuffle with the RANSAC sampling random numbers. */
+    for (std::size_t i = num_correspondences; i > 1; --i)
+        std::swap(order->at(i - 1), order->at(util::system::rand_int() % i));
+}
+
+/* ---------------------------------------------------------------- */
+
+namespace
+{
+    /* Initial (conservative) estimates of epsilon and delta. */
+    double const SPRT_INITIAL_EPSILON = 0.1;
+    double const SPRT_INITIAL_DELTA = 0.01;
+    /* Lower bound for delta to keep the weights finite. */
+    double const SPRT_MIN_DELTA = 0.001;
+}
+
+RansacSprt::RansacSprt (double model_cost, double models_per_sample)
+    : model_cost(model_cost)
+    , models_per_sample(models_per_sample)
+    , epsilon(SPRT_INITIAL_EPSILON)
+    , delta(SPRT_INITIAL_DELTA)
+    , delta_sum(0.0)
+    , num_rejected(0)
+{
+    this->update_threshold();
+}
+
+void
+RansacSprt::update_inlier_ratio (double inlier_ratio)
+{
+    /* The initial estimate is a lower bound, never decrease epsilon. */
+    if (inlier_ratio <= this->epsilon)
+        return;
+    this->epsilon = std::min(inlier_ratio, 0.999);
+    this->update_threshold();
+}
+
+void
+RansacSprt::add_rejected_model (int num_verified, int num_consistent)
+{
+    if (num_verified <= 0)
+        return;
+    this->delta_sum += static_cast<double>(num_consistent)
+        / static_cast<double>(num_verified);
+    this->num_rejected += 1;
+    this->delta = std::max(SPRT_MIN_DELTA,
+        this->delta_sum / static_cast<double>(this->num_rejected));
+    this->update_threshold();
+}
+
+double
+RansacSprt::get_acceptance_rate (void) const
+{
+    if (this->threshold == std::numeric_limits<double>::max())
+        return 1.0;
+    return 1.0 - std::exp(-this->threshold);
+}
+
+int
+RansacSprt::compute_iterations (double inlier_ratio, int num_samples,
+    double desired_success_rate) const
+{
+    /*
+     * A good sample is only found if the model is also accepted by the
+     * SPRT. For small w^n, log(1 - w^n * a) is about a * log(1 - w^n).
+     */
+    int const iterations = compute_ransac_iterations(inlier_ratio,
+        num_samples, desired_success_rate);
+    double const scaled = static_cast<double>(iterations)
+        / this->get_acceptance_rate();
+    if (scaled >= static_cast<double>(std::numeric_limits<int>::max()))
+        return std::numeric_limits<int>::max();
+    return static_cast<int>(std::ceil(scaled));
+}
+
+void
+RansacSprt::update_threshold (void)
+{
+    double const eps = this->epsilon;
+    double const delta = this->delta;
+    this->consistent_weight = std::log(delta / eps);
+    this->inconsistent_weight = std::log((1.0 - delta) / (1.0 - eps));
+
+    /* The test is useless if bad models are as consistent as good ones. */
+    if (delta >= eps)
+    {
+        this->threshold = std::numeric_limits<double>::max();
+        return;
+    }
+
+    /*
+     * The optimal threshold A is the solution of A = K + 1 + log(A)
+     * with K = t_M * C / m_S, see equation (9) in the paper. The
+     * fixed-point iteration converges quickly.
+     */
+    double const c = (1.0 - delta) * std::log((1.0 - delta) / (1.0 - eps))
+        + delta * std::log(delta / eps);
+    double const k = this->model_cost * c / this->models_per_sample + 1.0;
+    double a = k;
+    for (int i = 0; i < 10; ++i)
+        a = k + std::log(a);
+    this->threshold = std::log(a);
+}
+
 SFM_NAMESPACE_END
@@ -1,6 +1,9 @@
 #ifndef SFM_RANSAC_HEADER
 #define SFM_RANSAC_HEADER
 
+#include <cstddef>
+#include <vector>
+
 #include "sfm/defines.h"
 
 SFM_NAMESPACE_BEGIN
@@ -18,12 +21,109 @@ SFM_NAMESPACE_BEGIN
  *
  * Example: For w = 50%, p = 99%, n = 8: k = log(0.001) / log(0.99609) = 1176.
  * Thus, it requires 1176 iterations for RANSAC to succeed with a 99% chance.
+ * If the inlier ratio is zero, the largest integer is returned.
  */
 int
 compute_ransac_iterations (double inlier_ratio,
     int num_samples,
     double desired_success_rate = 0.99);
 
+/**
+ * Computes the order in which RANSAC verifies the correspondences. The SPRT
+ * assumes correspondences to be verified in random order, but matches are
+ * usually stored in a systematic order (e.g., by feature scale or match
+ * quality), which biases early rejection. If 'shuffle' is true, the order
+ * is a random permutation, otherwise it is the identity.
+ */
+void
+compute_verification_order (std::size_t num_correspondences, bool shuffle,
+    std::vector<int>* order);
+
+/**
+ * Sequential probability ratio test (SPRT) for early rejection of bad
+ * RANSAC models (Matas and Chum, "Randomized RANSAC with Sequential
+ * Probability Ratio Test", ICCV 2005).
+ *
+ * Instead of verifying all correspondences, a model is verified one
+ * correspondence at a time while updating the likelihood ratio of the model
+ * being bad versus being good. The model is rejected as soon as the ratio
+ * exceeds the decision threshold A. This requires the probability epsilon
+ * that a correspondence is consistent with a good model (the inlier ratio)
+ * and the probability delta that it is consistent with a bad model. Both
+ * are estimated while RANSAC is running, and A is chosen to minimize the
+ * expected running time. A good model is rejected with probability 1/A,
+ * which is compensated by running more iterations.
+ *
+ * Usage: Start every model with a log likelihood ratio of zero and add
+ * get_consistent_weight() or get_inconsistent_weight() for every verified
+ * correspondence. Reject the model once get_threshold() is exceeded.
+ */
+class RansacSprt
+{
+public:
+    /**
+     * The cost of computing models for one random sample is given in units
+     * of verifying a single correspondence. Some algorithms compute more
+     * than one model per sample (e.g., P3P).
+     */
+    RansacSprt (double model_cost, double models_per_sample);
+
+    /** Log likelihood ratio update for a consistent correspondence. */
+    double get_consistent_weight (void) const;
+    /** Log likelihood ratio update for an inconsistent correspondence. */
+    double get_inconsistent_weight (void) const;
+    /** Log decision threshold, models exceeding it are rejected. */
+    double get_threshold (void) const;
+    /** Probability that a good model is not rejected, 1 - 1/A. */
+    double get_acceptance_rate (void) const;
+
+    /** Updates epsilon after a new best model has been found. */
+    void update_inlier_ratio (double inlier_ratio);
+    /** Updates delta with the consistent fraction of a rejected model. */
+    void add_rejected_model (int num_verified, int num_consistent);
+
+    /**
+     * Returns the number of iterations for a desired success rate, see
+     * compute_ransac_iterations(), increased for rejected good models.
+     */
+    int compute_iterations (double inlier_ratio, int num_samples,
+        double desired_success_rate) const;
+
+private:
+    void update_threshold (void);
+
+private:
+    double model_cost;
+    double models_per_sample;
+    double epsilon;
+    double delta;
+    double delta_sum;
+    int num_rejected;
+    double consistent_weight;
+    double inconsistent_weight;
+    double threshold;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline double
+RansacSprt::get_consistent_weight (void) const
+{
+    return this->consistent_weight;
+}
+
+inline double
+RansacSprt::get_inconsistent_weight (void) const
+{
+    return this->inconsistent_weight;
+}
+
+inline double
+RansacSprt::get_threshold (void) const
+{
+    return this->threshold;
+}
+
 SFM_NAMESPACE_END
 
 #endif /* SFM_RANSAC_HEADER */
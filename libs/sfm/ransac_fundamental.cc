@@ -5,7 +5,9 @@
 
 #include "util/system.h"
 #include "math/algo.h"
+#include "sfm/ransac.h"
 #include "sfm/ransac_fundamental.h"
+#include "sfm/ransac_scoring.h"
 #include "sfm/pose.h"
 
 SFM_NAMESPACE_BEGIN
@@ -25,13 +27,36 @@ RansacFundamental::estimate (Correspondences const& matches, Result* result)
             << "..." << std::endl;
     }
 
+    /* Computing a model costs about 200 correspondence verifications. */
+    RansacSprt sprt(200.0, 1.0);
+    RansacSprt* sprt_ptr = this->opts.early_reject ? &sprt : NULL;
+
+    /*
+     * Correspondences are scored in batches using vector instructions,
+     * and in random order for early rejection.
+     */
+    std::vector<int> order;
+    compute_verification_order(matches.size(), this->opts.early_reject,
+        &order);
+    CorrespondencesSoA matches_soa;
+    correspondences_to_soa(matches, order, &matches_soa);
+
     std::vector<int> inliers;
     inliers.reserve(matches.size());
-    for (int iteration = 0; iteration < this->opts.max_iterations; ++iteration)
+    int num_iterations = this->opts.max_iterations;
+    int num_rejected = 0;
+    int iteration = 0;
+    for (; iteration < num_iterations; ++iteration)
     {
         FundamentalMatrix fundamental;
         this->estimate_8_point(matches, &fundamental);
-        this->find_inliers(matches, fundamental, &inliers);
+        if (!this->find_inliers(matches_soa, order, fundamental,
+            sprt_ptr, &inliers))
+        {
+            num_rejected += 1;
+            continue;
+        }
+
         if (inliers.size() > result->inliers.size())
         {
             if (this->opts.verbose_output)
@@ -45,8 +70,31 @@ RansacFundamental::estimate (Correspondences const& matches, Result* result)
             result->fundamental = fundamental;
             std::swap(result->inliers, inliers);
             inliers.reserve(matches.size());
+
+            double const inlier_ratio = static_cast<double>
+                (result->inliers.size()) / matches.size();
+            sprt.update_inlier_ratio(inlier_ratio);
+            if (this->opts.adaptive_termination)
+            {
+                int const required = this->opts.early_reject
+                    ? sprt.compute_iterations(inlier_ratio, 8,
+                    this->opts.success_rate)
+                    : compute_ransac_iterations(inlier_ratio, 8,
+                    this->opts.success_rate);
+                num_iterations = std::min(this->opts.max_iterations, required);
+            }
         }
     }
+
+    /* Inliers are found in verification order. */
+    std::sort(result->inliers.begin(), result->inliers.end());
+
+    if (this->opts.verbose_output)
+    {
+        std::cout << "RANSAC-F: Finished after " << iteration
+            << " iterations, " << num_rejected << " models rejected early."
+            << std::endl;
+    }
 }
 
 void
@@ -96,18 +144,14 @@ RansacFundamental::estimate_8_point (Correspondences const& matches,
     }
 }
 
-void
-RansacFundamental::find_inliers (Correspondences const& matches,
-    FundamentalMatrix const& fundamental, std::vector<int>* result)
+bool
+RansacFundamental::find_inliers (CorrespondencesSoA const& matches,
+    std::vector<int> const& order, FundamentalMatrix const& fundamental,
+    RansacSprt* sprt, std::vector<int>* result)
 {
-    result->resize(0);
     double const squared_thres = this->opts.threshold * this->opts.threshold;
-    for (std::size_t i = 0; i < matches.size(); ++i)
-    {
-        double error = sampson_distance(fundamental, matches[i]);
-        if (error < squared_thres)
-            result->push_back(i);
-    }
+    return find_inliers_batched(fundamental, &sampson_distances, matches,
+        order, squared_thres, sprt, result);
 }
 
 SFM_NAMESPACE_END
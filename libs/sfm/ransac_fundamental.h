@@ -10,6 +10,7 @@
 #include "sfm/defines.h"
 #include "sfm/correspondence.h"
 #include "sfm/fundamental.h"
+#include "sfm/ransac.h"
 
 SFM_NAMESPACE_BEGIN
 
@@ -21,7 +22,8 @@ SFM_NAMESPACE_BEGIN
  * randomly selects N image correspondences (where N depends on the pose
  * algorithm) to estimate a fundamental matrix. Running for a number of
  * iterations, the fundamental matrix supporting the most matches is
- * returned as result.
+ * returned as result. The number of iterations adapts to the inlier ratio,
+ * and bad models are rejected early, see Options.
  */
 class RansacFundamental
 {
@@ -47,6 +49,28 @@ public:
          */
         double threshold;
 
+        /**
+         * Stop as soon as enough iterations have been performed to find
+         * an all-inlier sample with probability 'success_rate', given the
+         * inlier ratio of the best model so far. 'max_iterations' is an
+         * upper bound. Defaults to true.
+         */
+        bool adaptive_termination;
+
+        /**
+         * Desired probability of RANSAC success for the adaptive
+         * termination. Defaults to 0.99.
+         */
+        double success_rate;
+
+        /**
+         * Reject bad models early during inlier counting using the
+         * sequential probability ratio test (see RansacSprt), which avoids
+         * verifying all correspondences for most models. Correspondences
+         * are then verified in a random order per run. Defaults to true.
+         */
+        bool early_reject;
+
         /**
          * Whether the input points are already normalized. Defaults to true.
          * If this is set to false, in every RANSAC iteration the coordinates
@@ -82,8 +106,9 @@ public:
 private:
     void estimate_8_point (Correspondences const& matches,
         FundamentalMatrix* fundamental);
-    void find_inliers (Correspondences const& matches,
-        FundamentalMatrix const& fundamental, std::vector<int>* result);
+    bool find_inliers (CorrespondencesSoA const& matches,
+        std::vector<int> const& order, FundamentalMatrix const& fundamental,
+        RansacSprt* sprt, std::vector<int>* result);
 
 private:
     Options opts;
@@ -95,6 +120,9 @@ inline
 RansacFundamental::Options::Options (void)
     : max_iterations(1000)
     , threshold(1e-3)
+    , adaptive_termination(true)
+    , success_rate(0.99)
+    , early_reject(true)
     , already_normalized(true)
     , verbose_output(false)
 {
@@ -7,6 +7,7 @@
 #include "math/algo.h"
 #include "math/matrix_tools.h"
 #include "sfm/ransac_homography.h"
+#include "sfm/ransac_scoring.h"
 
 SFM_NAMESPACE_BEGIN
 
@@ -25,13 +26,36 @@ RansacHomography::estimate (Correspondences const& matches, Result* result)
             << "..." << std::endl;
     }
 
+    /* Computing a model costs about 100 correspondence verifications. */
+    RansacSprt sprt(100.0, 1.0);
+    RansacSprt* sprt_ptr = this->opts.early_reject ? &sprt : NULL;
+
+    /*
+     * Correspondences are scored in batches using vector instructions,
+     * and in random order for early rejection.
+     */
+    std::vector<int> order;
+    compute_verification_order(matches.size(), this->opts.early_reject,
+        &order);
+    CorrespondencesSoA matches_soa;
+    correspondences_to_soa(matches, order, &matches_soa);
+
     std::vector<int> inliers;
     inliers.reserve(matches.size());
-    for (int iteration = 0; iteration < this->opts.max_iterations; ++iteration)
+    int num_iterations = this->opts.max_iterations;
+    int num_rejected = 0;
+    int iteration = 0;
+    for (; iteration < num_iterations; ++iteration)
     {
         HomographyMatrix homography;
         this->compute_homography(matches, &homography);
-        this->evaluate_homography(matches, homography, &inliers);
+        if (!this->evaluate_homography(matches_soa, order, homography,
+            sprt_ptr, &inliers))
+        {
+            num_rejected += 1;
+            continue;
+        }
+
         if (inliers.size() > result->inliers.size())
         {
             if (this->opts.verbose_output)
@@ -45,8 +69,31 @@ RansacHomography::estimate (Correspondences const& matches, Result* result)
             result->homography = homography;
             std::swap(result->inliers, inliers);
             inliers.reserve(matches.size());
+
+            double const inlier_ratio = static_cast<double>
+                (result->inliers.size()) / matches.size();
+            sprt.update_inlier_ratio(inlier_ratio);
+            if (this->opts.adaptive_termination)
+            {
+                int const required = this->opts.early_reject
+                    ? sprt.compute_iterations(inlier_ratio, 4,
+                    this->opts.success_rate)
+                    : compute_ransac_iterations(inlier_ratio, 4,
+                    this->opts.success_rate);
+                num_iterations = std::min(this->opts.max_iterations, required);
+            }
         }
     }
+
+    /* Inliers are found in verification order. */
+    std::sort(result->inliers.begin(), result->inliers.end());
+
+    if (this->opts.verbose_output)
+    {
+        std::cout << "RANSAC-H: Finished after " << iteration
+            << " iterations, " << num_rejected << " models rejected early."
+            << std::endl;
+    }
 }
 
 void
@@ -84,19 +131,14 @@ RansacHomography::compute_homography (Correspondences const& matches,
         *homography = invT2 * *homography * T1;
 }
 
-void
-RansacHomography::evaluate_homography (Correspondences const& matches,
-    HomographyMatrix const& homography, std::vector<int>* inliers)
+bool
+RansacHomography::evaluate_homography (CorrespondencesSoA const& matches,
+    std::vector<int> const& order, HomographyMatrix const& homography,
+    RansacSprt* sprt, std::vector<int>* inliers)
 {
     double const square_threshold = MATH_POW2(this->opts.threshold);
-    inliers->resize(0);
-    for (std::size_t i = 0; i < matches.size(); i++)
-    {
-        Correspondence const& match = matches[i];
-        double error = sfm::symmetric_transfer_error(homography, match);
-        if (error < square_threshold)
-            inliers->push_back(i);
-    }
+    return find_inliers_batched(homography, &symmetric_transfer_errors,
+        matches, order, square_threshold, sprt, inliers);
 }
 
 SFM_NAMESPACE_END
@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "sfm/homography.h"
+#include "sfm/ransac.h"
 
 SFM_NAMESPACE_BEGIN
 
@@ -14,6 +15,8 @@ SFM_NAMESPACE_BEGIN
  * correspondences contaminated with outliers. The algorithm randomly selects 4
  * image correspondences to estimate a homography matrix. Running for a number
  * of iterations, the homography matrix supporting the most matches returned.
+ * The number of iterations adapts to the inlier ratio, and bad models are
+ * rejected early, see Options.
  */
 class RansacHomography
 {
@@ -38,6 +41,28 @@ public:
          */
         double threshold;
 
+        /**
+         * Stop as soon as enough iterations have been performed to find
+         * an all-inlier sample with probability 'success_rate', given the
+         * inlier ratio of the best model so far. 'max_iterations' is an
+         * upper bound. Defaults to true.
+         */
+        bool adaptive_termination;
+
+        /**
+         * Desired probability of RANSAC success for the adaptive
+         * termination. Defaults to 0.99.
+         */
+        double success_rate;
+
+        /**
+         * Reject bad models early during inlier counting using the
+         * sequential probability ratio test (see RansacSprt), which avoids
+         * verifying all correspondences for most models. Correspondences
+         * are then verified in a random order per run. Defaults to true.
+         */
+        bool early_reject;
+
         /**
          * Whether the input points are already normalized. Defaults to true.
          * If this is set to false, in every RANSAC iteration the coordinates
@@ -74,8 +99,9 @@ public:
 private:
     void compute_homography (Correspondences const& matches,
         HomographyMatrix* homography);
-    void evaluate_homography (Correspondences const& matches,
-        HomographyMatrix const& homography, std::vector<int>* inliers);
+    bool evaluate_homography (CorrespondencesSoA const& matches,
+        std::vector<int> const& order, HomographyMatrix const& homography,
+        RansacSprt* sprt, std::vector<int>* inliers);
 
 private:
     Options opts;
@@ -87,6 +113,9 @@ inline
 RansacHomography::Options::Options (void)
     : max_iterations(1000)
     , threshold(0.01)
+    , adaptive_termination(true)
+    , success_rate(0.99)
+    , early_reject(true)
     , already_normalized(true)
     , verbose_output(false)
 {
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <set>
 #include <iostream>
 
@@ -27,9 +28,24 @@ RansacPoseP3P::estimate (Correspondences2D3D const& corresp,
     /* Pre-compute inverse K matrix to compute directions from corresp. */
     math::Matrix<double, 3, 3> inv_k_matrix = math::matrix_inverse(k_matrix);
 
+    /*
+     * Computing the poses costs about 50 correspondence verifications,
+     * and P3P yields about two real solutions on average.
+     */
+    RansacSprt sprt(50.0, 2.0);
+    RansacSprt* sprt_ptr = this->opts.early_reject ? &sprt : NULL;
+
+    /* Correspondences are verified in random order for early rejection. */
+    std::vector<int> order;
+    compute_verification_order(corresp.size(), this->opts.early_reject,
+        &order);
+
     std::vector<int> inliers;
     inliers.reserve(corresp.size());
-    for (int iteration = 0; iteration < this->opts.max_iterations; ++iteration)
+    int num_iterations = this->opts.max_iterations;
+    int num_rejected = 0;
+    int iteration = 0;
+    for (; iteration < num_iterations; ++iteration)
     {
         /* Compute up to four poses [R|t] using P3P algorithm. */
         PutativePoses poses;
@@ -39,7 +55,13 @@ RansacPoseP3P::estimate (Correspondences2D3D const& corresp,
         bool found_better_solution = false;
         for (std::size_t i = 0; i < poses.size(); ++i)
         {
-            this->find_inliers(corresp, k_matrix, poses[i], &inliers);
+            if (!this->find_inliers(corresp, order, k_matrix, poses[i],
+                sprt_ptr, &inliers))
+            {
+                num_rejected += 1;
+                continue;
+            }
+
             if (inliers.size() > result->inliers.size())
             {
                 result->pose = poses[i];
@@ -49,13 +71,39 @@ RansacPoseP3P::estimate (Correspondences2D3D const& corresp,
             }
         }
 
-        if (found_better_solution && this->opts.verbose_output)
+        if (!found_better_solution)
+            continue;
+
+        if (this->opts.verbose_output)
         {
             std::cout << "RANSAC-3: Iteration " << iteration
                 << ", inliers " << result->inliers.size() << " ("
                 << (100.0 * result->inliers.size() / corresp.size())
                 << "%)" << std::endl;
         }
+
+        double const inlier_ratio = static_cast<double>
+            (result->inliers.size()) / corresp.size();
+        sprt.update_inlier_ratio(inlier_ratio);
+        if (this->opts.adaptive_termination)
+        {
+            int const required = this->opts.early_reject
+                ? sprt.compute_iterations(inlier_ratio, 3,
+                this->opts.success_rate)
+                : compute_ransac_iterations(inlier_ratio, 3,
+                this->opts.success_rate);
+            num_iterations = std::min(this->opts.max_iterations, required);
+        }
+    }
+
+    /* Inliers are found in verification order. */
+    std::sort(result->inliers.begin(), result->inliers.end());
+
+    if (this->opts.verbose_output)
+    {
+        std::cout << "RANSAC-3: Finished after " << iteration
+            << " iterations, " << num_rejected << " poses rejected early."
+            << std::endl;
     }
 }
 
@@ -84,23 +132,36 @@ RansacPoseP3P::compute_p3p (Correspondences2D3D const& corresp,
         poses);
 }
 
-void
+bool
 RansacPoseP3P::find_inliers (Correspondences2D3D const& corresp,
-    math::Matrix<double, 3, 3> const& k_matrix,
-    Pose const& pose, std::vector<int>* inliers)
+    std::vector<int> const& order, math::Matrix<double, 3, 3> const& k_matrix,
+    Pose const& pose, RansacSprt* sprt, std::vector<int>* inliers)
 {
     inliers->resize(0);
     double const square_threshold = MATH_POW2(this->opts.threshold);
+    double likelihood_ratio = 0.0;
     for (std::size_t i = 0; i < corresp.size(); ++i)
     {
-        Correspondence2D3D const& c = corresp[i];
+        Correspondence2D3D const& c = corresp[order[i]];
         math::Vec4d p3d(c.p3d[0], c.p3d[1], c.p3d[2], 1.0);
         math::Vec3d p2d = k_matrix * (pose * p3d);
         double square_error = MATH_POW2(p2d[0] / p2d[2] - c.p2d[0])
             + MATH_POW2(p2d[1] / p2d[2] - c.p2d[1]);
-        if (square_error < square_threshold)
-            inliers->push_back(i);
+        bool const is_inlier = square_error < square_threshold;
+        if (is_inlier)
+            inliers->push_back(order[i]);
+
+        if (sprt == NULL)
+            continue;
+        likelihood_ratio += is_inlier ? sprt->get_consistent_weight()
+            : sprt->get_inconsistent_weight();
+        if (likelihood_ratio > sprt->get_threshold())
+        {
+            sprt->add_rejected_model(i + 1, inliers->size());
+            return false;
+        }
     }
+    return true;
 }
 
 SFM_NAMESPACE_END
@@ -11,6 +11,7 @@
 #include "math/matrix.h"
 #include "math/vector.h"
 #include "sfm/correspondence.h"
+#include "sfm/ransac.h"
 #include "sfm/defines.h"
 
 SFM_NAMESPACE_BEGIN
@@ -22,7 +23,8 @@ SFM_NAMESPACE_BEGIN
  * The rotation and translation of a camera is determined from a set of
  * 2D image to 3D point correspondences contaminated with outliers. The
  * algorithm iteratively selects 3 random correspondences and returns the
- * result which led to the most inliers.
+ * result which led to the most inliers. The number of iterations adapts to
+ * the inlier ratio, and bad poses are rejected early, see Options.
  *
  * The input 2D image coordinates, the input K-matrix and the threshold
  * in the options must be consistent. For example, if the 2D image coordinates
@@ -50,6 +52,28 @@ public:
          */
         double threshold;
 
+        /**
+         * Stop as soon as enough iterations have been performed to find
+         * an all-inlier sample with probability 'success_rate', given the
+         * inlier ratio of the best model so far. 'max_iterations' is an
+         * upper bound. Defaults to true.
+         */
+        bool adaptive_termination;
+
+        /**
+         * Desired probability of RANSAC success for the adaptive
+         * termination. Defaults to 0.99.
+         */
+        double success_rate;
+
+        /**
+         * Reject bad models early during inlier counting using the
+         * sequential probability ratio test (see RansacSprt), which avoids
+         * verifying all correspondences for most models. Correspondences
+         * are then verified in a random order per run. Defaults to true.
+         */
+        bool early_reject;
+
         /**
          * Produce status messages on the console.
          */
@@ -81,9 +105,10 @@ private:
         math::Matrix<double, 3, 3> const& inv_k_matrix,
         PutativePoses* poses);
 
-    void find_inliers (Correspondences2D3D const& corresp,
+    bool find_inliers (Correspondences2D3D const& corresp,
+        std::vector<int> const& order,
         math::Matrix<double, 3, 3> const& k_matrix,
-        Pose const& pose, std::vector<int>* inliers);
+        Pose const& pose, RansacSprt* sprt, std::vector<int>* inliers);
 
 private:
     Options opts;
@@ -95,6 +120,9 @@ inline
 RansacPoseP3P::Options::Options (void)
     : max_iterations(1000)
     , threshold(0.01)
+    , adaptive_termination(true)
+    , success_rate(0.99)
+    , early_reject(true)
     , verbose_output(false)
 {
 }
@@ -0,0 +1,437 @@
+/*
+ * Batched scoring of 2D-2D correspondences for RANSAC.
+ *
+ * The kernels read the coordinates from the structure-of-arrays layout
+ * and evaluate the error of consecutive correspondences in the lanes of
+ * double precision vectors. Remaining correspondences are scored with
+ * the next narrower kernel. The SSE2 kernels are used if enabled at
+ * compile time, the AVX2 and AVX-512 kernels are selected at runtime, see
+ * simd.h for the instruction set handling. All vector kernels multiply
+ * and add in the same order without FMA, so inlier decisions do not
+ * depend on the CPU.
+ */
+
+#include <algorithm>
+#include <emmintrin.h> // SSE2
+
+#include "math/matrix_tools.h"
+#include "sfm/ransac_scoring.h"
+
+#if SFM_AVX_KERNELS
+#   include <immintrin.h> // AVX2, AVX-512
+#   define RS_AVX_KERNELS 1
+#   define RS_TARGET_AVX2 __attribute__((target("avx2")))
+#   define RS_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#   define RS_AVX_KERNELS 0
+#endif
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    /* Number of correspondences scored at once before the SPRT. */
+    std::size_t const SCORING_BATCH_SIZE = 64;
+
+    /* ----------------------- Sampson distance ----------------------- */
+
+    void
+    sampson_scalar (double const* F, CorrespondencesSoA const& m,
+        std::size_t begin, std::size_t end, double* errors)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            double const x1 = m.x1[i], y1 = m.y1[i];
+            double const x2 = m.x2[i], y2 = m.y2[i];
+            double const fx0 = F[0] * x1 + F[1] * y1 + F[2];
+            double const fx1 = F[3] * x1 + F[4] * y1 + F[5];
+            double const fx2 = F[6] * x1 + F[7] * y1 + F[8];
+            double const ftx0 = F[0] * x2 + F[3] * y2 + F[6];
+            double const ftx1 = F[1] * x2 + F[4] * y2 + F[7];
+            double const p2_F_p1 = x2 * fx0 + y2 * fx1 + fx2;
+            errors[i - begin] = (p2_F_p1 * p2_F_p1) / (fx0 * fx0
+                + fx1 * fx1 + ftx0 * ftx0 + ftx1 * ftx1);
+        }
+    }
+
+#if defined(__SSE2__)
+    void
+    sampson_sse2 (double const* F, CorrespondencesSoA const& m,
+        std::size_t begin, std::size_t end, double* errors)
+    {
+        __m128d f[9];
+        for (int i = 0; i < 9; ++i)
+            f[i] = _mm_set1_pd(F[i]);
+
+        std::size_t i = begin;
+        for (; i + 2 <= end; i += 2)
+        {
+            __m128d const x1 = _mm_loadu_pd(&m.x1[i]);
+            __m128d const y1 = _mm_loadu_pd(&m.y1[i]);
+            __m128d const x2 = _mm_loadu_pd(&m.x2[i]);
+            __m128d const y2 = _mm_loadu_pd(&m.y2[i]);
+            __m128d const fx0 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(f[0], x1),
+                _mm_mul_pd(f[1], y1)), f[2]);
+            __m128d const fx1 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(f[3], x1),
+                _mm_mul_pd(f[4], y1)), f[5]);
+            __m128d const fx2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(f[6], x1),
+                _mm_mul_pd(f[7], y1)), f[8]);
+            __m128d const ftx0 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(f[0], x2),
+                _mm_mul_pd(f[3], y2)), f[6]);
+            __m128d const ftx1 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(f[1], x2),
+                _mm_mul_pd(f[4], y2)), f[7]);
+            __m128d num = _mm_add_pd(_mm_add_pd(_mm_mul_pd(x2, fx0),
+                _mm_mul_pd(y2, fx1)), fx2);
+            num = _mm_mul_pd(num, num);
+            __m128d den = _mm_add_pd(_mm_mul_pd(fx0, fx0),
+                _mm_mul_pd(fx1, fx1));
+            den = _mm_add_pd(den, _mm_mul_pd(ftx0, ftx0));
+            den = _mm_add_pd(den, _mm_mul_pd(ftx1, ftx1));
+            _mm_storeu_pd(errors + (i - begin), _mm_div_pd(num, den));
+        }
+        sampson_scalar(F, m, i, end, errors + (i - begin));
+    }
+#endif
+
+#if RS_AVX_KERNELS
+    RS_TARGET_AVX2 void
+    sampson_avx2 (double const* F, CorrespondencesSoA const& m,
+        std::size_t begin, std::size_t end, double* errors)
+    {
+        __m256d f[9];
+        for (int i = 0; i < 9; ++i)
+            f[i] = _mm256_set1_pd(F[i]);
+
+        std::size_t i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m256d const x1 = _mm256_loadu_pd(&m.x1[i]);
+            __m256d const y1 = _mm256_loadu_pd(&m.y1[i]);
+            __m256d const x2 = _mm256_loadu_pd(&m.x2[i]);
+            __m256d const y2 = _mm256_loadu_pd(&m.y2[i]);
+            __m256d const fx0 = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(f[0], x1), _mm256_mul_pd(f[1], y1)), f[2]);
+            __m256d const fx1 = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(f[3], x1), _mm256_mul_pd(f[4], y1)), f[5]);
+            __m256d const fx2 = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(f[6], x1), _mm256_mul_pd(f[7], y1)), f[8]);
+            __m256d const ftx0 = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(f[0], x2), _mm256_mul_pd(f[3], y2)), f[6]);
+            __m256d const ftx1 = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(f[1], x2), _mm256_mul_pd(f[4], y2)), f[7]);
+            __m256d num = _mm256_add_pd(_mm256_add_pd(
+                _mm256_mul_pd(x2, fx0), _mm256_mul_pd(y2, fx1)), fx2);
+            num = _mm256_mul_pd(num, num);
+            __m256d den = _mm256_add_pd(_mm256_mul_pd(fx0, fx0),
+                _mm256_mul_pd(fx1, fx1));
+            den = _mm256_add_pd(den, _mm256_mul_pd(ftx0, ftx0));
+            den = _mm256_add_pd(den, _mm256_mul_pd(ftx1, ftx1));
+            _mm256_storeu_pd(errors + (i - begin), _mm256_div_pd(num, den));
+        }
+#if defined(__SSE2__)
+        sampson_sse2(F, m, i, end, errors + (i - begin));
+#else
+        sampson_scalar(F, m, i, end, errors + (i - begin));
+#endif
+    }
+
+    RS_TARGET_AVX512 void
+    sampson_avx512 (double const* F, CorrespondencesSoA const& m,
+        std::size_t begin, std::size_t end, double* errors)
+    {
+        __m512d f[9];
+        for (int i = 0; i < 9; ++i)
+            f[i] = _mm512_set1_pd(F[i]);
+
+        std::size_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            __m512d const x1 = _mm512_loadu_pd(&m.x1[i]);
+            __m512d const y1 = _mm512_loadu_pd(&m.y1[i]);
+            __m512d const x2 = _mm512_loadu_pd(&m.x2[i]);
+            __m512d const y2 = _mm512_loadu_pd(&m.y2[i]);
+            __m512d const fx0 = _mm512_add_pd(_mm512_add_pd(
+                _mm512_mul_pd(f[0], x1), _mm512_mul_pd(f[1], y1)), f[2]);
+            __m512d const fx1 = _mm512_add_pd(_mm512_add_pd(
+                _mm512_mul_pd(f[3], x1), _mm512_mul_pd(f[4], y1)), f[5]);
+            __m512d const fx2 = _mm512_add_pd(_mm512_add_pd(
+                _mm512_mul_pd(f[6], x1), _mm512_mul_pd(f[7], y1)), f[8]);
+            __m512d const ftx0 = _mm512_add_pd(_mm512_add_pd(
+                _mm512_mul_pd(f[0], x2), _mm512_mul_pd(f[3], y2)), f[6]);
+            __m512d const ftx1 = _mm512_add_pd(_mm512_add_pd(
+                _mm512_mul_pd(f[1], x2), _mm512_mul_pd(f[4], y2)), f[7]);
+            __m512d num = _mm512_add_pd(_mm512_add_pd(
+                _mm512_mul_pd(x2, fx0), _mm512_mul_pd(y2, fx1)), fx2);
+            num = _mm512_mul_pd(num, num);
+            __m512d den = _mm512_add_pd(_mm512_mul_pd(fx0, fx0),
+                _mm512_mul_pd(fx1, fx1));
+            den = _mm512_add_pd(den, _mm512_mul_pd(ftx0, ftx0));
+            den = _mm512_add_pd(den, _mm512_mul_pd(ftx1, ftx1));
+            _mm512_storeu_pd(errors + (i - begin), _mm512_div_pd(num, den));
+        }
+        sampson_avx2(F, m, i, end, errors + (i - begin));
+    }
+#endif
+
+    /* ------------------- Symmetric transfer error ------------------- */
+
+    void
+    transfer_scalar (double const* H, double const* Hinv,
+        CorrespondencesSoA const& m, std::size_t begin, std::size_t end,
+        double* errors)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            double const x1 = m.x1[i], y1 = m.y1[i];
+            double const x2 = m.x2[i], y2 = m.y2[i];
+            double const w2 = H[6] * x1 + H[7] * y1 + H[8];
+            double const dx2 = (H[0] * x1 + H[1] * y1 + H[2]) / w2 - x2;
+            double const dy2 = (H[3] * x1 + H[4] * y1 + H[5]) / w2 - y2;
+            double const w1 = Hinv[6] * x2 + Hinv[7] * y2 + Hinv[8];
+            double const dx1 = (Hinv[0] * x2 + Hinv[1] * y2 + Hinv[2]) / w1
+                - x1;
+            double const dy1 = (Hinv[3] * x2 + Hinv[4] * y2 + Hinv[5]) / w1
+                - y1;
+            errors[i - begin] = 0.5 * ((dx1 * dx1 + dy1 * dy1)
+                + (dx2 * dx2 + dy2 * dy2));
+        }
+    }
+
+#if defined(__SSE2__)
+    /* Computes the squared distance of the transferred point (x, y). */
+    inline __m128d
+    transfer_sse2 (__m128d const* h, __m128d x, __m128d y,
+        __m128d tx, __m128d ty)
+    {
+        __m128d const w = _mm_add_pd(_mm_add_pd(_mm_mul_pd(h[6], x),
+            _mm_mul_pd(h[7], y)), h[8]);
+        __m128d const px = _mm_add_pd(_mm_add_pd(_mm_mul_pd(h[0], x),
+            _mm_mul_pd(h[1], y)), h[2]);
+        __m128d const py = _mm_add_pd(_mm_add_pd(_mm_mul_pd(h[3], x),
+            _mm_mul_pd(h[4], y)), h[5]);
+        __m128d const dx = _mm_sub_pd(_mm_div_pd(px, w), tx);
+        __m128d const dy = _mm_sub_pd(_mm_div_pd(py, w), ty);
+        return _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+    }
+
+    void
+    transfer_sse2 (double const* H, double const* Hinv,
+        CorrespondencesSoA const& m, std::size_t begin, std::size_t end,
+        double* errors)
+    {
+        __m128d h[9], hinv[9];
+        for (int i = 0; i < 9; ++i)
+        {
+            h[i] = _mm_set1_pd(H[i]);
+            hinv[i] = _mm_set1_pd(Hinv[i]);
+        }
+
+        __m128d const half = _mm_set1_pd(0.5);
+        std::size_t i = begin;
+        for (; i + 2 <= end; i += 2)
+        {
+            __m128d const x1 = _mm_loadu_pd(&m.x1[i]);
+            __m128d const y1 = _mm_loadu_pd(&m.y1[i]);
+            __m128d const x2 = _mm_loadu_pd(&m.x2[i]);
+            __m128d const y2 = _mm_loadu_pd(&m.y2[i]);
+            __m128d const error = _mm_add_pd(
+                transfer_sse2(hinv, x2, y2, x1, y1),
+                transfer_sse2(h, x1, y1, x2, y2));
+            _mm_storeu_pd(errors + (i - begin), _mm_mul_pd(half, error));
+        }
+        transfer_scalar(H, Hinv, m, i, end, errors + (i - begin));
+    }
+#endif
+
+#if RS_AVX_KERNELS
+    RS_TARGET_AVX2 inline __m256d
+    transfer_avx2 (__m256d const* h, __m256d x, __m256d y,
+        __m256d tx, __m256d ty)
+    {
+        __m256d const w = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h[6], x),
+            _mm256_mul_pd(h[7], y)), h[8]);
+        __m256d const px = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h[0], x),
+            _mm256_mul_pd(h[1], y)), h[2]);
+        __m256d const py = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h[3], x),
+            _mm256_mul_pd(h[4], y)), h[5]);
+        __m256d const dx = _mm256_sub_pd(_mm256_div_pd(px, w), tx);
+        __m256d const dy = _mm256_sub_pd(_mm256_div_pd(py, w), ty);
+        return _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    }
+
+    RS_TARGET_AVX2 void
+    transfer_avx2 (double const* H, double const* Hinv,
+        CorrespondencesSoA const& m, std::size_t begin, std::size_t end,
+        double* errors)
+    {
+        __m256d h[9], hinv[9];
+        for (int i = 0; i < 9; ++i)
+        {
+            h[i] = _mm256_set1_pd(H[i]);
+            hinv[i] = _mm256_set1_pd(Hinv[i]);
+        }
+
+        __m256d const half = _mm256_set1_pd(0.5);
+        std::size_t i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m256d const x1 = _mm256_loadu_pd(&m.x1[i]);
+            __m256d const y1 = _mm256_loadu_pd(&m.y1[i]);
+            __m256d const x2 = _mm256_loadu_pd(&m.x2[i]);
+            __m256d const y2 = _mm256_loadu_pd(&m.y2[i]);
+            __m256d const error = _mm256_add_pd(
+                transfer_avx2(hinv, x2, y2, x1, y1),
+                transfer_avx2(h, x1, y1, x2, y2));
+            _mm256_storeu_pd(errors + (i - begin),
+                _mm256_mul_pd(half, error));
+        }
+#if defined(__SSE2__)
+        transfer_sse2(H, Hinv, m, i, end, errors + (i - begin));
+#else
+        transfer_scalar(H, Hinv, m, i, end, errors + (i - begin));
+#endif
+    }
+
+    RS_TARGET_AVX512 inline __m512d
+    transfer_avx512 (__m512d const* h, __m512d x, __m512d y,
+        __m512d tx, __m512d ty)
+    {
+        __m512d const w = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(h[6], x),
+            _mm512_mul_pd(h[7], y)), h[8]);
+        __m512d const px = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(h[0], x),
+            _mm512_mul_pd(h[1], y)), h[2]);
+        __m512d const py = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(h[3], x),
+            _mm512_mul_pd(h[4], y)), h[5]);
+        __m512d const dx = _mm512_sub_pd(_mm512_div_pd(px, w), tx);
+        __m512d const dy = _mm512_sub_pd(_mm512_div_pd(py, w), ty);
+        return _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+    }
+
+    RS_TARGET_AVX512 void
+    transfer_avx512 (double const* H, double const* Hinv,
+        CorrespondencesSoA const& m, std::size_t begin, std::size_t end,
+        double* errors)
+    {
+        __m512d h[9], hinv[9];
+        for (int i = 0; i < 9; ++i)
+        {
+            h[i] = _mm512_set1_pd(H[i]);
+            hinv[i] = _mm512_set1_pd(Hinv[i]);
+        }
+
+        __m512d const half = _mm512_set1_pd(0.5);
+        std::size_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            __m512d const x1 = _mm512_loadu_pd(&m.x1[i]);
+            __m512d const y1 = _mm512_loadu_pd(&m.y1[i]);
+            __m512d const x2 = _mm512_loadu_pd(&m.x2[i]);
+            __m512d const y2 = _mm512_loadu_pd(&m.y2[i]);
+            __m512d const error = _mm512_add_pd(
+                transfer_avx512(hinv, x2, y2, x1, y1),
+                transfer_avx512(h, x1, y1, x2, y2));
+            _mm512_storeu_pd(errors + (i - begin),
+                _mm512_mul_pd(half, error));
+        }
+        transfer_avx2(H, Hinv, m, i, end, errors + (i - begin));
+    }
+#endif
+}  /* namespace */
+
+void
+sampson_distances (FundamentalMatrix const& fundamental,
+    CorrespondencesSoA const& matches, std::size_t begin, std::size_t end,
+    double* errors, SimdLevel simd)
+{
+    simd = std::min(simd, detect_simd());
+    double const* F = fundamental.begin();
+#if RS_AVX_KERNELS
+    if (simd == SIMD_AVX512)
+    {
+        sampson_avx512(F, matches, begin, end, errors);
+        return;
+    }
+    if (simd == SIMD_AVX2)
+    {
+        sampson_avx2(F, matches, begin, end, errors);
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    if (simd != SIMD_NONE)
+    {
+        sampson_sse2(F, matches, begin, end, errors);
+        return;
+    }
+#endif
+    sampson_scalar(F, matches, begin, end, errors);
+}
+
+void
+symmetric_transfer_errors (HomographyMatrix const& homography,
+    CorrespondencesSoA const& matches, std::size_t begin, std::size_t end,
+    double* errors, SimdLevel simd)
+{
+    simd = std::min(simd, detect_simd());
+    HomographyMatrix const inverse = math::matrix_inverse(homography);
+    double const* H = homography.begin();
+    double const* Hinv = inverse.begin();
+#if RS_AVX_KERNELS
+    if (simd == SIMD_AVX512)
+    {
+        transfer_avx512(H, Hinv, matches, begin, end, errors);
+        return;
+    }
+    if (simd == SIMD_AVX2)
+    {
+        transfer_avx2(H, Hinv, matches, begin, end, errors);
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    if (simd != SIMD_NONE)
+    {
+        transfer_sse2(H, Hinv, matches, begin, end, errors);
+        return;
+    }
+#endif
+    transfer_scalar(H, Hinv, matches, begin, end, errors);
+}
+
+bool
+find_inliers_batched (math::Matrix3d const& model,
+    BatchedErrorFunction error_function, CorrespondencesSoA const& matches,
+    std::vector<int> const& order, double square_threshold,
+    RansacSprt* sprt, std::vector<int>* inliers)
+{
+    SimdLevel const simd = detect_simd();
+    double likelihood_ratio = 0.0;
+    double errors[SCORING_BATCH_SIZE];
+    inliers->resize(0);
+    for (std::size_t begin = 0; begin < matches.size();
+        begin += SCORING_BATCH_SIZE)
+    {
+        std::size_t const end = std::min(matches.size(),
+            begin + SCORING_BATCH_SIZE);
+        error_function(model, matches, begin, end, errors, simd);
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            bool const is_inlier = errors[i - begin] < square_threshold;
+            if (is_inlier)
+                inliers->push_back(order[i]);
+
+            if (sprt == NULL)
+                continue;
+            likelihood_ratio += is_inlier ? sprt->get_consistent_weight()
+                : sprt->get_inconsistent_weight();
+            if (likelihood_ratio > sprt->get_threshold())
+            {
+                sprt->add_rejected_model(i + 1, inliers->size());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+SFM_NAMESPACE_END
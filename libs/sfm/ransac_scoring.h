@@ -0,0 +1,68 @@
+/*
+ * Batched scoring of 2D-2D correspondences for RANSAC.
+ */
+
+#ifndef SFM_RANSAC_SCORING_HEADER
+#define SFM_RANSAC_SCORING_HEADER
+
+#include <cstddef>
+#include <vector>
+
+#include "math/matrix.h"
+#include "sfm/defines.h"
+#include "sfm/correspondence.h"
+#include "sfm/fundamental.h"
+#include "sfm/homography.h"
+#include "sfm/ransac.h"
+#include "sfm/simd.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Computes the Sampson distances of the correspondences with indices in
+ * [begin, end) given the fundamental matrix. The distance of correspondence
+ * 'begin + i' is stored in 'errors[i]'. This is equivalent to calling
+ * sampson_distance() for every correspondence, but processes 2 (SSE2),
+ * 4 (AVX2) or 8 (AVX-512) correspondences per instruction. The results
+ * may differ from sampson_distance() by rounding errors, but are identical
+ * for all vector instruction sets.
+ *
+ * The instruction set defaults to the best instructions supported by the
+ * CPU (see detect_simd()) and is limited to these.
+ */
+void
+sampson_distances (FundamentalMatrix const& fundamental,
+    CorrespondencesSoA const& matches, std::size_t begin, std::size_t end,
+    double* errors, SimdLevel simd = detect_simd());
+
+/**
+ * Computes the symmetric transfer errors of the correspondences with indices
+ * in [begin, end) given the homography matrix, similar to
+ * sampson_distances(). The inverse homography is computed only once.
+ */
+void
+symmetric_transfer_errors (HomographyMatrix const& homography,
+    CorrespondencesSoA const& matches, std::size_t begin, std::size_t end,
+    double* errors, SimdLevel simd = detect_simd());
+
+/** Batched error function, e.g. sampson_distances(). */
+typedef void (*BatchedErrorFunction) (math::Matrix3d const& model,
+    CorrespondencesSoA const& matches, std::size_t begin, std::size_t end,
+    double* errors, SimdLevel simd);
+
+/**
+ * Finds the correspondences whose error given the model is below the
+ * squared threshold, and stores 'order[i]' for every inlier 'i'. The errors
+ * are computed in batches with the error function. If the SPRT is not NULL,
+ * scoring stops as soon as the SPRT rejects the model, the rejected model
+ * is added to the SPRT and false is returned.
+ */
+bool
+find_inliers_batched (math::Matrix3d const& model,
+    BatchedErrorFunction error_function, CorrespondencesSoA const& matches,
+    std::vector<int> const& order, double square_threshold,
+    RansacSprt* sprt, std::vector<int>* inliers);
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_RANSAC_SCORING_HEADER */
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
@@ -10,10 +11,36 @@
 #include "mve/image_tools.h"
 #include "sfm/sift.h"
 
+/* Keypoints per parallel work item in localization and description. */
+#define SIFT_CHUNK_SIZE 64
+/* Minimum image size to compute gradient images in parallel. */
+#define SIFT_PARALLEL_MIN_PIXELS 65536
+
 SFM_NAMESPACE_BEGIN
 
+namespace
+{
+    /* Pooled images contain old values, clear the unused border. */
+    void
+    clear_border (mve::FloatImage::Ptr image)
+    {
+        int const w = image->width();
+        int const h = image->height();
+        if (w == 0 || h == 0)
+            return;
+        std::fill(&image->at(0), &image->at(0) + w, 0.0f);
+        std::fill(&image->at((h - 1) * w), &image->at((h - 1) * w) + w, 0.0f);
+        for (int y = 0; y < h; ++y)
+        {
+            image->at(y * w) = 0.0f;
+            image->at(y * w + w - 1) = 0.0f;
+        }
+    }
+}  /* namespace */
+
 Sift::Sift (Options const& options)
     : options(options)
+    , num_allocated_images(0)
 {
     if (this->options.min_octave < -1
         || this->options.min_octave > this->options.max_octave)
@@ -32,13 +59,12 @@ Sift::Sift (Options const& options)
 void
 Sift::process (void)
 {
-    util::ClockTimer timer, total_timer;
+    util::ClockTimer total_timer;
+
+    this->keypoints.clear();
+    this->descriptors.clear();
+    this->num_allocated_images = 0;
 
-    /*
-     * Creates the scale space representation of the image by
-     * sampling the scale space and computing the DoG images.
-     * See Section 3, 3.2 and 3.3 in SIFT article.
-     */
     if (this->options.verbose_output)
     {
         std::cout << "SIFT: Creating "
@@ -46,51 +72,54 @@ Sift::process (void)
             << " octaves (" << this->options.min_octave << " to "
             << this->options.max_octave << ")..." << std::endl;
     }
-    timer.reset();
-    this->create_octaves();
-    if (this->options.debug_output)
-    {
-        std::cout << "SIFT: Creating octaves took "
-            << timer.get_elapsed() << "ms." << std::endl;
-    }
 
-    /*
-     * Detects local extrema in the DoG function as described in Section 3.1.
-     */
-    if (this->options.debug_output)
+    if (this->options.streaming_octaves)
+        this->process_streaming();
+    else
+        this->process_octaves();
+
+    if (this->options.verbose_output)
     {
-        std::cout << "SIFT: Detecting local extrema..." << std::endl;
+        std::cout << "SIFT: Generated " << this->descriptors.size()
+            << " descriptors from " << this->keypoints.size() << " keypoints,"
+            << " took " << total_timer.get_elapsed() << "ms." << std::endl;
     }
-    timer.reset();
-    this->extrema_detection();
+
     if (this->options.debug_output)
     {
-        std::cout << "SIFT: Detected " << this->keypoints.size()
-            << " keypoints, took " << timer.get_elapsed() << "ms." << std::endl;
+        std::cout << "SIFT: Allocated " << this->num_allocated_images
+            << " images." << std::endl;
     }
 
+    /* Free memory. */
+    this->octaves.clear();
+    this->image_pool.clear();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Sift::process_octaves (void)
+{
+    util::ClockTimer timer;
+
     /*
-     * Accurate keypoint localization and filtering.
-     * According to Section 4 in SIFT article.
+     * Creates the scale space representation of the image by
+     * sampling the scale space and computing the DoG images.
+     * See Section 3, 3.2 and 3.3 in SIFT article. Local extrema in the
+     * DoG function are detected on the fly as described in Section 3.1,
+     * and keypoints are localized and filtered according to Section 4
+     * as soon as the DoG images of their sample are complete.
      */
-    if (this->options.debug_output)
-    {
-        std::cout << "SIFT: Localizing and filtering keypoints..." << std::endl;
-    }
     timer.reset();
-    this->keypoint_localization();
+    this->create_octaves();
     if (this->options.debug_output)
     {
-        std::cout << "SIFT: Retained " << this->keypoints.size() << " stable "
-            << "keypoints, took " << timer.get_elapsed() << "ms." << std::endl;
+        std::cout << "SIFT: Creating octaves took "
+            << timer.get_elapsed() << "ms, retained "
+            << this->keypoints.size() << " stable keypoints." << std::endl;
     }
 
-    /*
-     * Difference of Gaussian images are not needed anymore.
-     */
-    for (std::size_t i = 0; i < this->octaves.size(); ++i)
-        this->octaves[i].dog.clear();
-
     /*
      * Generate the list of keypoint descriptors.
      * See Section 5 and 6 in the SIFT article.
@@ -102,22 +131,59 @@ Sift::process (void)
         std::cout << "SIFT: Generating keypoint descriptors..." << std::endl;
     }
     timer.reset();
-    this->descriptor_generation();
+    this->descriptor_generation(0);
     if (this->options.debug_output)
     {
         std::cout << "SIFT: Generated " << this->descriptors.size()
             << " descriptors, took " << timer.get_elapsed() << "ms."
             << std::endl;
     }
-    if (this->options.verbose_output)
-    {
-        std::cout << "SIFT: Generated " << this->descriptors.size()
-            << " descriptors from " << this->keypoints.size() << " keypoints,"
-            << " took " << total_timer.get_elapsed() << "ms." << std::endl;
-    }
+}
 
-    /* Free memory. */
+/* ---------------------------------------------------------------- */
+
+void
+Sift::process_streaming (void)
+{
+    /*
+     * Every octave only depends on the input image of the octave, and the
+     * keypoints and descriptors are generated in octave order. Processing
+     * the octaves one after another thus yields the same result as
+     * process_octaves(), but only keeps a single octave in memory. The
+     * images of an octave are reused within the octave and released as
+     * soon as the octave is done.
+     */
     this->octaves.clear();
+    this->octaves.reserve(this->options.max_octave
+        - this->options.min_octave + 1);
+
+    mve::FloatImage::ConstPtr image;
+    float image_sigma = 0.0f;
+    for (int i = this->options.min_octave; i <= this->options.max_octave; ++i)
+    {
+        util::ClockTimer timer;
+        std::size_t const begin = this->keypoints.size();
+        std::size_t const num_descriptors = this->descriptors.size();
+
+        /* Create octave with localized keypoints. */
+        this->create_octave(i, &image, &image_sigma);
+
+        /* Generate descriptors and release the octave. */
+        Octave& octave = this->octaves.back();
+        this->descriptor_generation(begin);
+        octave.img.clear();
+        octave.grad.clear();
+        octave.ori.clear();
+
+        if (this->options.debug_output)
+        {
+            std::cout << "SIFT: Octave " << i << ": "
+                << (this->keypoints.size() - begin)
+                << " keypoints, " << (this->descriptors.size()
+                - num_descriptors) << " descriptors, took "
+                << timer.get_elapsed() << "ms." << std::endl;
+        }
+    }
 }
 
 /* ---------------------------------------------------------------- */
@@ -162,59 +228,91 @@ Sift::create_octaves (void)
 {
     this->octaves.clear();
 
+    mve::FloatImage::ConstPtr image;
+    float image_sigma = 0.0f;
+    for (int i = this->options.min_octave; i <= this->options.max_octave; ++i)
+    {
+        this->create_octave(i, &image, &image_sigma);
+        this->image_pool.clear();
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Sift::create_octave (int octave_id, mve::FloatImage::ConstPtr* image,
+    float* image_sigma)
+{
     /*
      * Create octave -1. The original image is assumed to have blur
      * sigma = 0.5. The double size image therefore has sigma = 1.
      */
-    if (this->options.min_octave < 0)
+    if (octave_id < 0)
     {
-        //std::cout << "Creating octave -1..." << std::endl;
         mve::FloatImage::Ptr img
             = mve::image::rescale_double_size_supersample<float>(this->orig);
-        this->add_octave(img, this->options.inherent_blur_sigma * 2.0f,
-            this->options.base_blur_sigma);
+        this->add_octave(this->create_base_image(img,
+            this->options.inherent_blur_sigma * 2.0f));
+        return;
     }
 
     /*
      * Prepare image for the first positive octave by downsampling.
      * This code is executed only if min_octave > 0.
      */
-    mve::FloatImage::ConstPtr img = this->orig;
-    for (int i = 0; i < this->options.min_octave; ++i)
-        img = mve::image::rescale_half_size_gaussian<float>(img);
+    if (*image == NULL)
+    {
+        *image = this->orig;
+        for (int i = 0; i < this->options.min_octave; ++i)
+            *image = mve::image::rescale_half_size_gaussian<float>(*image);
+        *image_sigma = this->options.inherent_blur_sigma;
+    }
 
     /*
-     * Create new octave from 'img', then subsample octave image where
+     * Create new octave from 'image', then subsample octave image where
      * sigma is doubled to get a new base image for the next octave.
      */
-    float img_sigma = this->options.inherent_blur_sigma;
-    for (int i = std::max(0, this->options.min_octave);
-        i <= this->options.max_octave; ++i)
-    {
-        //std::cout << "Creating octave " << i << "..." << std::endl;
-        this->add_octave(img, img_sigma, this->options.base_blur_sigma);
-        img = mve::image::rescale_half_size_gaussian<float>(img);
-        img_sigma = this->options.base_blur_sigma;
-    }
+    this->add_octave(this->create_base_image(*image, *image_sigma));
+    *image = mve::image::rescale_half_size_gaussian<float>(*image);
+    *image_sigma = this->options.base_blur_sigma;
 }
 
 /* ---------------------------------------------------------------- */
 
-void
-Sift::add_octave (mve::FloatImage::ConstPtr image,
-        float has_sigma, float target_sigma)
+mve::FloatImage::Ptr
+Sift::create_base_image (mve::FloatImage::ConstPtr image, float has_sigma)
 {
     /*
-     * First, bring the provided image to the target blur.
-     * Since L * g(sigma1) * g(sigma2) = L * g(sqrt(sigma1^2 + sigma2^2)),
+     * Bring the provided image to the base blur. Since
+     * L * g(sigma1) * g(sigma2) = L * g(sqrt(sigma1^2 + sigma2^2)),
      * we need to blur with sigma = sqrt(target_sigma^2 - has_sigma^2).
      */
-    float sigma = std::sqrt(MATH_POW2(target_sigma) - MATH_POW2(has_sigma));
-    //std::cout << "Pre-blurring image to sigma " << target_sigma << " (has "
-    //    << has_sigma << ", blur = " << sigma << ")..." << std::endl;
-    mve::FloatImage::Ptr base = (target_sigma > has_sigma
-        ? mve::image::blur_gaussian<float>(image, sigma)
-        : mve::FloatImage::Ptr(image->duplicate()));
+    float const target_sigma = this->options.base_blur_sigma;
+    mve::FloatImage::Ptr base = this->acquire_image(image->width(),
+        image->height());
+    if (target_sigma > has_sigma)
+    {
+        mve::FloatImage::Ptr tmp = this->acquire_image(image->width(),
+            image->height());
+        mve::image::blur_gaussian(image, std::sqrt(MATH_POW2(target_sigma)
+            - MATH_POW2(has_sigma)), tmp, base);
+        this->image_pool.push_back(tmp);
+    }
+    else
+        std::copy(image->begin(), image->end(), base->begin());
+
+    return base;
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Sift::add_octave (mve::FloatImage::Ptr base)
+{
+    int const width = base->width();
+    int const height = base->height();
+    int const octave_id = this->options.min_octave
+        + static_cast<int>(this->octaves.size());
 
     /* Create the new octave and add initial image. */
     this->octaves.push_back(Octave());
@@ -223,9 +321,10 @@ Sift::add_octave (mve::FloatImage::ConstPtr image,
 
     /* 'k' is the constant factor between the scales in scale space. */
     float const k = std::pow(2.0f, 1.0f / this->options.num_samples_per_octave);
-    sigma = target_sigma;
+    float sigma = this->options.base_blur_sigma;
 
     /* Create other (s+2) samples of the octave to get a total of (s+3). */
+    mve::FloatImage::Ptr tmp = this->acquire_image(width, height);
     for (int i = 1; i < this->options.num_samples_per_octave + 3; ++i)
     {
         /* Calculate the blur sigma the image will get. */
@@ -233,261 +332,318 @@ Sift::add_octave (mve::FloatImage::ConstPtr image,
         float blur_sigma = std::sqrt(MATH_POW2(sigmak) - MATH_POW2(sigma));
 
         /* Blur the image to create a new scale space sample. */
-        //std::cout << "Blurring image to sigma " << sigmak << " (has " << sigma
-        //    << ", blur = " << blur_sigma << ")..." << std::endl;
-        mve::FloatImage::Ptr img = mve::image::blur_gaussian<float>
-            (base, blur_sigma);
+        mve::FloatImage::Ptr img = this->acquire_image(width, height);
+        mve::image::blur_gaussian(base, blur_sigma, tmp, img);
         oct.img.push_back(img);
 
-        /* Create the Difference of Gaussian image (DoG). */
-        mve::FloatImage::Ptr dog = mve::image::subtract<float>(img, base);
+        /*
+         * Create the Difference of Gaussian image (DoG) row by row. Once
+         * a row is complete, the previous row of the previous DoG image
+         * is checked for extrema (see Section 3.1 in SIFT article).
+         */
+        mve::FloatImage::Ptr dog = this->acquire_image(width, height);
         oct.dog.push_back(dog);
+        int const sample = static_cast<int>(oct.dog.size()) - 3;
+        std::size_t const sample_begin = this->keypoints.size();
+        for (int y = 0; y < height; ++y)
+        {
+            float const* img_row = &img->at(y * width);
+            float const* base_row = &base->at(y * width);
+            float* dog_row = &dog->at(y * width);
+            for (int x = 0; x < width; ++x)
+                dog_row[x] = img_row[x] - base_row[x];
+
+            if (sample < 0 || y < 2)
+                continue;
+            float const* samples[3];
+            for (int l = 0; l < 3; ++l)
+                samples[l] = &oct.dog[sample + l]->at((y - 1) * width);
+            this->extrema_detection(samples, width, y - 1,
+                octave_id, sample);
+        }
+
+        /*
+         * The extrema of the sample are complete. Localize them and
+         * release the lowest DoG image, which is reused for the next DoG.
+         */
+        if (sample >= 0)
+        {
+            this->keypoint_localization(sample_begin);
+            this->image_pool.push_back(oct.dog[sample]);
+            oct.dog[sample].reset();
+        }
 
         /* Update previous image and sigma for next round. */
         base = img;
         sigma = sigmak;
     }
+    this->image_pool.push_back(tmp);
+
+    /* The last sample is only used for the DoG images. */
+    this->image_pool.push_back(oct.img.back());
+    oct.img.pop_back();
+    this->release_images(&oct.dog);
 }
 
 /* ---------------------------------------------------------------- */
 
-void
-Sift::extrema_detection (void)
+mve::FloatImage::Ptr
+Sift::acquire_image (int width, int height)
 {
-    /* Delete previous keypoints. */
-    this->keypoints.clear();
-
-    /* Detect keypoints in each octave... */
-    for (std::size_t i = 0; i < this->octaves.size(); ++i)
+    /* Only reuse images of the same size, which belong to this octave. */
+    for (std::size_t i = this->image_pool.size(); i > 0; --i)
     {
-        Octave const& oct(this->octaves[i]);
-        /* In each octave, take three subsequent DoG images and detect. */
-        for (int s = 0; s < (int)oct.dog.size() - 2; ++s)
-        {
-            mve::FloatImage::ConstPtr samples[3] =
-            { oct.dog[s + 0], oct.dog[s + 1], oct.dog[s + 2] };
-            this->extrema_detection(samples, static_cast<int>(i)
-                + this->options.min_octave, s);
-        }
+        mve::FloatImage::Ptr image = this->image_pool[i - 1];
+        if (image->width() != width || image->height() != height)
+            continue;
+        this->image_pool.erase(this->image_pool.begin() + (i - 1));
+        return image;
     }
+
+    this->num_allocated_images += 1;
+    return mve::FloatImage::create(width, height, 1);
 }
 
 /* ---------------------------------------------------------------- */
 
-std::size_t
-Sift::extrema_detection (mve::FloatImage::ConstPtr s[3], int oi, int si)
+void
+Sift::release_images (Octave::ImageVector* images)
+{
+    for (std::size_t i = 0; i < images->size(); ++i)
+        if (images->at(i) != NULL)
+            this->image_pool.push_back(images->at(i));
+    images->clear();
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Sift::extrema_detection (float const* s[3], int width, int y,
+    int oi, int si)
 {
-    int const w = s[1]->width();
-    int const h = s[1]->height();
+    int const w = width;
 
     /* Offsets for the 9-neighborhood w.r.t. center pixel. */
     int noff[9] = { -1 - w, 0 - w, 1 - w, -1, 0, 1, -1 + w, 0 + w, 1 + w };
 
     /*
-     * Iterate over all pixels in s[1], and check if pixel is maximum
-     * (or minumum) in its 27-neighborhood.
+     * Iterate over all pixels in the row s[1], and check if pixel is
+     * maximum (or minumum) in its 27-neighborhood.
      */
-    int detected = 0;
-    int off = w;
-    for (int y = 1; y < h - 1; ++y, off += w)
-        for (int x = 1; x < w - 1; ++x)
-        {
-            int idx = off + x;
-
-            bool largest = true;
-            bool smallest = true;
-            float center_value = s[1]->at(idx);
-            for (int l = 0; (largest || smallest) && l < 3; ++l)
-                for (int i = 0; (largest || smallest) && i < 9; ++i)
-                {
-                    if (l == 1 && i == 4) // Skip center pixel
-                        continue;
-                    if (s[l]->at(idx + noff[i]) >= center_value)
-                        largest = false;
-                    if (s[l]->at(idx + noff[i]) <= center_value)
-                        smallest = false;
-                }
-
-            /* Skip non-maximum values. */
-            if (!smallest && !largest)
-                continue;
+    for (int x = 1; x < w - 1; ++x)
+    {
+        bool largest = true;
+        bool smallest = true;
+        float center_value = s[1][x];
+        for (int l = 0; (largest || smallest) && l < 3; ++l)
+            for (int i = 0; (largest || smallest) && i < 9; ++i)
+            {
+                if (l == 1 && i == 4) // Skip center pixel
+                    continue;
+                if (s[l][x + noff[i]] >= center_value)
+                    largest = false;
+                if (s[l][x + noff[i]] <= center_value)
+                    smallest = false;
+            }
 
-            /* Yummy. Add detected scale space extremum. */
-            Keypoint kp;
-            kp.octave = oi;
-            kp.x = static_cast<float>(x);
-            kp.y = static_cast<float>(y);
-            kp.sample = static_cast<float>(si);
-            this->keypoints.push_back(kp);
-            detected += 1;
-        }
+        /* Skip non-maximum values. */
+        if (!smallest && !largest)
+            continue;
 
-    return detected;
+        /* Yummy. Add detected scale space extremum. */
+        Keypoint kp;
+        kp.octave = oi;
+        kp.x = static_cast<float>(x);
+        kp.y = static_cast<float>(y);
+        kp.sample = static_cast<float>(si);
+        this->keypoints.push_back(kp);
+    }
 }
 
 /* ---------------------------------------------------------------- */
 
 void
-Sift::keypoint_localization (void)
+Sift::keypoint_localization (std::size_t begin)
 {
     /*
      * Iterate over all keypoints, accurately localize minima and maxima
      * in the DoG function by fitting a quadratic Taylor polynomial
-     * around the keypoint.
+     * around the keypoint. Keypoints are localized independently in
+     * parallel, the accepted keypoints are compacted in the original order.
      */
-
+    int const num_candidates = static_cast<int>(this->keypoints.size()
+        - std::min(begin, this->keypoints.size()));
+    std::vector<char> accepted(num_candidates, 0);
     int num_singular = 0;
-    int num_keypoints = 0; // Write iterator
-    for (std::size_t i = 0; i < this->keypoints.size(); ++i)
-    {
-        /* Copy keypoint. */
-        Keypoint kp(this->keypoints[i]);
-
-        /* Get corresponding octave and DoG images. */
-        Octave const& oct(this->octaves[kp.octave - this->options.min_octave]);
-        int sample = static_cast<int>(kp.sample);
-        mve::FloatImage::ConstPtr dogs[3] =
-        { oct.dog[sample + 0], oct.dog[sample + 1], oct.dog[sample + 2] };
-
-        /* Shorthand for image width and height. */
-        int const w = dogs[0]->width();
-        int const h = dogs[0]->height();
-        /* The integer and floating point location of the keypoints. */
-        int ix = static_cast<int>(kp.x);
-        int iy = static_cast<int>(kp.y);
-        int is = static_cast<int>(kp.sample);
-        float fx, fy, fs;
-        /* The first and second order derivatives. */
-        float Dx, Dy, Ds;
-        float Dxx, Dyy, Dss;
-        float Dxy, Dxs, Dys;
+#pragma omp parallel for schedule(dynamic, SIFT_CHUNK_SIZE) \
+    reduction(+:num_singular) if (num_candidates > SIFT_CHUNK_SIZE)
+    for (int i = 0; i < num_candidates; ++i)
+    {
+        bool singular = false;
+        accepted[i] = this->keypoint_localization
+            (&this->keypoints[begin + i], &singular);
+        num_singular += singular;
+    }
 
-        /*
-         * Locate the keypoint using second order Taylor approximation.
-         * The procedure might get iterated around a neighboring pixel if
-         * the accurate keypoint is off by >0.6 from the center pixel.
-         */
-#       define AT(S,OFF) (dogs[S]->at(px + OFF))
-        for (int j = 0; j < 5; ++j)
+    /* Copy accepted keypoints to write iter and advance. */
+    std::size_t num_keypoints = begin; // Write iterator
+    for (int i = 0; i < num_candidates; ++i)
+        if (accepted[i])
         {
-            std::size_t px = iy * w + ix;
-
-            /* Compute first and second derivatives. */
-            Dx = (AT(1,1) - AT(1,-1)) * 0.5f;
-            Dy = (AT(1,w) - AT(1,-w)) * 0.5f;
-            Ds = (AT(2,0) - AT(0,0))  * 0.5f;
-
-            Dxx = AT(1,1) + AT(1,-1) - 2.0f * AT(1,0);
-            Dyy = AT(1,w) + AT(1,-w) - 2.0f * AT(1,0);
-            Dss = AT(2,0) + AT(0,0)  - 2.0f * AT(1,0);
-
-            Dxy = (AT(1,1+w) + AT(1,-1-w) - AT(1,-1+w) - AT(1,1-w)) * 0.25f;
-            Dxs = (AT(2,1)   + AT(0,-1)   - AT(2,-1)   - AT(0,1))   * 0.25f;
-            Dys = (AT(2,w)   + AT(0,-w)   - AT(2,-w)   - AT(0,w))   * 0.25f;
-
-            /* Setup the Hessian matrix. */
-            math::Matrix3f A;
-            A[0] = Dxx; A[1] = Dxy; A[2] = Dxs;
-            A[3] = Dxy; A[4] = Dyy; A[5] = Dys;
-            A[6] = Dxs; A[7] = Dys; A[8] = Dss;
-
-            /* Compute determinant to detect singular matrix. */
-            float detA = math::matrix_determinant(A);
-            if (MATH_EPSILON_EQ(detA, 0.0f, 1e-15f))
-            {
-                num_singular += 1;
-                fx = fy = fs = 0.0f; // FIXME: Handle this case?
-                break;
-            }
+            this->keypoints[num_keypoints] = this->keypoints[begin + i];
+            num_keypoints += 1;
+        }
 
-            /* Invert the matrix to get the accurate keypoint. */
-            A = math::matrix_inverse(A, detA);
-            math::Vec3f b(-Dx, -Dy, -Ds);
-            b = A * b;
-            fx = b[0]; fy = b[1]; fs = b[2];
+    /* Limit vector size to number of accepted keypoints. */
+    this->keypoints.resize(num_keypoints);
 
-            /* Check if accurate location is far away from pixel center. */
-            int dx = (fx > 0.6f && ix < w-2) * 1 + (fx < -0.6f && ix > 1) * -1;
-            int dy = (fy > 0.6f && iy < h-2) * 1 + (fy < -0.6f && iy > 1) * -1;
+    if (this->options.debug_output && num_singular > 0)
+    {
+        std::cout << "SIFT: Warning: " << num_singular
+            << " singular matrices detected!" << std::endl;
+    }
+}
 
-            /* If the accurate location is closer to another pixel,
-             * repeat localization around the other pixel. */
-            if (dx != 0 || dy != 0)
-            {
-                ix += dx;
-                iy += dy;
-                continue;
-            }
+/* ---------------------------------------------------------------- */
+
+bool
+Sift::keypoint_localization (Keypoint* keypoint, bool* singular) const
+{
+    Keypoint& kp = *keypoint;
+
+    /* Get corresponding octave and DoG images (without reference count). */
+    Octave const& oct(this->octaves[kp.octave - this->options.min_octave]);
+    int sample = static_cast<int>(kp.sample);
+    mve::FloatImage const* dogs[3] = { oct.dog[sample + 0].get(),
+        oct.dog[sample + 1].get(), oct.dog[sample + 2].get() };
+
+    /* Shorthand for image width and height. */
+    int const w = dogs[0]->width();
+    int const h = dogs[0]->height();
+    /* The integer and floating point location of the keypoints. */
+    int ix = static_cast<int>(kp.x);
+    int iy = static_cast<int>(kp.y);
+    int is = static_cast<int>(kp.sample);
+    float fx, fy, fs;
+    /* The first and second order derivatives. */
+    float Dx, Dy, Ds;
+    float Dxx, Dyy, Dss;
+    float Dxy, Dxs, Dys;
 
-            /* Accurate location looks good. */
+    /*
+     * Locate the keypoint using second order Taylor approximation.
+     * The procedure might get iterated around a neighboring pixel if
+     * the accurate keypoint is off by >0.6 from the center pixel.
+     */
+#   define AT(S,OFF) (dogs[S]->at(px + OFF))
+    for (int j = 0; j < 5; ++j)
+    {
+        std::size_t px = iy * w + ix;
+
+        /* Compute first and second derivatives. */
+        Dx = (AT(1,1) - AT(1,-1)) * 0.5f;
+        Dy = (AT(1,w) - AT(1,-w)) * 0.5f;
+        Ds = (AT(2,0) - AT(0,0))  * 0.5f;
+
+        Dxx = AT(1,1) + AT(1,-1) - 2.0f * AT(1,0);
+        Dyy = AT(1,w) + AT(1,-w) - 2.0f * AT(1,0);
+        Dss = AT(2,0) + AT(0,0)  - 2.0f * AT(1,0);
+
+        Dxy = (AT(1,1+w) + AT(1,-1-w) - AT(1,-1+w) - AT(1,1-w)) * 0.25f;
+        Dxs = (AT(2,1)   + AT(0,-1)   - AT(2,-1)   - AT(0,1))   * 0.25f;
+        Dys = (AT(2,w)   + AT(0,-w)   - AT(2,-w)   - AT(0,w))   * 0.25f;
+
+        /* Setup the Hessian matrix. */
+        math::Matrix3f A;
+        A[0] = Dxx; A[1] = Dxy; A[2] = Dxs;
+        A[3] = Dxy; A[4] = Dyy; A[5] = Dys;
+        A[6] = Dxs; A[7] = Dys; A[8] = Dss;
+
+        /* Compute determinant to detect singular matrix. */
+        float detA = math::matrix_determinant(A);
+        if (MATH_EPSILON_EQ(detA, 0.0f, 1e-15f))
+        {
+            *singular = true;
+            fx = fy = fs = 0.0f; // FIXME: Handle this case?
             break;
         }
 
-        /* Calcualte function value D(x) at accurate keypoint x. */
-        float val = dogs[1]->at(ix, iy, 0) + 0.5f * (Dx * fx + Dy * fy + Ds * fs);
+        /* Invert the matrix to get the accurate keypoint. */
+        A = math::matrix_inverse(A, detA);
+        math::Vec3f b(-Dx, -Dy, -Ds);
+        b = A * b;
+        fx = b[0]; fy = b[1]; fs = b[2];
 
-        /* Calcualte edge response score Tr(H)^2 / Det(H), see Section 4.1. */
-        float hessian_trace = Dxx + Dyy;
-        float hessian_det = Dxx * Dyy - MATH_POW2(Dxy);
-        float hessian_score = MATH_POW2(hessian_trace) / hessian_det;
-        float score_thres = MATH_POW2(this->options.edge_ratio_threshold + 1.0f)
-            / this->options.edge_ratio_threshold;
-
-        /*
-         * Set accurate final keypoint location.
-         */
-        kp.x = (float)ix + fx;
-        kp.y = (float)iy + fy;
-        kp.sample = (float)is + fs;
+        /* Check if accurate location is far away from pixel center. */
+        int dx = (fx > 0.6f && ix < w-2) * 1 + (fx < -0.6f && ix > 1) * -1;
+        int dy = (fy > 0.6f && iy < h-2) * 1 + (fy < -0.6f && iy > 1) * -1;
 
-        /*
-         * Discard keypoints with:
-         * 1. low contrast (value of DoG function at keypoint),
-         * 2. negative hessian determinant (curvatures with different sign),
-         *    Note that negative score implies negative determinant.
-         * 3. large edge response (large hessian score),
-         * 4. unstable keypoint accurate locations,
-         * 5. keypoints beyond the scale space boundary.
-         */
-        if (std::abs(val) < this->options.contrast_threshold
-            || hessian_score < 0.0f || hessian_score > score_thres
-            || std::abs(fx) > 1.5f || std::abs(fy) > 1.5f || std::abs(fs) > 1.0f
-            || kp.sample < -1.0f
-            || kp.sample > (float)this->options.num_samples_per_octave
-            || kp.x < 0.0f || kp.x > (float)(w - 1)
-            || kp.y < 0.0f || kp.y > (float)(h - 1))
+        /* If the accurate location is closer to another pixel,
+         * repeat localization around the other pixel. */
+        if (dx != 0 || dy != 0)
         {
-            //std::cout << " REJECTED!" << std::endl;
+            ix += dx;
+            iy += dy;
             continue;
         }
 
-        /* Keypoint is accepted, copy to write iter and advance. */
-        this->keypoints[num_keypoints] = kp;
-        num_keypoints += 1;
+        /* Accurate location looks good. */
+        break;
     }
 
-    /* Limit vector size to number of accepted keypoints. */
-    this->keypoints.resize(num_keypoints);
+    /* Calcualte function value D(x) at accurate keypoint x. */
+    float val = dogs[1]->at(ix, iy, 0) + 0.5f * (Dx * fx + Dy * fy + Ds * fs);
 
-    if (this->options.debug_output && num_singular > 0)
+    /* Calcualte edge response score Tr(H)^2 / Det(H), see Section 4.1. */
+    float hessian_trace = Dxx + Dyy;
+    float hessian_det = Dxx * Dyy - MATH_POW2(Dxy);
+    float hessian_score = MATH_POW2(hessian_trace) / hessian_det;
+    float score_thres = MATH_POW2(this->options.edge_ratio_threshold + 1.0f)
+        / this->options.edge_ratio_threshold;
+
+    /*
+     * Set accurate final keypoint location.
+     */
+    kp.x = (float)ix + fx;
+    kp.y = (float)iy + fy;
+    kp.sample = (float)is + fs;
+
+    /*
+     * Discard keypoints with:
+     * 1. low contrast (value of DoG function at keypoint),
+     * 2. negative hessian determinant (curvatures with different sign),
+     *    Note that negative score implies negative determinant.
+     * 3. large edge response (large hessian score),
+     * 4. unstable keypoint accurate locations,
+     * 5. keypoints beyond the scale space boundary.
+     */
+    if (std::abs(val) < this->options.contrast_threshold
+        || hessian_score < 0.0f || hessian_score > score_thres
+        || std::abs(fx) > 1.5f || std::abs(fy) > 1.5f || std::abs(fs) > 1.0f
+        || kp.sample < -1.0f
+        || kp.sample > (float)this->options.num_samples_per_octave
+        || kp.x < 0.0f || kp.x > (float)(w - 1)
+        || kp.y < 0.0f || kp.y > (float)(h - 1))
     {
-        std::cout << "SIFT: Warning: " << num_singular
-            << " singular matrices detected!" << std::endl;
+        //std::cout << " REJECTED!" << std::endl;
+        return false;
     }
+
+    return true;
 }
 
 /* ---------------------------------------------------------------- */
 
 void
-Sift::descriptor_generation (void)
+Sift::descriptor_generation (std::size_t begin)
 {
     if (this->octaves.empty())
         throw std::runtime_error("Octaves not available!");
-    if (this->keypoints.empty())
+    if (begin >= this->keypoints.size())
         return;
 
-    this->descriptors.clear();
-    this->descriptors.reserve(this->keypoints.size() * 3 / 2);
+    this->descriptors.reserve(this->descriptors.size()
+        + (this->keypoints.size() - begin) * 3 / 2);
 
     /*
      * Keep a buffer of S+3 gradient and orientation images for the current
@@ -495,51 +651,85 @@ Sift::descriptor_generation (void)
      * To ensure efficiency, the octave index must always increase, never
      * decrease, which is enforced during the algorithm.
      */
-    int octave_index = this->keypoints[0].octave;
-    Octave* octave = &this->octaves[octave_index - this->options.min_octave];
-    this->generate_grad_ori_images(octave);
-
-    /* Walk over all keypoints and compute descriptors. */
-    for (std::size_t i = 0; i < this->keypoints.size(); ++i)
+    Octave* octave = NULL;
+    std::size_t octave_begin = begin;
+    while (octave_begin < this->keypoints.size())
     {
-        Keypoint const& kp(this->keypoints[i]);
+        /* Find the range of keypoints in the next octave. */
+        int const octave_index = this->keypoints[octave_begin].octave;
+        std::size_t octave_end = octave_begin + 1;
+        while (octave_end < this->keypoints.size()
+            && this->keypoints[octave_end].octave == octave_index)
+            octave_end += 1;
+        if (octave_end < this->keypoints.size()
+            && this->keypoints[octave_end].octave < octave_index)
+            throw std::runtime_error("Decreasing octave index!");
 
-        /* Generate new gradient and orientation images if octave changed. */
-        if (kp.octave > octave_index)
+        /* Free old and setup new gradient and orientation images. */
+        if (octave)
         {
-            /* Clear old octave gradient and orientation images. */
-            if (octave)
-            {
-                octave->grad.clear();
-                octave->ori.clear();
-            }
-            /* Setup new octave gradient and orientation images. */
-            octave_index = kp.octave;
-            octave = &this->octaves[octave_index - this->options.min_octave];
-            this->generate_grad_ori_images(octave);
+            octave->grad.clear();
+            octave->ori.clear();
         }
-        else if (kp.octave < octave_index)
+        octave = &this->octaves[octave_index - this->options.min_octave];
+        this->generate_grad_ori_images(octave);
+
+        /*
+         * Walk over the keypoints of the octave in chunks. The chunks are
+         * processed in parallel with descriptors in per-chunk vectors,
+         * which are appended in chunk order to be identical to the
+         * serial result.
+         */
+        int const num_chunks = static_cast<int>((octave_end - octave_begin
+            + SIFT_CHUNK_SIZE - 1) / SIFT_CHUNK_SIZE);
+        std::vector<Descriptors> chunk_descriptors(num_chunks);
+#pragma omp parallel for schedule(dynamic) if (num_chunks > 1)
+        for (int i = 0; i < num_chunks; ++i)
         {
-            throw std::runtime_error("Decreasing octave index!");
+            std::size_t const chunk_begin = octave_begin
+                + static_cast<std::size_t>(i) * SIFT_CHUNK_SIZE;
+            std::size_t const chunk_end = std::min(octave_end,
+                chunk_begin + SIFT_CHUNK_SIZE);
+            Descriptors* result = &chunk_descriptors[i];
+            result->reserve((chunk_end - chunk_begin) * 3 / 2);
+            for (std::size_t j = chunk_begin; j < chunk_end; ++j)
+                this->descriptor_generation(this->keypoints[j], octave,
+                    result);
         }
 
-        /* Orientation assignment. This returns multiple orientations. */
-        std::vector<float> orientations;
-        orientations.reserve(8);
-        this->orientation_assignment(kp, octave, orientations);
-
-        /* Feature vector extraction. */
-        for (std::size_t j = 0; j < orientations.size(); ++j)
+        for (int i = 0; i < num_chunks; ++i)
         {
-            Descriptor desc;
-            float const scale_factor = std::pow(2.0f, kp.octave);
-            desc.x = scale_factor * (kp.x + 0.5f) - 0.5f;
-            desc.y = scale_factor * (kp.y + 0.5f) - 0.5f;
-            desc.scale = this->keypoint_absolute_scale(kp);
-            desc.orientation = orientations[j];
-            if (this->descriptor_assignment(kp, desc, octave))
-                this->descriptors.push_back(desc);
+            this->descriptors.insert(this->descriptors.end(),
+                chunk_descriptors[i].begin(), chunk_descriptors[i].end());
+            Descriptors().swap(chunk_descriptors[i]);
         }
+
+        octave_begin = octave_end;
+    }
+}
+
+/* ---------------------------------------------------------------- */
+
+void
+Sift::descriptor_generation (Keypoint const& kp, Octave const* octave,
+    Descriptors* result)
+{
+    /* Orientation assignment. This returns multiple orientations. */
+    std::vector<float> orientations;
+    orientations.reserve(8);
+    this->orientation_assignment(kp, octave, orientations);
+
+    /* Feature vector extraction. */
+    for (std::size_t j = 0; j < orientations.size(); ++j)
+    {
+        Descriptor desc;
+        float const scale_factor = std::pow(2.0f, kp.octave);
+        desc.x = scale_factor * (kp.x + 0.5f) - 0.5f;
+        desc.y = scale_factor * (kp.y + 0.5f) - 0.5f;
+        desc.scale = this->keypoint_absolute_scale(kp);
+        desc.orientation = orientations[j];
+        if (this->descriptor_assignment(kp, desc, octave))
+            result->push_back(desc);
     }
 }
 
@@ -548,9 +738,9 @@ Sift::descriptor_generation (void)
 void
 Sift::generate_grad_ori_images (Octave* octave)
 {
-    octave->grad.clear();
+    this->release_images(&octave->grad);
     octave->grad.reserve(octave->img.size());
-    octave->ori.clear();
+    this->release_images(&octave->ori);
     octave->ori.reserve(octave->img.size());
 
     int const width = octave->img[0]->width();
@@ -560,11 +750,16 @@ Sift::generate_grad_ori_images (Octave* octave)
     for (std::size_t i = 0; i < octave->img.size(); ++i)
     {
         mve::FloatImage::ConstPtr img = octave->img[i];
-        mve::FloatImage::Ptr grad = mve::FloatImage::create(width, height, 1);
-        mve::FloatImage::Ptr ori = mve::FloatImage::create(width, height, 1);
-
-        int image_iter = width + 1;
-        for (int y = 1; y < height - 1; ++y, image_iter += 2)
+        mve::FloatImage::Ptr grad = this->acquire_image(width, height);
+        mve::FloatImage::Ptr ori = this->acquire_image(width, height);
+        clear_border(grad);
+        clear_border(ori);
+
+#pragma omp parallel for schedule(static) \
+    if (width * height >= SIFT_PARALLEL_MIN_PIXELS)
+        for (int y = 1; y < height - 1; ++y)
+        {
+            int image_iter = y * width + 1;
             for (int x = 1; x < width - 1; ++x, ++image_iter)
             {
                 float m1x = img->at(image_iter - 1);
@@ -579,9 +774,20 @@ Sift::generate_grad_ori_images (Octave* octave)
                 ori->at(image_iter) = atan2f < 0.0f
                     ? atan2f + MATH_PI * 2.0f : atan2f;
             }
+        }
         octave->grad.push_back(grad);
         octave->ori.push_back(ori);
+
+        /* Streaming releases the octave afterwards, release early. */
+        if (this->options.streaming_octaves)
+        {
+            this->image_pool.push_back(octave->img[i]);
+            octave->img[i].reset();
+        }
     }
+
+    /* Free unused images before the descriptors are computed. */
+    this->image_pool.clear();
 }
 
 /* ---------------------------------------------------------------- */
@@ -604,8 +810,8 @@ Sift::orientation_assignment (Keypoint const& kp,
     float const sigma = this->keypoint_relative_scale(kp);
 
     /* Images with its dimension for the keypoint. */
-    mve::FloatImage::ConstPtr grad(octave->grad[is + 1]);
-    mve::FloatImage::ConstPtr ori(octave->ori[is + 1]);
+    mve::FloatImage const* grad = octave->grad[is + 1].get();
+    mve::FloatImage const* ori = octave->ori[is + 1].get();
     int const width = grad->width();
     int const height = grad->height();
 
@@ -711,8 +917,8 @@ Sift::descriptor_assignment (Keypoint const& kp, Descriptor& desc,
     float const sigma = this->keypoint_relative_scale(kp);
 
     /* Images with its dimension for the keypoint. */
-    mve::FloatImage::ConstPtr grad(octave->grad[is + 1]);
-    mve::FloatImage::ConstPtr ori(octave->ori[is + 1]);
+    mve::FloatImage const* grad = octave->grad[is + 1].get();
+    mve::FloatImage const* ori = octave->ori[is + 1].get();
     int const width = grad->width();
     int const height = grad->height();
 
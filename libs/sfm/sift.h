@@ -8,8 +8,11 @@
  * - Coordinates in the keypoint are relative to the octave.
  *   Absolute coordinates are obtained by (TODO why? explain):
  *   (x + 0.5, y + 0.5) * 2^octave - (0.5, 0.5).
- * - Memory consumption is quite high, especially with large images.
- *   TODO: Find a more efficent code path to create octaves.
+ * - Memory consumption is quite high, especially with large images, unless
+ *   octaves are processed one at a time (see Options::streaming_octaves).
+ *   Images are pooled and reused within an octave.
+ * - Keypoint localization and descriptor generation use OpenMP. Keypoints
+ *   are processed in chunks and the result is identical to a serial run.
  */
 #ifndef SFM_SIFT_HEADER
 #define SFM_SIFT_HEADER
@@ -93,6 +96,15 @@ public:
          */
         float inherent_blur_sigma;
 
+        /**
+         * Processes one octave at a time: The octave is created, keypoints
+         * are detected and localized, descriptors are generated and the
+         * octave is released before the next octave is created. This
+         * reduces peak memory consumption to a single octave without
+         * changing the result. Defaults to true.
+         */
+        bool streaming_octaves;
+
         /**
          * Produce status messages on the console.
          */
@@ -179,25 +191,32 @@ protected:
     struct Octave
     {
         typedef std::vector<mve::FloatImage::Ptr> ImageVector;
-        ImageVector img; ///< S+3 images per octave
-        ImageVector dog; ///< S+2 difference of gaussian images
-        ImageVector grad; ///< S+3 gradient images
-        ImageVector ori; ///< S+3 orientation images
+        ImageVector img; ///< S+2 images per octave (the last is dropped)
+        ImageVector dog; ///< S+2 DoG images, released once localized
+        ImageVector grad; ///< S+2 gradient images
+        ImageVector ori; ///< S+2 orientation images
     };
 
 protected:
     typedef std::vector<Octave> Octaves;
 
 protected:
+    void process_octaves (void);
+    void process_streaming (void);
     void create_octaves (void);
-    void add_octave (mve::FloatImage::ConstPtr image,
-        float has_sigma, float target_sigma);
-    void extrema_detection (void);
-    std::size_t extrema_detection (mve::FloatImage::ConstPtr s[3],
+    void create_octave (int octave_id, mve::FloatImage::ConstPtr* image,
+        float* image_sigma);
+    mve::FloatImage::Ptr create_base_image (mve::FloatImage::ConstPtr image,
+        float has_sigma);
+    void add_octave (mve::FloatImage::Ptr base);
+    void extrema_detection (float const* s[3], int width, int y,
         int oi, int si);
-    void keypoint_localization (void);
+    void keypoint_localization (std::size_t begin);
+    bool keypoint_localization (Keypoint* kp, bool* singular) const;
 
-    void descriptor_generation (void);
+    void descriptor_generation (std::size_t begin);
+    void descriptor_generation (Keypoint const& kp, Octave const* octave,
+        Descriptors* result);
     void generate_grad_ori_images (Octave* octave);
     void orientation_assignment (Keypoint const& kp,
         Octave const* octave, std::vector<float>& orientations);
@@ -207,12 +226,17 @@ protected:
     float keypoint_relative_scale (Keypoint const& kp);
     float keypoint_absolute_scale (Keypoint const& kp);
 
+    mve::FloatImage::Ptr acquire_image (int width, int height);
+    void release_images (Octave::ImageVector* images);
+
 private:
     Options options;
     mve::FloatImage::ConstPtr orig; // Original input image
     Octaves octaves; // The image pyramid (the octaves)
     Keypoints keypoints; // Detected keypoints
     Descriptors descriptors; // Final SIFT descriptors
+    Octave::ImageVector image_pool; // Released images for reuse
+    std::size_t num_allocated_images; // Images allocated by the pool
 };
 
 /* ---------------------------------------------------------------- */
@@ -226,6 +250,7 @@ Sift::Options::Options (void)
     , edge_ratio_threshold(10.0f)
     , base_blur_sigma(1.6f)
     , inherent_blur_sigma(0.5f)
+    , streaming_octaves(true)
     , verbose_output(false)
     , debug_output(false)
 {
@@ -0,0 +1,33 @@
+#include "sfm/simd.h"
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    SimdLevel
+    cpu_simd (void)
+    {
+#if SFM_AVX_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512bw"))
+            return SIMD_AVX512;
+        if (__builtin_cpu_supports("avx2"))
+            return SIMD_AVX2;
+#endif
+#if defined(__SSE2__)
+        return SIMD_SSE;
+#else
+        return SIMD_NONE;
+#endif
+    }
+}  /* namespace */
+
+SimdLevel
+detect_simd (void)
+{
+    static SimdLevel const simd = cpu_simd();
+    return simd;
+}
+
+SFM_NAMESPACE_END
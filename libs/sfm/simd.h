@@ -0,0 +1,44 @@
+/*
+ * Runtime detection of SIMD instruction sets.
+ */
+
+#ifndef SFM_SIMD_HEADER
+#define SFM_SIMD_HEADER
+
+#include "sfm/defines.h"
+
+/*
+ * AVX2 and AVX-512 kernels are compiled using function specific target
+ * attributes, independent of the compiler flags, and selected at runtime.
+ * This requires a GCC compatible compiler on x86.
+ */
+#define ENABLE_AVX_KERNELS 1
+#if ENABLE_AVX_KERNELS && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#   define SFM_AVX_KERNELS 1
+#else
+#   define SFM_AVX_KERNELS 0
+#endif
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * SIMD instruction sets, ordered by vector width. SSE is available if the
+ * compiler targets SSE2, AVX2 and AVX-512 are available if the kernels are
+ * compiled (see above) and the CPU supports them.
+ */
+enum SimdLevel
+{
+    SIMD_NONE,
+    SIMD_SSE,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+/** Returns the widest SIMD instruction set supported by the CPU. */
+SimdLevel
+detect_simd (void);
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_SIMD_HEADER */
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "util/timer.h"
 #include "math/functions.h"
@@ -9,8 +11,30 @@
 #include "mve/image_tools.h"
 #include "mve/image_drawing.h"
 #include "sfm/defines.h"
+#include "sfm/simd.h"
 #include "sfm/surf.h"
 
+/*
+ * The AVX2 response kernel is compiled using a function specific target
+ * attribute and selected at runtime, see simd.h. FMA is not
+ * enabled to keep the rounding of the default kernel.
+ */
+#if SFM_AVX_KERNELS
+#   define SURF_AVX2_KERNEL 1
+#   define SURF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#   define SURF_AVX2_KERNEL 0
+#endif
+
+#if defined(__GNUC__)
+#   define SURF_ALWAYS_INLINE __attribute__((always_inline))
+#else
+#   define SURF_ALWAYS_INLINE
+#endif
+
+/* Rows of a response map per parallel work item. */
+#define SURF_RESPONSE_ROWS 16
+
 SFM_NAMESPACE_BEGIN
 
 namespace
@@ -23,6 +47,101 @@ namespace
         {  9, 17, 25, 33 },  // 27  51  75  99
         { 17, 33, 49, 65 }   // 51  99 147 195
     };
+
+    /*
+     * Computes the Hessian responses of 'num' pixels in a row with pixel
+     * spacing 'step' in the SAT. 'sat' points to the SAT value of the first
+     * pixel and 'w' is the SAT width. The box filters are evaluated for
+     * adjacent pixels from the same SAT rows, see Surf::filter_dxx(),
+     * Surf::filter_dyy() and Surf::filter_dxy() for the single pixel
+     * versions. The filter responses fit into 32 bits, and the SAT values
+     * are truncated to 32 bits: Wrap-around arithmetic yields the exact
+     * responses and allows vectorization with 32 bit lanes.
+     */
+    inline SURF_ALWAYS_INLINE void
+    hessian_response_row (uint32_t const* sat, int w, int fs, int step,
+        int num, float inv_karea, float weight, float* out)
+    {
+        int const fs2 = fs / 2;
+
+        /* SAT rows and column offsets for Dxx. */
+        uint32_t const* xx1 = sat + (-fs - fs2 - 1) + w * (-fs);
+        uint32_t const* xx2 = xx1 + w * (fs + fs - 1);
+        /* SAT rows and column offsets for Dyy. */
+        uint32_t const* yy1 = sat + (-fs) + w * (-fs - fs2 - 1);
+        uint32_t const* yy2 = yy1 + w * fs;
+        uint32_t const* yy3 = yy2 + w * fs;
+        uint32_t const* yy4 = yy3 + w * fs;
+        int const yyc = fs + fs - 1;
+        /* SAT rows and column offsets for Dxy. */
+        uint32_t const* xy1 = sat + (-fs - 1) + w * (-fs - 1);
+        uint32_t const* xy2 = xy1 + w * fs;
+        uint32_t const* xy3 = xy2 + w;
+        uint32_t const* xy4 = xy3 + w * fs;
+        int const xyc1 = fs + 1;
+        int const xyc2 = fs + fs + 1;
+
+#       define SAT(ROW,OFF) (ROW[x + (OFF)])
+        for (int i = 0; i < num; ++i)
+        {
+            int const x = i * step;
+
+            uint32_t dxx = SAT(xx2,fs) + SAT(xx1,0) - SAT(xx2,0) - SAT(xx1,fs);
+            dxx -= 2 * (SAT(xx2,2*fs) + SAT(xx1,fs)
+                - SAT(xx2,fs) - SAT(xx1,2*fs));
+            dxx += SAT(xx2,3*fs) + SAT(xx1,2*fs)
+                - SAT(xx2,2*fs) - SAT(xx1,3*fs);
+
+            uint32_t dyy = SAT(yy2,yyc) + SAT(yy1,0)
+                - SAT(yy2,0) - SAT(yy1,yyc);
+            dyy -= 2 * (SAT(yy3,yyc) + SAT(yy2,0) - SAT(yy3,0) - SAT(yy2,yyc));
+            dyy += SAT(yy4,yyc) + SAT(yy3,0) - SAT(yy4,0) - SAT(yy3,yyc);
+
+            uint32_t dxy = SAT(xy2,fs) + SAT(xy1,0) - SAT(xy2,0) - SAT(xy1,fs);
+            dxy -= SAT(xy2,xyc2) + SAT(xy1,xyc1)
+                - SAT(xy2,xyc1) - SAT(xy1,xyc2);
+            dxy -= SAT(xy4,fs) + SAT(xy3,0) - SAT(xy4,0) - SAT(xy3,fs);
+            dxy += SAT(xy4,xyc2) + SAT(xy3,xyc1)
+                - SAT(xy4,xyc1) - SAT(xy3,xyc2);
+
+            float const dxx_t = static_cast<float>
+                (static_cast<int32_t>(dxx)) * inv_karea;
+            float const dyy_t = static_cast<float>
+                (static_cast<int32_t>(dyy)) * inv_karea;
+            float const dxy_t = static_cast<float>
+                (static_cast<int32_t>(dxy)) * inv_karea;
+            out[i] = dxx_t * dyy_t - weight * dxy_t * dxy_t;
+        }
+#       undef SAT
+    }
+
+    /* Kernels with a contiguous case for the first octave. */
+    typedef void (*HessianRowKernel) (uint32_t const*, int, int, int, int,
+        float, float, float*);
+
+    void
+    hessian_response_row_default (uint32_t const* sat, int w, int fs,
+        int step, int num, float inv_karea, float weight, float* out)
+    {
+        if (step == 1)
+            hessian_response_row(sat, w, fs, 1, num, inv_karea, weight, out);
+        else
+            hessian_response_row(sat, w, fs, step, num, inv_karea,
+                weight, out);
+    }
+
+#if SURF_AVX2_KERNEL
+    SURF_TARGET_AVX2 void
+    hessian_response_row_avx2 (uint32_t const* sat, int w, int fs,
+        int step, int num, float inv_karea, float weight, float* out)
+    {
+        if (step == 1)
+            hessian_response_row(sat, w, fs, 1, num, inv_karea, weight, out);
+        else
+            hessian_response_row(sat, w, fs, step, num, inv_karea,
+                weight, out);
+    }
+#endif
 }  // namespace
 
 /* ---------------------------------------------------------------- */
@@ -133,21 +252,54 @@ Surf::set_image (mve::ByteImage::ConstPtr image)
 void
 Surf::create_octaves (void)
 {
-    /* Prepare octaves. */
+    /* Prepare octaves and response maps. */
+    int const w = this->sat->width();
+    int const h = this->sat->height();
+    int chunk_offsets[17];
+    chunk_offsets[0] = 0;
     this->octaves.resize(4);
-    for (int i = 0; i < 4; ++i)
-        this->octaves[i].imgs.resize(4);
+    for (int o = 0, ow = w, oh = h; o < 4; ++o)
+    {
+        this->octaves[o].imgs.resize(4);
+        for (int k = 0; k < 4; ++k)
+        {
+            this->octaves[o].imgs[k] = Octave::RespImage::create(ow, oh, 1);
+            chunk_offsets[o * 4 + k + 1] = chunk_offsets[o * 4 + k]
+                + (oh + SURF_RESPONSE_ROWS - 1) / SURF_RESPONSE_ROWS;
+        }
+        ow = (ow + 1) >> 1;
+        oh = (oh + 1) >> 1;
+    }
 
-    /* Create octaves. */
-    for (int octave = 0; octave < 4; ++octave)
-        for (int sample = 0; sample < 4; ++sample)
-            this->create_response_map(octave, sample);
+    /* Create the 16 response maps in parallel in chunks of rows. */
+    int const num_chunks = chunk_offsets[16];
+    this->sat_low.resize(this->sat->get_value_amount());
+#pragma omp parallel
+    {
+        /* The lower 32 bits of the SAT, see hessian_response_row(). */
+#pragma omp for schedule(static)
+        for (int i = 0; i < h; ++i)
+            std::copy(&this->sat->at(i * w), &this->sat->at(i * w) + w,
+                this->sat_low.begin() + i * w);
+
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < num_chunks; ++i)
+        {
+            int map = 0;
+            while (chunk_offsets[map + 1] <= i)
+                map += 1;
+            int const y = (i - chunk_offsets[map]) * SURF_RESPONSE_ROWS;
+            this->create_response_map(map / 4, map % 4, y,
+                y + SURF_RESPONSE_ROWS);
+        }
+    }
+    std::vector<uint32_t>().swap(this->sat_low);
 }
 
 /* ---------------------------------------------------------------- */
 
 void
-Surf::create_response_map (int o, int k)
+Surf::create_response_map (int o, int k, int y_begin, int y_end)
 {
     /*
      * In order to create the Hessian response map for filter size 'fs',
@@ -172,39 +324,40 @@ Surf::create_response_map (int o, int k)
     /* Original dimensions and octave dimensions. */
     int const w = this->sat->width();
     int const h = this->sat->height();
-    int ow = w;
-    int oh = h;
-    for (int i = 0; i < o; ++i)
-    {
-        ow = (ow + 1) >> 1;
-        oh = (oh + 1) >> 1;
-    }
+    Octave::RespImage::Ptr img = this->octaves[o].imgs[k];
+    int const ow = img->width();
+    int const oh = img->height();
 
-    /* Generate the response maps. */
-    Octave::RespImage::Ptr img = Octave::RespImage::create(ow, oh, 1);
+    /* Range of pixels in a row with the filter inside the image. */
     int const border = fs + fs / 2 + 1;
-    for (int y = 0, i = 0; y < h; y += step)
-        for (int x = 0; x < w; x += step, ++i)
+    int const x_begin = std::min(ow, (border + step - 1) / step);
+    int const x_end = std::max(x_begin, w - border - 1 < 0
+        ? 0 : std::min(ow, (w - border - 1) / step + 1));
+
+    HessianRowKernel kernel = hessian_response_row_default;
+#if SURF_AVX2_KERNEL
+    if (detect_simd() >= SIMD_AVX2)
+        kernel = hessian_response_row_avx2;
+#endif
+
+    /* Generate the response map rows. */
+    for (int oy = y_begin; oy < std::min(y_end, oh); ++oy)
+    {
+        RespType* row = &img->at(oy * ow);
+        int const y = oy * step;
+        if (y < border || y + border >= h)
         {
-            if (x < border || x + border >= w || y < border || y + border >= h)
-            {
-                img->at(i) = 0.0f;
-                continue;
-            }
-
-            SatType dxx = this->filter_dxx(fs, x, y);
-            SatType dyy = this->filter_dyy(fs, x, y);
-            SatType dxy = this->filter_dxy(fs, x, y);
-            RespType dxx_t = static_cast<RespType>(dxx) * inv_karea;
-            RespType dyy_t = static_cast<RespType>(dyy) * inv_karea;
-            RespType dxy_t = static_cast<RespType>(dxy) * inv_karea;
-            /* Compute the determinant of the hessian. */
-            img->at(i) = dxx_t * dyy_t - weight * dxy_t * dxy_t;
-            /* The laplacian can be computed as dxx_t + dyy_t. */
-            // float laplacian = dxx_t + dyy_t;
+            std::fill(row, row + ow, 0.0f);
+            continue;
         }
 
-    this->octaves[o].imgs[k] = img;
+        std::fill(row, row + x_begin, 0.0f);
+        if (x_begin < x_end)
+            kernel(&this->sat_low[y * w + x_begin * step], w, fs, step,
+                x_end - x_begin, inv_karea, weight, row + x_begin);
+        std::fill(row + x_end, row + ow, 0.0f);
+        /* The laplacian can be computed as dxx_t + dyy_t. */
+    }
 }
 
 /* ---------------------------------------------------------------- */
@@ -128,7 +128,7 @@ protected:
 protected:
     void create_octaves (void);
 
-    void create_response_map (int o, int k);
+    void create_response_map (int o, int k, int y_begin, int y_end);
     SatType filter_dxx (int fs, int x, int y);
     SatType filter_dyy (int fs, int x, int y);
     SatType filter_dxy (int fs, int x, int y);
@@ -144,9 +144,14 @@ protected:
     bool descriptor_computation (Descriptor* descr, bool upright);
     void filter_dx_dy(int x, int y, int fs, float* dx, float* dy);
 
+    /** Returns the SAT image and the response maps for testing. */
+    SatImage::ConstPtr get_sat (void) const;
+    Octaves const& get_octaves (void) const;
+
 private:
     Options options;
     SatImage::Ptr sat;
+    std::vector<uint32_t> sat_low; ///< Lower 32 bits of the SAT values
     Octaves octaves;
     Keypoints keypoints;
     Descriptors descriptors;
@@ -175,6 +180,18 @@ Surf::get_descriptors (void) const
     return this->descriptors;
 }
 
+inline Surf::SatImage::ConstPtr
+Surf::get_sat (void) const
+{
+    return this->sat;
+}
+
+inline Surf::Octaves const&
+Surf::get_octaves (void) const
+{
+    return this->octaves;
+}
+
 SFM_NAMESPACE_END
 
 #endif /* SFM_SURF_HEADER */
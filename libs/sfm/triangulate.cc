@@ -1,3 +1,7 @@
+#include <cmath>
+#include <stdexcept>
+
+#include "math/matrix_tools.h"
 #include "math/matrix_svd.h"
 #include "sfm/triangulate.h"
 
@@ -27,9 +31,129 @@ triangulate_match (Correspondence const& match,
     return math::Vector<double, 3>(x[0] / x[3], x[1] / x[3], x[2] / x[3]);
 }
 
+namespace
+{
+    /*
+     * Returns the eigenvector of the smallest eigenvalue of the symmetric
+     * matrix using cyclic Jacobi rotations (Numerical Recipes 11.1).
+     */
+    math::Vector<double, 4>
+    smallest_eigenvector (math::Matrix<double, 4, 4> a)
+    {
+        math::Matrix<double, 4, 4> v;
+        math::matrix_set_identity(&v);
+
+        for (int sweep = 0; sweep < 50; ++sweep)
+        {
+            double off_diagonal = 0.0;
+            double diagonal = 0.0;
+            for (int p = 0; p < 4; ++p)
+            {
+                diagonal += MATH_POW2(a(p, p));
+                for (int q = p + 1; q < 4; ++q)
+                    off_diagonal += MATH_POW2(a(p, q));
+            }
+            if (off_diagonal <= 1e-32 * diagonal)
+                break;
+
+            for (int p = 0; p < 3; ++p)
+                for (int q = p + 1; q < 4; ++q)
+                {
+                    if (a(p, q) == 0.0)
+                        continue;
+
+                    /* Rotation that annihilates a(p, q). */
+                    double const theta = (a(q, q) - a(p, p)) / (2.0 * a(p, q));
+                    double t = 1.0 / (std::abs(theta)
+                        + std::sqrt(MATH_POW2(theta) + 1.0));
+                    if (theta < 0.0)
+                        t = -t;
+                    double const c = 1.0 / std::sqrt(MATH_POW2(t) + 1.0);
+                    double const s = t * c;
+
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        double const akp = a(k, p);
+                        double const akq = a(k, q);
+                        a(k, p) = c * akp - s * akq;
+                        a(k, q) = s * akp + c * akq;
+                    }
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        double const apk = a(p, k);
+                        double const aqk = a(q, k);
+                        a(p, k) = c * apk - s * aqk;
+                        a(q, k) = s * apk + c * aqk;
+                    }
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        double const vkp = v(k, p);
+                        double const vkq = v(k, q);
+                        v(k, p) = c * vkp - s * vkq;
+                        v(k, q) = s * vkp + c * vkq;
+                    }
+                }
+        }
+
+        int smallest = 0;
+        for (int i = 1; i < 4; ++i)
+            if (a(i, i) < a(smallest, smallest))
+                smallest = i;
+        return v.col(smallest);
+    }
+}
+
 math::Vector<double, 3>
 triangulate_track (std::vector<math::Vec2f> const& pos,
-    std::vector<CameraPose const*> poses)
+    std::vector<CameraPose const*> const& poses)
+{
+    if (pos.size() != poses.size() || pos.size() < 2)
+        throw std::invalid_argument("Invalid number of positions/poses");
+    return triangulate_track(&pos[0], &poses[0], poses.size());
+}
+
+math::Vector<double, 3>
+triangulate_track (math::Vec2f const* pos,
+    CameraPose const* const* poses, std::size_t num_views)
+{
+    /*
+     * Accumulate the normal equations of the DLT system. Rows are scaled
+     * to unit length, which keeps the 4 x 4 system well conditioned.
+     */
+    math::Matrix<double, 4, 4> ata(0.0);
+    for (std::size_t i = 0; i < num_views; ++i)
+    {
+        math::Matrix<double, 3, 4> p_mat;
+        poses[i]->fill_p_matrix(&p_mat);
+
+        for (int j = 0; j < 2; ++j)
+        {
+            math::Vector<double, 4> row;
+            for (int k = 0; k < 4; ++k)
+                row[k] = static_cast<double>(pos[i][j]) * p_mat(2, k)
+                    - p_mat(j, k);
+            double const square_norm = row.square_norm();
+            if (square_norm == 0.0)
+                continue;
+            row /= std::sqrt(square_norm);
+
+            for (int k = 0; k < 4; ++k)
+                for (int l = k; l < 4; ++l)
+                    ata(k, l) += row[k] * row[l];
+        }
+    }
+    for (int k = 1; k < 4; ++k)
+        for (int l = 0; l < k; ++l)
+            ata(k, l) = ata(l, k);
+
+    /* The solution is the eigenvector of the smallest eigenvalue. */
+    math::Vector<double, 4> x = smallest_eigenvector(ata);
+    return math::Vector<double, 3>(x[0] / x[3], x[1] / x[3], x[2] / x[3]);
+}
+
+math::Vector<double, 3>
+triangulate_track_svd (std::vector<math::Vec2f> const& pos,
+    std::vector<CameraPose const*> const& poses)
 {
     if (pos.size() != poses.size() || pos.size() < 2)
         throw std::invalid_argument("Invalid number of positions/poses");
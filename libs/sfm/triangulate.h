@@ -21,10 +21,30 @@ triangulate_match (Correspondence const& match,
 /**
  * Given any number of 2D image positions and the corresponding camera poses,
  * this function triangulates the 3D point coordinate using the DLT algorithm.
+ * Instead of an SVD of the 2N x 4 system, the smallest eigenvector of the
+ * 4 x 4 normal equations is computed with Jacobi rotations, which requires
+ * no memory allocation. The rows of the system are scaled to unit length,
+ * so every observation has the same weight, whereas the SVD weights rows
+ * by their norm. With noisy positions, the result thus differs slightly
+ * from triangulate_track_svd().
  */
 math::Vector<double, 3>
 triangulate_track (std::vector<math::Vec2f> const& pos,
-    std::vector<CameraPose const*> poses);
+    std::vector<CameraPose const*> const& poses);
+
+/** Same as above for positions and poses of num_views views. */
+math::Vector<double, 3>
+triangulate_track (math::Vec2f const* pos,
+    CameraPose const* const* poses, std::size_t num_views);
+
+/**
+ * Triangulates the track with the DLT algorithm like triangulate_track(),
+ * but uses the SVD of the 2N x 4 system. This is slower and only used
+ * as a reference.
+ */
+math::Vector<double, 3>
+triangulate_track_svd (std::vector<math::Vec2f> const& pos,
+    std::vector<CameraPose const*> const& poses);
 
 /**
  * Given a two-view pose configuration and a correspondence, this function
@@ -0,0 +1,383 @@
+/*
+ * Vocabulary tree for bag-of-words image retrieval.
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include "sfm/vocabulary_tree.h"
+
+SFM_NAMESPACE_BEGIN
+
+namespace
+{
+    /*
+     * Simple linear congruential generator to keep the training
+     * deterministic and the global random state untouched.
+     */
+    inline unsigned int
+    vt_random (unsigned int* state)
+    {
+        *state = *state * 1103515245u + 12345u;
+        return (*state >> 16) & 0x7fff;
+    }
+
+    template <typename T>
+    inline float
+    square_distance (T const* descriptor, float const* center, int dimensions)
+    {
+        float dist = 0.0f;
+        for (int i = 0; i < dimensions; ++i)
+        {
+            float const diff = static_cast<float>(descriptor[i]) - center[i];
+            dist += diff * diff;
+        }
+        return dist;
+    }
+
+    /* Returns the closest of 'num' consecutive centers. */
+    template <typename T>
+    inline int
+    closest_center (T const* descriptor, float const* centers, int num,
+        int dimensions)
+    {
+        int best_id = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (int i = 0; i < num; ++i)
+        {
+            float const dist = square_distance(descriptor,
+                centers + i * dimensions, dimensions);
+            if (dist < best_dist)
+            {
+                best_id = i;
+                best_dist = dist;
+            }
+        }
+        return best_id;
+    }
+
+    inline int
+    popcount (uint64_t value)
+    {
+#if defined(__GNUC__)
+        return __builtin_popcountll(value);
+#else
+        int count = 0;
+        for (; value != 0; value &= value - 1)
+            count += 1;
+        return count;
+#endif
+    }
+
+    /* Returns the closest of 'num' consecutive binary centers. */
+    inline int
+    closest_binary_center (uint64_t const* descriptor,
+        uint64_t const* centers, int num, int num_words)
+    {
+        int best_id = 0;
+        int best_dist = std::numeric_limits<int>::max();
+        for (int i = 0; i < num; ++i)
+        {
+            uint64_t const* center = centers + i * num_words;
+            int dist = 0;
+            for (int j = 0; j < num_words; ++j)
+                dist += popcount(descriptor[j] ^ center[j]);
+            if (dist < best_dist)
+            {
+                best_id = i;
+                best_dist = dist;
+            }
+        }
+        return best_id;
+    }
+}  /* namespace */
+
+template <typename T>
+void
+VocabularyTree::train (T const* descriptors, int num_descriptors,
+    int dimensions)
+{
+    this->dimensions = dimensions;
+    this->num_words = 0;
+    this->nodes.clear();
+    this->centers.clear();
+
+    /* The root node center is not used. */
+    Node root;
+    root.first_child = 0;
+    root.num_children = 0;
+    root.word_id = -1;
+    this->nodes.push_back(root);
+    this->centers.resize(dimensions, 0.0f);
+
+    std::vector<int> indices(num_descriptors);
+    for (int i = 0; i < num_descriptors; ++i)
+        indices[i] = i;
+
+    unsigned int rng = 0x5eedu;
+    this->train_node(descriptors, &indices, 0, num_descriptors, 0, 0, &rng);
+}
+
+void
+VocabularyTree::train_binary (uint64_t const* descriptors,
+    int num_descriptors, int num_words)
+{
+    this->dimensions = num_words;
+    this->num_words = 0;
+    this->nodes.clear();
+    this->binary_centers.clear();
+
+    /* The root node center is not used. */
+    Node root;
+    root.first_child = 0;
+    root.num_children = 0;
+    root.word_id = -1;
+    this->nodes.push_back(root);
+    this->binary_centers.resize(num_words, 0);
+
+    std::vector<int> indices(num_descriptors);
+    for (int i = 0; i < num_descriptors; ++i)
+        indices[i] = i;
+
+    unsigned int rng = 0x5eedu;
+    this->train_binary_node(descriptors, &indices, 0, num_descriptors,
+        0, 0, &rng);
+}
+
+template <typename T>
+void
+VocabularyTree::train_node (T const* descriptors, std::vector<int>* indices,
+    int begin, int end, int node_id, int level, unsigned int* rng)
+{
+    int const dim = this->dimensions;
+    int const num = end - begin;
+    int const k = this->opts.branching_factor;
+    if (level >= this->opts.num_levels || num <= k)
+    {
+        this->add_leaf(node_id);
+        return;
+    }
+
+    /* Initialize the cluster centers with random descriptors. */
+    std::vector<float> node_centers(k * dim);
+    for (int i = 0; i < k; ++i)
+    {
+        int const id = indices->at(begin + vt_random(rng) % num);
+        T const* descr = descriptors + static_cast<std::size_t>(id) * dim;
+        std::copy(descr, descr + dim, node_centers.begin() + i * dim);
+    }
+
+    /* Lloyd iterations, empty clusters keep their center. */
+    std::vector<int> assignment(num, 0);
+    for (int iter = 0; iter <= this->opts.kmeans_iterations; ++iter)
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < num; ++i)
+        {
+            T const* descr = descriptors + static_cast<std::size_t>
+                (indices->at(begin + i)) * dim;
+            assignment[i] = closest_center(descr, &node_centers[0], k, dim);
+        }
+
+        /* The last iteration only computes the final assignment. */
+        if (iter == this->opts.kmeans_iterations)
+            break;
+
+        std::vector<double> sums(k * dim, 0.0);
+        std::vector<int> counts(k, 0);
+        for (int i = 0; i < num; ++i)
+        {
+            T const* descr = descriptors + static_cast<std::size_t>
+                (indices->at(begin + i)) * dim;
+            double* sum = &sums[assignment[i] * dim];
+            for (int j = 0; j < dim; ++j)
+                sum[j] += static_cast<double>(descr[j]);
+            counts[assignment[i]] += 1;
+        }
+        for (int i = 0; i < k; ++i)
+        {
+            if (counts[i] == 0)
+                continue;
+            for (int j = 0; j < dim; ++j)
+                node_centers[i * dim + j] = static_cast<float>
+                    (sums[i * dim + j] / static_cast<double>(counts[i]));
+        }
+    }
+
+    std::vector<int> offsets;
+    this->sort_by_cluster(assignment, k, indices, begin, &offsets);
+
+    int const first_child = this->add_children(node_id, k);
+    this->centers.insert(this->centers.end(),
+        node_centers.begin(), node_centers.end());
+
+    for (int i = 0; i < k; ++i)
+        this->train_node(descriptors, indices, begin + offsets[i],
+            begin + offsets[i + 1], first_child + i, level + 1, rng);
+}
+
+void
+VocabularyTree::train_binary_node (uint64_t const* descriptors,
+    std::vector<int>* indices, int begin, int end, int node_id, int level,
+    unsigned int* rng)
+{
+    int const words = this->dimensions;
+    int const bits = words * 64;
+    int const num = end - begin;
+    int const k = this->opts.branching_factor;
+    if (level >= this->opts.num_levels || num <= k)
+    {
+        this->add_leaf(node_id);
+        return;
+    }
+
+    /* Initialize the cluster centers with random descriptors. */
+    std::vector<uint64_t> node_centers(k * words);
+    for (int i = 0; i < k; ++i)
+    {
+        int const id = indices->at(begin + vt_random(rng) % num);
+        uint64_t const* descr = descriptors
+            + static_cast<std::size_t>(id) * words;
+        std::copy(descr, descr + words, node_centers.begin() + i * words);
+    }
+
+    /* K-majority iterations, empty clusters keep their center. */
+    std::vector<int> assignment(num, 0);
+    for (int iter = 0; iter <= this->opts.kmeans_iterations; ++iter)
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < num; ++i)
+        {
+            uint64_t const* descr = descriptors + static_cast<std::size_t>
+                (indices->at(begin + i)) * words;
+            assignment[i] = closest_binary_center(descr, &node_centers[0],
+                k, words);
+        }
+
+        /* The last iteration only computes the final assignment. */
+        if (iter == this->opts.kmeans_iterations)
+            break;
+
+        std::vector<int> bit_counts(k * bits, 0);
+        std::vector<int> counts(k, 0);
+        for (int i = 0; i < num; ++i)
+        {
+            uint64_t const* descr = descriptors + static_cast<std::size_t>
+                (indices->at(begin + i)) * words;
+            int* bit_count = &bit_counts[assignment[i] * bits];
+            for (int j = 0; j < bits; ++j)
+                bit_count[j] += (descr[j / 64] >> (j % 64)) & 1;
+            counts[assignment[i]] += 1;
+        }
+        for (int i = 0; i < k; ++i)
+        {
+            if (counts[i] == 0)
+                continue;
+            uint64_t* center = &node_centers[i * words];
+            std::fill(center, center + words, 0);
+            for (int j = 0; j < bits; ++j)
+                if (2 * bit_counts[i * bits + j] > counts[i])
+                    center[j / 64] |= static_cast<uint64_t>(1) << (j % 64);
+        }
+    }
+
+    std::vector<int> offsets;
+    this->sort_by_cluster(assignment, k, indices, begin, &offsets);
+
+    int const first_child = this->add_children(node_id, k);
+    this->binary_centers.insert(this->binary_centers.end(),
+        node_centers.begin(), node_centers.end());
+
+    for (int i = 0; i < k; ++i)
+        this->train_binary_node(descriptors, indices, begin + offsets[i],
+            begin + offsets[i + 1], first_child + i, level + 1, rng);
+}
+
+void
+VocabularyTree::add_leaf (int node_id)
+{
+    this->nodes[node_id].word_id = this->num_words;
+    this->num_words += 1;
+}
+
+int
+VocabularyTree::add_children (int node_id, int num_children)
+{
+    /* The node vector may be reallocated. */
+    int const first_child = static_cast<int>(this->nodes.size());
+    this->nodes[node_id].first_child = first_child;
+    this->nodes[node_id].num_children = num_children;
+    for (int i = 0; i < num_children; ++i)
+    {
+        Node child;
+        child.first_child = 0;
+        child.num_children = 0;
+        child.word_id = -1;
+        this->nodes.push_back(child);
+    }
+    return first_child;
+}
+
+void
+VocabularyTree::sort_by_cluster (std::vector<int> const& assignment, int k,
+    std::vector<int>* indices, int begin, std::vector<int>* offsets)
+{
+    /* Counting sort of the descriptor indices by cluster. */
+    int const num = static_cast<int>(assignment.size());
+    offsets->assign(k + 1, 0);
+    for (int i = 0; i < num; ++i)
+        offsets->at(assignment[i] + 1) += 1;
+    for (int i = 0; i < k; ++i)
+        offsets->at(i + 1) += offsets->at(i);
+
+    std::vector<int> sorted(num);
+    std::vector<int> pos(offsets->begin(), offsets->end() - 1);
+    for (int i = 0; i < num; ++i)
+        sorted[pos[assignment[i]]++] = indices->at(begin + i);
+    std::copy(sorted.begin(), sorted.end(), indices->begin() + begin);
+}
+
+template <typename T>
+int
+VocabularyTree::quantize (T const* descriptor) const
+{
+    if (this->nodes.empty())
+        return -1;
+
+    int node_id = 0;
+    while (this->nodes[node_id].num_children > 0)
+    {
+        Node const& node = this->nodes[node_id];
+        node_id = node.first_child + closest_center(descriptor,
+            &this->centers[node.first_child * this->dimensions],
+            node.num_children, this->dimensions);
+    }
+    return this->nodes[node_id].word_id;
+}
+
+int
+VocabularyTree::quantize_binary (uint64_t const* descriptor) const
+{
+    if (this->nodes.empty())
+        return -1;
+
+    int node_id = 0;
+    while (this->nodes[node_id].num_children > 0)
+    {
+        Node const& node = this->nodes[node_id];
+        node_id = node.first_child + closest_binary_center(descriptor,
+            &this->binary_centers[node.first_child * this->dimensions],
+            node.num_children, this->dimensions);
+    }
+    return this->nodes[node_id].word_id;
+}
+
+/* Explicit instantiation for the supported types. */
+template void VocabularyTree::train<unsigned short>
+    (unsigned short const*, int, int);
+template void VocabularyTree::train<float> (float const*, int, int);
+template int VocabularyTree::quantize<unsigned short>
+    (unsigned short const*) const;
+template int VocabularyTree::quantize<float> (float const*) const;
+
+SFM_NAMESPACE_END
@@ -0,0 +1,129 @@
+/*
+ * Vocabulary tree for bag-of-words image retrieval.
+ */
+
+#ifndef SFM_VOCABULARY_TREE_HEADER
+#define SFM_VOCABULARY_TREE_HEADER
+
+#include <vector>
+
+#include "util/stdint_compat.h"
+#include "sfm/defines.h"
+
+SFM_NAMESPACE_BEGIN
+
+/**
+ * Vocabulary tree (Nister and Stewenius, "Scalable Recognition with a
+ * Vocabulary Tree", CVPR 2006) that quantizes descriptors to visual words.
+ *
+ * The tree is trained with hierarchical k-means: The training descriptors
+ * are clustered into 'branching_factor' clusters, and every cluster is
+ * clustered recursively until 'num_levels' levels are reached. The leaves
+ * of the tree are the visual words. A descriptor is quantized by greedily
+ * descending to the closest cluster center on every level.
+ *
+ * Descriptors are arrays of unsigned short (discretized SIFT) or float
+ * values. Binary descriptors (e.g. ORB) are packed into 64 bit words and
+ * clustered with k-majority (Grana et al., "A Fast Approach for Integrating
+ * ORB Descriptors in the Bag of Words Model", 2013): Distances are Hamming
+ * distances and every center bit is the majority of the cluster's bits.
+ * Training is deterministic.
+ */
+class VocabularyTree
+{
+public:
+    struct Options
+    {
+        Options (void);
+
+        /** Number of clusters per node. Defaults to 10. */
+        int branching_factor;
+        /** Number of levels, there are at most B^L words. Defaults to 5. */
+        int num_levels;
+        /** Number of k-means iterations per node. Defaults to 10. */
+        int kmeans_iterations;
+    };
+
+public:
+    explicit VocabularyTree (Options const& options);
+
+    /** Trains the tree with 'num_descriptors' descriptors. */
+    template <typename T>
+    void train (T const* descriptors, int num_descriptors, int dimensions);
+
+    /** Returns the visual word ID of the descriptor. */
+    template <typename T>
+    int quantize (T const* descriptor) const;
+
+    /** Trains the tree with binary descriptors of 'num_words' 64 bit words. */
+    void train_binary (uint64_t const* descriptors, int num_descriptors,
+        int num_words);
+
+    /** Returns the visual word ID of the binary descriptor. */
+    int quantize_binary (uint64_t const* descriptor) const;
+
+    /** Returns the number of visual words after training. */
+    int get_num_words (void) const;
+
+private:
+    /**
+     * Tree node. Inner nodes have 'num_children' consecutive children
+     * starting at 'first_child'. Leaf nodes have no children and a word ID.
+     */
+    struct Node
+    {
+        int first_child;
+        int num_children;
+        int word_id;
+    };
+
+private:
+    template <typename T>
+    void train_node (T const* descriptors, std::vector<int>* indices,
+        int begin, int end, int node_id, int level, unsigned int* rng);
+    void train_binary_node (uint64_t const* descriptors,
+        std::vector<int>* indices, int begin, int end, int node_id,
+        int level, unsigned int* rng);
+    void add_leaf (int node_id);
+    int add_children (int node_id, int num_children);
+    void sort_by_cluster (std::vector<int> const& assignment, int k,
+        std::vector<int>* indices, int begin, std::vector<int>* offsets);
+
+private:
+    Options opts;
+    int dimensions;
+    int num_words;
+    std::vector<Node> nodes;
+    /* The cluster centers, one per node, 'dimensions' values each. */
+    std::vector<float> centers;
+    /* The binary cluster centers, 'dimensions' 64 bit words each. */
+    std::vector<uint64_t> binary_centers;
+};
+
+/* ------------------------ Implementation ------------------------ */
+
+inline
+VocabularyTree::Options::Options (void)
+    : branching_factor(10)
+    , num_levels(5)
+    , kmeans_iterations(10)
+{
+}
+
+inline
+VocabularyTree::VocabularyTree (Options const& options)
+    : opts(options)
+    , dimensions(0)
+    , num_words(0)
+{
+}
+
+inline int
+VocabularyTree::get_num_words (void) const
+{
+    return this->num_words;
+}
+
+SFM_NAMESPACE_END
+
+#endif /* SFM_VOCABULARY_TREE_HEADER */
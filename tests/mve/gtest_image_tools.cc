@@ -510,10 +510,69 @@ TEST(ImageToolsTest, ImageFlippingTwoChannels)
 }
 
 
+namespace
+{
+    /* Blurs with the generic implementation, which double images use. */
+    mve::DoubleImage::Ptr
+    blur_gaussian_reference (mve::FloatImage::ConstPtr img, float sigma)
+    {
+        mve::DoubleImage::Ptr dimg = mve::DoubleImage::create
+            (img->width(), img->height(), img->channels());
+        for (int i = 0; i < img->get_value_amount(); ++i)
+            dimg->at(i) = img->at(i);
+        return mve::image::blur_gaussian<double>(dimg, sigma);
+    }
+}
+
+TEST(ImageToolsTest, BlurGaussianFloatMatchesReference)
+{
+    /* Sizes not divisible by the vector sizes, and a large image. */
+    int const sizes[3][3] = { { 37, 23, 1 }, { 19, 31, 3 }, { 301, 257, 1 } };
+    float const sigmas[4] = { 0.8f, 1.6f, 3.2f, 12.0f };
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j)
+        {
+            mve::FloatImage::Ptr img = mve::FloatImage::create
+                (sizes[i][0], sizes[i][1], sizes[i][2]);
+            for (int k = 0; k < img->get_value_amount(); ++k)
+                img->at(k) = static_cast<float>((k * 7919) % 256) / 255.0f;
+
+            mve::FloatImage::Ptr blurred
+                = mve::image::blur_gaussian<float>(img, sigmas[j]);
+            mve::DoubleImage::Ptr expected
+                = blur_gaussian_reference(img, sigmas[j]);
+            ASSERT_EQ(img->get_value_amount(), blurred->get_value_amount());
+            for (int k = 0; k < img->get_value_amount(); ++k)
+                ASSERT_NEAR(expected->at(k), blurred->at(k), 1e-5);
+        }
+}
+
+TEST(ImageToolsTest, BlurGaussianByteMatchesReference)
+{
+    mve::ByteImage::Ptr img = mve::ByteImage::create(53, 41, 3);
+    mve::FloatImage::Ptr fimg = mve::FloatImage::create(53, 41, 3);
+    for (int k = 0; k < img->get_value_amount(); ++k)
+    {
+        img->at(k) = static_cast<uint8_t>((k * 7919) % 256);
+        fimg->at(k) = img->at(k);
+    }
+
+    /* The intermediate image is rounded, allow rounding differences. */
+    mve::ByteImage::Ptr blurred = mve::image::blur_gaussian<uint8_t>(img, 2.0f);
+    mve::DoubleImage::Ptr expected = blur_gaussian_reference(fimg, 2.0f);
+    for (int k = 0; k < img->get_value_amount(); ++k)
+        ASSERT_NEAR(expected->at(k), blurred->at(k), 1.0);
+
+    /* Small sigmas do not change the image. */
+    blurred = mve::image::blur_gaussian<uint8_t>(img, 0.05f);
+    for (int k = 0; k < img->get_value_amount(); ++k)
+        ASSERT_EQ(img->at(k), blurred->at(k));
+}
+
 // TODO
 // Test rescale_half_size and variations
 // Test rescale_double_size and variations
-// Test blurring of images, boxfilter, gaussian
+// Test blurring of images, boxfilter
 // Test gamma correction with byte and float
 // Test image flipping with all parameters
 // Test simple image rotation
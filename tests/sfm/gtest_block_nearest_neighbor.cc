@@ -0,0 +1,113 @@
+// Test cases for blocked many-to-many nearest neighbor search.
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "util/aligned_memory.h"
+#include "sfm/nearest_neighbor.h"
+#include "sfm/block_nearest_neighbor.h"
+#include "sfm/matching.h"
+#include "random_descriptors.h"
+
+namespace
+{
+    template <typename T>
+    void
+    expect_results_equal (typename sfm::NearestNeighbor<T>::Result const& a,
+        typename sfm::NearestNeighbor<T>::Result const& b, float epsilon)
+    {
+        EXPECT_EQ(a.index_1st_best, b.index_1st_best);
+        EXPECT_EQ(a.index_2nd_best, b.index_2nd_best);
+        EXPECT_NEAR(a.dist_1st_best, b.dist_1st_best, epsilon);
+        EXPECT_NEAR(a.dist_2nd_best, b.dist_2nd_best, epsilon);
+    }
+
+    /* Compares both directions to the exhaustive search. */
+    template <typename T>
+    void
+    test_block_search (int dim, float norm, bool positive, float epsilon)
+    {
+        /* Sizes not divisible by the block and kernel sizes. */
+        int const num_1 = 203;
+        int const num_2 = 157;
+        std::srand(0);
+        util::AlignedMemory<T> set_1(num_1 * dim);
+        util::AlignedMemory<T> set_2(num_2 * dim);
+        fill_random_descriptors(set_1.begin(), num_1, dim, norm, positive);
+        fill_random_descriptors(set_2.begin(), num_2, dim, norm, positive);
+
+        sfm::NearestNeighbor<T> nn_1, nn_2;
+        nn_1.set_elements(set_1.begin(), num_1);
+        nn_1.set_element_dimensions(dim);
+        nn_2.set_elements(set_2.begin(), num_2);
+        nn_2.set_element_dimensions(dim);
+
+        sfm::SimdLevel const levels[] = { sfm::SIMD_NONE,
+            sfm::SIMD_SSE, sfm::SIMD_AVX2 };
+        for (int l = 0; l < 3; ++l)
+        {
+            sfm::BlockNearestNeighbor<T> block_nn;
+            block_nn.set_elements(set_2.begin(), num_2);
+            block_nn.set_element_dimensions(dim);
+            block_nn.set_simd(levels[l]);
+
+            typedef typename sfm::NearestNeighbor<T>::Result Result;
+            std::vector<Result> results_1_2, results_2_1;
+            block_nn.find_all(set_1.begin(), num_1,
+                &results_1_2, &results_2_1);
+            ASSERT_EQ(num_1, static_cast<int>(results_1_2.size()));
+            ASSERT_EQ(num_2, static_cast<int>(results_2_1.size()));
+
+            for (int i = 0; i < num_1; ++i)
+            {
+                Result expected;
+                nn_2.find(set_1.begin() + i * dim, &expected);
+                expect_results_equal<T>(expected, results_1_2[i], epsilon);
+            }
+            for (int i = 0; i < num_2; ++i)
+            {
+                Result expected;
+                nn_1.find(set_2.begin() + i * dim, &expected);
+                expect_results_equal<T>(expected, results_2_1[i], epsilon);
+            }
+        }
+    }
+}
+
+TEST(BlockNearestNeighborTest, UnsignedShortMatchesExhaustive)
+{
+    test_block_search<unsigned short>(128, 255.0f, true, 0.0f);
+    test_block_search<unsigned short>(24, 255.0f, true, 0.0f);
+}
+
+TEST(BlockNearestNeighborTest, SignedShortMatchesExhaustive)
+{
+    test_block_search<short>(64, 127.0f, false, 0.0f);
+    test_block_search<short>(12, 127.0f, false, 0.0f);
+}
+
+TEST(BlockNearestNeighborTest, FloatMatchesExhaustive)
+{
+    test_block_search<float>(128, 1.0f, true, 1e-5f);
+    test_block_search<float>(64, 1.0f, false, 1e-5f);
+    test_block_search<float>(6, 1.0f, false, 1e-5f);
+}
+
+TEST(BlockNearestNeighborTest, TwowayMatchEmptySet)
+{
+    util::AlignedMemory<unsigned short> set_1(4 * 16);
+    fill_random_descriptors(set_1.begin(), 4, 16, 255.0f, true);
+    sfm::Matching::Options options;
+    options.descriptor_length = 16;
+    options.lowe_ratio_threshold = 1.0f;
+    sfm::Matching::Result result;
+    sfm::Matching::twoway_match(options, set_1.begin(), 4,
+        set_1.begin(), 0, &result);
+    ASSERT_EQ(4, static_cast<int>(result.matches_1_2.size()));
+    EXPECT_EQ(0, static_cast<int>(result.matches_2_1.size()));
+    for (int i = 0; i < 4; ++i)
+        EXPECT_EQ(-1, result.matches_1_2[i]);
+}
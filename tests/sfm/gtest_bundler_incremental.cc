@@ -0,0 +1,320 @@
+// Test cases for the incremental bundler component.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "math/vector.h"
+#include "math/matrix.h"
+#include "sfm/bundler_common.h"
+#include "sfm/bundler_incremental.h"
+
+namespace
+{
+    /*
+     * Creates a synthetic scene with cameras on a circle around random
+     * points. Every point is seen by every camera and has one track. The
+     * projections are disturbed by up to half a pixel of noise.
+     */
+    void
+    create_scene (int num_views, int num_points,
+        sfm::bundler::ViewportList* viewports,
+        sfm::bundler::TrackList* tracks)
+    {
+        std::srand(0);
+        std::vector<math::Vec3d> points(num_points);
+        for (int i = 0; i < num_points; ++i)
+            for (int j = 0; j < 3; ++j)
+                points[i][j] = 2.0 * std::rand() / RAND_MAX - 1.0;
+
+        int const width = 1000;
+        int const height = 800;
+        viewports->clear();
+        viewports->resize(num_views);
+        for (int i = 0; i < num_views; ++i)
+        {
+            /* Camera looking at the origin from distance 6. */
+            double const angle = 0.15 * i;
+            math::Matrix3d rot(0.0);
+            rot(0, 0) = std::cos(angle);
+            rot(0, 2) = -std::sin(angle);
+            rot(1, 1) = 1.0;
+            rot(2, 0) = std::sin(angle);
+            rot(2, 2) = std::cos(angle);
+            math::Vec3d const trans(0.0, 0.0, 6.0);
+            double const flen = static_cast<double>(width);
+
+            sfm::bundler::Viewport& viewport = viewports->at(i);
+            viewport.width = width;
+            viewport.height = height;
+            viewport.focal_length = 1.0f;
+            viewport.features.positions.resize(num_points);
+            viewport.features.colors.resize(num_points,
+                math::Vec3uc(128, 128, 128));
+            viewport.track_ids.resize(num_points);
+            for (int j = 0; j < num_points; ++j)
+            {
+                math::Vec3d const x = rot * points[j] + trans;
+                double const noise_x = std::rand() / (double)RAND_MAX - 0.5;
+                double const noise_y = std::rand() / (double)RAND_MAX - 0.5;
+                viewport.features.positions[j] = math::Vec2f(
+                    flen * x[0] / x[2] + width / 2.0 + noise_x,
+                    flen * x[1] / x[2] + height / 2.0 + noise_y);
+                viewport.track_ids[j] = j;
+            }
+        }
+
+        std::vector<int> offsets(num_points + 1);
+        sfm::bundler::FeatureReferenceList refs(num_points * num_views);
+        for (int i = 0; i <= num_points; ++i)
+            offsets[i] = i * num_views;
+        for (int i = 0; i < num_points; ++i)
+            for (int j = 0; j < num_views; ++j)
+            {
+                refs[i * num_views + j].view_id = j;
+                refs[i * num_views + j].feature_id = i;
+            }
+        tracks->assign(&offsets, &refs);
+    }
+
+    /* Counts the reconstructed tracks per view from scratch. */
+    std::vector<int>
+    count_visible_tracks (sfm::bundler::TrackList const& tracks,
+        std::size_t num_views)
+    {
+        std::vector<int> counts(num_views, 0);
+        for (std::size_t i = 0; i < tracks.size(); ++i)
+        {
+            if (!tracks.is_valid(i))
+                continue;
+            for (sfm::bundler::FeatureReference const* ref = tracks.begin(i);
+                ref != tracks.end(i); ++ref)
+                counts[ref->view_id] += 1;
+        }
+        return counts;
+    }
+
+    void
+    expect_visible_tracks (sfm::bundler::Incremental const& incremental,
+        sfm::bundler::TrackList const& tracks, std::size_t num_views)
+    {
+        std::vector<int> counts = count_visible_tracks(tracks, num_views);
+        for (std::size_t i = 0; i < num_views; ++i)
+            EXPECT_EQ(counts[i], incremental.num_visible_tracks(i))
+                << " view " << i;
+    }
+}  // namespace
+
+/*
+ * Fixture with a synthetic scene and options for unnormalized positions.
+ */
+class BundlerIncrementalTest : public testing::Test
+{
+protected:
+    BundlerIncrementalTest()
+    {
+        this->options.fundamental_opts.already_normalized = false;
+        this->options.fundamental_opts.threshold = 3.0f;
+        this->options.pose_p3p_opts.threshold = 10.0f;
+    }
+
+    void
+    init_scene(int num_views, int num_points)
+    {
+        create_scene(num_views, num_points, &this->viewports, &this->tracks);
+    }
+
+protected:
+    sfm::bundler::ViewportList viewports;
+    sfm::bundler::TrackList tracks;
+    sfm::bundler::Incremental::Options options;
+};
+
+TEST_F(BundlerIncrementalTest, VisibleTracksTest)
+{
+    int const num_views = 5;
+    this->init_scene(num_views, 200);
+
+    sfm::bundler::Incremental incremental(this->options);
+    incremental.initialize(&this->viewports, &this->tracks);
+    expect_visible_tracks(incremental, this->tracks, num_views);
+    EXPECT_EQ(-1, incremental.find_next_view());
+
+    incremental.reconstruct_initial_pair(0, 1);
+    incremental.triangulate_new_tracks();
+    expect_visible_tracks(incremental, this->tracks, num_views);
+    EXPECT_GT(incremental.num_visible_tracks(2), 100);
+
+    /* Invalidate some tracks, each track is seen by all views. */
+    incremental.invalidate_large_error_tracks();
+    expect_visible_tracks(incremental, this->tracks, num_views);
+    for (int i = 1; i < num_views; ++i)
+        EXPECT_EQ(incremental.num_visible_tracks(0),
+            incremental.num_visible_tracks(i));
+
+    /* The next views are the three unreconstructed views. */
+    std::vector<int> next_views;
+    incremental.find_next_views(&next_views);
+    ASSERT_EQ(3u, next_views.size());
+    EXPECT_EQ(2, incremental.find_next_view());
+    incremental.find_next_views(2, &next_views);
+    EXPECT_EQ(2u, next_views.size());
+
+    ASSERT_TRUE(incremental.reconstruct_next_view(next_views[0]));
+    incremental.triangulate_new_tracks();
+    incremental.bundle_adjustment_full();
+    expect_visible_tracks(incremental, this->tracks, num_views);
+    incremental.find_next_views(&next_views);
+    EXPECT_EQ(2u, next_views.size());
+}
+
+TEST_F(BundlerIncrementalTest, BatchRegistrationTest)
+{
+    int const num_views = 6;
+    this->init_scene(num_views, 200);
+
+    sfm::bundler::Incremental incremental(this->options);
+    incremental.initialize(&this->viewports, &this->tracks);
+    incremental.reconstruct_initial_pair(0, 1);
+    incremental.triangulate_new_tracks();
+
+    std::vector<int> next_views, accepted_views;
+    incremental.find_next_views(3, &next_views);
+    ASSERT_EQ(3u, next_views.size());
+    incremental.reconstruct_next_views(next_views, &accepted_views);
+    EXPECT_EQ(next_views, accepted_views);
+    for (std::size_t i = 0; i < accepted_views.size(); ++i)
+        EXPECT_TRUE(incremental.get_cameras()[accepted_views[i]].is_valid());
+
+    incremental.bundle_adjustment_cams(accepted_views);
+    incremental.triangulate_new_tracks();
+    expect_visible_tracks(incremental, this->tracks, num_views);
+    incremental.find_next_views(&next_views);
+    ASSERT_EQ(1u, next_views.size());
+    EXPECT_TRUE(incremental.reconstruct_next_view(next_views[0]));
+}
+
+TEST_F(BundlerIncrementalTest, LocalBundleAdjustmentTest)
+{
+    int const num_views = 6;
+    this->init_scene(num_views, 200);
+
+    this->options.local_ba_num_neighbors = 1;
+    sfm::bundler::Incremental incremental(this->options);
+    incremental.initialize(&this->viewports, &this->tracks);
+    incremental.reconstruct_initial_pair(0, 1);
+    incremental.triangulate_new_tracks();
+    incremental.bundle_adjustment_full();
+
+    std::vector<int> next_views;
+    for (int i = 2; i < num_views; ++i)
+    {
+        incremental.find_next_views(1, &next_views);
+        ASSERT_EQ(1u, next_views.size());
+        ASSERT_TRUE(incremental.reconstruct_next_view(next_views[0]));
+        incremental.bundle_adjustment_cams(next_views);
+        incremental.triangulate_new_tracks();
+
+        /* Only the new view and one neighbor are optimized. */
+        std::vector<sfm::CameraPose> const before = incremental.get_cameras();
+        incremental.bundle_adjustment_local(next_views);
+        std::vector<sfm::CameraPose> const& after = incremental.get_cameras();
+        int num_changed = 0;
+        for (int j = 0; j < num_views; ++j)
+        {
+            ASSERT_EQ(before[j].is_valid(), after[j].is_valid());
+            if (!after[j].is_valid())
+                continue;
+            if (!std::equal(before[j].t.begin(), before[j].t.end(),
+                after[j].t.begin()))
+                num_changed += 1;
+        }
+        EXPECT_LE(num_changed, 2);
+        expect_visible_tracks(incremental, this->tracks, num_views);
+    }
+
+    /* The local BA keeps the model consistent for a final full BA. */
+    incremental.bundle_adjustment_full();
+    incremental.invalidate_large_error_tracks();
+    expect_visible_tracks(incremental, this->tracks, num_views);
+    EXPECT_GT(incremental.num_visible_tracks(num_views - 1), 150);
+}
+
+TEST_F(BundlerIncrementalTest, TriangulateNewViewsTest)
+{
+    int const num_views = 4;
+    this->init_scene(num_views, 300);
+    sfm::bundler::ViewportList viewports_1 = this->viewports;
+    sfm::bundler::ViewportList viewports_2 = this->viewports;
+    sfm::bundler::TrackList tracks_1 = this->tracks;
+    sfm::bundler::TrackList tracks_2 = this->tracks;
+
+    /* Remove the first view from some tracks, these are not visited. */
+    for (int i = 0; i < 300; i += 3)
+    {
+        tracks_1.remove_view(i, 0);
+        tracks_2.remove_view(i, 0);
+        viewports_1[0].track_ids[i] = -1;
+        viewports_2[0].track_ids[i] = -1;
+    }
+
+    sfm::bundler::Incremental incremental_1(this->options);
+    sfm::bundler::Incremental incremental_2(this->options);
+    incremental_1.initialize(&viewports_1, &tracks_1);
+    incremental_2.initialize(&viewports_2, &tracks_2);
+    incremental_1.reconstruct_initial_pair(0, 1);
+    incremental_2.reconstruct_initial_pair(0, 1);
+
+    /* Triangulating all tracks or the tracks of the pair is the same. */
+    incremental_1.triangulate_new_tracks();
+    incremental_2.triangulate_new_tracks(std::vector<int>(1, 0));
+    ASSERT_EQ(tracks_1.size(), tracks_2.size());
+    for (std::size_t i = 0; i < tracks_1.size(); ++i)
+    {
+        ASSERT_EQ(tracks_1.is_valid(i), tracks_2.is_valid(i));
+        if (tracks_1.is_valid(i))
+        {
+            EXPECT_EQ(tracks_1.position(i), tracks_2.position(i));
+        }
+    }
+    expect_visible_tracks(incremental_2, tracks_2, num_views);
+    EXPECT_EQ(200, incremental_2.num_visible_tracks(0));
+
+    /* The tracks without the first view are triangulated with view 2. */
+    ASSERT_TRUE(incremental_2.reconstruct_next_view(2));
+    incremental_2.triangulate_new_tracks(std::vector<int>(1, 2));
+    expect_visible_tracks(incremental_2, tracks_2, num_views);
+    EXPECT_EQ(300, incremental_2.num_visible_tracks(1));
+}
+
+TEST_F(BundlerIncrementalTest, RetryRejectedTracksTest)
+{
+    int const num_views = 3;
+    this->init_scene(num_views, 200);
+
+    /* Invalidates all tracks above the median error. */
+    this->options.track_error_threshold_factor = 1.0;
+    sfm::bundler::Incremental incremental(this->options);
+    incremental.initialize(&this->viewports, &this->tracks);
+    incremental.reconstruct_initial_pair(0, 1);
+    incremental.triangulate_new_tracks();
+    incremental.bundle_adjustment_full();
+    EXPECT_EQ(200, incremental.num_visible_tracks(0));
+    incremental.invalidate_large_error_tracks();
+    int const num_valid = incremental.num_visible_tracks(0);
+    EXPECT_LT(num_valid, 200);
+
+    /* Invalidated tracks are not retried while the cameras are unchanged. */
+    std::vector<int> const no_views;
+    incremental.triangulate_new_tracks(no_views);
+    EXPECT_EQ(num_valid, incremental.num_visible_tracks(0));
+
+    /* Once a camera of the tracks changed, they are retried. */
+    incremental.bundle_adjustment_cams(std::vector<int>(1, 1));
+    incremental.triangulate_new_tracks(no_views);
+    EXPECT_EQ(200, incremental.num_visible_tracks(0));
+    expect_visible_tracks(incremental, this->tracks, num_views);
+}
@@ -0,0 +1,187 @@
+// Test cases for the persistent bundle adjustment problem.
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "util/exception.h"
+#include "util/file_system.h"
+#include "util/stdint_compat.h"
+#include "sfm/bundler_pba_session.h"
+
+namespace
+{
+    struct TempProblemFile : public std::string
+    {
+        TempProblemFile (void)
+            : std::string(std::tmpnam(NULL))
+        {
+        }
+
+        ~TempProblemFile (void)
+        {
+            util::fs::unlink(this->c_str());
+        }
+    };
+
+    sfm::pba::Point2D
+    make_point (float x, float y)
+    {
+        sfm::pba::Point2D point;
+        point.x = x;
+        point.y = y;
+        return point;
+    }
+
+    void
+    expect_sorted_observations (sfm::bundler::PbaSession const& session)
+    {
+        for (std::size_t i = 1; i < session.num_observations(); ++i)
+            EXPECT_LE(session.observation_point(i - 1),
+                session.observation_point(i));
+    }
+}  // namespace
+
+TEST(BundlerPbaSessionTest, AddObservationsTest)
+{
+    sfm::bundler::PbaSession session;
+    session.add_camera(3);
+    session.add_camera(1);
+    session.add_camera(3);
+    session.add_track(10);
+    session.add_track(4);
+    session.add_observation(10, 3, make_point(1.0f, 2.0f));
+    session.add_observation(4, 1, make_point(3.0f, 4.0f));
+    session.add_observation(4, 3, make_point(5.0f, 6.0f));
+    session.add_observation(10, 1, make_point(7.0f, 8.0f));
+    session.apply_changes();
+
+    ASSERT_EQ(2u, session.num_cameras());
+    EXPECT_EQ(3, session.get_view_id(0));
+    EXPECT_EQ(1, session.get_view_id(1));
+    ASSERT_EQ(2u, session.num_points());
+    EXPECT_EQ(10, session.get_track_id(0));
+    EXPECT_EQ(4, session.get_track_id(1));
+    ASSERT_EQ(4u, session.num_observations());
+    expect_sorted_observations(session);
+    EXPECT_EQ(0, session.observation_camera(0));
+    EXPECT_EQ(1, session.observation_camera(1));
+    EXPECT_EQ(1, session.observation_camera(2));
+    EXPECT_EQ(0, session.observation_camera(3));
+
+    /* A new camera adds observations to existing points. */
+    session.add_camera(0);
+    session.add_observation(4, 0, make_point(0.0f, 0.0f));
+    session.add_observation(10, 0, make_point(0.0f, 0.0f));
+    session.apply_changes();
+    ASSERT_EQ(6u, session.num_observations());
+    expect_sorted_observations(session);
+    EXPECT_EQ(2, session.observation_camera(2));
+    EXPECT_EQ(2, session.observation_camera(5));
+}
+
+TEST(BundlerPbaSessionTest, RemoveTracksTest)
+{
+    sfm::bundler::PbaSession session;
+    session.add_camera(0);
+    session.add_camera(1);
+    for (int i = 0; i < 4; ++i)
+    {
+        session.add_track(i);
+        session.add_observation(i, 0, make_point(0.0f, i));
+        session.add_observation(i, 1, make_point(1.0f, i));
+    }
+    session.apply_changes();
+    ASSERT_EQ(8u, session.num_observations());
+
+    /* Removed tracks may be added again before changes are applied. */
+    session.remove_track(1);
+    session.remove_track(2);
+    session.remove_track(7);
+    session.add_track(1);
+    session.add_observation(1, 1, make_point(2.0f, 1.0f));
+    session.apply_changes();
+
+    ASSERT_EQ(3u, session.num_points());
+    EXPECT_EQ(0, session.get_track_id(0));
+    EXPECT_EQ(3, session.get_track_id(1));
+    EXPECT_EQ(1, session.get_track_id(2));
+    ASSERT_EQ(5u, session.num_observations());
+    expect_sorted_observations(session);
+    EXPECT_EQ(2, session.observation_point(4));
+    EXPECT_EQ(1, session.observation_camera(4));
+
+    session.clear();
+    session.apply_changes();
+    EXPECT_EQ(0u, session.num_cameras());
+    EXPECT_EQ(0u, session.num_points());
+    EXPECT_EQ(0u, session.num_observations());
+}
+
+TEST(BundlerPbaSessionTest, SaveLoadProblemTest)
+{
+    sfm::bundler::PbaSession session;
+    session.add_camera(2);
+    session.add_camera(5);
+    for (int i = 0; i < 3; ++i)
+    {
+        session.add_track(i * 3);
+        session.point(i).xyz[0] = static_cast<float>(i);
+        session.add_observation(i * 3, 5, make_point(1.0f, i));
+        session.add_observation(i * 3, 2, make_point(2.0f, i));
+    }
+    session.camera(1).f = 2.0f;
+    session.remove_track(3);
+
+    TempProblemFile filename;
+    session.save_problem(filename);
+    sfm::bundler::PbaSession loaded;
+    loaded.load_problem(filename);
+
+    ASSERT_EQ(2u, loaded.num_cameras());
+    EXPECT_EQ(2, loaded.get_view_id(0));
+    EXPECT_EQ(5, loaded.get_view_id(1));
+    EXPECT_EQ(2.0f, loaded.camera(1).f);
+    ASSERT_EQ(2u, loaded.num_points());
+    EXPECT_EQ(0, loaded.get_track_id(0));
+    EXPECT_EQ(6, loaded.get_track_id(1));
+    EXPECT_EQ(2.0f, loaded.point(1).xyz[0]);
+    ASSERT_EQ(4u, loaded.num_observations());
+    expect_sorted_observations(loaded);
+    EXPECT_EQ(1, loaded.observation_camera(0));
+    EXPECT_EQ(0, loaded.observation_camera(1));
+
+    /* The restored mapping accepts new observations of loaded tracks. */
+    loaded.add_camera(7);
+    loaded.add_observation(6, 7, make_point(3.0f, 3.0f));
+    loaded.apply_changes();
+    ASSERT_EQ(5u, loaded.num_observations());
+    EXPECT_EQ(2, loaded.observation_camera(4));
+}
+
+TEST(BundlerPbaSessionTest, LoadInvalidProblemTest)
+{
+    sfm::bundler::PbaSession session;
+    session.add_camera(0);
+    session.add_track(0);
+    session.add_observation(0, 0, make_point(1.0f, 1.0f));
+
+    /* The camera index of the last observation ends the file. */
+    TempProblemFile filename;
+    session.save_problem(filename);
+    {
+        std::fstream file(filename.c_str(), std::ios::binary
+            | std::ios::in | std::ios::out);
+        int32_t const camera_id = 1;
+        file.seekp(-static_cast<int>(sizeof(int32_t)), std::ios::end);
+        file.write(reinterpret_cast<char const*>(&camera_id),
+            sizeof(int32_t));
+    }
+
+    sfm::bundler::PbaSession loaded;
+    EXPECT_THROW(loaded.load_problem(filename), util::Exception);
+    EXPECT_EQ(0u, loaded.num_cameras());
+    EXPECT_EQ(0u, loaded.num_points());
+    EXPECT_EQ(0u, loaded.num_observations());
+}
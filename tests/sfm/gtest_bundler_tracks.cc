@@ -3,11 +3,33 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "util/file_system.h"
+#include "sfm/bundler_common.h"
+#include "sfm/bundler_matching.h"
 #include "sfm/bundler_tracks.h"
 
-TEST(BundlerTracksTest, RemoveConflictsTest)
+namespace
 {
-    sfm::bundler::ViewportList viewports;
+    struct TempLogFile : public std::string
+    {
+        TempLogFile (void)
+            : std::string(std::tmpnam(NULL))
+        {
+        }
+
+        ~TempLogFile (void)
+        {
+            util::fs::unlink(this->c_str());
+        }
+    };
+
+    void
+    create_viewports (sfm::bundler::ViewportList* viewports)
     {
         sfm::bundler::Viewport v1;
         sfm::bundler::Viewport v2;
@@ -18,40 +40,65 @@ TEST(BundlerTracksTest, RemoveConflictsTest)
         v2.features.positions.resize(9, math::Vec2f(0.0f));
         v3.features.colors.resize(10, math::Vec3uc(0, 0, 0));
         v3.features.positions.resize(10, math::Vec2f(0.0f));
-        viewports.push_back(v1);
-        viewports.push_back(v2);
-        viewports.push_back(v3);
+        viewports->push_back(v1);
+        viewports->push_back(v2);
+        viewports->push_back(v3);
     }
 
-    sfm::bundler::TwoViewMatching m10;
-    m10.view_1_id = 1;
-    m10.view_2_id = 0;
-    m10.matches.push_back(sfm::CorrespondenceIndex(1, 0));
-    m10.matches.push_back(sfm::CorrespondenceIndex(2, 2));
-    m10.matches.push_back(sfm::CorrespondenceIndex(5, 5));
-    m10.matches.push_back(sfm::CorrespondenceIndex(6, 5));
-    m10.matches.push_back(sfm::CorrespondenceIndex(7, 7));
+    void
+    create_matching (sfm::bundler::PairwiseMatching* matching)
+    {
+        sfm::bundler::TwoViewMatching m10;
+        m10.view_1_id = 1;
+        m10.view_2_id = 0;
+        m10.matches.push_back(sfm::CorrespondenceIndex(1, 0));
+        m10.matches.push_back(sfm::CorrespondenceIndex(2, 2));
+        m10.matches.push_back(sfm::CorrespondenceIndex(5, 5));
+        m10.matches.push_back(sfm::CorrespondenceIndex(6, 5));
+        m10.matches.push_back(sfm::CorrespondenceIndex(7, 7));
 
-    sfm::bundler::TwoViewMatching m20;
-    m20.view_1_id = 2;
-    m20.view_2_id = 0;
-    m20.matches.push_back(sfm::CorrespondenceIndex(2, 4));
-    m20.matches.push_back(sfm::CorrespondenceIndex(8, 7));
+        sfm::bundler::TwoViewMatching m20;
+        m20.view_1_id = 2;
+        m20.view_2_id = 0;
+        m20.matches.push_back(sfm::CorrespondenceIndex(2, 4));
+        m20.matches.push_back(sfm::CorrespondenceIndex(8, 7));
 
-    sfm::bundler::TwoViewMatching m21;
-    m21.view_1_id = 2;
-    m21.view_2_id = 1;
-    m21.matches.push_back(sfm::CorrespondenceIndex(0, 1));
-    m21.matches.push_back(sfm::CorrespondenceIndex(2, 2));
-    m21.matches.push_back(sfm::CorrespondenceIndex(3, 4));
-    m21.matches.push_back(sfm::CorrespondenceIndex(5, 5));
-    m21.matches.push_back(sfm::CorrespondenceIndex(5, 6));
-    m21.matches.push_back(sfm::CorrespondenceIndex(8, 7));
+        sfm::bundler::TwoViewMatching m21;
+        m21.view_1_id = 2;
+        m21.view_2_id = 1;
+        m21.matches.push_back(sfm::CorrespondenceIndex(0, 1));
+        m21.matches.push_back(sfm::CorrespondenceIndex(2, 2));
+        m21.matches.push_back(sfm::CorrespondenceIndex(3, 4));
+        m21.matches.push_back(sfm::CorrespondenceIndex(5, 5));
+        m21.matches.push_back(sfm::CorrespondenceIndex(5, 6));
+        m21.matches.push_back(sfm::CorrespondenceIndex(8, 7));
 
+        matching->push_back(m10);
+        matching->push_back(m21);
+        matching->push_back(m20);
+    }
+
+    void
+    write_matching_log (sfm::bundler::ViewportList const& viewports,
+        sfm::bundler::PairwiseMatching const& matching,
+        std::string const& filename)
+    {
+        sfm::bundler::MatchingLogViews views;
+        sfm::bundler::create_matching_log_views(viewports, &views);
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        sfm::bundler::write_matching_log_header(views, out);
+        for (std::size_t i = 0; i < matching.size(); ++i)
+            sfm::bundler::append_to_matching_log(matching[i], out);
+        out.close();
+    }
+}
+
+TEST(BundlerTracksTest, SplitConflictsTest)
+{
+    sfm::bundler::ViewportList viewports;
+    create_viewports(&viewports);
     sfm::bundler::PairwiseMatching matching;
-    matching.push_back(m10);
-    matching.push_back(m21);
-    matching.push_back(m20);
+    create_matching(&matching);
 
     sfm::bundler::Tracks::Options options;
     options.verbose_output = true;
@@ -59,19 +106,26 @@ TEST(BundlerTracksTest, RemoveConflictsTest)
     sfm::bundler::Tracks tracks(options);
     tracks.compute(matching, &viewports, &track_list);
 
-    // Check tracks (at least list sizes).
-    ASSERT_EQ(3, track_list.size());
-    ASSERT_EQ(3, track_list[0].features.size());
-    ASSERT_EQ(3, track_list[1].features.size());
-    ASSERT_EQ(2, track_list[2].features.size());
+    /*
+     * The tracks of features v0:2 and v0:5 have conflicts, which are split
+     * by dropping the match v2:2-v0:4 and the matches of feature v1:6.
+     */
+    ASSERT_EQ(5, track_list.size());
+    ASSERT_EQ(3, track_list.num_features(0));
+    ASSERT_EQ(3, track_list.num_features(1));
+    ASSERT_EQ(3, track_list.num_features(2));
+    ASSERT_EQ(3, track_list.num_features(3));
+    ASSERT_EQ(2, track_list.num_features(4));
+    EXPECT_EQ(1, track_list.begin(4)->view_id);
+    EXPECT_EQ(4, track_list.begin(4)->feature_id);
     // Check viewports and to-track mapping.
     ASSERT_EQ(8, viewports[0].track_ids.size());
     ASSERT_EQ(9, viewports[1].track_ids.size());
     ASSERT_EQ(10, viewports[2].track_ids.size());
 
-    int track_ids_v0[] = { 0, -1, -1, -1, -1, -1, -1, 1 };
-    int track_ids_v1[] = { -1, 0, -1, -1, 2, -1, -1, 1, -1 };
-    int track_ids_v2[] = { 0, -1, -1, 2, -1, -1, -1, -1, 1, -1 };
+    int track_ids_v0[] = { 0, -1, 1, -1, -1, 2, -1, 3 };
+    int track_ids_v1[] = { -1, 0, 1, -1, 4, 2, -1, 3, -1 };
+    int track_ids_v2[] = { 0, -1, 1, 4, -1, 2, -1, -1, 3, -1 };
     for (int i = 0; i < 8; ++i)
         EXPECT_EQ(track_ids_v0[i], viewports[0].track_ids[i]) << " v0:" << i;
     for (int i = 0; i < 9; ++i)
@@ -79,3 +133,294 @@ TEST(BundlerTracksTest, RemoveConflictsTest)
     for (int i = 0; i < 10; ++i)
         EXPECT_EQ(track_ids_v2[i], viewports[2].track_ids[i]) << " v2:" << i;
 }
+
+TEST(BundlerTracksTest, TrackViewTest)
+{
+    sfm::bundler::ViewportList viewports;
+    create_viewports(&viewports);
+    sfm::bundler::PairwiseMatching matching;
+    create_matching(&matching);
+    sfm::bundler::Tracks::Options options;
+    sfm::bundler::TrackList track_list;
+    sfm::bundler::Tracks tracks(options);
+    tracks.compute(matching, &viewports, &track_list);
+    ASSERT_EQ(5, track_list.size());
+
+    // The view refers to the storage of the track list.
+    sfm::bundler::Track track = track_list[0];
+    ASSERT_EQ(3, track.features.size());
+    EXPECT_EQ(track_list.begin(0), track.features.begin());
+    EXPECT_EQ(track_list.begin(0)[1].view_id, track.features[1].view_id);
+    EXPECT_FALSE(track.is_valid());
+    track.pos = math::Vec3f(1.0f, 2.0f, 3.0f);
+    track.color = math::Vec3uc(10, 20, 30);
+    EXPECT_TRUE(track_list.is_valid(0));
+    EXPECT_EQ(math::Vec3f(1.0f, 2.0f, 3.0f), track_list.position(0));
+    EXPECT_EQ(math::Vec3uc(10, 20, 30), track_list.color(0));
+
+    int const view_id = track.features[0].view_id;
+    track.remove_view(view_id);
+    ASSERT_EQ(2, track.features.size());
+    EXPECT_EQ(2, track_list.num_features(0));
+    for (std::size_t i = 0; i < track.features.size(); ++i)
+        EXPECT_NE(view_id, track.features[i].view_id);
+
+    sfm::bundler::TrackList const& const_list = track_list;
+    sfm::bundler::ConstTrack const_track = const_list[0];
+    EXPECT_TRUE(const_track.is_valid());
+    EXPECT_EQ(track_list.end(0), const_track.features.end());
+    track.invalidate();
+    EXPECT_FALSE(const_track.is_valid());
+    EXPECT_FALSE(track_list.is_valid(0));
+}
+
+TEST(BundlerTracksTest, PairOrderTest)
+{
+    sfm::bundler::PairwiseMatching matching;
+    create_matching(&matching);
+    sfm::bundler::PairwiseMatching reversed(matching.rbegin(),
+        matching.rend());
+
+    sfm::bundler::Tracks::Options options;
+    sfm::bundler::Tracks tracks(options);
+    sfm::bundler::ViewportList viewports_1, viewports_2;
+    create_viewports(&viewports_1);
+    create_viewports(&viewports_2);
+    sfm::bundler::TrackList track_list_1, track_list_2;
+    tracks.compute(matching, &viewports_1, &track_list_1);
+    tracks.compute(reversed, &viewports_2, &track_list_2);
+
+    ASSERT_EQ(track_list_1.size(), track_list_2.size());
+    for (std::size_t i = 0; i < viewports_1.size(); ++i)
+        EXPECT_EQ(viewports_1[i].track_ids, viewports_2[i].track_ids);
+}
+
+TEST(BundlerTracksTest, TiedPairOrderTest)
+{
+    /*
+     * All pairs have one match and the united track has the features
+     * v0:0 and v0:1. Ties are split by view IDs, thus pair (1, 0) and then
+     * pair (2, 0) are united, which rejects pair (2, 1).
+     */
+    sfm::bundler::TwoViewMatching m10, m20, m21;
+    m10.view_1_id = 1;
+    m10.view_2_id = 0;
+    m10.matches.push_back(sfm::CorrespondenceIndex(0, 0));
+    m20.view_1_id = 2;
+    m20.view_2_id = 0;
+    m20.matches.push_back(sfm::CorrespondenceIndex(0, 1));
+    m21.view_1_id = 2;
+    m21.view_2_id = 1;
+    m21.matches.push_back(sfm::CorrespondenceIndex(0, 0));
+
+    sfm::bundler::PairwiseMatching matching;
+    matching.push_back(m10);
+    matching.push_back(m20);
+    matching.push_back(m21);
+    sfm::bundler::PairwiseMatching reversed(matching.rbegin(),
+        matching.rend());
+
+    sfm::bundler::Tracks::Options options;
+    sfm::bundler::Tracks tracks(options);
+    sfm::bundler::PairwiseMatching const* inputs[2] = { &matching, &reversed };
+    for (int i = 0; i < 2; ++i)
+    {
+        sfm::bundler::ViewportList viewports;
+        create_viewports(&viewports);
+        sfm::bundler::TrackList track_list;
+        tracks.compute(*inputs[i], &viewports, &track_list);
+
+        ASSERT_EQ(2u, track_list.size());
+        EXPECT_EQ(viewports[0].track_ids[0], viewports[1].track_ids[0]);
+        EXPECT_EQ(viewports[0].track_ids[1], viewports[2].track_ids[0]);
+        EXPECT_NE(viewports[0].track_ids[0], viewports[0].track_ids[1]);
+    }
+}
+
+TEST(BundlerTracksTest, MatchingLogTest)
+{
+    sfm::bundler::PairwiseMatching matching;
+    create_matching(&matching);
+    /* A rejected pair without matches. */
+    sfm::bundler::TwoViewMatching rejected;
+    rejected.view_1_id = 3;
+    rejected.view_2_id = 1;
+    matching.push_back(rejected);
+
+    sfm::bundler::ViewportList viewports;
+    create_viewports(&viewports);
+    TempLogFile filename;
+    write_matching_log(viewports, matching, filename);
+
+    /* Simulate a crash while writing the last record. */
+    {
+        std::ofstream out(filename.c_str(), std::ios::binary | std::ios::app);
+        int32_t const partial[4] = { 3, 2, 5, 1 };
+        out.write(reinterpret_cast<char const*>(partial), sizeof(partial));
+    }
+
+    sfm::bundler::MatchingLogIndex index;
+    sfm::bundler::MatchingLogViews views;
+    std::streamoff const size
+        = sfm::bundler::load_matching_log_index(filename, &index, &views);
+    ASSERT_EQ(4u, index.size());
+    EXPECT_EQ(0, index[3].num_matches);
+    EXPECT_EQ(static_cast<std::streamoff>(MATCHING_LOG_SIGNATURE_LEN
+        + (1 + 3 * 5 + 3 * 4 + 2 * 13) * sizeof(int32_t)), size);
+    ASSERT_EQ(3u, views.size());
+    EXPECT_EQ(9, views[1].num_features);
+
+    sfm::bundler::PairwiseMatching loaded;
+    sfm::bundler::load_matching_log(filename, &loaded);
+    ASSERT_EQ(3u, loaded.size());
+    for (std::size_t i = 0; i < loaded.size(); ++i)
+    {
+        EXPECT_EQ(matching[i].view_1_id, loaded[i].view_1_id);
+        EXPECT_EQ(matching[i].view_2_id, loaded[i].view_2_id);
+        EXPECT_EQ(matching[i].matches, loaded[i].matches);
+    }
+}
+
+TEST(BundlerTracksTest, ResumeMatchingLogTest)
+{
+    sfm::bundler::ViewportList viewports;
+    create_viewports(&viewports);
+    sfm::bundler::PairwiseMatching matching;
+    create_matching(&matching);
+    TempLogFile filename;
+    write_matching_log(viewports, matching, filename);
+
+    /* All pairs are resumed from the log for the same features. */
+    sfm::bundler::Matching::Options options;
+    options.matching_log_file = filename;
+    sfm::bundler::Matching bundler_matching(options);
+    sfm::bundler::PairwiseMatching resumed;
+    bundler_matching.compute(viewports, &resumed);
+    ASSERT_EQ(3u, resumed.size());
+    /* The resumed pairs are sorted like new pairs. */
+    std::sort(matching.begin(), matching.end());
+    for (std::size_t i = 0; i < resumed.size(); ++i)
+    {
+        EXPECT_EQ(matching[i].view_1_id, resumed[i].view_1_id);
+        EXPECT_EQ(matching[i].view_2_id, resumed[i].view_2_id);
+        EXPECT_EQ(matching[i].matches, resumed[i].matches);
+    }
+
+    /* The log is discarded for different features. */
+    viewports[1].features.positions[0] = math::Vec2f(1.0f, 2.0f);
+    sfm::bundler::PairwiseMatching rematched;
+    bundler_matching.compute(viewports, &rematched);
+    EXPECT_TRUE(rematched.empty());
+
+    sfm::bundler::MatchingLogIndex index;
+    sfm::bundler::MatchingLogViews views, expected_views;
+    sfm::bundler::load_matching_log_index(filename, &index, &views);
+    sfm::bundler::create_matching_log_views(viewports, &expected_views);
+    EXPECT_TRUE(views == expected_views);
+    ASSERT_EQ(3u, index.size());
+    for (std::size_t i = 0; i < index.size(); ++i)
+        EXPECT_EQ(0, index[i].num_matches);
+}
+
+TEST(BundlerTracksTest, TracksFromMatchingLogTest)
+{
+    sfm::bundler::ViewportList viewports;
+    create_viewports(&viewports);
+    sfm::bundler::PairwiseMatching matching;
+    create_matching(&matching);
+    TempLogFile filename;
+    write_matching_log(viewports, matching, filename);
+
+    sfm::bundler::Tracks::Options options;
+    sfm::bundler::Tracks tracks(options);
+
+    /* The log is processed in the order of the sorted matching. */
+    std::sort(matching.begin(), matching.end());
+    sfm::bundler::ViewportList viewports_1, viewports_2;
+    create_viewports(&viewports_1);
+    create_viewports(&viewports_2);
+    sfm::bundler::TrackList track_list_1, track_list_2;
+    tracks.compute(matching, &viewports_1, &track_list_1);
+    tracks.compute(filename, &viewports_2, &track_list_2);
+
+    ASSERT_EQ(track_list_1.size(), track_list_2.size());
+    for (std::size_t i = 0; i < track_list_1.size(); ++i)
+        EXPECT_EQ(track_list_1.num_features(i),
+            track_list_2.num_features(i));
+    for (std::size_t i = 0; i < viewports_1.size(); ++i)
+        EXPECT_EQ(viewports_1[i].track_ids, viewports_2[i].track_ids);
+}
+
+TEST(BundlerTracksTest, PrebundleFromMatchingLogTest)
+{
+    sfm::bundler::ViewportList viewports;
+    create_viewports(&viewports);
+    sfm::bundler::PairwiseMatching matching;
+    create_matching(&matching);
+    sfm::bundler::TwoViewMatching rejected;
+    rejected.view_1_id = 1;
+    rejected.view_2_id = 0;
+    matching.push_back(rejected);
+    TempLogFile log_filename;
+    write_matching_log(viewports, matching, log_filename);
+
+    TempLogFile prebundle_filename;
+    sfm::bundler::save_prebundle_from_matching_log(viewports,
+        log_filename, prebundle_filename);
+    sfm::bundler::ViewportList loaded_viewports;
+    sfm::bundler::PairwiseMatching loaded;
+    sfm::bundler::load_prebundle_from_file(prebundle_filename,
+        &loaded_viewports, &loaded);
+
+    /* The rejected pair is dropped and the pairs are sorted. */
+    matching.pop_back();
+    std::sort(matching.begin(), matching.end());
+    ASSERT_EQ(3u, loaded_viewports.size());
+    ASSERT_EQ(matching.size(), loaded.size());
+    for (std::size_t i = 0; i < loaded.size(); ++i)
+    {
+        EXPECT_EQ(matching[i].view_1_id, loaded[i].view_1_id);
+        EXPECT_EQ(matching[i].view_2_id, loaded[i].view_2_id);
+        EXPECT_EQ(matching[i].matches, loaded[i].matches);
+    }
+}
+
+TEST(BundlerTracksTest, TrackListTest)
+{
+    int const offsets_data[] = { 0, 3, 5 };
+    int const refs_data[][2] = { {0, 1}, {1, 4}, {2, 3}, {1, 7}, {2, 9} };
+    std::vector<int> offsets(offsets_data, offsets_data + 3);
+    sfm::bundler::FeatureReferenceList refs(5);
+    for (int i = 0; i < 5; ++i)
+    {
+        refs[i].view_id = refs_data[i][0];
+        refs[i].feature_id = refs_data[i][1];
+    }
+
+    sfm::bundler::TrackList tracks;
+    EXPECT_TRUE(tracks.empty());
+    tracks.assign(&offsets, &refs);
+    ASSERT_EQ(2u, tracks.size());
+    EXPECT_EQ(3u, tracks.num_features(0));
+    EXPECT_EQ(2u, tracks.num_features(1));
+    EXPECT_EQ(7, tracks.begin(1)->feature_id);
+    EXPECT_FALSE(tracks.is_valid(0));
+
+    tracks.position(0) = math::Vec3f(1.0f, 2.0f, 3.0f);
+    EXPECT_TRUE(tracks.is_valid(0));
+    EXPECT_FALSE(tracks.is_valid(1));
+    tracks.invalidate(0);
+    EXPECT_FALSE(tracks.is_valid(0));
+
+    /* Removing a view keeps the order and does not affect other tracks. */
+    tracks.remove_view(0, 1);
+    ASSERT_EQ(2u, tracks.num_features(0));
+    EXPECT_EQ(0, tracks.begin(0)[0].view_id);
+    EXPECT_EQ(2, tracks.begin(0)[1].view_id);
+    EXPECT_EQ(tracks.begin(0) + 2, tracks.end(0));
+    ASSERT_EQ(2u, tracks.num_features(1));
+    EXPECT_EQ(1, tracks.begin(1)->view_id);
+
+    tracks.clear();
+    EXPECT_TRUE(tracks.empty());
+}
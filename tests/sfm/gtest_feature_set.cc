@@ -0,0 +1,121 @@
+// Test cases for restoring feature sets from cached descriptors.
+
+#include <gtest/gtest.h>
+
+#include "mve/image.h"
+#include "sfm/feature_set.h"
+#include "sfm/bundler_common.h"
+
+namespace
+{
+    /* A color image with blobs of different sizes. */
+    mve::ByteImage::Ptr
+    create_blob_image (void)
+    {
+        mve::ByteImage::Ptr image = mve::ByteImage::create(160, 120, 3);
+        image->fill(40);
+        for (int y = 0; y < image->height(); ++y)
+            for (int x = 0; x < image->width(); ++x)
+                for (int i = 0; i < 6; ++i)
+                {
+                    int const cx = 20 + 25 * i;
+                    int const cy = 30 + 12 * (i % 3);
+                    int const radius = 3 + i;
+                    int const dx = x - cx;
+                    int const dy = y - cy;
+                    if (dx * dx + dy * dy > radius * radius)
+                        continue;
+                    image->at(x, y, 0) = 220;
+                    image->at(x, y, 1) = 40 + 30 * i;
+                    image->at(x, y, 2) = 100;
+                }
+        return image;
+    }
+}
+
+TEST(FeatureSetTest, SetFeaturesFromEmbedding)
+{
+    mve::ByteImage::Ptr image = create_blob_image();
+    sfm::FeatureSet::Options options;
+    options.feature_types = sfm::FeatureSet::FEATURE_ALL;
+
+    sfm::FeatureSet computed(options);
+    sfm::Sift::Descriptors sift_descr;
+    sfm::Surf::Descriptors surf_descr;
+    computed.compute_features(image, &sift_descr, &surf_descr);
+    ASSERT_EQ(sift_descr.size() + surf_descr.size(),
+        computed.positions.size());
+    ASSERT_GT(computed.positions.size(), 0u);
+
+    /* Round trip through the embedding format used by the feature cache. */
+    int width, height;
+    sfm::Sift::Descriptors cached_sift;
+    sfm::bundler::embedding_to_descriptors(sfm::bundler::
+        descriptors_to_embedding(sift_descr, image->width(), image->height()),
+        &cached_sift, &width, &height);
+    EXPECT_EQ(image->width(), width);
+    EXPECT_EQ(image->height(), height);
+    sfm::Surf::Descriptors cached_surf;
+    sfm::bundler::embedding_to_descriptors(sfm::bundler::
+        descriptors_to_embedding(surf_descr, image->width(), image->height()),
+        &cached_surf, &width, &height);
+
+    sfm::FeatureSet restored(options);
+    restored.set_features(image, cached_sift, cached_surf);
+    EXPECT_EQ(computed.width, restored.width);
+    EXPECT_EQ(computed.height, restored.height);
+    EXPECT_EQ(computed.get_num_sift_descriptors(),
+        restored.get_num_sift_descriptors());
+    ASSERT_EQ(computed.positions.size(), restored.positions.size());
+    ASSERT_EQ(computed.colors.size(), restored.colors.size());
+    for (std::size_t i = 0; i < computed.positions.size(); ++i)
+    {
+        EXPECT_EQ(computed.positions[i], restored.positions[i]);
+        EXPECT_EQ(computed.colors[i], restored.colors[i]);
+    }
+
+    /* The restored descriptors match like the computed descriptors. */
+    sfm::Matching::Result expected, result;
+    computed.match(computed, &expected);
+    computed.match(restored, &result);
+    EXPECT_EQ(expected.matches_1_2, result.matches_1_2);
+    EXPECT_EQ(expected.matches_2_1, result.matches_2_1);
+    EXPECT_GT(sfm::Matching::count_consistent_matches(result), 0);
+}
+
+TEST(FeatureSetTest, MatchCandidates)
+{
+    mve::ByteImage::Ptr image = create_blob_image();
+    sfm::FeatureSet::Options options;
+    options.feature_types = sfm::FeatureSet::FEATURE_ALL;
+    sfm::FeatureSet features(options);
+    features.compute_features(image);
+    int const num_features = static_cast<int>(features.positions.size());
+    int const num_sift = features.get_num_sift_descriptors();
+    ASSERT_GT(num_sift, 0);
+    ASSERT_GT(num_features, num_sift);
+
+    /* Every feature with itself and the first SIFT feature as candidate. */
+    std::vector<int> offsets(1, 0), candidates;
+    for (int i = 0; i < num_features; ++i)
+    {
+        candidates.push_back(i);
+        candidates.push_back(0);
+        offsets.push_back(candidates.size());
+    }
+    std::vector<int> result;
+    features.match_candidates(features, offsets, candidates, &result);
+    ASSERT_EQ(num_features, static_cast<int>(result.size()));
+    for (int i = 0; i < num_features; ++i)
+        EXPECT_EQ(i, result[i]);
+
+    /*
+     * Candidates of a different feature type are ignored. SIFT features
+     * only keep the first SIFT feature, SURF features keep no candidate.
+     */
+    for (int i = 0; i < num_features; ++i)
+        candidates[2 * i] = i < num_sift ? num_features - 1 : 0;
+    features.match_candidates(features, offsets, candidates, &result);
+    for (int i = 0; i < num_features; ++i)
+        EXPECT_EQ(i < num_sift ? 0 : -1, result[i]);
+}
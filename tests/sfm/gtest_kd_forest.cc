@@ -0,0 +1,127 @@
+// Test cases for approximate nearest neighbor search.
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "util/aligned_memory.h"
+#include "sfm/nearest_neighbor.h"
+#include "sfm/kd_forest.h"
+#include "random_descriptors.h"
+
+namespace
+{
+    template <typename T>
+    void
+    test_exact_with_full_budget (float norm, bool positive)
+    {
+        int const num = 500;
+        int const dim = 32;
+        util::AlignedMemory<T> elements(num * dim);
+        std::srand(0);
+        fill_random_descriptors(elements.begin(), num, dim, norm, positive);
+
+        sfm::NearestNeighbor<T> nn;
+        nn.set_elements(elements.begin(), num);
+        nn.set_element_dimensions(dim);
+
+        sfm::KdForest<T> forest;
+        forest.set_elements(elements.begin(), num);
+        forest.set_element_dimensions(dim);
+        forest.set_max_checks(num);
+        forest.build();
+
+        /* With enough checks, the search is exhaustive. */
+        for (int i = 0; i < num; i += 7)
+        {
+            typename sfm::NearestNeighbor<T>::Result exact, approx;
+            nn.find(elements.begin() + i * dim, &exact);
+            forest.find(elements.begin() + i * dim, &approx);
+            EXPECT_EQ(i, approx.index_1st_best);
+            EXPECT_EQ(exact.index_1st_best, approx.index_1st_best);
+            /* Float sums differ by summation order. */
+            EXPECT_NEAR(exact.dist_1st_best, approx.dist_1st_best, 1e-5f);
+            EXPECT_NEAR(exact.dist_2nd_best, approx.dist_2nd_best, 1e-5f);
+        }
+    }
+}
+
+TEST(KdForestTest, ExhaustiveBudgetSignedShort)
+{
+    test_exact_with_full_budget<short>(127.0f, false);
+}
+
+TEST(KdForestTest, ExhaustiveBudgetUnsignedShort)
+{
+    test_exact_with_full_budget<unsigned short>(255.0f, true);
+}
+
+TEST(KdForestTest, ExhaustiveBudgetFloat)
+{
+    test_exact_with_full_budget<float>(1.0f, false);
+}
+
+TEST(KdForestTest, ApproximateFindsSelf)
+{
+    int const num = 2000;
+    int const dim = 64;
+    util::AlignedMemory<float> elements(num * dim);
+    std::srand(0);
+    fill_random_descriptors(elements.begin(), num, dim, 1.0f, false);
+
+    sfm::KdForest<float> forest;
+    forest.set_elements(elements.begin(), num);
+    forest.set_element_dimensions(dim);
+    forest.set_max_checks(64);
+    forest.build();
+
+    /* The query descends to its own leaf in every tree. */
+    for (int i = 0; i < num; i += 13)
+    {
+        sfm::KdForest<float>::Result result;
+        forest.find(elements.begin() + i * dim, &result);
+        EXPECT_EQ(i, result.index_1st_best);
+        EXPECT_NEAR(0.0f, result.dist_1st_best, 1e-5f);
+    }
+}
+
+TEST(KdForestTest, ReusedSearchBuffer)
+{
+    int const num = 1000;
+    int const dim = 32;
+    util::AlignedMemory<unsigned short> elements(num * dim);
+    std::srand(0);
+    fill_random_descriptors(elements.begin(), num, dim, 255.0f, true);
+
+    sfm::KdForest<unsigned short> forest_1, forest_2;
+    forest_1.set_elements(elements.begin(), num);
+    forest_2.set_elements(elements.begin(), num / 2);
+    forest_1.set_element_dimensions(dim);
+    forest_2.set_element_dimensions(dim);
+    forest_1.set_max_checks(32);
+    forest_2.set_max_checks(32);
+    forest_1.build();
+    forest_2.build();
+
+    /* A buffer shared by queries and forests gives the same results. */
+    std::vector<sfm::KdForest<unsigned short>::Result> results;
+    forest_1.find_all(elements.begin(), num, &results);
+    sfm::KdForest<unsigned short>::SearchBuffer buffer;
+    for (int i = 0; i < num; i += 3)
+    {
+        sfm::KdForest<unsigned short>::Result expected, actual;
+        unsigned short const* query = elements.begin() + i * dim;
+        forest_1.find(query, &actual, &buffer);
+        EXPECT_EQ(results[i].index_1st_best, actual.index_1st_best);
+        EXPECT_EQ(results[i].index_2nd_best, actual.index_2nd_best);
+        EXPECT_EQ(results[i].dist_1st_best, actual.dist_1st_best);
+        EXPECT_EQ(results[i].dist_2nd_best, actual.dist_2nd_best);
+
+        forest_2.find(query, &expected);
+        forest_2.find(query, &actual, &buffer);
+        EXPECT_EQ(expected.index_1st_best, actual.index_1st_best);
+        EXPECT_EQ(expected.index_2nd_best, actual.index_2nd_best);
+    }
+}
@@ -29,3 +29,53 @@ TEST(MatchingTest, RemoveInconsistentMatches)
     EXPECT_EQ(2, result.matches_2_1[3]);
     EXPECT_EQ(-1, result.matches_2_1[4]);
 }
+
+TEST(MatchingTest, HammingTwowayMatch)
+{
+    /* Two words per descriptor, set 2 is set 1 with a few flipped bits. */
+    uint64_t set_1[4 * 2] = {
+        0x0000ffff, 0x0,
+        0xffff0000, 0xff,
+        0x12345678, 0x9abcdef0,
+        0x0f0f0f0f, 0x0f0f0f0f };
+    uint64_t set_2[3 * 2] = {
+        0x12345679, 0x9abcdef0,
+        0x0000fff0, 0x0,
+        0x0000ff00, 0xffff };
+
+    sfm::Matching::Options options;
+    options.descriptor_length = 128;
+    options.lowe_ratio_threshold = 0.5f;
+    sfm::Matching::Result result;
+    sfm::Matching::twoway_match_hamming(options, set_1, 4, set_2, 3, &result);
+
+    ASSERT_EQ(4u, result.matches_1_2.size());
+    ASSERT_EQ(3u, result.matches_2_1.size());
+    EXPECT_EQ(1, result.matches_1_2[0]);
+    EXPECT_EQ(-1, result.matches_1_2[1]);
+    EXPECT_EQ(0, result.matches_1_2[2]);
+    EXPECT_EQ(-1, result.matches_1_2[3]);
+    EXPECT_EQ(2, result.matches_2_1[0]);
+    EXPECT_EQ(0, result.matches_2_1[1]);
+    EXPECT_EQ(-1, result.matches_2_1[2]);
+
+    /* The one-way matching yields the same result. */
+    std::vector<int> oneway;
+    sfm::Matching::oneway_match_hamming(options, set_2, 3, set_1, 4, &oneway);
+    EXPECT_EQ(result.matches_2_1, oneway);
+
+    /* Distance threshold in bits. */
+    options.distance_threshold = 2.0f;
+    sfm::Matching::twoway_match_hamming(options, set_1, 4, set_2, 3, &result);
+    EXPECT_EQ(-1, result.matches_1_2[0]);
+    EXPECT_EQ(0, result.matches_1_2[2]);
+}
+
+TEST(MatchingTest, HammingDistance)
+{
+    uint64_t descr_1[4] = { 0x0, 0xffffffffffffffffull, 0x12345678, 0x1 };
+    uint64_t descr_2[4] = { 0x0, 0x0, 0x12345679, 0x8000000000000001ull };
+    EXPECT_EQ(0, sfm::Matching::hamming_distance(descr_1, descr_1, 4));
+    EXPECT_EQ(66, sfm::Matching::hamming_distance(descr_1, descr_2, 4));
+    EXPECT_EQ(64, sfm::Matching::hamming_distance(descr_1, descr_2, 2));
+}
@@ -3,8 +3,14 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
 #include "util/aligned_memory.h"
 #include "sfm/nearest_neighbor.h"
+#include "random_descriptors.h"
 
 TEST(NearestNeighborTest, TestSingnedShort)
 {
@@ -125,3 +131,93 @@ TEST(NearestNeighborTest, TestUnsingnedShort)
     EXPECT_EQ(0, result.dist_1st_best);
     EXPECT_EQ(65534, result.dist_2nd_best);
 }
+
+namespace
+{
+    /* All SIMD kernels must produce the result of the scalar kernel. */
+    template <typename T>
+    void
+    expect_simd_kernels (T const* elements, int num, int dim,
+        int query_step, float epsilon)
+    {
+        sfm::NearestNeighbor<T> nn;
+        nn.set_elements(elements, num);
+        nn.set_element_dimensions(dim);
+
+        sfm::SimdLevel const levels[] = { sfm::SIMD_SSE,
+            sfm::SIMD_AVX2, sfm::SIMD_AVX512 };
+        for (int i = 0; i < num; i += query_step)
+        {
+            T const* query = elements + i * dim;
+            typename sfm::NearestNeighbor<T>::Result expected, result;
+            nn.set_simd(sfm::SIMD_NONE);
+            nn.find(query, &expected);
+            for (int j = 0; j < 3; ++j)
+            {
+                nn.set_simd(levels[j]);
+                nn.find(query, &result);
+                EXPECT_EQ(expected.index_1st_best, result.index_1st_best);
+                EXPECT_EQ(expected.index_2nd_best, result.index_2nd_best);
+                EXPECT_NEAR(expected.dist_1st_best,
+                    result.dist_1st_best, epsilon);
+                EXPECT_NEAR(expected.dist_2nd_best,
+                    result.dist_2nd_best, epsilon);
+            }
+        }
+    }
+
+    template <typename T>
+    void
+    test_simd_kernels (int dim, float norm, bool positive, float epsilon)
+    {
+        int const num = 300;
+        util::AlignedMemory<T> elements(num * dim);
+        std::srand(0);
+        fill_random_descriptors(elements.begin(), num, dim, norm, positive);
+        expect_simd_kernels(elements.begin(), num, dim, 3, epsilon);
+    }
+
+    /*
+     * Fills vectors with all values in every 8th dimension, which is a
+     * single 16 bit lane of the SSE2 kernel. The largest vector has 16
+     * values of 'value', which is within the normalized value range.
+     */
+    template <typename T>
+    void
+    test_simd_kernels_single_lane (int value, bool alternate_sign)
+    {
+        int const num = 8;
+        int const dim = 128;
+        util::AlignedMemory<T> elements(num * dim);
+        std::fill(elements.begin(), elements.end(), T(0));
+        for (int i = 0; i < num; ++i)
+        {
+            int const sign = alternate_sign && i % 2 == 1 ? -1 : 1;
+            for (int j = 0; j < dim; j += 8)
+                elements[i * dim + j] = static_cast<T>(sign * (value - i));
+        }
+        expect_simd_kernels(elements.begin(), num, dim, 1, 0.0f);
+    }
+}
+
+TEST(NearestNeighborTest, TestSimdKernels)
+{
+    /* SIFT descriptors, 128 dimensions. */
+    test_simd_kernels<unsigned short>(128, 255.0f, true, 0.0f);
+    test_simd_kernels<short>(128, 127.0f, false, 0.0f);
+    test_simd_kernels<float>(128, 1.0f, true, 1e-5f);
+    /* SURF descriptors, 64 dimensions. */
+    test_simd_kernels<short>(64, 127.0f, false, 0.0f);
+    test_simd_kernels<unsigned short>(64, 255.0f, true, 0.0f);
+    test_simd_kernels<float>(64, 1.0f, false, 1e-5f);
+    /* Dimensions not divisible by the AVX register width. */
+    test_simd_kernels<short>(24, 127.0f, false, 0.0f);
+    test_simd_kernels<float>(12, 1.0f, false, 1e-5f);
+}
+
+TEST(NearestNeighborTest, TestSimdKernelsSingleLane)
+{
+    /* The lane sums exceed the 16 bit signed range for unsigned short. */
+    test_simd_kernels_single_lane<unsigned short>(63, false);
+    test_simd_kernels_single_lane<short>(31, true);
+}
@@ -0,0 +1,124 @@
+// Test cases for the ORB feature detector and descriptor.
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+
+#include "mve/image.h"
+#include "mve/image_tools.h"
+#include "sfm/matching.h"
+#include "sfm/orb.h"
+
+namespace
+{
+    /* Blurred random noise, which produces many corners. */
+    mve::ByteImage::Ptr
+    create_noise_image (int width, int height)
+    {
+        std::srand(0);
+        mve::ByteImage::Ptr img = mve::ByteImage::create(width, height, 1);
+        for (int i = 0; i < img->get_value_amount(); ++i)
+            img->at(i) = std::rand() % 256;
+        return mve::image::blur_gaussian<uint8_t>(img, 1.5f);
+    }
+
+    /* Rotates the image clockwise by 90 degrees. */
+    mve::ByteImage::Ptr
+    rotate_image (mve::ByteImage::ConstPtr img)
+    {
+        int const w = img->width();
+        int const h = img->height();
+        mve::ByteImage::Ptr out = mve::ByteImage::create(h, w, 1);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                out->at(h - 1 - y, x, 0) = img->at(x, y, 0);
+        return out;
+    }
+
+    sfm::Orb::Descriptors
+    compute_orb (mve::ByteImage::ConstPtr img)
+    {
+        sfm::Orb::Options options;
+        options.max_features = 500;
+        sfm::Orb orb(options);
+        orb.set_image(img);
+        orb.process();
+        return orb.get_descriptors();
+    }
+
+    void
+    copy_descriptors (sfm::Orb::Descriptors const& descr,
+        std::vector<uint64_t>* data)
+    {
+        data->clear();
+        for (std::size_t i = 0; i < descr.size(); ++i)
+            data->insert(data->end(), descr[i].data.begin(),
+                descr[i].data.end());
+    }
+}  // namespace
+
+TEST(OrbTest, TestSmallImages)
+{
+    mve::ByteImage::Ptr img = mve::ByteImage::create(20, 20, 1);
+    img->fill(128);
+    EXPECT_TRUE(compute_orb(img).empty());
+    EXPECT_TRUE(compute_orb(create_noise_image(30, 30)).empty());
+}
+
+TEST(OrbTest, TestDetection)
+{
+    mve::ByteImage::Ptr img = create_noise_image(320, 240);
+    sfm::Orb::Descriptors descr = compute_orb(img);
+    ASSERT_GT(descr.size(), 100u);
+    EXPECT_LE(descr.size(), 500u);
+    for (std::size_t i = 0; i < descr.size(); ++i)
+    {
+        EXPECT_GE(descr[i].x, 0.0f);
+        EXPECT_GE(descr[i].y, 0.0f);
+        EXPECT_LT(descr[i].x, 320.0f);
+        EXPECT_LT(descr[i].y, 240.0f);
+    }
+
+    /* Detection and descriptors are deterministic. */
+    sfm::Orb::Descriptors descr2 = compute_orb(img);
+    ASSERT_EQ(descr.size(), descr2.size());
+    for (std::size_t i = 0; i < descr.size(); ++i)
+    {
+        EXPECT_EQ(descr[i].x, descr2[i].x);
+        EXPECT_EQ(descr[i].y, descr2[i].y);
+        EXPECT_EQ(descr[i].data, descr2[i].data);
+    }
+}
+
+TEST(OrbTest, TestRotationInvariance)
+{
+    mve::ByteImage::Ptr img1 = create_noise_image(320, 240);
+    mve::ByteImage::Ptr img2 = rotate_image(img1);
+    sfm::Orb::Descriptors descr1 = compute_orb(img1);
+    sfm::Orb::Descriptors descr2 = compute_orb(img2);
+
+    std::vector<uint64_t> data1, data2;
+    copy_descriptors(descr1, &data1);
+    copy_descriptors(descr2, &data2);
+    sfm::Matching::Options options;
+    options.descriptor_length = 256;
+    sfm::Matching::Result result;
+    sfm::Matching::twoway_match_hamming(options, &data1[0], descr1.size(),
+        &data2[0], descr2.size(), &result);
+    sfm::Matching::remove_inconsistent_matches(&result);
+
+    /* Matches must agree with the rotation. */
+    int num_matches = 0, num_correct = 0;
+    for (std::size_t i = 0; i < result.matches_1_2.size(); ++i)
+    {
+        if (result.matches_1_2[i] < 0)
+            continue;
+        sfm::Orb::Descriptor const& d1 = descr1[i];
+        sfm::Orb::Descriptor const& d2 = descr2[result.matches_1_2[i]];
+        float const dx = d2.x - (239.0f - d1.y);
+        float const dy = d2.y - d1.x;
+        num_matches += 1;
+        num_correct += (dx * dx + dy * dy < 4.0f) ? 1 : 0;
+    }
+    EXPECT_GT(num_matches, 100);
+    EXPECT_GT(num_correct, num_matches * 9 / 10);
+}
@@ -3,6 +3,8 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdlib>
+
 #include "math/matrix_tools.h"
 #include "math/matrix_svd.h"
 #include "sfm/pose.h"
@@ -378,6 +380,88 @@ TEST(PostTest, TriangulateTest1)
     EXPECT_TRUE(sfm::is_consistent_pose(match, pose1, pose2));
 }
 
+TEST(PoseTest, TriangulateTrackTest)
+{
+    // Cameras on a circle around the origin looking at the origin.
+    std::vector<sfm::CameraPose> cameras(10);
+    for (std::size_t i = 0; i < cameras.size(); ++i)
+    {
+        double const angle = 0.2 * i;
+        sfm::CameraPose& pose = cameras[i];
+        pose.set_k_matrix(800, 800 / 2, 600 / 2);
+        pose.R.fill(0.0);
+        pose.R(0,0) = std::cos(angle); pose.R(0,2) = -std::sin(angle);
+        pose.R(1,1) = 1.0;
+        pose.R(2,0) = std::sin(angle); pose.R(2,2) = std::cos(angle);
+        pose.t = math::Vec3d(0.0, 0.0, 5.0);
+    }
+
+    math::Vec3d const x_gt(0.3, -0.2, 0.5);
+    for (std::size_t n = 2; n <= cameras.size(); ++n)
+    {
+        std::vector<math::Vec2f> pos;
+        std::vector<sfm::CameraPose const*> poses;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            math::Vec3d x = cameras[i].K * (cameras[i].R * x_gt + cameras[i].t);
+            pos.push_back(math::Vec2f(x[0] / x[2], x[1] / x[2]));
+            poses.push_back(&cameras[i]);
+        }
+
+        math::Vec3d x = sfm::triangulate_track(pos, poses);
+        math::Vec3d x_svd = sfm::triangulate_track_svd(pos, poses);
+        for (int i = 0; i < 3; ++i)
+        {
+            EXPECT_NEAR(x_gt[i], x[i], 1e-4);
+            EXPECT_NEAR(x_svd[i], x[i], 1e-4);
+        }
+    }
+}
+
+TEST(PoseTest, TriangulateTrackNoiseTest)
+{
+    // Cameras on a circle around the origin at different distances.
+    std::vector<sfm::CameraPose> cameras(10);
+    for (std::size_t i = 0; i < cameras.size(); ++i)
+    {
+        double const angle = 0.2 * i;
+        sfm::CameraPose& pose = cameras[i];
+        pose.set_k_matrix(800, 800 / 2, 600 / 2);
+        pose.R.fill(0.0);
+        pose.R(0,0) = std::cos(angle); pose.R(0,2) = -std::sin(angle);
+        pose.R(1,1) = 1.0;
+        pose.R(2,0) = std::sin(angle); pose.R(2,2) = std::cos(angle);
+        pose.t = math::Vec3d(0.0, 0.0, 3.0 + i);
+    }
+
+    // The normal equations weight the observations differently than the
+    // SVD, which gives slightly different results with noisy positions.
+    std::srand(0);
+    for (int track = 0; track < 100; ++track)
+    {
+        math::Vec3d x_gt;
+        for (int i = 0; i < 3; ++i)
+            x_gt[i] = std::rand() / (double)RAND_MAX - 0.5;
+
+        std::size_t const n = 2 + track % (cameras.size() - 1);
+        std::vector<math::Vec2f> pos;
+        std::vector<sfm::CameraPose const*> poses;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            math::Vec3d x = cameras[i].K * (cameras[i].R * x_gt + cameras[i].t);
+            pos.push_back(math::Vec2f(
+                x[0] / x[2] + std::rand() / (double)RAND_MAX - 0.5,
+                x[1] / x[2] + std::rand() / (double)RAND_MAX - 0.5));
+            poses.push_back(&cameras[i]);
+        }
+
+        math::Vec3d x = sfm::triangulate_track(pos, poses);
+        math::Vec3d x_svd = sfm::triangulate_track_svd(pos, poses);
+        EXPECT_LT((x - x_gt).norm(), 0.05);
+        EXPECT_LT((x - x_svd).norm(), 1e-3);
+    }
+}
+
 TEST(PoseTest, PoseFrom2D3DCorrespondences)
 {
     sfm::CameraPose pose;
@@ -0,0 +1,211 @@
+// Test cases for RANSAC helpers, adaptive termination and early rejection.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "util/system.h"
+#include "sfm/correspondence.h"
+#include "sfm/ransac.h"
+#include "sfm/ransac_homography.h"
+#include "sfm/ransac_scoring.h"
+
+TEST(RansacTest, ComputeIterationsLimits)
+{
+    EXPECT_EQ(std::numeric_limits<int>::max(),
+        sfm::compute_ransac_iterations(0.0, 8, 0.99));
+    EXPECT_EQ(0, sfm::compute_ransac_iterations(1.0, 8, 0.99));
+    EXPECT_GT(sfm::compute_ransac_iterations(0.3, 8, 0.99),
+        sfm::compute_ransac_iterations(0.6, 8, 0.99));
+}
+
+TEST(RansacTest, SprtThresholdAndWeights)
+{
+    sfm::RansacSprt sprt(200.0, 1.0);
+    EXPECT_LT(sprt.get_consistent_weight(), 0.0);
+    EXPECT_GT(sprt.get_inconsistent_weight(), 0.0);
+    EXPECT_GT(sprt.get_threshold(), 0.0);
+    EXPECT_GT(sprt.get_acceptance_rate(), 0.0);
+    EXPECT_LT(sprt.get_acceptance_rate(), 1.0);
+
+    /* Rejecting models with few consistent matches is cheaper. */
+    double const threshold = sprt.get_threshold();
+    sprt.update_inlier_ratio(0.5);
+    EXPECT_LT(sprt.get_consistent_weight(), 0.0);
+    EXPECT_NE(threshold, sprt.get_threshold());
+
+    /* More iterations are required to compensate rejected good models. */
+    EXPECT_GE(sprt.compute_iterations(0.5, 8, 0.99),
+        sfm::compute_ransac_iterations(0.5, 8, 0.99));
+}
+
+TEST(RansacTest, SprtDisabledForUninformativeModels)
+{
+    /* Bad models are as consistent as good models, never reject. */
+    sfm::RansacSprt sprt(200.0, 1.0);
+    sprt.add_rejected_model(100, 50);
+    EXPECT_EQ(std::numeric_limits<double>::max(), sprt.get_threshold());
+    EXPECT_EQ(1.0, sprt.get_acceptance_rate());
+}
+
+TEST(RansacTest, BatchedScoringMatchesScalar)
+{
+    /* Number of matches not divisible by the vector sizes. */
+    util::system::rand_seed(1);
+    sfm::Correspondences matches(37);
+    for (std::size_t i = 0; i < matches.size(); ++i)
+        for (int j = 0; j < 2; ++j)
+        {
+            matches[i].p1[j] = (util::system::rand_int() % 2000) / 1000.0 - 1.0;
+            matches[i].p2[j] = (util::system::rand_int() % 2000) / 1000.0 - 1.0;
+        }
+    sfm::CorrespondencesSoA matches_soa;
+    sfm::correspondences_to_soa(matches, &matches_soa);
+    ASSERT_EQ(matches.size(), matches_soa.size());
+
+    sfm::FundamentalMatrix F;
+    sfm::HomographyMatrix H;
+    for (int i = 0; i < 9; ++i)
+    {
+        F[i] = (util::system::rand_int() % 2000) / 1000.0 - 1.0;
+        H[i] = (i % 4 == 0 ? 1.0 : 0.0)
+            + (util::system::rand_int() % 200) / 1000.0 - 0.1;
+    }
+
+    sfm::SimdLevel const levels[] = { sfm::SIMD_NONE,
+        sfm::SIMD_SSE, sfm::SIMD_AVX2, sfm::SIMD_AVX512 };
+    std::vector<double> sse_sampson, sse_transfer;
+    for (int l = 0; l < 4; ++l)
+    {
+        /* Score a sub-range to test the offsets. */
+        std::vector<double> sampson(matches.size(), -1.0);
+        sfm::sampson_distances(F, matches_soa, 1, matches.size(),
+            &sampson[1], levels[l]);
+        EXPECT_EQ(-1.0, sampson[0]);
+        for (std::size_t i = 1; i < matches.size(); ++i)
+        {
+            double const expected = sfm::sampson_distance(F, matches[i]);
+            EXPECT_NEAR(expected, sampson[i], 1e-10 * (1.0 + expected));
+        }
+
+        std::vector<double> transfer(matches.size());
+        sfm::symmetric_transfer_errors(H, matches_soa, 0, matches.size(),
+            &transfer[0], levels[l]);
+        for (std::size_t i = 0; i < matches.size(); ++i)
+        {
+            double const expected
+                = sfm::symmetric_transfer_error(H, matches[i]);
+            EXPECT_NEAR(expected, transfer[i], 1e-10 * (1.0 + expected));
+        }
+
+        /* All vector instruction sets yield identical errors. */
+        if (levels[l] == sfm::SIMD_SSE)
+        {
+            sse_sampson = sampson;
+            sse_transfer = transfer;
+        }
+        else if (levels[l] != sfm::SIMD_NONE)
+        {
+            EXPECT_EQ(sse_sampson, sampson);
+            EXPECT_EQ(sse_transfer, transfer);
+        }
+    }
+}
+
+namespace
+{
+    /*
+     * Matches from a known homography with 40% outliers, which are either
+     * interleaved with the inliers or stored before all inliers.
+     */
+    void
+    create_homography_matches (bool outliers_first,
+        sfm::Correspondences* matches, std::vector<int>* expected_inliers)
+    {
+        sfm::HomographyMatrix H(0.0);
+        H[0] = 0.9; H[1] = -0.2; H[2] = 0.3;
+        H[3] = 0.1; H[4] = 1.1; H[5] = -0.1;
+        H[6] = 0.05; H[7] = 0.02; H[8] = 1.0;
+
+        util::system::rand_seed(0);
+        int const num_matches = 200;
+        matches->resize(num_matches);
+        expected_inliers->clear();
+        for (int i = 0; i < num_matches; ++i)
+        {
+            sfm::Correspondence& match = matches->at(i);
+            match.p1[0] = (util::system::rand_int() % 2000) / 1000.0 - 1.0;
+            match.p1[1] = (util::system::rand_int() % 2000) / 1000.0 - 1.0;
+            bool const is_outlier = outliers_first
+                ? i < num_matches * 2 / 5 : i % 5 < 2;
+            if (is_outlier)
+            {
+                match.p2[0] = (util::system::rand_int() % 2000)
+                    / 1000.0 - 1.0;
+                match.p2[1] = (util::system::rand_int() % 2000)
+                    / 1000.0 - 1.0;
+                continue;
+            }
+            double const w = H[6] * match.p1[0] + H[7] * match.p1[1] + H[8];
+            match.p2[0] = (H[0] * match.p1[0] + H[1] * match.p1[1] + H[2]) / w;
+            match.p2[1] = (H[3] * match.p1[0] + H[4] * match.p1[1] + H[5]) / w;
+            expected_inliers->push_back(i);
+        }
+    }
+
+    void
+    expect_homography_inliers (bool outliers_first)
+    {
+        sfm::Correspondences matches;
+        std::vector<int> expected_inliers;
+        create_homography_matches(outliers_first, &matches,
+            &expected_inliers);
+
+        sfm::RansacHomography::Options options;
+        options.max_iterations = 1000;
+        options.threshold = 1e-4;
+        sfm::RansacHomography ransac(options);
+        sfm::RansacHomography::Result result;
+        ransac.estimate(matches, &result);
+
+        /* Inliers are reported in ascending order. */
+        ASSERT_EQ(expected_inliers.size(), result.inliers.size());
+        for (std::size_t i = 0; i < result.inliers.size(); ++i)
+            EXPECT_EQ(expected_inliers[i], result.inliers[i]);
+    }
+}
+
+TEST(RansacTest, VerificationOrder)
+{
+    std::vector<int> order;
+    sfm::compute_verification_order(100, false, &order);
+    ASSERT_EQ(100u, order.size());
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(i, order[i]);
+
+    util::system::rand_seed(0);
+    sfm::compute_verification_order(100, true, &order);
+    ASSERT_EQ(100u, order.size());
+    std::vector<int> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    int num_fixed = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(i, sorted[i]);
+        num_fixed += order[i] == i ? 1 : 0;
+    }
+    EXPECT_LT(num_fixed, 10);
+}
+
+TEST(RansacTest, HomographyWithOutliers)
+{
+    expect_homography_inliers(false);
+}
+
+TEST(RansacTest, HomographyWithSortedOutliers)
+{
+    /* Early rejection must not be biased by the order of the matches. */
+    expect_homography_inliers(true);
+}
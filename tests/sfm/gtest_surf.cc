@@ -2,6 +2,8 @@
 // Written by Simon Fuhrmann.
 
 #include <gtest/gtest.h>
+#include <cmath>
+#include <cstdlib>
 
 #include "sfm/surf.h"
 
@@ -110,6 +112,53 @@ TEST_F(SurfTest, TestFilterDxxDyy)
     EXPECT_EQ(0, dyy);
 }
 
+TEST_F(SurfTest, TestResponseMapsMatchFilters)
+{
+    // Random image with a width that is not a multiple of the vector size.
+    std::srand(0);
+    mve::ByteImage::Ptr img = mve::ByteImage::create(413, 298, 1);
+    for (int i = 0; i < img->get_value_amount(); ++i)
+        img->at(i) = std::rand() % 256;
+    this->set_image(img);
+    this->create_octaves();
+
+    int const fs[4][4] = { { 3, 5, 7, 9 }, { 5, 9, 13, 17 },
+        { 9, 17, 25, 33 }, { 17, 33, 49, 65 } };
+    int const w = img->width();
+    int const h = img->height();
+    for (int o = 0; o < 4; ++o)
+        for (int k = 0; k < 4; ++k)
+        {
+            Octave::RespImage::ConstPtr resp = this->get_octaves()[o].imgs[k];
+            int const step = 1 << o;
+            int const border = fs[o][k] + fs[o][k] / 2 + 1;
+            for (int y = 0, i = 0; y < h; y += step)
+                for (int x = 0; x < w; x += step, ++i)
+                {
+                    if (x < border || x + border >= w
+                        || y < border || y + border >= h)
+                    {
+                        EXPECT_EQ(0.0f, resp->at(i));
+                        continue;
+                    }
+
+                    float const inv_karea = 1.0 / (fs[o][k]
+                        * (2 * fs[o][k] - 1));
+                    float const dxx = static_cast<float>
+                        (this->filter_dxx(fs[o][k], x, y)) * inv_karea;
+                    float const dyy = static_cast<float>
+                        (this->filter_dyy(fs[o][k], x, y)) * inv_karea;
+                    float const dxy = static_cast<float>
+                        (this->filter_dxy(fs[o][k], x, y)) * inv_karea;
+                    float const weight = 0.912f;
+                    float const tolerance = 1e-5f
+                        * (std::abs(dxx * dyy) + weight * dxy * dxy) + 1e-6f;
+                    EXPECT_NEAR(dxx * dyy - weight * dxy * dxy, resp->at(i),
+                        tolerance);
+                }
+        }
+}
+
 TEST_F(SurfTest, TestHaarWaveletsDXY)
 {
     float dx, dy;
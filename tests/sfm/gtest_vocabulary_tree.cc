@@ -0,0 +1,147 @@
+// Test cases for the vocabulary tree.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include "sfm/vocabulary_tree.h"
+
+namespace
+{
+    /* Creates 'num_clusters' well separated clusters of descriptors. */
+    void
+    fill_clustered_descriptors (int num_clusters, int num_per_cluster,
+        int dim, std::vector<unsigned short>* descriptors)
+    {
+        std::srand(0);
+        descriptors->resize(num_clusters * num_per_cluster * dim);
+        for (int i = 0; i < num_clusters; ++i)
+            for (int j = 0; j < num_per_cluster; ++j)
+                for (int k = 0; k < dim; ++k)
+                {
+                    int const value = (k % num_clusters == i ? 200 : 20)
+                        + std::rand() % 10;
+                    descriptors->at((i * num_per_cluster + j) * dim + k)
+                        = static_cast<unsigned short>(value);
+                }
+    }
+}
+
+TEST(VocabularyTreeTest, QuantizeClusters)
+{
+    int const num_clusters = 4;
+    int const num_per_cluster = 50;
+    int const dim = 16;
+    std::vector<unsigned short> descriptors;
+    fill_clustered_descriptors(num_clusters, num_per_cluster, dim,
+        &descriptors);
+
+    sfm::VocabularyTree::Options options;
+    options.branching_factor = 4;
+    options.num_levels = 2;
+    sfm::VocabularyTree tree(options);
+    tree.train(&descriptors[0], num_clusters * num_per_cluster, dim);
+    EXPECT_GT(tree.get_num_words(), 0);
+    EXPECT_LE(tree.get_num_words(), 16);
+
+    /* Clusters must not share words. */
+    std::vector<std::set<int> > cluster_words(num_clusters);
+    for (int i = 0; i < num_clusters; ++i)
+        for (int j = 0; j < num_per_cluster; ++j)
+        {
+            int const word = tree.quantize(&descriptors[0]
+                + (i * num_per_cluster + j) * dim);
+            EXPECT_GE(word, 0);
+            EXPECT_LT(word, tree.get_num_words());
+            cluster_words[i].insert(word);
+        }
+    for (int i = 0; i < num_clusters; ++i)
+        for (int j = i + 1; j < num_clusters; ++j)
+        {
+            std::set<int>::const_iterator iter = cluster_words[i].begin();
+            for (; iter != cluster_words[i].end(); ++iter)
+                EXPECT_EQ(0u, cluster_words[j].count(*iter));
+        }
+}
+
+TEST(VocabularyTreeTest, DeterministicTraining)
+{
+    int const dim = 8;
+    std::vector<unsigned short> descriptors;
+    fill_clustered_descriptors(8, 30, dim, &descriptors);
+
+    sfm::VocabularyTree::Options options;
+    options.branching_factor = 3;
+    options.num_levels = 3;
+    sfm::VocabularyTree tree1(options), tree2(options);
+    tree1.train(&descriptors[0], 240, dim);
+    tree2.train(&descriptors[0], 240, dim);
+    EXPECT_EQ(tree1.get_num_words(), tree2.get_num_words());
+    for (int i = 0; i < 240; ++i)
+        EXPECT_EQ(tree1.quantize(&descriptors[0] + i * dim),
+            tree2.quantize(&descriptors[0] + i * dim));
+}
+
+TEST(VocabularyTreeTest, UntrainedTree)
+{
+    sfm::VocabularyTree tree((sfm::VocabularyTree::Options()));
+    float descriptor[4] = { 0.5f, 0.5f, 0.5f, 0.5f };
+    EXPECT_EQ(0, tree.get_num_words());
+    EXPECT_EQ(-1, tree.quantize(descriptor));
+}
+
+TEST(VocabularyTreeTest, QuantizeBinaryClusters)
+{
+    /* Random base descriptors with up to 16 of 256 bits flipped. */
+    int const num_clusters = 4;
+    int const num_per_cluster = 50;
+    int const words = 4;
+    std::srand(0);
+    std::vector<uint64_t> bases(num_clusters * words);
+    for (std::size_t i = 0; i < bases.size(); ++i)
+        for (int j = 0; j < 64; j += 8)
+            bases[i] |= static_cast<uint64_t>(std::rand() & 0xff) << j;
+    std::vector<uint64_t> descriptors;
+    for (int i = 0; i < num_clusters; ++i)
+        for (int j = 0; j < num_per_cluster; ++j)
+        {
+            uint64_t descr[4];
+            std::copy(&bases[i * words], &bases[i * words] + words, descr);
+            for (int k = 0; k < 16; ++k)
+            {
+                int const bit = std::rand() % 256;
+                descr[bit / 64] ^= static_cast<uint64_t>(1) << (bit % 64);
+            }
+            descriptors.insert(descriptors.end(), descr, descr + words);
+        }
+
+    sfm::VocabularyTree::Options options;
+    options.branching_factor = 4;
+    options.num_levels = 2;
+    sfm::VocabularyTree tree(options);
+    tree.train_binary(&descriptors[0], num_clusters * num_per_cluster, words);
+    EXPECT_GT(tree.get_num_words(), 0);
+    EXPECT_LE(tree.get_num_words(), 16);
+
+    /* Clusters must not share words. */
+    std::vector<std::set<int> > cluster_words(num_clusters);
+    for (int i = 0; i < num_clusters; ++i)
+        for (int j = 0; j < num_per_cluster; ++j)
+        {
+            int const word = tree.quantize_binary(&descriptors[0]
+                + (i * num_per_cluster + j) * words);
+            EXPECT_GE(word, 0);
+            EXPECT_LT(word, tree.get_num_words());
+            cluster_words[i].insert(word);
+        }
+    for (int i = 0; i < num_clusters; ++i)
+        for (int j = i + 1; j < num_clusters; ++j)
+        {
+            std::set<int>::const_iterator iter = cluster_words[i].begin();
+            for (; iter != cluster_words[i].end(); ++iter)
+                EXPECT_EQ(0u, cluster_words[j].count(*iter));
+        }
+}
@@ -0,0 +1,36 @@
+// Random descriptors for the nearest neighbor test cases.
+
+#ifndef TESTS_SFM_RANDOM_DESCRIPTORS_HEADER
+#define TESTS_SFM_RANDOM_DESCRIPTORS_HEADER
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+/*
+ * Fills normalized random vectors scaled to 'norm', with positive values
+ * or values of both signs. Uses std::rand(), the caller seeds.
+ */
+template <typename T>
+void
+fill_random_descriptors (T* elements, int num, int dim, float norm,
+    bool positive)
+{
+    for (int i = 0; i < num; ++i)
+    {
+        std::vector<float> v(dim);
+        float square_len = 0.0f;
+        for (int j = 0; j < dim; ++j)
+        {
+            v[j] = static_cast<float>(std::rand()) / RAND_MAX;
+            if (!positive)
+                v[j] -= 0.5f;
+            square_len += v[j] * v[j];
+        }
+        for (int j = 0; j < dim; ++j)
+            elements[i * dim + j] = static_cast<T>
+                (v[j] * norm / std::sqrt(square_len));
+    }
+}
+
+#endif /* TESTS_SFM_RANDOM_DESCRIPTORS_HEADER */